@@ -0,0 +1,310 @@
+/*
+  ==============================================================================
+
+    juce_hid_allocation_test.cpp
+    Created: 18 Oct 2026
+
+    Checks that the paths meant for realtime threads don't allocate: pushing
+    to and popping from a RealtimeReportQueue, copying ReportViews and
+    DeviceInfos, and a ReportReader feeding a queue from the loopback
+    backend. Each one is warmed up and then run many times while
+    hid::AllocationTracker counts, and fails if anything was allocated or
+    a must-not-allocate entry point was violated.
+
+    Build it like juce_hid_benchmarks.cpp, as a console app with the
+    juce_core, juce_events and juce_hid modules, JUCE_HID_LOOPBACK=1 and
+    JUCE_HID_ALLOCATION_TRACKING=1:
+
+        juce_add_console_app (HIDAllocationTest)
+        target_sources (HIDAllocationTest PRIVATE benchmarks/juce_hid_allocation_test.cpp)
+        target_compile_definitions (HIDAllocationTest PRIVATE JUCE_HID_LOOPBACK=1 JUCE_HID_ALLOCATION_TRACKING=1)
+        target_link_libraries (HIDAllocationTest PRIVATE juce_hid juce::juce_core juce::juce_events)
+
+    It's only meaningful on glibc, where the tracker sees every malloc();
+    elsewhere it only sees operator new.
+
+    Usage:
+
+        HIDAllocationTest
+
+    Prints a line per check and the tracker's report, and exits with 1 if
+    any check failed.
+
+  ==============================================================================
+*/
+
+#include "../juce_hid.h"
+
+#if ! JUCE_HID_LOOPBACK || ! JUCE_HID_ALLOCATION_TRACKING
+ #error "The allocation test needs JUCE_HID_LOOPBACK=1 and JUCE_HID_ALLOCATION_TRACKING=1"
+#endif
+
+using namespace juce;
+
+namespace
+{
+    const int numIterations = 1000;
+    const size_t reportSize = 64;
+
+    int numFailures = 0;
+
+    void report (const String& name, bool ok, int64 allocations, int64 violations)
+    {
+        const bool passed = ok && allocations == 0 && violations == 0;
+
+        if (! passed) {
+            ++numFailures;
+        }
+
+        std::cerr << (passed ? "PASS " : "FAIL ") << name.paddedRight (' ', 32)
+                  << " allocations=" << allocations << " violations=" << violations
+                  << (ok ? "" : " (operation failed)") << std::endl;
+    }
+
+    /** What these entry points have allocated so far, on any thread. */
+    int64 getEntryPointAllocations (const StringArray& names)
+    {
+        int64 allocations = 0;
+        for (const auto& stats : hid::AllocationTracker::getStats()) {
+            if (names.contains (stats.entryPoint)) {
+                allocations += stats.allocations;
+            }
+        }
+        return allocations;
+    }
+
+    /** Runs op once to warm up, then numIterations times, and fails if those
+     *  allocated on this thread or broke a must-not-allocate entry point.
+     */
+    template <typename Op>
+    void expectNoAllocations (const String& name, Op&& op)
+    {
+        op();
+
+        const int64 allocationsBefore = hid::AllocationTracker::getThreadAllocations();
+        const int64 violationsBefore = hid::AllocationTracker::getNumViolations();
+
+        bool ok = true;
+        for (int i = 0; i < numIterations; ++i) {
+            ok = op() && ok;
+        }
+
+        report (name, ok,
+                hid::AllocationTracker::getThreadAllocations() - allocationsBefore,
+                hid::AllocationTracker::getNumViolations() - violationsBefore);
+    }
+
+    /** One simulated device, opened. */
+    class LoopbackDevice
+    {
+    public:
+
+        LoopbackDevice()
+            : report (reportSize, true)
+        {
+            hid_loopback_remove_all();
+
+            hid_loopback_device_desc desc {};
+            desc.vendor_id = 0x1209;
+            desc.product_id = 0x0003;
+            desc.serial_number = L"ALLOC0001";
+            desc.manufacturer_string = L"juce_hid";
+            desc.product_string = L"Loopback allocation test device";
+            desc.input_report_length = reportSize;
+            desc.output_report_length = reportSize;
+            desc.feature_report_length = reportSize;
+            id = hid_loopback_add_device (&desc);
+
+            info = hid::getAllDevicesAvailable (hid::DeviceFilter().setIds (0x1209, 0x0003))[0];
+            handle = hid_open_path (info.getPath().toRawUTF8());
+
+            // Numbered reports, so the full size is read back.
+            report[0] = 1;
+            for (size_t i = 1; i < reportSize; ++i) {
+                report[i] = (char) i;
+            }
+        }
+
+        ~LoopbackDevice()
+        {
+            if (handle != nullptr) {
+                hid_close (handle);
+            }
+            hid_loopback_remove_all();
+        }
+
+        bool isOpen() const                     { return handle != nullptr; }
+        hid::DeviceIO getDeviceIO() const       { return hid::DeviceIO (handle, info); }
+        const unsigned char* getReport() const  { return static_cast<const unsigned char*> (report.getData()); }
+
+        bool sendInput()
+        {
+            return hid_loopback_send_input (id, getReport(), reportSize) >= 0;
+        }
+
+        int id = -1;
+        hid::DeviceInfo info;
+        hid::Device handle = nullptr;
+
+    private:
+
+        MemoryBlock report;
+    };
+
+    void testQueue (const LoopbackDevice& device)
+    {
+        unsigned char buffer[reportSize];
+
+        {
+            hid::RealtimeReportQueue queue (16, reportSize);
+
+            expectNoAllocations ("RealtimeReportQueue push/pop", [&] {
+                size_t length = 0;
+                uint64 timestamp = 0;
+                return queue.push (device.getReport(), reportSize, hid::getMonotonicTime())
+                    && queue.pop (buffer, length, timestamp)
+                    && length == reportSize;
+            });
+        }
+
+        {
+            hid::RealtimeReportQueue queue (16, reportSize);
+
+            expectNoAllocations ("RealtimeReportQueue popAll", [&] {
+                for (int i = 0; i < 8; ++i) {
+                    queue.push (device.getReport(), reportSize, hid::getMonotonicTime());
+                }
+
+                size_t total = 0;
+                const int n = queue.popAll ([&] (const unsigned char*, size_t length, uint64) { total += length; });
+                return n == 8 && total == 8 * reportSize && queue.getNumReady() == 0;
+            });
+        }
+
+        {
+            // A full queue, and a report too big for a slot, are both rejected
+            // rather than making room.
+            hid::RealtimeReportQueue queue (4, reportSize / 2);
+
+            expectNoAllocations ("RealtimeReportQueue rejecting", [&] {
+                while (queue.push (device.getReport(), reportSize / 2, hid::getMonotonicTime())) {}
+                return ! queue.push (device.getReport(), reportSize, hid::getMonotonicTime())
+                    && queue.getNumReady() == queue.getCapacity();
+            });
+        }
+    }
+
+    void testReportView (LoopbackDevice& device)
+    {
+        hid::DeviceIO io (device.getDeviceIO());
+        hid::ReportView view;
+
+        if (! device.sendInput() || io.readReport (view, 1000).failed()) {
+            ++numFailures;
+            std::cerr << "FAIL ReportView: couldn't read a report" << std::endl;
+            return;
+        }
+
+        expectNoAllocations ("ReportView copies", [&] {
+            hid::ReportView copy (view);
+            hid::ReportView assigned;
+            assigned = copy;
+            hid::ReportView moved (std::move (copy));
+            return moved.getSize() == view.getSize() && assigned.getData() == view.getData();
+        });
+    }
+
+    /** Reports go through the loopback backend into a ReportReader, which
+     *  pushes them into a queue that this thread pops. The reader has a
+     *  thread of its own, so its entry points' counts are checked rather
+     *  than this thread's.
+     */
+    void testReader (LoopbackDevice& device)
+    {
+        hid::RealtimeReportQueue queue (16, reportSize);
+        hid::ReportReader reader (device.getDeviceIO(), queue);
+        reader.start();
+
+        unsigned char buffer[reportSize];
+
+        auto sendAndReceive = [&] (int count) {
+            for (int i = 0; i < count; ++i) {
+                if (! device.sendInput()) {
+                    return false;
+                }
+
+                size_t length = 0;
+                uint64 timestamp = 0;
+                const uint64 deadline = hid::getMonotonicTime() + 1000000000;
+
+                while (! queue.pop (buffer, length, timestamp)) {
+                    if (reader.hasFailed() || hid::getMonotonicTime() > deadline) {
+                        return false;
+                    }
+                    Thread::yield();
+                }
+            }
+            return true;
+        };
+
+        const StringArray entryPoints { "ReportReader: read", "RealtimeReportQueue::push", "RealtimeReportQueue::pop" };
+
+        // Lets the backend's report pool and the reader's thread settle.
+        bool ok = sendAndReceive (64);
+
+        const int64 allocationsBefore = getEntryPointAllocations (entryPoints);
+        const int64 violationsBefore = hid::AllocationTracker::getNumViolations();
+
+        ok = sendAndReceive (numIterations) && ok;
+        reader.stop();
+
+        report ("ReportReader into queue", ok,
+                getEntryPointAllocations (entryPoints) - allocationsBefore,
+                hid::AllocationTracker::getNumViolations() - violationsBefore);
+    }
+
+    void testDeviceInfo (const LoopbackDevice& device)
+    {
+        expectNoAllocations ("DeviceInfo copies", [&] {
+            hid::DeviceInfo copy (device.info);
+            hid::DeviceInfo assigned;
+            assigned = copy;
+            hid::DeviceInfo moved (std::move (copy));
+            copy = std::move (moved);
+            return copy == device.info && assigned == device.info;
+        });
+    }
+}
+
+int main (int, char*[])
+{
+    // DeviceScanner is a Timer and a ChangeBroadcaster, so it needs the
+    // message manager to exist.
+    ScopedJuceInitialiser_GUI juce;
+
+    Result r = hid::init();
+    if (r.failed()) {
+        std::cerr << r.getErrorMessage() << std::endl;
+        return 1;
+    }
+
+    {
+        LoopbackDevice device;
+
+        if (! device.isOpen()) {
+            std::cerr << "FAIL couldn't open the loopback device" << std::endl;
+            ++numFailures;
+        }
+        else {
+            testQueue (device);
+            testReportView (device);
+            testDeviceInfo (device);
+            testReader (device);
+        }
+    }
+
+    std::cerr << hid::AllocationTracker::getReport() << std::endl;
+
+    hid::exit();
+    return numFailures > 0 ? 1 : 0;
+}
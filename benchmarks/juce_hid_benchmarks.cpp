@@ -0,0 +1,607 @@
+/*
+  ==============================================================================
+
+    juce_hid_benchmarks.cpp
+    Created: 18 Oct 2026
+
+    Microbenchmarks for the wrapper's hot paths. They run against simulated
+    devices from the loopback backend, so they need no hardware and build on
+    Linux as well as macOS and Windows.
+
+    Build this file as a console app with the juce_core, juce_events and
+    juce_hid modules and JUCE_HID_LOOPBACK=1. With JUCE's CMake API, after
+    juce_add_module (path/to/juce_hid):
+
+        juce_add_console_app (HIDBenchmarks)
+        target_sources (HIDBenchmarks PRIVATE benchmarks/juce_hid_benchmarks.cpp)
+        target_compile_definitions (HIDBenchmarks PRIVATE JUCE_HID_LOOPBACK=1)
+        target_link_libraries (HIDBenchmarks PRIVATE juce_hid juce::juce_core juce::juce_events)
+
+    Usage:
+
+        HIDBenchmarks [--devices 1,8,64,256] [--sizes 8,64,1024]
+                      [--min-time-ms 200] [--filter text] [--output file.json]
+
+    The results are written as JSON to stdout (or to --output), one entry per
+    operation, device count and report size, with ns/op and allocations/op.
+    A summary goes to stderr as it runs.
+
+    Allocations are counted on the thread that runs the operation, so the
+    backend's and the pool's own threads don't add to them. On glibc every
+    malloc(), calloc() and realloc() is counted, backend ones included;
+    elsewhere only operator new is. Built with JUCE_HID_ALLOCATION_TRACKING=1,
+    the module's hid::AllocationTracker does the counting instead, and its
+    per-entry-point report is printed to stderr at the end.
+
+  ==============================================================================
+*/
+
+#include "../juce_hid.h"
+
+#if ! JUCE_HID_LOOPBACK
+ #error "The benchmarks need the loopback backend: build them with JUCE_HID_LOOPBACK=1"
+#endif
+
+using namespace juce;
+
+#if JUCE_HID_ALLOCATION_TRACKING
+
+// The module already replaces the allocator and counts per thread.
+static int64 getNumAllocations() noexcept   { return hid::AllocationTracker::getThreadAllocations(); }
+
+ #if defined (__GLIBC__)
+static const char* const allocationCounter = "malloc";
+ #else
+static const char* const allocationCounter = "operator new";
+ #endif
+
+#else
+
+namespace
+{
+    thread_local int64 numAllocations = 0;
+}
+
+static int64 getNumAllocations() noexcept   { return numAllocations; }
+
+ #if defined (__GLIBC__)
+
+// glibc lets an executable replace malloc() and friends; these just count and
+// forward to the real allocator, so free() can stay as it is.
+extern "C"
+{
+    void* __libc_malloc (size_t);
+    void* __libc_calloc (size_t, size_t);
+    void* __libc_realloc (void*, size_t);
+
+    void* malloc (size_t size) noexcept                 { ++numAllocations; return __libc_malloc (size); }
+    void* calloc (size_t count, size_t size) noexcept   { ++numAllocations; return __libc_calloc (count, size); }
+    void* realloc (void* ptr, size_t size) noexcept     { ++numAllocations; return __libc_realloc (ptr, size); }
+}
+
+static const char* const allocationCounter = "malloc";
+
+ #else
+
+void* operator new (size_t size)
+{
+    ++numAllocations;
+
+    if (void* ptr = std::malloc (size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[] (size_t size)                  { return operator new (size); }
+void operator delete (void* ptr) noexcept           { std::free (ptr); }
+void operator delete[] (void* ptr) noexcept         { std::free (ptr); }
+void operator delete (void* ptr, size_t) noexcept   { std::free (ptr); }
+void operator delete[] (void* ptr, size_t) noexcept { std::free (ptr); }
+
+static const char* const allocationCounter = "operator new";
+
+ #endif
+
+#endif
+
+
+
+
+
+
+
+
+
+
+namespace
+{
+    /** Keeps results alive so the optimiser can't drop the work. */
+    volatile int64 sink = 0;
+
+    struct Options
+    {
+        Array<int> deviceCounts { 1, 8, 64, 256 };
+        Array<int> reportSizes { 8, 64, 1024 };
+        int minTimeMs = 200;
+        String filter;
+        String outputFile;
+    };
+
+    struct Measurement
+    {
+        String operation;
+        int numDevices;
+        int reportSize;     // 0 where the report size doesn't matter
+        int numThreads;     // 0 unless the operation uses a thread pool
+        int64 iterations;
+        double nanosPerOp;
+        double allocationsPerOp;
+        int64 errors;
+    };
+
+
+    /** A set of simulated devices, all opened, with a report of the
+     *  configured size ready to send.
+     */
+    class LoopbackDevices
+    {
+    public:
+
+        LoopbackDevices (int numDevices, int reportSizeToUse, int queueDepth)
+            : reportSize (jmax (2, reportSizeToUse)), report ((size_t) reportSize, true)
+        {
+            hid_loopback_remove_all();
+
+            for (int i = 0; i < numDevices; ++i) {
+                String serial ("BENCH" + String (i).paddedLeft ('0', 4));
+
+                hid_loopback_device_desc desc {};
+                desc.vendor_id = 0x1209;
+                desc.product_id = (unsigned short) (0x0001 + i % 4);
+                desc.usage_page = 0xff00;
+                desc.usage = 0x01;
+                desc.interface_number = 0;
+                desc.serial_number = serial.toWideCharPointer();
+                desc.manufacturer_string = L"juce_hid";
+                desc.product_string = L"Loopback benchmark device";
+                desc.input_report_length = (size_t) reportSize;
+                desc.output_report_length = (size_t) reportSize;
+                desc.feature_report_length = (size_t) reportSize;
+                ids.add (hid_loopback_add_device (&desc));
+            }
+
+            infos = hid::getAllDevicesAvailable();
+
+            for (auto& info : infos) {
+                hid::Device handle = hid_open_path (info.getPath().toRawUTF8());
+                handles.add (handle);
+                devices.add (hid::DeviceIO (handle, info));
+                devices.getReference (devices.size() - 1).setInputQueue (queueDepth);
+            }
+
+            // Numbered reports, so the full size is read back.
+            report[0] = 1;
+            for (int i = 1; i < reportSize; ++i) {
+                report[i] = (char) i;
+            }
+        }
+
+        ~LoopbackDevices()
+        {
+            for (auto handle : handles) {
+                hid_close (handle);
+            }
+            hid_loopback_remove_all();
+        }
+
+        int size() const                        { return devices.size(); }
+        hid::DeviceIO& getDevice (int index)    { return devices.getReference (index % devices.size()); }
+        const unsigned char* getReport() const  { return static_cast<const unsigned char*> (report.getData()); }
+
+        /** Queues count reports, spread over the devices in the same order
+         *  the benchmarks read them back.
+         */
+        void sendInput (int count)
+        {
+            for (int i = 0; i < count; ++i) {
+                hid_loopback_send_input (ids[i % ids.size()], getReport(), (size_t) reportSize);
+            }
+        }
+
+        const int reportSize;
+        Array<hid::DeviceInfo> infos;
+
+    private:
+
+        MemoryBlock report;
+        Array<int> ids;
+        Array<hid::Device> handles;
+        Array<hid::DeviceIO> devices;
+    };
+
+
+    class BenchmarkRunner
+    {
+    public:
+
+        BenchmarkRunner (const Options& optionsToUse) : options (optionsToUse) {}
+
+        void runAll()
+        {
+            for (int numDevices : options.deviceCounts) {
+                for (int reportSize : options.reportSizes) {
+                    runDeviceIO (numDevices, reportSize);
+                }
+                runDeviceInfo (numDevices);
+                runEnumeration (numDevices);
+
+                for (int reportSize : options.reportSizes) {
+                    runDecodePool (numDevices, reportSize);
+                }
+            }
+        }
+
+        var toJSON() const
+        {
+            Array<var> list;
+
+            for (auto& m : results) {
+                DynamicObject::Ptr entry (new DynamicObject());
+                entry->setProperty ("operation", m.operation);
+                entry->setProperty ("devices", m.numDevices);
+                if (m.reportSize > 0) {
+                    entry->setProperty ("reportSize", m.reportSize);
+                }
+                if (m.numThreads > 0) {
+                    entry->setProperty ("threads", m.numThreads);
+                }
+                entry->setProperty ("iterations", m.iterations);
+                entry->setProperty ("nsPerOp", m.nanosPerOp);
+                entry->setProperty ("allocsPerOp", m.allocationsPerOp);
+                entry->setProperty ("errors", m.errors);
+                list.add (var (entry.get()));
+            }
+
+            DynamicObject::Ptr root (new DynamicObject());
+            root->setProperty ("suite", "juce_hid");
+            root->setProperty ("backend", "loopback");
+            root->setProperty ("platform", SystemStats::getOperatingSystemName());
+            root->setProperty ("cpus", SystemStats::getNumCpus());
+            root->setProperty ("timestamp", Time::getCurrentTime().toISO8601 (true));
+            root->setProperty ("allocationCounter", allocationCounter);
+            root->setProperty ("minTimeMs", options.minTimeMs);
+            root->setProperty ("results", list);
+            return var (root.get());
+        }
+
+    private:
+
+        // Reads need reports queued first, so everything runs in batches with
+        // an untimed prepare step before each one.
+        static const int batchSize = 256;
+
+        bool isWanted (const String& operation) const
+        {
+            return options.filter.isEmpty() || operation.containsIgnoreCase (options.filter);
+        }
+
+        /** Runs prepare (untimed), then op (i) for i in [0, batch), then
+         *  finish (timed), until minTimeMs of timed work has been done.
+         *  op returns false on an error.
+         */
+        template <typename Prepare, typename Op, typename Finish>
+        void measure (const String& operation, int numDevices, int reportSize, int numThreads,
+                      int batch, Prepare&& prepare, Op&& op, Finish&& finish)
+        {
+            if (! isWanted (operation)) {
+                return;
+            }
+
+            // One batch to warm up caches, pools and lazily read strings.
+            prepare();
+            for (int i = 0; i < batch; ++i) {
+                op (i);
+            }
+            finish();
+
+            const uint64 minTime = (uint64) options.minTimeMs * 1000000;
+            uint64 elapsed = 0;
+            int64 iterations = 0, allocations = 0, errors = 0;
+
+            while (elapsed < minTime || iterations < batch * 4) {
+                prepare();
+
+                const int64 allocationsBefore = getNumAllocations();
+                const uint64 start = hid::getMonotonicTime();
+                for (int i = 0; i < batch; ++i) {
+                    if (! op (i)) {
+                        ++errors;
+                    }
+                }
+                finish();
+                elapsed += hid::getMonotonicTime() - start;
+                allocations += getNumAllocations() - allocationsBefore;
+                iterations += batch;
+            }
+
+            Measurement m { operation, numDevices, reportSize, numThreads, iterations,
+                            (double) elapsed / (double) iterations,
+                            (double) allocations / (double) iterations, errors };
+            results.add (m);
+
+            String line (operation.paddedRight (' ', 32) + " devices=" + String (numDevices).paddedRight (' ', 4));
+            line << (reportSize > 0 ? " size=" + String (reportSize).paddedRight (' ', 5) : String::repeatedString (" ", 11));
+            line << (numThreads > 0 ? " threads=" + String (numThreads).paddedRight (' ', 3) : String::repeatedString (" ", 12));
+            line << String (m.nanosPerOp, 1).paddedLeft (' ', 10) << " ns/op"
+                 << String (m.allocationsPerOp, 2).paddedLeft (' ', 8) << " allocs/op";
+            if (errors > 0) {
+                line << "  (" << errors << " errors)";
+            }
+            std::cerr << line << std::endl;
+        }
+
+        template <typename Prepare, typename Op>
+        void measure (const String& operation, int numDevices, int reportSize, int batch, Prepare&& prepare, Op&& op)
+        {
+            measure (operation, numDevices, reportSize, 0, batch, prepare, op, [] {});
+        }
+
+        void runDeviceIO (int numDevices, int reportSize)
+        {
+            LoopbackDevices loopback (numDevices, reportSize, batchSize);
+            HeapBlock<unsigned char> buffer ((size_t) loopback.reportSize, true);
+            const size_t length = (size_t) loopback.reportSize;
+            auto fill = [&] { loopback.sendInput (batchSize); };
+            auto nothing = [] {};
+
+            measure ("DeviceIO::read", numDevices, reportSize, batchSize, fill, [&] (int i) {
+                return loopback.getDevice (i).read (buffer, length).wasOk();
+            });
+
+            measure ("DeviceIO::readTimeout", numDevices, reportSize, batchSize, fill, [&] (int i) {
+                return loopback.getDevice (i).readTimeout (buffer, length, 100).wasOk();
+            });
+
+            measure ("DeviceIO::readReport", numDevices, reportSize, batchSize, fill, [&] (int i) {
+                hid::ReportView view;
+                bool ok = loopback.getDevice (i).readReport (view, 0).wasOk();
+                sink = sink + (int64) view.getSize();
+                return ok;
+            });
+
+            measure ("DeviceIO::write", numDevices, reportSize, batchSize, nothing, [&] (int i) {
+                return loopback.getDevice (i).write (loopback.getReport(), length).wasOk();
+            });
+
+            // Like FeatureReportBatch below, the batch is written in the finish
+            // step so ns/op is per report.
+            HeapBlock<hid_output_report> outputReports ((size_t) batchSize);
+            for (int i = 0; i < batchSize; ++i) {
+                outputReports[i] = { loopback.getReport(), length };
+            }
+            measure ("DeviceIO::writeMany", numDevices, reportSize, 0, batchSize, nothing,
+                     [] (int) { return true; },
+                     [&] { loopback.getDevice (0).writeMany (outputReports, (size_t) batchSize); });
+
+            measure ("DeviceIO::sendFeatureReport", numDevices, reportSize, batchSize, nothing, [&] (int i) {
+                return loopback.getDevice (i).sendFeatureReport (loopback.getReport(), length).wasOk();
+            });
+
+            measure ("DeviceIO::getFeatureReport", numDevices, reportSize, batchSize, nothing, [&] (int i) {
+                buffer[0] = 1;
+                return loopback.getDevice (i).getFeatureReport (buffer, length).wasOk();
+            });
+
+            for (int i = 0; i < loopback.size(); ++i) {
+                loopback.getDevice (i).setFeatureReportCache (-1);
+            }
+            measure ("DeviceIO::getFeatureReport (cached)", numDevices, reportSize, batchSize, nothing, [&] (int i) {
+                buffer[0] = 1;
+                return loopback.getDevice (i).getFeatureReport (buffer, length).wasOk();
+            });
+            for (int i = 0; i < loopback.size(); ++i) {
+                loopback.getDevice (i).setFeatureReportCache (0);
+            }
+
+            // The whole batch goes in the timed finish step, so ns/op is per
+            // report, read back included.
+            hid::FeatureReportBatch batch;
+            for (int i = 0; i < batchSize; ++i) {
+                batch.add (loopback.getReport(), length, loopback.getReport(), length);
+            }
+            measure ("FeatureReportBatch::send", numDevices, reportSize, 0, batchSize, nothing,
+                     [] (int) { return true; },
+                     [&] { batch.send (loopback.getDevice (0)); });
+        }
+
+        void runDeviceInfo (int numDevices)
+        {
+            LoopbackDevices loopback (numDevices, 64, batchSize);
+            const Array<hid::DeviceInfo>& infos = loopback.infos;
+            const int n = infos.size();
+            auto nothing = [] {};
+
+            measure ("DeviceInfo copy", numDevices, 0, batchSize, nothing, [&] (int i) {
+                hid::DeviceInfo copy (infos.getReference (i % n));
+                sink = sink + copy.getProductId();
+                return true;
+            });
+
+            measure ("DeviceInfo compare", numDevices, 0, batchSize, nothing, [&] (int i) {
+                sink = sink + (infos.getReference (i % n) == infos.getReference ((i * 7 + 3) % n) ? 1 : 0);
+                return true;
+            });
+        }
+
+        void runEnumeration (int numDevices)
+        {
+            LoopbackDevices loopback (numDevices, 64, 1);
+            const int batch = 16;
+            auto nothing = [] {};
+
+            // Before and after the string-less scans: hid_enumerate() copies
+            // every string, the DeviceFilter scan leaves them out.
+            measure ("hid_enumerate", numDevices, 0, batch, nothing, [&] (int) {
+                hid_device_info* list = hid_enumerate (0, 0);
+                hid_free_enumeration (list);
+                return list != nullptr;
+            });
+
+            measure ("DeviceFilter::enumerate", numDevices, 0, batch, nothing, [&] (int) {
+                hid_device_info* list = hid::DeviceFilter().enumerate();
+                hid_free_enumeration (list);
+                return list != nullptr;
+            });
+
+            measure ("hid::getAllDevicesAvailable", numDevices, 0, batch, nothing, [&] (int) {
+                Array<hid::DeviceInfo> devices = hid::getAllDevicesAvailable();
+                sink = sink + devices.size();
+                return devices.size() == numDevices;
+            });
+
+            hid::DeviceScanner scanner;
+            scanner.scanNow();
+
+            measure ("DeviceScanner::scanNow", numDevices, 0, batch, nothing, [&] (int) {
+                scanner.scanNow();
+                return scanner.getCurrentDevices().size() == numDevices;
+            });
+        }
+
+        void runDecodePool (int numDevices, int reportSize)
+        {
+            if (! isWanted ("DecodePool::submit")) {
+                return;
+            }
+
+            Array<int> threadCounts;
+            for (int n = 1; n < SystemStats::getNumCpus(); n *= 2) {
+                threadCounts.add (n);
+            }
+            threadCounts.add (SystemStats::getNumCpus());
+
+            LoopbackDevices loopback (numDevices, reportSize, batchSize);
+            Array<hid::ReportView> views;
+
+            // The reports are read outside the timed part; what's timed is
+            // handing them to the pool and waiting for them to be handled.
+            auto prepare = [&] {
+                views.clearQuick();
+                loopback.sendInput (batchSize);
+                for (int i = 0; i < batchSize; ++i) {
+                    hid::ReportView view;
+                    loopback.getDevice (i).readReport (view, 0);
+                    views.add (view);
+                }
+            };
+
+            for (int numThreads : threadCounts) {
+                Atomic<int64> bytesHandled;
+                hid::DecodePool pool ([&] (int, const hid::ReportView& report) {
+                    bytesHandled += (int64) report.getSize();
+                }, numThreads);
+
+                for (int i = 0; i < numDevices; ++i) {
+                    pool.addLane();
+                }
+
+                measure ("DecodePool::submit", numDevices, reportSize, numThreads, batchSize, prepare, [&] (int i) {
+                    return pool.submit (i % numDevices, views.getReference (i));
+                }, [&] {
+                    pool.waitUntilIdle();
+                });
+            }
+            views.clear();
+        }
+
+        const Options options;
+        Array<Measurement> results;
+    };
+
+
+    Array<int> parseList (const String& text)
+    {
+        Array<int> values;
+        for (auto& token : StringArray::fromTokens (text, ",", "")) {
+            if (token.getIntValue() > 0) {
+                values.add (token.getIntValue());
+            }
+        }
+        return values;
+    }
+}
+
+
+
+
+
+
+
+
+
+
+int main (int argc, char* argv[])
+{
+    Options options;
+
+    for (int i = 1; i < argc; ++i) {
+        const String arg (argv[i]);
+        const String value (i + 1 < argc ? String (argv[i + 1]) : String());
+
+        if (arg == "--devices" && parseList (value).size() > 0) {
+            options.deviceCounts = parseList (value);
+            ++i;
+        }
+        else if (arg == "--sizes" && parseList (value).size() > 0) {
+            options.reportSizes = parseList (value);
+            ++i;
+        }
+        else if (arg == "--min-time-ms" && value.getIntValue() > 0) {
+            options.minTimeMs = value.getIntValue();
+            ++i;
+        }
+        else if (arg == "--filter" && value.isNotEmpty()) {
+            options.filter = value;
+            ++i;
+        }
+        else if (arg == "--output" && value.isNotEmpty()) {
+            options.outputFile = value;
+            ++i;
+        }
+        else {
+            std::cerr << "Usage: HIDBenchmarks [--devices 1,8,64,256] [--sizes 8,64,1024]\n"
+                      << "                     [--min-time-ms 200] [--filter text] [--output file.json]\n";
+            return 1;
+        }
+    }
+
+    // DeviceScanner is a Timer and a ChangeBroadcaster, so it needs the
+    // message manager to exist.
+    ScopedJuceInitialiser_GUI juce;
+
+    Result r = hid::init();
+    if (r.failed()) {
+        std::cerr << r.getErrorMessage() << std::endl;
+        return 1;
+    }
+
+    BenchmarkRunner runner (options);
+    runner.runAll();
+
+    const String json (JSON::toString (runner.toJSON()));
+
+    if (options.outputFile.isNotEmpty()) {
+        File (File::getCurrentWorkingDirectory().getChildFile (options.outputFile)).replaceWithText (json);
+    }
+    else {
+        std::cout << json << std::endl;
+    }
+
+   #if JUCE_HID_ALLOCATION_TRACKING
+    std::cerr << hid::AllocationTracker::getReport() << std::endl;
+   #endif
+
+    hid::exit();
+    return 0;
+}
@@ -0,0 +1,555 @@
+/*
+  ==============================================================================
+
+    juce_hid_stress.cpp
+    Created: 18 Oct 2026
+
+    End-to-end stress test: N simulated devices from the loopback backend each
+    send reports at a fixed rate, and the whole pipeline runs for a fixed
+    time. Every device has a ReportReader (read) feeding its own DecodePool
+    lane, whose handler decodes each report (decode) and hands it to that
+    device's consumer (dispatch).
+
+    Each run reports the sustained throughput, the end-to-end latency from
+    the report being generated to it being dispatched (p50/p99/p99.9), the
+    reports dropped by the input queues or lost anywhere else, and CPU use.
+    Sweep the device count to find where throughput stops keeping up with
+    the offered rate or the latency takes off.
+
+    Build it like juce_hid_benchmarks.cpp: a console app with the juce_core,
+    juce_events and juce_hid modules and JUCE_HID_LOOPBACK=1.
+
+    Usage:
+
+        HIDStress [--devices 1,4,16,64,256] [--rate 1000] [--size 64]
+                  [--duration-ms 5000] [--warmup-ms 1000] [--threads 0]
+                  [--generators 4] [--queue 32] [--policy dropOldest]
+                  [--decode-ns 0] [--output file.json]
+
+    --rate is per device, in reports per second. --threads is the number of
+    DecodePool threads (0 for one per core). --generators is the number of
+    threads standing in for the hardware; their CPU time is measured and
+    reported apart from the library's. --decode-ns adds that much busy work
+    to the decoding of every report.
+
+    CPU use is in percent of one core over the measured window.
+
+  ==============================================================================
+*/
+
+#include "../juce_hid.h"
+
+#include <thread>
+
+#if JUCE_WINDOWS
+ #include <windows.h>
+#else
+ #include <sys/resource.h>
+ #include <time.h>
+#endif
+
+#if ! JUCE_HID_LOOPBACK
+ #error "The stress test needs the loopback backend: build it with JUCE_HID_LOOPBACK=1"
+#endif
+
+using namespace juce;
+
+namespace
+{
+   #if JUCE_WINDOWS
+    uint64 fileTimeToNanoseconds (const FILETIME& t)
+    {
+        return ((uint64) t.dwHighDateTime << 32 | t.dwLowDateTime) * 100;
+    }
+   #endif
+
+    /** CPU time used by the whole process so far, in nanoseconds. */
+    uint64 getProcessCpuTime()
+    {
+       #if JUCE_WINDOWS
+        FILETIME creation, exit, kernel, user;
+        GetProcessTimes (GetCurrentProcess(), &creation, &exit, &kernel, &user);
+        return fileTimeToNanoseconds (kernel) + fileTimeToNanoseconds (user);
+       #else
+        rusage usage;
+        getrusage (RUSAGE_SELF, &usage);
+        return ((uint64) usage.ru_utime.tv_sec + (uint64) usage.ru_stime.tv_sec) * 1000000000
+             + ((uint64) usage.ru_utime.tv_usec + (uint64) usage.ru_stime.tv_usec) * 1000;
+       #endif
+    }
+
+    /** CPU time used by the calling thread so far, in nanoseconds. */
+    uint64 getThreadCpuTime()
+    {
+       #if JUCE_WINDOWS
+        FILETIME creation, exit, kernel, user;
+        GetThreadTimes (GetCurrentThread(), &creation, &exit, &kernel, &user);
+        return fileTimeToNanoseconds (kernel) + fileTimeToNanoseconds (user);
+       #else
+        timespec ts;
+        clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+        return (uint64) ts.tv_sec * 1000000000 + (uint64) ts.tv_nsec;
+       #endif
+    }
+
+    // Report layout: report ID, sequence number, generation time, then filler.
+    const int sequenceOffset  = 1;
+    const int timestampOffset = 9;
+    const int minReportSize   = 17;
+
+    struct Options
+    {
+        Array<int> deviceCounts { 1, 4, 16, 64, 256 };
+        int rate = 1000;
+        int reportSize = 64;
+        int durationMs = 5000;
+        int warmupMs = 1000;
+        int numThreads = 0;
+        int numGenerators = 4;
+        int queueDepth = 32;
+        hid::OverflowPolicy policy = hid::dropOldest;
+        int decodeNanoseconds = 0;
+        String outputFile;
+    };
+
+    /** The measured window, in hid::getMonotonicTime() nanoseconds. Reports
+     *  generated outside it are handled but not counted.
+     */
+    struct Window
+    {
+        Atomic<uint64> start { std::numeric_limits<uint64>::max() };
+        Atomic<uint64> end   { std::numeric_limits<uint64>::max() };
+
+        bool contains (uint64 time) const noexcept   { return time >= start.get() && time < end.get(); }
+    };
+
+
+    /** Stands in for the hardware of a few devices, sending each of them one
+     *  report per period. All of its devices send on the same tick, like USB
+     *  devices polled on the same frame.
+     */
+    class Generator :   public Thread
+    {
+    public:
+
+        Generator (const Array<int>& deviceIds, const Options& options, const Window& windowToUse, uint64 startTimeToUse)
+            : Thread ("HID stress generator"), ids (deviceIds),
+              period (1000000000 / (uint64) jmax (1, options.rate)),
+              report ((size_t) jmax (minReportSize, options.reportSize), true),
+              sequences ((size_t) deviceIds.size(), true),
+              window (windowToUse), startTime (startTimeToUse)
+        {
+            report[0] = 1;
+        }
+
+        ~Generator()
+        {
+            stopThread (2000);
+        }
+
+        void run()
+        {
+            uint64 next = startTime;
+            unsigned char* data = static_cast<unsigned char*> (report.getData());
+
+            while (! threadShouldExit()) {
+                uint64 now = hid::getMonotonicTime();
+
+                if (now < next) {
+                    std::this_thread::sleep_for (std::chrono::nanoseconds (next - now));
+                    continue;
+                }
+
+                if (cpuAtStart == 0 && now >= window.start.get()) {
+                    cpuAtStart = getThreadCpuTime();
+                }
+                if (cpuAtEnd == 0 && now >= window.end.get()) {
+                    cpuAtEnd = getThreadCpuTime();
+                }
+                if (now - next > period && window.contains (now)) {
+                    ++lateTicks;
+                }
+
+                for (int i = 0; i < ids.size(); ++i) {
+                    const uint64 sequence = ++sequences[i];
+                    const uint64 timestamp = hid::getMonotonicTime();
+                    memcpy (data + sequenceOffset, &sequence, sizeof (sequence));
+                    memcpy (data + timestampOffset, &timestamp, sizeof (timestamp));
+
+                    if (hid_loopback_send_input (ids[i], data, report.getSize()) < 0) {
+                        ++failedSends;
+                    }
+                    else if (window.contains (timestamp)) {
+                        ++sent;
+                    }
+                }
+                next += period;
+            }
+
+            if (cpuAtEnd == 0) {
+                cpuAtEnd = getThreadCpuTime();
+            }
+        }
+
+        uint64 getCpuTime() const   { return cpuAtEnd > cpuAtStart ? cpuAtEnd - cpuAtStart : 0; }
+
+        int64 sent = 0, failedSends = 0, lateTicks = 0;
+
+    private:
+
+        const Array<int> ids;
+        const uint64 period;
+        MemoryBlock report;
+        HeapBlock<uint64> sequences;
+        const Window& window;
+        const uint64 startTime;
+        uint64 cpuAtStart = 0, cpuAtEnd = 0;
+    };
+
+
+    /** What a device's consumer has seen. Only touched from its DecodePool
+     *  lane, which handles one report at a time.
+     */
+    struct DeviceState
+    {
+        hid::LatencyHistogram latency;
+        uint64 lastSequence = 0;
+        int64 delivered = 0;
+        int64 lost = 0;
+        uint64 checksum = 0;
+    };
+
+
+    class StressRun
+    {
+    public:
+
+        StressRun (const Options& optionsToUse, int numDevicesToUse)
+            : options (optionsToUse), numDevices (numDevicesToUse),
+              reportSize (jmax (minReportSize, options.reportSize)),
+              states ((size_t) numDevices)
+        {
+        }
+
+        var run()
+        {
+            hid_loopback_remove_all();
+
+            Array<int> ids;
+            for (int i = 0; i < numDevices; ++i) {
+                hid_loopback_device_desc desc {};
+                desc.vendor_id = 0x1209;
+                desc.product_id = 0x0002;
+                desc.input_report_length = (size_t) reportSize;
+                desc.output_report_length = (size_t) reportSize;
+                desc.feature_report_length = (size_t) reportSize;
+                ids.add (hid_loopback_add_device (&desc));
+            }
+
+            // Read -> decode -> dispatch.
+            hid::DecodePool pool ([this] (int lane, const hid::ReportView& report) {
+                handleReport (lane, report);
+            }, options.numThreads);
+
+            Array<hid::Device> handles;
+            Array<hid::DeviceIO> devices;
+            OwnedArray<hid::ReportReader> readers;
+
+            for (auto& info : hid::getAllDevicesAvailable (hid::DeviceFilter().setIds (0x1209, 0x0002))) {
+                hid::Device handle = hid_open_path (info.getPath().toRawUTF8());
+                handles.add (handle);
+
+                hid::DeviceIO device (handle, info);
+                device.setInputQueue (options.queueDepth, options.policy, options.queueDepth * 8);
+                devices.add (device);
+
+                hid::ReportReader* reader = new hid::ReportReader (device, pool, pool.addLane());
+                readers.add (reader);
+                reader->start();
+            }
+
+            // Hand the devices out to the generators round-robin.
+            const int numGenerators = jlimit (1, numDevices, options.numGenerators);
+            const uint64 startTime = hid::getMonotonicTime() + 10000000;
+            OwnedArray<Generator> generators;
+
+            for (int g = 0; g < numGenerators; ++g) {
+                Array<int> generatorIds;
+                for (int i = g; i < ids.size(); i += numGenerators) {
+                    generatorIds.add (ids[i]);
+                }
+                generators.add (new Generator (generatorIds, options, window, startTime));
+            }
+            for (auto* generator : generators) {
+                generator->startThread();
+            }
+
+            // Warm up, then measure.
+            Thread::sleep (options.warmupMs);
+
+            uint64 droppedBefore = 0;
+            for (auto& device : devices) {
+                droppedBefore += device.getNumDroppedReports();
+            }
+            const uint64 cpuBefore = getProcessCpuTime();
+            const uint64 windowStart = hid::getMonotonicTime();
+            window.start = windowStart;
+
+            Thread::sleep (options.durationMs);
+
+            const uint64 windowEnd = hid::getMonotonicTime();
+            window.end = windowEnd;
+            const uint64 cpuAfter = getProcessCpuTime();
+
+            uint64 droppedAfter = 0;
+            for (auto& device : devices) {
+                droppedAfter += device.getNumDroppedReports();
+            }
+
+            // Let what was generated in the window make it through.
+            Thread::sleep (20);
+            for (auto* generator : generators) {
+                generator->signalThreadShouldExit();
+            }
+            for (auto* generator : generators) {
+                generator->stopThread (2000);
+            }
+            Thread::sleep (200);
+            const bool drained = pool.waitUntilIdle (5000);
+
+            for (auto* reader : readers) {
+                reader->stop();
+            }
+            for (auto handle : handles) {
+                hid_close (handle);
+            }
+            hid_loopback_remove_all();
+
+            return makeResult (generators, droppedAfter - droppedBefore, windowEnd - windowStart,
+                               cpuAfter - cpuBefore, drained);
+        }
+
+    private:
+
+        void handleReport (int lane, const hid::ReportView& report)
+        {
+            const uint64 now = hid::getMonotonicTime();
+            DeviceState& state = states[(size_t) lane];
+
+            if (report.getSize() < (size_t) minReportSize) {
+                return;
+            }
+
+            // Decode.
+            uint64 sequence, timestamp;
+            memcpy (&sequence, report.getData() + sequenceOffset, sizeof (sequence));
+            memcpy (&timestamp, report.getData() + timestampOffset, sizeof (timestamp));
+
+            uint64 checksum = 0;
+            for (size_t i = 0; i < report.getSize(); ++i) {
+                checksum = checksum * 31 + report.getData()[i];
+            }
+
+            if (options.decodeNanoseconds > 0) {
+                const uint64 until = now + (uint64) options.decodeNanoseconds;
+                while (hid::getMonotonicTime() < until) {}
+            }
+
+            // Dispatch.
+            const bool counted = window.contains (timestamp);
+            if (counted) {
+                state.latency.addSample (hid::getMonotonicTime() - timestamp);
+                state.delivered++;
+                if (state.lastSequence != 0 && sequence > state.lastSequence + 1) {
+                    state.lost += (int64) (sequence - state.lastSequence - 1);
+                }
+            }
+            state.lastSequence = jmax (state.lastSequence, sequence);
+            state.checksum += checksum;
+        }
+
+        var makeResult (const OwnedArray<Generator>& generators, uint64 dropped, uint64 windowNs,
+                        uint64 cpuNs, bool drained) const
+        {
+            hid::LatencyHistogram latency;
+            int64 delivered = 0, lost = 0;
+            for (auto& state : states) {
+                latency.merge (state.latency);
+                delivered += state.delivered;
+                lost += state.lost;
+            }
+
+            int64 sent = 0, failedSends = 0, lateTicks = 0;
+            uint64 generatorCpuNs = 0;
+            for (auto* generator : generators) {
+                sent += generator->sent;
+                failedSends += generator->failedSends;
+                lateTicks += generator->lateTicks;
+                generatorCpuNs += generator->getCpuTime();
+            }
+
+            const double seconds = (double) windowNs / 1.0e9;
+            const double toPercent = 100.0 / (double) windowNs;
+
+            DynamicObject::Ptr latencyObject (new DynamicObject());
+            latencyObject->setProperty ("p50", (int64) latency.getPercentile (0.5));
+            latencyObject->setProperty ("p99", (int64) latency.getPercentile (0.99));
+            latencyObject->setProperty ("p999", (int64) latency.getPercentile (0.999));
+            latencyObject->setProperty ("max", (int64) latency.getMax());
+            latencyObject->setProperty ("mean", (int64) latency.getMean());
+
+            DynamicObject::Ptr cpu (new DynamicObject());
+            cpu->setProperty ("process", (double) cpuNs * toPercent);
+            cpu->setProperty ("generators", (double) generatorCpuNs * toPercent);
+            cpu->setProperty ("pipeline", (double) (cpuNs > generatorCpuNs ? cpuNs - generatorCpuNs : 0) * toPercent);
+
+            DynamicObject::Ptr result (new DynamicObject());
+            result->setProperty ("devices", numDevices);
+            result->setProperty ("ratePerDevice", options.rate);
+            result->setProperty ("reportSize", reportSize);
+            result->setProperty ("decodeThreads", options.numThreads > 0 ? options.numThreads : SystemStats::getNumCpus());
+            result->setProperty ("generators", generators.size());
+            result->setProperty ("queueDepth", options.queueDepth);
+            result->setProperty ("decodeNs", options.decodeNanoseconds);
+            result->setProperty ("windowMs", (double) windowNs / 1.0e6);
+            result->setProperty ("targetRate", (double) numDevices * options.rate);
+            result->setProperty ("offeredRate", (double) sent / seconds);
+            result->setProperty ("throughput", (double) delivered / seconds);
+            result->setProperty ("sent", sent);
+            result->setProperty ("delivered", delivered);
+            result->setProperty ("dropped", (int64) dropped);
+            result->setProperty ("lost", lost);
+            result->setProperty ("failedSends", failedSends);
+            result->setProperty ("generatorLateTicks", lateTicks);
+            result->setProperty ("drained", drained);
+            result->setProperty ("latencyNs", var (latencyObject.get()));
+            result->setProperty ("cpuPercent", var (cpu.get()));
+
+            String line ("devices=" + String (numDevices).paddedRight (' ', 4));
+            line << " offered=" << String ((double) sent / seconds, 0).paddedLeft (' ', 9) << "/s"
+                 << " throughput=" << String ((double) delivered / seconds, 0).paddedLeft (' ', 9) << "/s"
+                 << " p50=" << String ((double) latency.getPercentile (0.5) / 1000.0, 1) << "us"
+                 << " p99=" << String ((double) latency.getPercentile (0.99) / 1000.0, 1) << "us"
+                 << " p99.9=" << String ((double) latency.getPercentile (0.999) / 1000.0, 1) << "us"
+                 << " dropped=" << (int64) dropped << " lost=" << lost
+                 << " cpu=" << String ((double) (cpuNs > generatorCpuNs ? cpuNs - generatorCpuNs : 0) * toPercent, 1) << "%";
+            if (! drained) {
+                line << " (not drained)";
+            }
+            std::cerr << line << std::endl;
+
+            return var (result.get());
+        }
+
+        const Options options;
+        const int numDevices;
+        const int reportSize;
+        Window window;
+        std::vector<DeviceState> states;
+    };
+
+
+    Array<int> parseList (const String& text)
+    {
+        Array<int> values;
+        for (auto& token : StringArray::fromTokens (text, ",", "")) {
+            if (token.getIntValue() > 0) {
+                values.add (token.getIntValue());
+            }
+        }
+        return values;
+    }
+
+    bool parsePolicy (const String& text, hid::OverflowPolicy& policy)
+    {
+        if (text == "dropOldest")       policy = hid::dropOldest;
+        else if (text == "dropNewest")  policy = hid::dropNewest;
+        else if (text == "block")       policy = hid::block;
+        else if (text == "grow")        policy = hid::grow;
+        else                            return false;
+        return true;
+    }
+}
+
+
+
+
+
+
+
+
+
+
+int main (int argc, char* argv[])
+{
+    Options options;
+    bool ok = true;
+
+    for (int i = 1; i < argc && ok; ++i) {
+        const String arg (argv[i]);
+        const String value (i + 1 < argc ? String (argv[i + 1]) : String());
+        ++i;
+
+        if (arg == "--devices") {
+            options.deviceCounts = parseList (value);
+            for (int n : options.deviceCounts) {
+                ok = ok && n >= 1 && n <= 256;
+            }
+            ok = ok && options.deviceCounts.size() > 0;
+        }
+        else if (arg == "--rate")           ok = (options.rate = value.getIntValue()) > 0;
+        else if (arg == "--size")           ok = (options.reportSize = value.getIntValue()) > 0;
+        else if (arg == "--duration-ms")    ok = (options.durationMs = value.getIntValue()) > 0;
+        else if (arg == "--warmup-ms")      ok = (options.warmupMs = value.getIntValue()) >= 0;
+        else if (arg == "--threads")        ok = (options.numThreads = value.getIntValue()) >= 0;
+        else if (arg == "--generators")     ok = (options.numGenerators = value.getIntValue()) > 0;
+        else if (arg == "--queue")          ok = (options.queueDepth = value.getIntValue()) > 0;
+        else if (arg == "--policy")         ok = parsePolicy (value, options.policy);
+        else if (arg == "--decode-ns")      ok = (options.decodeNanoseconds = value.getIntValue()) >= 0;
+        else if (arg == "--output")         ok = (options.outputFile = value).isNotEmpty();
+        else                                ok = false;
+    }
+
+    if (! ok) {
+        std::cerr << "Usage: HIDStress [--devices 1,4,16,64,256] [--rate 1000] [--size 64]\n"
+                  << "                 [--duration-ms 5000] [--warmup-ms 1000] [--threads 0]\n"
+                  << "                 [--generators 4] [--queue 32] [--policy dropOldest]\n"
+                  << "                 [--decode-ns 0] [--output file.json]\n"
+                  << "Device counts must be between 1 and 256.\n";
+        return 1;
+    }
+
+    ScopedJuceInitialiser_GUI juce;
+
+    Result r = hid::init();
+    if (r.failed()) {
+        std::cerr << r.getErrorMessage() << std::endl;
+        return 1;
+    }
+
+    Array<var> runs;
+    for (int numDevices : options.deviceCounts) {
+        StressRun run (options, numDevices);
+        runs.add (run.run());
+    }
+
+    DynamicObject::Ptr root (new DynamicObject());
+    root->setProperty ("suite", "juce_hid_stress");
+    root->setProperty ("backend", "loopback");
+    root->setProperty ("platform", SystemStats::getOperatingSystemName());
+    root->setProperty ("cpus", SystemStats::getNumCpus());
+    root->setProperty ("timestamp", Time::getCurrentTime().toISO8601 (true));
+    root->setProperty ("runs", runs);
+
+    const String json (JSON::toString (var (root.get())));
+
+    if (options.outputFile.isNotEmpty()) {
+        File::getCurrentWorkingDirectory().getChildFile (options.outputFile).replaceWithText (json);
+    }
+    else {
+        std::cout << json << std::endl;
+    }
+
+    hid::exit();
+    return 0;
+}
@@ -127,6 +127,83 @@ extern "C" {
 		*/
 		void  HID_API_EXPORT HID_API_CALL hid_free_enumeration(struct hid_device_info *devs);
 
+		/** hidapi enumeration filter
+
+			Passed to hid_enumerate_filtered(). Every criterion is checked
+			before the device's string properties (serial number,
+			manufacturer and product) are fetched, so devices that don't
+			match cost as little as possible. Zero-initialise it and set
+			only the fields you care about.
+		*/
+		struct hid_enumerate_filter {
+			/** Vendor ID to match, or 0 for any */
+			unsigned short vendor_id;
+			/** Product ID to match, or 0 for any */
+			unsigned short product_id;
+			/** Usage Page to match, or 0 for any */
+			unsigned short usage_page;
+			/** Usage to match, or 0 for any */
+			unsigned short usage;
+			/** Non-zero to only match devices whose interface_number
+			    equals interface_number below */
+			int match_interface_number;
+			/** Interface number to match if match_interface_number is set */
+			int interface_number;
+			/** Only match devices whose path starts with this, or NULL for any */
+			const char *path_prefix;
+			/** Optional callback deciding whether to keep a device that passed
+			    every other check. It sees path, ids, release number, usage
+			    and interface number; the string fields are still NULL.
+			    Return non-zero to keep the device. */
+			int (*predicate)(const struct hid_device_info *info, void *context);
+			/** Passed to predicate */
+			void *context;
+			/** Non-zero to leave serial_number, manufacturer_string and
+			    product_string NULL in the result. Reading them is the
+			    most expensive part of an enumeration; fetch them later,
+			    for the devices that need them, with
+			    hid_get_strings_by_path(). */
+			int skip_strings;
+		};
+
+		/** @brief Enumerate the HID Devices matching a filter.
+
+			Like hid_enumerate(), but with more ways to narrow the result
+			down, all of which are evaluated before the expensive string
+			properties are read.
+
+			@ingroup API
+			@param filter The criteria to match (NULL matches everything).
+			@returns
+				A linked list like the one hid_enumerate() returns. Free it
+				with hid_free_enumeration().
+		*/
+		struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate_filtered(const struct hid_enumerate_filter *filter);
+
+		/** @brief Get the string properties of a device without opening it
+			for I/O.
+
+			Meant for lists returned by hid_enumerate_filtered() with
+			skip_strings set. Any of the string buffers may be NULL if
+			that string isn't needed; strings the device doesn't have are
+			returned empty.
+
+			@ingroup API
+			@param path The path of the device, as returned by
+				hid_enumerate_filtered().
+			@param serial_number A wide string buffer for the serial
+				number, or NULL.
+			@param manufacturer_string A wide string buffer for the
+				manufacturer string, or NULL.
+			@param product_string A wide string buffer for the product
+				string, or NULL.
+			@param maxlen The length of each buffer in multiples of wchar_t.
+			@returns
+				This function returns 0 on success and -1 if the device
+				could not be found.
+		*/
+		int HID_API_EXPORT_CALL hid_get_strings_by_path(const char *path, wchar_t *serial_number, wchar_t *manufacturer_string, wchar_t *product_string, size_t maxlen);
+
 		/** @brief Open a HID device using a Vendor ID (VID), Product ID
 			(PID) and optionally a serial number.
 			If @p serial_number is NULL, the first device with the
@@ -178,6 +255,36 @@ extern "C" {
 		*/
 		int  HID_API_EXPORT HID_API_CALL hid_write(hid_device *device, const unsigned char *data, size_t length);
 
+		/** One Output report for hid_write_many(), laid out as for
+			hid_write(): the Report ID followed by the report data.
+		*/
+		struct hid_output_report {
+			const unsigned char *data;
+			size_t length;
+		};
+
+		/** @brief Write several Output reports to a HID device.
+			The reports are sent in order, as if by calling hid_write()
+			for each, but the backend submits them with as few
+			system calls and waits as it can. On Windows up to 16
+			writes are in flight at once.
+			No more reports are started once one fails, though any
+			already in flight are still waited for.
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param reports The reports to send.
+			@param count The number of reports.
+			@param results Optional; if not NULL, receives for each
+				report the number of bytes written, -1 if it failed
+				or 0 if it wasn't sent because an earlier one failed.
+				Must have room for @p count ints.
+			@returns
+				This function returns the number of reports written
+				before the first failure, i.e. @p count if they all
+				were written.
+		*/
+		int  HID_API_EXPORT HID_API_CALL hid_write_many(hid_device *device, const struct hid_output_report *reports, size_t count, int *results);
+
 		/** @brief Read an Input report from a HID device with timeout.
 			Input reports are returned
 			to the host through the INTERRUPT IN endpoint. The first byte will
@@ -312,6 +419,23 @@ extern "C" {
 		*/
 		int HID_API_EXPORT_CALL hid_get_serial_number_string(hid_device *device, wchar_t *string, size_t maxlen);
 
+		/** @brief Get the largest input, output and feature report a
+			device can send or receive.
+
+			The lengths are the ones the OS reports for the device. On
+			Windows they always include the report ID byte. They're read
+			when the device is opened, so this doesn't talk to the OS.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param input Receives the maximum Input report length, or NULL.
+			@param output Receives the maximum Output report length, or NULL.
+			@param feature Receives the maximum Feature report length, or NULL.
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT_CALL hid_get_max_report_lengths(hid_device *device, size_t *input, size_t *output, size_t *feature);
+
 		/** @brief Get a string from a HID device, based on its string index.
 			@ingroup API
 			@param device A device handle returned from hid_open().
@@ -332,6 +456,339 @@ extern "C" {
 		*/
 		HID_API_EXPORT const wchar_t* HID_API_CALL hid_error(hid_device *device);
 
+		/** hidapi pooled input report
+
+			Returned by hid_read_report_timeout(). The report bytes live in
+			a buffer owned by the device's report pool, so they are only
+			copied once on their way from the OS. Give the buffer back with
+			hid_report_release() when done; it stays valid until then,
+			even if the device is closed in the meantime.
+		*/
+		struct hid_report {
+			/** The report data. The first byte is the Report ID if
+			    the device uses numbered reports. */
+			const unsigned char *data;
+			/** Number of valid bytes in data */
+			size_t length;
+			/** Report ID (0 for devices without numbered reports) */
+			unsigned char report_id;
+			/** Arrival time in nanoseconds, on the clock used by
+			    hid_get_monotonic_time() */
+			unsigned long long timestamp;
+		};
+
+		/** @brief Read an Input report from a HID device without copying it.
+
+			Works like hid_read_timeout(), but instead of copying the
+			report into a caller supplied buffer it hands out the pooled
+			buffer the report was received into.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param report Receives the report on success. Must be
+				released with hid_report_release().
+			@param milliseconds timeout in milliseconds or -1 for blocking wait.
+			@returns
+				This function returns the number of bytes in the report,
+				0 if no report was available within the timeout period
+				and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_read_report_timeout(hid_device *device, struct hid_report **report, int milliseconds);
+
+		/** @brief Take an extra reference to a report returned by
+			hid_read_report_timeout().
+
+			@ingroup API
+			@param report The report to retain.
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_report_retain(struct hid_report *report);
+
+		/** @brief Give a report back to its pool.
+
+			Every report from hid_read_report_timeout() and every call to
+			hid_report_retain() needs a matching release.
+
+			@ingroup API
+			@param report The report to release (may be NULL).
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_report_release(struct hid_report *report);
+
+		/** @brief Get the current time on the clock used for report timestamps.
+
+			@ingroup API
+			@returns
+				A monotonic time in nanoseconds.
+		*/
+		unsigned long long HID_API_EXPORT HID_API_CALL hid_get_monotonic_time(void);
+
+		/** Called when an input report has been queued on a device, or
+			the device has gone away, so that code waiting on many
+			devices at once knows when to read. It's called on the
+			backend's reader thread with the device's lock held, so
+			keep it short and don't call into the device from it. */
+		typedef void (HID_API_CALL *hid_input_callback)(hid_device *device, void *context);
+
+		/** @brief Set a function to be told when input arrives.
+
+			A device has one; setting it replaces the last one. Once
+			this has returned, the old function won't be called again.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param callback The function, or NULL to remove it.
+			@param context Passed to callback.
+			@returns
+				This function returns 0 on success and -1 if the
+				backend has no reader thread to call it from (Windows).
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_set_input_callback(hid_device *device, hid_input_callback callback, void *context);
+
+		/** Scheduling policies for hid_thread_options. */
+		#define HID_THREAD_POLICY_DEFAULT 0 /**< Leave the OS default */
+		#define HID_THREAD_POLICY_FIFO    1 /**< Real-time, first in first out (SCHED_FIFO) */
+		#define HID_THREAD_POLICY_RR      2 /**< Real-time, round robin (SCHED_RR) */
+
+		/** How a thread should be scheduled.
+
+			Used for the threads the backend reads input reports on,
+			and for threads of your own with
+			hid_set_current_thread_options(). Zero-initialise it and
+			set only the fields you care about.
+		*/
+		struct hid_thread_options {
+			/** One of the HID_THREAD_POLICY_ values */
+			int policy;
+			/** For the real-time policies: 1 (lowest) to 99 (highest),
+			    scaled onto the platform's range */
+			int priority;
+			/** Bit n set allows the thread to run on CPU n, 0 leaves it
+			    alone. macOS has no hard affinity, so there it's only
+			    used as an affinity tag hint. */
+			unsigned long long affinity_mask;
+			/** Thread name, or NULL to leave it alone */
+			const char *name;
+			/** Backend reader threads only: if non-zero, the thread wakes
+			    up every this many milliseconds to measure how late the
+			    scheduler runs it. See hid_get_thread_stats(). */
+			int latency_probe_ms;
+		};
+
+		/** Scheduling latency observed on a thread, in nanoseconds. */
+		struct hid_thread_stats {
+			unsigned long long num_samples;
+			unsigned long long total_latency_ns;
+			unsigned long long max_latency_ns;
+			unsigned long long last_latency_ns;
+		};
+
+		/** @brief Set the options for reader threads started from now on.
+
+			@ingroup API
+			@param options The options, or NULL to go back to the OS
+				defaults.
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_set_default_thread_options(const struct hid_thread_options *options);
+
+		/** @brief Change the options of a device's reader thread.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param options The options to apply.
+			@returns
+				This function returns 0 on success and -1 on error,
+				including when the backend has no reader thread
+				(Windows reads on the calling thread).
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_set_thread_options(hid_device *device, const struct hid_thread_options *options);
+
+		/** @brief Apply options to the calling thread.
+
+			@ingroup API
+			@param options The options to apply. latency_probe_ms is
+				ignored.
+			@returns
+				This function returns 0 on success and -1 if any of
+				the options could not be applied (e.g. real-time
+				scheduling without the privileges for it).
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_set_current_thread_options(const struct hid_thread_options *options);
+
+		/** @brief Get the scheduling latency measured on a device's reader
+			thread, if it has a latency probe running.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param stats Receives the statistics.
+			@returns
+				This function returns 0 on success and -1 if the
+				backend has no reader thread.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_get_thread_stats(hid_device *device, struct hid_thread_stats *stats);
+
+		/** What happens to input reports that arrive when a device's
+			input queue is full. See hid_set_input_queue(). */
+		#define HID_OVERFLOW_DROP_OLDEST 0 /**< Make room by dropping the oldest queued report (the default) */
+		#define HID_OVERFLOW_DROP_NEWEST 1 /**< Drop the report that just arrived */
+		#define HID_OVERFLOW_BLOCK       2 /**< Hold up the backend until a report is read */
+		#define HID_OVERFLOW_GROW        3 /**< Keep growing up to a bound, then drop the oldest */
+
+		/** Called when input reports are dropped, with the total number
+			dropped since the device was opened (or its metrics reset).
+			It's called on the backend's reader thread, so keep it short
+			and don't read from the device in it. */
+		typedef void (HID_API_CALL *hid_drop_callback)(hid_device *device, unsigned long long total_dropped, void *context);
+
+		/** @brief Configure a device's input report queue.
+
+			The default is 32 reports (64 on Windows) with
+			HID_OVERFLOW_DROP_OLDEST.
+			Every report dropped is counted in
+			hid_device_metrics::reports_dropped.
+
+			With HID_OVERFLOW_BLOCK the backend stops taking reports
+			from the OS while the queue is full, so any dropping
+			happens in the OS's own buffers, unseen.
+
+			On Windows the queue is the OS's: only
+			HID_OVERFLOW_DROP_OLDEST and HID_OVERFLOW_GROW are
+			supported, depths are limited to 2 - 512, and drops can't
+			be counted.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param depth The number of reports to queue, at least 1.
+			@param policy One of the HID_OVERFLOW_ values.
+			@param max_depth For HID_OVERFLOW_GROW, the most reports
+				the queue can grow to. Ignored otherwise.
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_set_input_queue(hid_device *device, int depth, int policy, int max_depth);
+
+		/** @brief Set a function to be told about dropped input reports.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param callback The function, or NULL to remove it.
+			@param context Passed to callback.
+			@returns
+				This function returns 0 on success and -1 if the
+				backend can't see drops (Windows).
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_set_drop_callback(hid_device *device, hid_drop_callback callback, void *context);
+
+		/** Number of buckets in a hid_latency_histogram. */
+		#define HID_LATENCY_HISTOGRAM_BUCKETS 160
+
+		/** A latency histogram in nanoseconds, with a relative error of
+			at most 25%: values below 4 get a bucket each, and every
+			power of two above that is split into 4 equal buckets. The
+			last bucket also holds everything longer than 2^41 ns
+			(about 36 minutes).
+			Use hid_latency_bucket_lower_bound() to map a bucket back
+			to a value.
+		*/
+		struct hid_latency_histogram {
+			unsigned long long count;
+			unsigned long long total_ns;
+			unsigned long long max_ns;
+			unsigned long long buckets[HID_LATENCY_HISTOGRAM_BUCKETS];
+		};
+
+		/** Counters kept for every open device. */
+		struct hid_device_metrics {
+			/** Input reports that arrived from the OS */
+			unsigned long long reports_received;
+			/** Input reports handed out by the hid_read functions */
+			unsigned long long reports_read;
+			unsigned long long bytes_read;
+			/** Output reports sent with hid_write() */
+			unsigned long long reports_written;
+			unsigned long long bytes_written;
+			/** Input reports thrown away before they were read */
+			unsigned long long reports_dropped;
+			unsigned long long read_errors;
+			unsigned long long write_errors;
+			/** Most input reports that were ever queued at once */
+			unsigned long long queue_high_water;
+			/** How long hid_write() took to complete */
+			struct hid_latency_histogram write_latency;
+			/** Time from a report arriving to it being read */
+			struct hid_latency_histogram consume_latency;
+		};
+
+		/** @brief Get a snapshot of a device's counters.
+
+			The backend updates the counters with atomic adds as it
+			goes, and this reads them the same way, so neither side
+			takes a lock. The snapshot is not a single point in time:
+			counters may be a report apart from each other.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param metrics Receives the counters.
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_get_device_metrics(hid_device *device, struct hid_device_metrics *metrics);
+
+		/** @brief Set all of a device's counters back to zero.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_reset_device_metrics(hid_device *device);
+
+		/** @brief The smallest latency, in nanoseconds, that falls into a
+			bucket of a hid_latency_histogram.
+
+			@ingroup API
+			@param bucket A bucket index.
+		*/
+		unsigned long long HID_API_EXPORT HID_API_CALL hid_latency_bucket_lower_bound(int bucket);
+
+		/** @brief The bucket of a hid_latency_histogram that a latency,
+			in nanoseconds, falls into.
+
+			@ingroup API
+			@param ns A latency in nanoseconds.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_latency_bucket(unsigned long long ns);
+
+		/** @brief Have hid_get_feature_report() answer from memory
+			for a while after it has read a report.
+
+			Reports are cached per report ID. A cached report is
+			thrown away when its time-to-live runs out, when a
+			report with the same ID is sent with
+			hid_send_feature_report() on the same handle, and by
+			hid_invalidate_feature_report_cache(). Other handles to
+			the same device, and the device itself, can still change
+			a report without the cache knowing, so only cache
+			reports that you know change that way.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param ttl_ms How long a report stays cached, in
+				milliseconds. 0 turns the cache off and empties it;
+				a negative value keeps reports until they're
+				invalidated.
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_set_feature_report_cache(hid_device *device, int ttl_ms);
+
+		/** @brief Throw away cached feature reports.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param report_id The report ID to forget, or -1 for all
+				of them.
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_invalidate_feature_report_cache(hid_device *device, int report_id);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,134 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Arena allocator for hid_enumerate() results, shared by the
+ Mac and Windows backends. Include this after hidapi.h.
+
+ Every hid_device_info node and all of its strings are carved
+ out of one growing arena, so an enumeration costs a handful
+ of mallocs instead of five per device, and
+ hid_free_enumeration() frees it all in one go.
+
+ The root node is always the first allocation in the first
+ block, which is how hid_free_enumeration() finds the arena
+ again from the list it was handed.
+********************************************************/
+
+#ifndef HIDAPI_ENUM_ARENA_H__
+#define HIDAPI_ENUM_ARENA_H__
+
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+/* Size of the first block. Big enough for a typical scan of a
+   dozen devices; later blocks double in size. */
+#define ENUM_ARENA_FIRST_BLOCK 4096
+
+struct enum_arena_block {
+	struct enum_arena_block *next;
+	size_t capacity;
+	size_t used;
+};
+
+/* Offset of the first allocation in a block, keeping it aligned
+   for anything hid_device_info holds. */
+#define ENUM_ARENA_HEADER ((sizeof(struct enum_arena_block) + 15) & ~(size_t) 15)
+
+struct enum_arena {
+	struct enum_arena_block *first;
+	struct enum_arena_block *current;
+};
+
+static void enum_arena_init(struct enum_arena *arena)
+{
+	arena->first = NULL;
+	arena->current = NULL;
+}
+
+static void enum_arena_free_blocks(struct enum_arena_block *block)
+{
+	while (block) {
+		struct enum_arena_block *next = block->next;
+		free(block);
+		block = next;
+	}
+}
+
+static void *enum_arena_alloc(struct enum_arena *arena, size_t size, size_t align)
+{
+	struct enum_arena_block *block = arena->current;
+	size_t offset = 0;
+
+	if (block) {
+		offset = (block->used + align - 1) & ~(align - 1);
+	}
+
+	if (!block || offset + size > block->capacity) {
+		size_t capacity = block ? block->capacity * 2 : ENUM_ARENA_FIRST_BLOCK;
+		if (capacity < size)
+			capacity = size;
+
+		block = (struct enum_arena_block *) malloc(ENUM_ARENA_HEADER + capacity);
+		if (!block)
+			return NULL;
+
+		block->next = NULL;
+		block->capacity = capacity;
+		block->used = 0;
+		offset = 0;
+
+		if (arena->current)
+			arena->current->next = block;
+		else
+			arena->first = block;
+		arena->current = block;
+	}
+
+	block->used = offset + size;
+	return (char *) block + ENUM_ARENA_HEADER + offset;
+}
+
+static struct hid_device_info *enum_arena_new_info(struct enum_arena *arena)
+{
+	struct hid_device_info *info = (struct hid_device_info *)
+		enum_arena_alloc(arena, sizeof(struct hid_device_info), sizeof(void *));
+
+	if (info)
+		memset(info, 0, sizeof(struct hid_device_info));
+
+	return info;
+}
+
+static char *enum_arena_strdup(struct enum_arena *arena, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *ret = (char *) enum_arena_alloc(arena, len, 1);
+
+	if (ret)
+		memcpy(ret, s, len);
+
+	return ret;
+}
+
+static wchar_t *enum_arena_wcsdup(struct enum_arena *arena, const wchar_t *s)
+{
+	size_t len = (wcslen(s) + 1) * sizeof(wchar_t);
+	wchar_t *ret = (wchar_t *) enum_arena_alloc(arena, len, sizeof(wchar_t));
+
+	if (ret)
+		memcpy(ret, s, len);
+
+	return ret;
+}
+
+/* Frees the arena behind a list returned by hid_enumerate().
+   devs must be the root of that list. */
+static void enum_arena_free_list(struct hid_device_info *devs)
+{
+	if (devs)
+		enum_arena_free_blocks((struct enum_arena_block *) ((char *) devs - ENUM_ARENA_HEADER));
+}
+
+#endif
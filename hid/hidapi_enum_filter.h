@@ -0,0 +1,52 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Enumeration filter helpers, shared by the Mac and Windows
+ backends. Include this after hidapi.h.
+
+ The checks are split by what they need, so each backend
+ can run them as soon as the property they look at is
+ available and skip the rest of the work for devices that
+ don't match.
+********************************************************/
+
+#ifndef HIDAPI_ENUM_FILTER_H__
+#define HIDAPI_ENUM_FILTER_H__
+
+#include <string.h>
+
+static int filter_matches_ids(const struct hid_enumerate_filter *filter, unsigned short vendor_id, unsigned short product_id)
+{
+	return (filter->vendor_id == 0x0 || filter->vendor_id == vendor_id) &&
+	       (filter->product_id == 0x0 || filter->product_id == product_id);
+}
+
+static int filter_matches_usage(const struct hid_enumerate_filter *filter, unsigned short usage_page, unsigned short usage)
+{
+	return (filter->usage_page == 0x0 || filter->usage_page == usage_page) &&
+	       (filter->usage == 0x0 || filter->usage == usage);
+}
+
+static int filter_matches_interface(const struct hid_enumerate_filter *filter, int interface_number)
+{
+	return !filter->match_interface_number || filter->interface_number == interface_number;
+}
+
+static int filter_matches_path(const struct hid_enumerate_filter *filter, const char *path)
+{
+	if (!filter->path_prefix)
+		return 1;
+	if (!path)
+		return 0;
+	return strncmp(path, filter->path_prefix, strlen(filter->path_prefix)) == 0;
+}
+
+/* Runs the user's predicate on a record that has everything
+   but the strings filled in. */
+static int filter_accepts(const struct hid_enumerate_filter *filter, const struct hid_device_info *info)
+{
+	return !filter->predicate || filter->predicate(info, filter->context);
+}
+
+#endif
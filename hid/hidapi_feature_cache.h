@@ -0,0 +1,219 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Per-device cache of feature reports read with
+ hid_get_feature_report(), shared by the backends. Include
+ this after hidapi.h. See hid_set_feature_report_cache().
+
+ Each report ID has a slot holding the last report read
+ and when it was read. Slots are guarded by a spin lock
+ that is only held to copy a report in or out, never
+ during a transfer or a heap call. Every invalidation bumps the slot's
+ generation, so a read that was already under way when a
+ report was sent can't put the old report back.
+********************************************************/
+
+#ifndef HIDAPI_FEATURE_CACHE_H__
+#define HIDAPI_FEATURE_CACHE_H__
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+static void feature_cache_lock(volatile long *lock)
+{
+	while (InterlockedExchange(lock, 1) != 0)
+		YieldProcessor();
+}
+
+static void feature_cache_unlock(volatile long *lock)
+{
+	InterlockedExchange(lock, 0);
+}
+
+static long feature_cache_is_enabled(volatile long *enabled)
+{
+	return InterlockedCompareExchange(enabled, 0, 0);
+}
+#else
+static void feature_cache_lock(volatile long *lock)
+{
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE) != 0)
+		while (__atomic_load_n(lock, __ATOMIC_RELAXED) != 0)
+			;
+}
+
+static void feature_cache_unlock(volatile long *lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+static long feature_cache_is_enabled(volatile long *enabled)
+{
+	return __atomic_load_n(enabled, __ATOMIC_RELAXED);
+}
+#endif
+
+#define FEATURE_CACHE_SLOTS 256
+
+struct feature_cache_slot {
+	unsigned char *data;
+	size_t capacity;
+	/* The length that was asked for, and what the device returned;
+	   0 if nothing is cached */
+	size_t requested;
+	int length;
+	unsigned long long read_time;
+	unsigned int generation;
+};
+
+struct hid_feature_cache {
+	volatile long lock;
+	volatile long enabled;
+	/* 0 for no expiry */
+	unsigned long long ttl_ns;
+	/* FEATURE_CACHE_SLOTS of them, allocated when the cache is
+	   first enabled and kept until the device is closed */
+	struct feature_cache_slot *slots;
+};
+
+/* Does the transfer when the cache can't answer */
+typedef int (*feature_cache_transfer)(hid_device *dev, unsigned char *data, size_t length);
+
+static int feature_cache_set_ttl(struct hid_feature_cache *cache, int ttl_ms)
+{
+	struct feature_cache_slot *slots = NULL;
+	int needs_slots;
+	int i;
+
+	/* The slots are allocated outside the lock and put in if
+	   nobody beat us to it. */
+	feature_cache_lock(&cache->lock);
+	needs_slots = ttl_ms != 0 && !cache->slots;
+	feature_cache_unlock(&cache->lock);
+
+	if (needs_slots) {
+		slots = (struct feature_cache_slot*) calloc(FEATURE_CACHE_SLOTS, sizeof(struct feature_cache_slot));
+		if (!slots)
+			return -1;
+	}
+
+	feature_cache_lock(&cache->lock);
+	if (slots && !cache->slots) {
+		cache->slots = slots;
+		slots = NULL;
+	}
+	if (cache->slots) {
+		for (i = 0; i < FEATURE_CACHE_SLOTS; i++) {
+			cache->slots[i].length = 0;
+			cache->slots[i].generation++;
+		}
+	}
+	cache->ttl_ns = ttl_ms > 0 ? (unsigned long long) ttl_ms * 1000000ULL : 0;
+	cache->enabled = ttl_ms != 0;
+	feature_cache_unlock(&cache->lock);
+
+	free(slots);
+	return 0;
+}
+
+static int feature_cache_invalidate(struct hid_feature_cache *cache, int report_id)
+{
+	int i;
+
+	if (report_id < -1 || report_id >= FEATURE_CACHE_SLOTS)
+		return -1;
+	if (!feature_cache_is_enabled(&cache->enabled))
+		return 0;
+
+	feature_cache_lock(&cache->lock);
+	for (i = 0; i < FEATURE_CACHE_SLOTS; i++) {
+		if (report_id == -1 || report_id == i) {
+			cache->slots[i].length = 0;
+			cache->slots[i].generation++;
+		}
+	}
+	feature_cache_unlock(&cache->lock);
+	return 0;
+}
+
+/* hid_get_feature_report() through the cache. A cached report
+   answers a request for no more than was asked for when it was
+   read, or for any length if the device returned less than
+   that, i.e. the whole report. */
+static int feature_cache_get_report(struct hid_feature_cache *cache, hid_device *dev,
+                                    unsigned char *data, size_t length,
+                                    unsigned long long now, feature_cache_transfer transfer)
+{
+	struct feature_cache_slot *slot;
+	unsigned int generation;
+	size_t capacity, stored;
+	unsigned char *grown = NULL, *old = NULL;
+	int res;
+
+	if (length == 0 || !feature_cache_is_enabled(&cache->enabled))
+		return transfer(dev, data, length);
+
+	feature_cache_lock(&cache->lock);
+	slot = &cache->slots[data[0]];
+	if (slot->length > 0
+	    && (cache->ttl_ns == 0 || now - slot->read_time < cache->ttl_ns)
+	    && (length <= slot->requested || (size_t) slot->length < slot->requested)) {
+		res = (size_t) slot->length < length ? slot->length : (int) length;
+		memcpy(data, slot->data, (size_t) res);
+		feature_cache_unlock(&cache->lock);
+		return res;
+	}
+	generation = slot->generation;
+	capacity = slot->capacity;
+	feature_cache_unlock(&cache->lock);
+
+	res = transfer(dev, data, length);
+	if (res <= 0)
+		return res;
+
+	/* The Windows backend counts a report ID byte that isn't in
+	   the buffer, so never copy more than length. */
+	stored = (size_t) res < length ? (size_t) res : length;
+
+	/* Bigger storage is allocated before taking the lock and swapped
+	   in under it, so nobody spins while we're in the heap. */
+	if (capacity < stored)
+		grown = (unsigned char*) malloc(stored);
+
+	feature_cache_lock(&cache->lock);
+	if (slot->generation == generation && cache->enabled) {
+		if (grown && slot->capacity < stored) {
+			old = slot->data;
+			slot->data = grown;
+			slot->capacity = stored;
+			grown = NULL;
+		}
+		if (slot->capacity >= stored) {
+			memcpy(slot->data, data, stored);
+			slot->requested = length;
+			slot->length = (int) stored;
+			slot->read_time = now;
+		}
+	}
+	feature_cache_unlock(&cache->lock);
+
+	free(old);
+	free(grown);
+	return res;
+}
+
+static void feature_cache_free(struct hid_feature_cache *cache)
+{
+	int i;
+
+	if (cache->slots) {
+		for (i = 0; i < FEATURE_CACHE_SLOTS; i++)
+			free(cache->slots[i].data);
+		free(cache->slots);
+	}
+	memset(cache, 0, sizeof(*cache));
+}
+
+#endif
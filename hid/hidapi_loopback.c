@@ -0,0 +1,1123 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Loopback backend: simulated devices held in memory, for
+ benchmarks and tests without hardware. See
+ hidapi_loopback.h for how to set devices up.
+
+ Each open handle has an input queue that behaves like the
+ Mac backend's (same depth, overflow policies, metrics and
+ drop callback), except that reports are produced by
+ hid_loopback_send_input() or echoed writes on the calling
+ thread, instead of by an OS run loop.
+********************************************************/
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+	#define _GNU_SOURCE /* For pthread_setname_np() and pthread_setaffinity_np() */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <pthread.h>
+	#include <sched.h>
+	#include <time.h>
+	#include <errno.h>
+#endif
+
+#include "hidapi.h"
+#include "hidapi_loopback.h"
+#include "hidapi_report_pool.h"
+#include "hidapi_enum_arena.h"
+#include "hidapi_enum_filter.h"
+#include "hidapi_thread_options.h"
+#include "hidapi_metrics.h"
+#include "hidapi_feature_cache.h"
+
+#ifdef _WIN32
+	typedef CRITICAL_SECTION loopback_mutex;
+	typedef CONDITION_VARIABLE loopback_cond;
+	#define loopback_mutex_init(m)    InitializeCriticalSection(m)
+	#define loopback_mutex_destroy(m) DeleteCriticalSection(m)
+	#define loopback_mutex_lock(m)    EnterCriticalSection(m)
+	#define loopback_mutex_unlock(m)  LeaveCriticalSection(m)
+	#define loopback_cond_init(c)     InitializeConditionVariable(c)
+	#define loopback_cond_destroy(c)
+	#define loopback_cond_signal(c)   WakeConditionVariable(c)
+	#define loopback_cond_broadcast(c) WakeAllConditionVariable(c)
+#else
+	typedef pthread_mutex_t loopback_mutex;
+	typedef pthread_cond_t loopback_cond;
+	#define loopback_mutex_init(m)    pthread_mutex_init(m, NULL)
+	#define loopback_mutex_destroy(m) pthread_mutex_destroy(m)
+	#define loopback_mutex_lock(m)    pthread_mutex_lock(m)
+	#define loopback_mutex_unlock(m)  pthread_mutex_unlock(m)
+	#define loopback_cond_init(c)     pthread_cond_init(c, NULL)
+	#define loopback_cond_destroy(c)  pthread_cond_destroy(c)
+	#define loopback_cond_signal(c)   pthread_cond_signal(c)
+	#define loopback_cond_broadcast(c) pthread_cond_broadcast(c)
+#endif
+
+#define LOOPBACK_DEFAULT_REPORT_LENGTH 64
+#define LOOPBACK_STRING_LEN 128
+#define LOOPBACK_PATH_LEN 32
+
+unsigned long long HID_API_EXPORT HID_API_CALL hid_get_monotonic_time(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER now;
+	if (frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&now);
+	return (unsigned long long) (now.QuadPart / frequency.QuadPart) * 1000000000ULL
+		+ (unsigned long long) (now.QuadPart % frequency.QuadPart) * 1000000000ULL / (unsigned long long) frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+#endif
+}
+
+/* Waits on cond until deadline (hid_get_monotonic_time(), 0 for
+   none). Returns 0 if woken and 1 on timeout. */
+static int loopback_cond_wait_until(loopback_cond *cond, loopback_mutex *mutex, unsigned long long deadline)
+{
+	unsigned long long now;
+
+	if (deadline == 0) {
+#ifdef _WIN32
+		SleepConditionVariableCS(cond, mutex, INFINITE);
+#else
+		pthread_cond_wait(cond, mutex);
+#endif
+		return 0;
+	}
+
+	now = hid_get_monotonic_time();
+	if (now >= deadline)
+		return 1;
+
+#ifdef _WIN32
+	return SleepConditionVariableCS(cond, mutex, (DWORD) ((deadline - now + 999999) / 1000000)) ? 0 : 1;
+#else
+	{
+		/* pthread_cond_timedwait() wants wall clock time. */
+		struct timespec ts;
+		unsigned long long wait = deadline - now;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += (time_t) (wait / 1000000000ULL);
+		ts.tv_nsec += (long) (wait % 1000000000ULL);
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		return pthread_cond_timedwait(cond, mutex, &ts) == ETIMEDOUT ? 1 : 0;
+	}
+#endif
+}
+
+/* A simulated device. Reference counted: the registry holds
+   one reference while it's plugged in, and every open handle
+   holds another. */
+struct loopback_device {
+	int id;
+	int ref_count; /* Protected by registry_mutex */
+	int removed;
+	char path[LOOPBACK_PATH_LEN];
+	unsigned short vendor_id;
+	unsigned short product_id;
+	unsigned short release_number;
+	unsigned short usage_page;
+	unsigned short usage;
+	int interface_number;
+	wchar_t serial_number[LOOPBACK_STRING_LEN];
+	wchar_t manufacturer_string[LOOPBACK_STRING_LEN];
+	wchar_t product_string[LOOPBACK_STRING_LEN];
+	size_t input_report_length;
+	size_t output_report_length;
+	size_t feature_report_length;
+	int echo_output;
+
+	/* Last feature report sent for each report ID. Protected by
+	   registry_mutex. */
+	unsigned char *features[256];
+	size_t feature_lengths[256];
+	size_t feature_capacities[256];
+
+	struct hid_device_ *handles; /* Open handles. Protected by registry_mutex */
+};
+
+struct hid_device_ {
+	struct loopback_device *sim;
+	struct hid_device_ *next_handle; /* In sim->handles */
+	int blocking;
+	int closing;
+	const wchar_t *last_error;
+
+	loopback_mutex mutex; /* Protects everything below */
+	loopback_cond condition;
+	struct report_pool *report_pool;
+	struct report_slab *input_reports;
+	struct report_slab *input_reports_tail;
+	int num_queued;
+	int queue_depth;
+	int queue_max_depth; /* For HID_OVERFLOW_GROW */
+	int overflow_policy;
+	loopback_cond space_available; /* For HID_OVERFLOW_BLOCK */
+	hid_drop_callback drop_callback;
+	void *drop_context;
+	hid_input_callback input_callback; /* Protected by mutex */
+	void *input_context;
+
+	struct hid_device_metrics metrics;
+	struct hid_feature_cache feature_cache;
+};
+
+static loopback_mutex registry_mutex;
+static int registry_initialized = 0;
+static struct loopback_device **registry = NULL; /* Indexed by id, NULL once removed */
+static int registry_size = 0;
+static int registry_capacity = 0;
+
+static void copy_wide_string(wchar_t *dest, const wchar_t *source, size_t maxlen)
+{
+	if (maxlen == 0)
+		return;
+	if (source)
+		wcsncpy(dest, source, maxlen);
+	else
+		dest[0] = 0;
+	dest[maxlen - 1] = 0;
+}
+
+/* Must be called with registry_mutex held. */
+static void release_sim(struct loopback_device *sim)
+{
+	int i;
+
+	if (--sim->ref_count > 0)
+		return;
+
+	for (i = 0; i < 256; i++)
+		free(sim->features[i]);
+	free(sim);
+}
+
+/* Returns the device with this path, or NULL. Must be called
+   with registry_mutex held. */
+static struct loopback_device *find_sim_by_path(const char *path)
+{
+	int id;
+
+	if (!path || strncmp(path, "loopback:", 9) != 0)
+		return NULL;
+
+	id = atoi(path + 9);
+	if (id < 0 || id >= registry_size)
+		return NULL;
+
+	return registry[id];
+}
+
+int HID_API_EXPORT HID_API_CALL hid_init(void)
+{
+	/* Not thread safe, like the other backends: call it before
+	   using the library from several threads. */
+	if (!registry_initialized) {
+		loopback_mutex_init(&registry_mutex);
+		registry_initialized = 1;
+	}
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_exit(void)
+{
+	/* Simulated devices are set up by the caller, so they outlive
+	   hid_exit(). Use hid_loopback_remove_all() to get rid of them. */
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_loopback_add_device(const struct hid_loopback_device_desc *desc)
+{
+	struct loopback_device *sim;
+	int id;
+
+	if (!desc || hid_init() < 0)
+		return -1;
+
+	sim = (struct loopback_device *) calloc(1, sizeof(struct loopback_device));
+	if (!sim)
+		return -1;
+
+	sim->ref_count = 1;
+	sim->vendor_id = desc->vendor_id;
+	sim->product_id = desc->product_id;
+	sim->release_number = desc->release_number;
+	sim->usage_page = desc->usage_page;
+	sim->usage = desc->usage;
+	sim->interface_number = desc->interface_number;
+	copy_wide_string(sim->serial_number, desc->serial_number, LOOPBACK_STRING_LEN);
+	copy_wide_string(sim->manufacturer_string, desc->manufacturer_string, LOOPBACK_STRING_LEN);
+	copy_wide_string(sim->product_string, desc->product_string, LOOPBACK_STRING_LEN);
+	sim->input_report_length = desc->input_report_length ? desc->input_report_length : LOOPBACK_DEFAULT_REPORT_LENGTH;
+	sim->output_report_length = desc->output_report_length ? desc->output_report_length : LOOPBACK_DEFAULT_REPORT_LENGTH;
+	sim->feature_report_length = desc->feature_report_length ? desc->feature_report_length : LOOPBACK_DEFAULT_REPORT_LENGTH;
+	sim->echo_output = desc->echo_output;
+
+	loopback_mutex_lock(&registry_mutex);
+	if (registry_size == registry_capacity) {
+		int capacity = registry_capacity ? registry_capacity * 2 : 16;
+		struct loopback_device **grown = (struct loopback_device **) realloc(registry, (size_t) capacity * sizeof(*registry));
+		if (!grown) {
+			loopback_mutex_unlock(&registry_mutex);
+			free(sim);
+			return -1;
+		}
+		registry = grown;
+		registry_capacity = capacity;
+	}
+	id = registry_size++;
+	sim->id = id;
+	snprintf(sim->path, LOOPBACK_PATH_LEN, "loopback:%d", id);
+	registry[id] = sim;
+	loopback_mutex_unlock(&registry_mutex);
+
+	return id;
+}
+
+/* Must be called with registry_mutex held. */
+static int remove_sim(int id)
+{
+	struct loopback_device *sim;
+	struct hid_device_ *dev;
+
+	if (id < 0 || id >= registry_size || !registry[id])
+		return -1;
+
+	sim = registry[id];
+	registry[id] = NULL;
+	sim->removed = 1;
+
+	/* Wake up anything waiting on the open handles, so it sees
+	   the device has gone. */
+	for (dev = sim->handles; dev; dev = dev->next_handle) {
+		loopback_mutex_lock(&dev->mutex);
+		loopback_cond_broadcast(&dev->condition);
+		loopback_cond_broadcast(&dev->space_available);
+		if (dev->input_callback)
+			dev->input_callback(dev, dev->input_context);
+		loopback_mutex_unlock(&dev->mutex);
+	}
+
+	release_sim(sim);
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_loopback_remove_device(int id)
+{
+	int res;
+
+	if (hid_init() < 0)
+		return -1;
+
+	loopback_mutex_lock(&registry_mutex);
+	res = remove_sim(id);
+	loopback_mutex_unlock(&registry_mutex);
+
+	return res;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_loopback_remove_all(void)
+{
+	int i;
+
+	if (hid_init() < 0)
+		return;
+
+	loopback_mutex_lock(&registry_mutex);
+	for (i = 0; i < registry_size; i++)
+		remove_sim(i);
+
+	/* Start the ids from 0 again, so that enumerating doesn't have
+	   to skip over every device there has ever been. */
+	registry_size = 0;
+	loopback_mutex_unlock(&registry_mutex);
+}
+
+/* Throws away the oldest queued report. Must be called with
+   dev->mutex held. */
+static void drop_oldest(hid_device *dev)
+{
+	struct report_slab *rpt = dev->input_reports;
+	dev->input_reports = rpt->next;
+	dev->num_queued--;
+	report_slab_release(rpt);
+	metrics_add(&dev->metrics.reports_dropped, 1);
+}
+
+/* Tells the drop callback, if there is one, that reports were
+   dropped. Must be called without dev->mutex held. */
+static void notify_dropped(hid_device *dev)
+{
+	hid_drop_callback callback;
+	void *context;
+
+	loopback_mutex_lock(&dev->mutex);
+	callback = dev->drop_callback;
+	context = dev->drop_context;
+	loopback_mutex_unlock(&dev->mutex);
+
+	if (callback)
+		callback(dev, metrics_load(&dev->metrics.reports_dropped), context);
+}
+
+/* Queues an input report on one handle. This is what the Mac
+   backend's report callback does, with the calling thread in
+   the place of the run loop. */
+static void queue_input(hid_device *dev, const unsigned char *data, size_t length)
+{
+	struct report_slab *rpt;
+	int limit, dropped = 0;
+
+	metrics_add(&dev->metrics.reports_received, 1);
+
+	rpt = report_pool_acquire(dev->report_pool);
+	if (!rpt) {
+		metrics_add(&dev->metrics.reports_dropped, 1);
+		notify_dropped(dev);
+		return;
+	}
+
+	if (length > dev->report_pool->slab_size)
+		length = dev->report_pool->slab_size;
+	memcpy(rpt->storage, data, length);
+	rpt->report.report_id = length > 0 ? data[0] : 0;
+	rpt->report.length = length;
+	if (length > 0 && data[0] == 0x0) {
+		/* Like the real backends, leave out the report ID of
+		   devices that don't use numbered reports. */
+		rpt->report.data++;
+		rpt->report.length--;
+	}
+	rpt->report.timestamp = hid_get_monotonic_time();
+
+	loopback_mutex_lock(&dev->mutex);
+
+	if (dev->num_queued >= dev->queue_depth) {
+		if (dev->overflow_policy == HID_OVERFLOW_BLOCK) {
+			/* Hold up the sender until there's room. */
+			while (dev->num_queued >= dev->queue_depth && !dev->closing && !dev->sim->removed
+			       && dev->overflow_policy == HID_OVERFLOW_BLOCK)
+				loopback_cond_wait_until(&dev->space_available, &dev->mutex, 0);
+		}
+		if (dev->closing || dev->sim->removed || (dev->overflow_policy == HID_OVERFLOW_DROP_NEWEST
+		                                          && dev->num_queued >= dev->queue_depth)) {
+			int counted = !dev->closing && !dev->sim->removed;
+			loopback_mutex_unlock(&dev->mutex);
+			report_slab_release(rpt);
+			if (counted) {
+				metrics_add(&dev->metrics.reports_dropped, 1);
+				notify_dropped(dev);
+			}
+			return;
+		}
+	}
+
+	if (dev->input_reports == NULL)
+		dev->input_reports = rpt;
+	else
+		dev->input_reports_tail->next = rpt;
+	dev->input_reports_tail = rpt;
+	dev->num_queued++;
+	metrics_max(&dev->metrics.queue_high_water, (unsigned long long) dev->num_queued);
+
+	limit = dev->overflow_policy == HID_OVERFLOW_GROW ? dev->queue_max_depth : dev->queue_depth;
+	while (dev->num_queued > limit) {
+		drop_oldest(dev);
+		dropped = 1;
+	}
+
+	loopback_cond_signal(&dev->condition);
+	if (dev->input_callback)
+		dev->input_callback(dev, dev->input_context);
+	loopback_mutex_unlock(&dev->mutex);
+
+	if (dropped)
+		notify_dropped(dev);
+}
+
+/* Queues a report on every open handle of a device. Returns
+   how many there were. Must be called with registry_mutex held. */
+static int broadcast_input(struct loopback_device *sim, const unsigned char *data, size_t length)
+{
+	struct hid_device_ *dev;
+	int count = 0;
+
+	for (dev = sim->handles; dev; dev = dev->next_handle) {
+		queue_input(dev, data, length);
+		count++;
+	}
+	return count;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_loopback_send_input(int id, const unsigned char *data, size_t length)
+{
+	int count;
+
+	if (hid_init() < 0)
+		return -1;
+
+	loopback_mutex_lock(&registry_mutex);
+	if (id < 0 || id >= registry_size || !registry[id]) {
+		loopback_mutex_unlock(&registry_mutex);
+		return -1;
+	}
+	count = broadcast_input(registry[id], data, length);
+	loopback_mutex_unlock(&registry_mutex);
+
+	return count;
+}
+
+struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate_filtered(const struct hid_enumerate_filter *filter)
+{
+	struct hid_device_info *root = NULL;
+	struct hid_device_info *cur_dev = NULL;
+	struct enum_arena arena;
+	struct hid_enumerate_filter match_all;
+	int i;
+
+	if (!filter) {
+		memset(&match_all, 0, sizeof(match_all));
+		filter = &match_all;
+	}
+
+	if (hid_init() < 0)
+		return NULL;
+
+	enum_arena_init(&arena);
+
+	loopback_mutex_lock(&registry_mutex);
+	for (i = 0; i < registry_size; i++) {
+		struct loopback_device *sim = registry[i];
+		struct hid_device_info candidate;
+		struct hid_device_info *tmp;
+
+		if (!sim)
+			continue;
+
+		/* Same order as the real backends: cheap checks first. */
+		if (!filter_matches_ids(filter, sim->vendor_id, sim->product_id) ||
+		    !filter_matches_usage(filter, sim->usage_page, sim->usage) ||
+		    !filter_matches_interface(filter, sim->interface_number) ||
+		    !filter_matches_path(filter, sim->path))
+			continue;
+
+		memset(&candidate, 0, sizeof(candidate));
+		candidate.path = sim->path;
+		candidate.vendor_id = sim->vendor_id;
+		candidate.product_id = sim->product_id;
+		candidate.release_number = sim->release_number;
+		candidate.usage_page = sim->usage_page;
+		candidate.usage = sim->usage;
+		candidate.interface_number = sim->interface_number;
+		if (!filter_accepts(filter, &candidate))
+			continue;
+
+		tmp = enum_arena_new_info(&arena);
+		if (!tmp)
+			break;
+		if (cur_dev)
+			cur_dev->next = tmp;
+		else
+			root = tmp;
+		cur_dev = tmp;
+
+		*cur_dev = candidate;
+		cur_dev->next = NULL;
+		cur_dev->path = enum_arena_strdup(&arena, sim->path);
+
+		if (filter->skip_strings)
+			continue;
+
+		cur_dev->serial_number = enum_arena_wcsdup(&arena, sim->serial_number);
+		cur_dev->manufacturer_string = enum_arena_wcsdup(&arena, sim->manufacturer_string);
+		cur_dev->product_string = enum_arena_wcsdup(&arena, sim->product_string);
+	}
+	loopback_mutex_unlock(&registry_mutex);
+
+	return root;
+}
+
+struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	struct hid_enumerate_filter filter;
+	memset(&filter, 0, sizeof(filter));
+	filter.vendor_id = vendor_id;
+	filter.product_id = product_id;
+
+	return hid_enumerate_filtered(&filter);
+}
+
+void HID_API_EXPORT HID_API_CALL hid_free_enumeration(struct hid_device_info *devs)
+{
+	enum_arena_free_list(devs);
+}
+
+int HID_API_EXPORT_CALL hid_get_strings_by_path(const char *path, wchar_t *serial_number, wchar_t *manufacturer_string, wchar_t *product_string, size_t maxlen)
+{
+	struct loopback_device *sim;
+
+	if (hid_init() < 0)
+		return -1;
+
+	loopback_mutex_lock(&registry_mutex);
+	sim = find_sim_by_path(path);
+	if (sim) {
+		if (serial_number)
+			copy_wide_string(serial_number, sim->serial_number, maxlen);
+		if (manufacturer_string)
+			copy_wide_string(manufacturer_string, sim->manufacturer_string, maxlen);
+		if (product_string)
+			copy_wide_string(product_string, sim->product_string, maxlen);
+	}
+	loopback_mutex_unlock(&registry_mutex);
+
+	return sim ? 0 : -1;
+}
+
+hid_device * HID_API_EXPORT HID_API_CALL hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
+{
+	/* This function is identical to the Linux version. Platform independent. */
+	struct hid_device_info *devs, *cur_dev;
+	const char *path_to_open = NULL;
+	hid_device * handle = NULL;
+
+	devs = hid_enumerate(vendor_id, product_id);
+	cur_dev = devs;
+	while (cur_dev) {
+		if (cur_dev->vendor_id == vendor_id &&
+		    cur_dev->product_id == product_id) {
+			if (serial_number) {
+				if (wcscmp(serial_number, cur_dev->serial_number) == 0) {
+					path_to_open = cur_dev->path;
+					break;
+				}
+			}
+			else {
+				path_to_open = cur_dev->path;
+				break;
+			}
+		}
+		cur_dev = cur_dev->next;
+	}
+
+	if (path_to_open) {
+		/* Open the device */
+		handle = hid_open_path(path_to_open);
+	}
+
+	hid_free_enumeration(devs);
+
+	return handle;
+}
+
+hid_device * HID_API_EXPORT HID_API_CALL hid_open_path(const char *path)
+{
+	struct loopback_device *sim;
+	hid_device *dev;
+
+	if (hid_init() < 0)
+		return NULL;
+
+	dev = (hid_device *) calloc(1, sizeof(hid_device));
+	if (!dev)
+		return NULL;
+
+	loopback_mutex_lock(&registry_mutex);
+	sim = find_sim_by_path(path);
+	if (sim)
+		dev->report_pool = report_pool_create(sim->input_report_length);
+	if (!sim || !dev->report_pool) {
+		loopback_mutex_unlock(&registry_mutex);
+		free(dev);
+		return NULL;
+	}
+
+	dev->sim = sim;
+	dev->blocking = 1;
+	dev->last_error = NULL;
+	dev->queue_depth = 32;
+	dev->queue_max_depth = 32;
+	dev->overflow_policy = HID_OVERFLOW_DROP_OLDEST;
+	loopback_mutex_init(&dev->mutex);
+	loopback_cond_init(&dev->condition);
+	loopback_cond_init(&dev->space_available);
+
+	sim->ref_count++;
+	dev->next_handle = sim->handles;
+	sim->handles = dev;
+	loopback_mutex_unlock(&registry_mutex);
+
+	return dev;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_close(hid_device *dev)
+{
+	struct hid_device_ **link;
+	struct report_slab *rpt;
+
+	if (!dev)
+		return;
+
+	/* Wake up a sender blocked on a full queue. */
+	loopback_mutex_lock(&dev->mutex);
+	dev->closing = 1;
+	loopback_cond_broadcast(&dev->space_available);
+	loopback_cond_broadcast(&dev->condition);
+	loopback_mutex_unlock(&dev->mutex);
+
+	loopback_mutex_lock(&registry_mutex);
+	for (link = &dev->sim->handles; *link; link = &(*link)->next_handle) {
+		if (*link == dev) {
+			*link = dev->next_handle;
+			break;
+		}
+	}
+	release_sim(dev->sim);
+	loopback_mutex_unlock(&registry_mutex);
+
+	/* Give any input reports still left over back to the pool. */
+	rpt = dev->input_reports;
+	while (rpt) {
+		struct report_slab *next = rpt->next;
+		report_slab_release(rpt);
+		rpt = next;
+	}
+	report_pool_destroy(dev->report_pool);
+	feature_cache_free(&dev->feature_cache);
+
+	loopback_cond_destroy(&dev->space_available);
+	loopback_cond_destroy(&dev->condition);
+	loopback_mutex_destroy(&dev->mutex);
+	free(dev);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_write(hid_device *dev, const unsigned char *data, size_t length)
+{
+	unsigned long long start = hid_get_monotonic_time();
+	int res = (int) length;
+
+	loopback_mutex_lock(&registry_mutex);
+	if (dev->sim->removed) {
+		dev->last_error = L"The device has been unplugged";
+		res = -1;
+	}
+	else if (dev->sim->echo_output) {
+		broadcast_input(dev->sim, data, length);
+	}
+	loopback_mutex_unlock(&registry_mutex);
+
+	metrics_report_written(&dev->metrics, res, start);
+	return res;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_write_many(hid_device *dev, const struct hid_output_report *reports, size_t count, int *results)
+{
+	size_t i;
+
+	/* One trip through the registry lock for the whole batch. */
+	loopback_mutex_lock(&registry_mutex);
+	for (i = 0; i < count; i++) {
+		unsigned long long start = hid_get_monotonic_time();
+		int res = (int) reports[i].length;
+
+		if (dev->sim->removed) {
+			dev->last_error = L"The device has been unplugged";
+			res = -1;
+		}
+		else if (dev->sim->echo_output) {
+			broadcast_input(dev->sim, reports[i].data, reports[i].length);
+		}
+
+		metrics_report_written(&dev->metrics, res, start);
+		if (results)
+			results[i] = res;
+		if (res < 0)
+			break;
+	}
+	loopback_mutex_unlock(&registry_mutex);
+
+	if (results && i < count) {
+		size_t j;
+		for (j = i + 1; j < count; j++)
+			results[j] = 0;
+	}
+
+	return (int) i;
+}
+
+/* Waits until a report is queued. Must be called with dev->mutex
+   held. Returns 1 if there is a report to return, 0 on timeout or
+   in non-blocking mode, and -1 if the device has gone. */
+static int wait_for_report(hid_device *dev, int milliseconds)
+{
+	unsigned long long deadline = 0;
+
+	if (milliseconds > 0)
+		deadline = hid_get_monotonic_time() + (unsigned long long) milliseconds * 1000000ULL;
+
+	while (!dev->input_reports) {
+		if (dev->sim->removed || dev->closing) {
+			dev->last_error = L"The device has been unplugged";
+			return -1;
+		}
+		if (milliseconds == 0)
+			return 0;
+		if (loopback_cond_wait_until(&dev->condition, &dev->mutex, deadline) && !dev->input_reports)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Unlinks the first queued report. Must be called with dev->mutex
+   held and a report queued. */
+static struct report_slab *take_report(hid_device *dev)
+{
+	struct report_slab *rpt = dev->input_reports;
+	dev->input_reports = rpt->next;
+	dev->num_queued--;
+	rpt->next = NULL;
+	loopback_cond_signal(&dev->space_available);
+	metrics_report_read(&dev->metrics, &rpt->report);
+	return rpt;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	struct report_slab *rpt;
+	size_t len;
+	int res;
+
+	loopback_mutex_lock(&dev->mutex);
+	res = wait_for_report(dev, milliseconds);
+	if (res <= 0) {
+		if (res < 0)
+			metrics_add(&dev->metrics.read_errors, 1);
+		loopback_mutex_unlock(&dev->mutex);
+		return res;
+	}
+	rpt = take_report(dev);
+	loopback_mutex_unlock(&dev->mutex);
+
+	len = length < rpt->report.length ? length : rpt->report.length;
+	if (len)
+		memcpy(data, rpt->report.data, len);
+	report_slab_release(rpt);
+
+	return (int) len;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_read_report_timeout(hid_device *dev, struct hid_report **report, int milliseconds)
+{
+	int res;
+
+	*report = NULL;
+
+	loopback_mutex_lock(&dev->mutex);
+	res = wait_for_report(dev, milliseconds);
+	if (res > 0) {
+		*report = &take_report(dev)->report;
+		res = (int) (*report)->length;
+	}
+	else if (res < 0) {
+		metrics_add(&dev->metrics.read_errors, 1);
+	}
+	loopback_mutex_unlock(&dev->mutex);
+
+	return res;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_read(hid_device *dev, unsigned char *data, size_t length)
+{
+	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_nonblocking(hid_device *dev, int nonblock)
+{
+	dev->blocking = !nonblock;
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
+{
+	struct loopback_device *sim = dev->sim;
+	unsigned char report_id;
+	int res = (int) length;
+
+	if (length == 0)
+		return -1;
+	report_id = data[0];
+
+	loopback_mutex_lock(&registry_mutex);
+	if (sim->removed) {
+		dev->last_error = L"The device has been unplugged";
+		res = -1;
+	}
+	else {
+		/* The buffer is only reallocated if the report grows, so
+		   sending the same report again doesn't allocate. */
+		if (sim->feature_capacities[report_id] < length) {
+			unsigned char *grown = (unsigned char *) realloc(sim->features[report_id], length);
+			if (grown) {
+				sim->features[report_id] = grown;
+				sim->feature_capacities[report_id] = length;
+			}
+			else {
+				dev->last_error = L"Out of memory";
+				res = -1;
+			}
+		}
+		if (res >= 0) {
+			memcpy(sim->features[report_id], data, length);
+			sim->feature_lengths[report_id] = length;
+		}
+	}
+	loopback_mutex_unlock(&registry_mutex);
+
+	feature_cache_invalidate(&dev->feature_cache, report_id);
+	return res;
+}
+
+static int get_feature_report(hid_device *dev, unsigned char *data, size_t length)
+{
+	struct loopback_device *sim = dev->sim;
+	unsigned char report_id;
+	size_t len;
+	int res;
+
+	if (length == 0)
+		return -1;
+	report_id = data[0];
+
+	loopback_mutex_lock(&registry_mutex);
+	if (sim->removed) {
+		dev->last_error = L"The device has been unplugged";
+		res = -1;
+	}
+	else if (sim->features[report_id]) {
+		/* Read back what was last sent. */
+		len = length < sim->feature_lengths[report_id] ? length : sim->feature_lengths[report_id];
+		memcpy(data, sim->features[report_id], len);
+		res = (int) len;
+	}
+	else {
+		/* Nothing sent yet: a zeroed report of the full length. */
+		len = length < sim->feature_report_length ? length : sim->feature_report_length;
+		memset(data + 1, 0, len - 1);
+		res = (int) len;
+	}
+	loopback_mutex_unlock(&registry_mutex);
+
+	return res;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_feature_report(hid_device *dev, unsigned char *data, size_t length)
+{
+	return feature_cache_get_report(&dev->feature_cache, dev, data, length,
+	                                hid_get_monotonic_time(), get_feature_report);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_feature_report_cache(hid_device *dev, int ttl_ms)
+{
+	return feature_cache_set_ttl(&dev->feature_cache, ttl_ms);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_invalidate_feature_report_cache(hid_device *dev, int report_id)
+{
+	return feature_cache_invalidate(&dev->feature_cache, report_id);
+}
+
+int HID_API_EXPORT_CALL hid_get_manufacturer_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+	copy_wide_string(string, dev->sim->manufacturer_string, maxlen);
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_product_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+	copy_wide_string(string, dev->sim->product_string, maxlen);
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_serial_number_string(hid_device *dev, wchar_t *string, size_t maxlen)
+{
+	copy_wide_string(string, dev->sim->serial_number, maxlen);
+	return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index, wchar_t *string, size_t maxlen)
+{
+	/* Indices as on a typical USB device: 1 manufacturer,
+	   2 product, 3 serial number. */
+	switch (string_index) {
+		case 1: copy_wide_string(string, dev->sim->manufacturer_string, maxlen); return 0;
+		case 2: copy_wide_string(string, dev->sim->product_string, maxlen); return 0;
+		case 3: copy_wide_string(string, dev->sim->serial_number, maxlen); return 0;
+		default: break;
+	}
+
+	dev->last_error = L"No such string";
+	return -1;
+}
+
+int HID_API_EXPORT_CALL hid_get_max_report_lengths(hid_device *dev, size_t *input, size_t *output, size_t *feature)
+{
+	if (input)
+		*input = dev->sim->input_report_length;
+	if (output)
+		*output = dev->sim->output_report_length;
+	if (feature)
+		*feature = dev->sim->feature_report_length;
+	return 0;
+}
+
+HID_API_EXPORT const wchar_t * HID_API_CALL hid_error(hid_device *dev)
+{
+	return dev ? dev->last_error : NULL;
+}
+
+/* Applies settings to the calling thread. */
+static int apply_thread_settings(const struct thread_settings *settings)
+{
+	int ret = 0;
+
+#ifdef _WIN32
+	if (settings->policy != HID_THREAD_POLICY_DEFAULT) {
+		int priority = settings->priority >= 90 ? THREAD_PRIORITY_TIME_CRITICAL
+		             : settings->priority >= 50 ? THREAD_PRIORITY_HIGHEST
+		             : THREAD_PRIORITY_ABOVE_NORMAL;
+		if (!SetThreadPriority(GetCurrentThread(), priority))
+			ret = -1;
+	}
+	if (settings->affinity_mask) {
+		if (!SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) settings->affinity_mask))
+			ret = -1;
+	}
+#else
+	if (settings->policy != HID_THREAD_POLICY_DEFAULT) {
+		struct sched_param param;
+		int policy = settings->policy == HID_THREAD_POLICY_FIFO ? SCHED_FIFO : SCHED_RR;
+		param.sched_priority = thread_settings_scale_priority(settings->priority,
+			sched_get_priority_min(policy), sched_get_priority_max(policy));
+		if (pthread_setschedparam(pthread_self(), policy, &param) != 0)
+			ret = -1;
+	}
+
+  #ifdef __linux__
+	if (settings->name[0]) {
+		/* Linux limits thread names to 15 characters. */
+		char name[16];
+		strncpy(name, settings->name, sizeof(name) - 1);
+		name[sizeof(name) - 1] = 0;
+		pthread_setname_np(pthread_self(), name);
+	}
+
+	if (settings->affinity_mask) {
+		cpu_set_t cpus;
+		int cpu;
+		CPU_ZERO(&cpus);
+		for (cpu = 0; cpu < 64 && cpu < CPU_SETSIZE; cpu++) {
+			if (settings->affinity_mask & (1ULL << cpu))
+				CPU_SET(cpu, &cpus);
+		}
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+			ret = -1;
+	}
+  #endif
+#endif
+
+	return ret;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_thread_options(hid_device *dev, const struct hid_thread_options *options)
+{
+	/* Reports are produced on the sender's thread; there's no
+	   reader thread to configure. */
+	(void) options;
+	dev->last_error = L"The loopback backend has no reader thread";
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_current_thread_options(const struct hid_thread_options *options)
+{
+	struct thread_settings settings;
+	thread_settings_from_options(&settings, options);
+	return apply_thread_settings(&settings);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_thread_stats(hid_device *dev, struct hid_thread_stats *stats)
+{
+	(void) dev;
+	memset(stats, 0, sizeof(*stats));
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_input_queue(hid_device *dev, int depth, int policy, int max_depth)
+{
+	if (depth < 1 || policy < HID_OVERFLOW_DROP_OLDEST || policy > HID_OVERFLOW_GROW)
+		return -1;
+	if (policy == HID_OVERFLOW_GROW && max_depth < depth)
+		return -1;
+
+	loopback_mutex_lock(&dev->mutex);
+	dev->queue_depth = depth;
+	dev->queue_max_depth = policy == HID_OVERFLOW_GROW ? max_depth : depth;
+	dev->overflow_policy = policy;
+
+	if (policy == HID_OVERFLOW_DROP_OLDEST || policy == HID_OVERFLOW_GROW) {
+		while (dev->num_queued > dev->queue_max_depth)
+			drop_oldest(dev);
+	}
+	loopback_cond_broadcast(&dev->space_available);
+	loopback_mutex_unlock(&dev->mutex);
+
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_drop_callback(hid_device *dev, hid_drop_callback callback, void *context)
+{
+	loopback_mutex_lock(&dev->mutex);
+	dev->drop_callback = callback;
+	dev->drop_context = context;
+	loopback_mutex_unlock(&dev->mutex);
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_input_callback(hid_device *dev, hid_input_callback callback, void *context)
+{
+	/* Taking the mutex waits out a call that's in progress. */
+	loopback_mutex_lock(&dev->mutex);
+	dev->input_callback = callback;
+	dev->input_context = context;
+	loopback_mutex_unlock(&dev->mutex);
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_device_metrics(hid_device *dev, struct hid_device_metrics *metrics)
+{
+	metrics_snapshot(&dev->metrics, metrics);
+	return 0;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_reset_device_metrics(hid_device *dev)
+{
+	metrics_reset(&dev->metrics);
+}
@@ -0,0 +1,97 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Control functions of the loopback backend
+ (hidapi_loopback.c), which simulates devices in memory
+ instead of talking to the OS. It builds anywhere with
+ pthreads or Win32, so benchmarks and tests can run without
+ hardware, Linux included.
+
+ A simulated device shows up in hid_enumerate() with the
+ path "loopback:<id>" and can be opened any number of
+ times. Input reports given to hid_loopback_send_input()
+ are queued on every open handle, output reports can be
+ echoed back as input reports, and feature reports are
+ stored per report ID and read back.
+********************************************************/
+
+#ifndef HIDAPI_LOOPBACK_H__
+#define HIDAPI_LOOPBACK_H__
+
+#include <wchar.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+		/** Describes a simulated device. Zero-initialise it and set
+			only the fields you care about. */
+		struct hid_loopback_device_desc {
+			unsigned short vendor_id;
+			unsigned short product_id;
+			unsigned short release_number;
+			unsigned short usage_page;
+			unsigned short usage;
+			int interface_number;
+			/** Any of these may be NULL for an empty string */
+			const wchar_t *serial_number;
+			const wchar_t *manufacturer_string;
+			const wchar_t *product_string;
+			/** Largest reports, including the report ID byte.
+			    0 is taken as 64. */
+			size_t input_report_length;
+			size_t output_report_length;
+			size_t feature_report_length;
+			/** If non-zero, every report written with hid_write()
+			    is queued back as an input report on all of the
+			    device's open handles. */
+			int echo_output;
+		};
+
+		/** @brief Add a simulated device.
+
+			@ingroup API
+			@param desc The device.
+			@returns
+				The new device's id (0 or more), or -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_loopback_add_device(const struct hid_loopback_device_desc *desc);
+
+		/** @brief Unplug a simulated device.
+
+			Its open handles stay valid, but reads and writes on
+			them fail from now on, like with a real device that's
+			been unplugged.
+
+			@ingroup API
+			@param id An id from hid_loopback_add_device().
+			@returns
+				This function returns 0 on success and -1 if there's
+				no such device.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_loopback_remove_device(int id);
+
+		/** @brief Unplug every simulated device.
+
+			Ids start from 0 again afterwards.
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_loopback_remove_all(void);
+
+		/** @brief Have a simulated device send an input report.
+
+			@ingroup API
+			@param id An id from hid_loopback_add_device().
+			@param data The report, starting with the report ID
+				(0 for devices without numbered reports).
+			@param length The length of data.
+			@returns
+				The number of open handles the report was queued
+				on, or -1 if there's no such device.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_loopback_send_input(int id, const unsigned char *data, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
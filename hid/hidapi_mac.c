@@ -28,8 +28,18 @@
 #include <sys/time.h>
 #include <unistd.h>
 #include <dlfcn.h>
+#include <mach/mach_time.h>
+#include <mach/thread_act.h>
+#include <mach/thread_policy.h>
+#include <sched.h>
 
 #include "hidapi.h"
+#include "hidapi_report_pool.h"
+#include "hidapi_enum_arena.h"
+#include "hidapi_enum_filter.h"
+#include "hidapi_thread_options.h"
+#include "hidapi_metrics.h"
+#include "hidapi_feature_cache.h"
 
 /* Barrier implementation because Mac OSX doesn't have pthread_barrier.
    It also doesn't have clock_gettime(). So much for POSIX and SUSv2.
@@ -89,14 +99,8 @@ static int pthread_barrier_wait(pthread_barrier_t *barrier)
 	}
 }
 
-static int return_data(hid_device *dev, unsigned char *data, size_t length);
-
-/* Linked List of input reports received from the device. */
-struct input_report {
-	uint8_t *data;
-	size_t len;
-	struct input_report *next;
-};
+static void drop_oldest(hid_device *dev);
+static void notify_dropped(hid_device *dev);
 
 struct hid_device_ {
 	IOHIDDeviceRef device_handle;
@@ -108,14 +112,39 @@ struct hid_device_ {
 	CFRunLoopSourceRef source;
 	uint8_t *input_report_buf;
 	CFIndex max_input_report_len;
-	struct input_report *input_reports;
+	/* Read along with max_input_report_len when the device is opened */
+	size_t max_output_report_len;
+	size_t max_feature_report_len;
+	struct report_pool *report_pool;
+	struct report_slab *input_reports; /* Linked list of received reports. */
+	struct report_slab *input_reports_tail; /* Last of input_reports, if there are any */
+	int num_queued; /* Length of input_reports */
+	int queue_depth;
+	int queue_max_depth; /* For HID_OVERFLOW_GROW */
+	int overflow_policy;
+	pthread_cond_t space_available; /* For HID_OVERFLOW_BLOCK */
+	hid_drop_callback drop_callback;
+	void *drop_context;
 
 	pthread_t thread;
 	pthread_mutex_t mutex; /* Protects input_reports */
 	pthread_cond_t condition;
+	hid_input_callback input_callback; /* Protected by mutex */
+	void *input_context;
 	pthread_barrier_t barrier; /* Ensures correct startup sequence */
 	pthread_barrier_t shutdown_barrier; /* Ensures correct shutdown sequence */
 	int shutdown_thread;
+
+	/* Reader thread scheduling. thread_settings and thread_stats
+	   are protected by mutex. */
+	struct thread_settings thread_settings;
+	CFRunLoopSourceRef settings_source; /* Signaled to re-apply thread_settings */
+	CFRunLoopTimerRef probe_timer;
+	unsigned long long probe_expected; /* When probe_timer should fire next */
+	struct hid_thread_stats thread_stats;
+
+	struct hid_device_metrics metrics;
+	struct hid_feature_cache feature_cache;
 };
 
 static hid_device *new_hid_device(void)
@@ -129,12 +158,29 @@ static hid_device *new_hid_device(void)
 	dev->run_loop = NULL;
 	dev->source = NULL;
 	dev->input_report_buf = NULL;
+	dev->max_input_report_len = 0;
+	dev->max_output_report_len = 0;
+	dev->max_feature_report_len = 0;
+	dev->report_pool = NULL;
 	dev->input_reports = NULL;
+	dev->input_reports_tail = NULL;
+	dev->num_queued = 0;
+	dev->queue_depth = 32;
+	dev->queue_max_depth = 32;
+	dev->overflow_policy = HID_OVERFLOW_DROP_OLDEST;
+	dev->drop_callback = NULL;
+	dev->drop_context = NULL;
 	dev->shutdown_thread = 0;
+	dev->input_callback = NULL;
+	dev->input_context = NULL;
+	dev->thread_settings = default_thread_settings;
+	dev->settings_source = NULL;
+	dev->probe_timer = NULL;
 
 	/* Thread objects */
 	pthread_mutex_init(&dev->mutex, NULL);
 	pthread_cond_init(&dev->condition, NULL);
+	pthread_cond_init(&dev->space_available, NULL);
 	pthread_barrier_init(&dev->barrier, NULL, 2);
 	pthread_barrier_init(&dev->shutdown_barrier, NULL, 2);
 
@@ -146,14 +192,15 @@ static void free_hid_device(hid_device *dev)
 	if (!dev)
 		return;
 
-	/* Delete any input reports still left over. */
-	struct input_report *rpt = dev->input_reports;
+	/* Give any input reports still left over back to the pool. */
+	struct report_slab *rpt = dev->input_reports;
 	while (rpt) {
-		struct input_report *next = rpt->next;
-		free(rpt->data);
-		free(rpt);
+		struct report_slab *next = rpt->next;
+		report_slab_release(rpt);
 		rpt = next;
 	}
+	report_pool_destroy(dev->report_pool);
+	feature_cache_free(&dev->feature_cache);
 
 	/* Free the string and the report buffer. The check for NULL
 	   is necessary here as CFRelease() doesn't handle NULL like
@@ -162,12 +209,15 @@ static void free_hid_device(hid_device *dev)
 		CFRelease(dev->run_loop_mode);
 	if (dev->source)
 		CFRelease(dev->source);
+	if (dev->settings_source)
+		CFRelease(dev->settings_source);
 	free(dev->input_report_buf);
 
 	/* Clean up the thread objects */
 	pthread_barrier_destroy(&dev->shutdown_barrier);
 	pthread_barrier_destroy(&dev->barrier);
 	pthread_cond_destroy(&dev->condition);
+	pthread_cond_destroy(&dev->space_available);
 	pthread_mutex_destroy(&dev->mutex);
 
 	/* Free the structure itself. */
@@ -273,16 +323,6 @@ static int get_product_string(IOHIDDeviceRef device, wchar_t *buf, size_t len)
 }
 
 
-/* Implementation of wcsdup() for Mac. */
-static wchar_t *dup_wcs(const wchar_t *s)
-{
-	size_t len = wcslen(s);
-	wchar_t *ret = (wchar_t *) malloc((len+1)*sizeof(wchar_t));
-	wcscpy(ret, s);
-
-	return ret;
-}
-
 /* hidapi_IOHIDDeviceGetService()
  *
  * Return the io_service_t corresponding to a given IOHIDDeviceRef, either by:
@@ -379,6 +419,15 @@ int HID_API_EXPORT hid_exit(void)
 	return 0;
 }
 
+unsigned long long HID_API_EXPORT hid_get_monotonic_time(void)
+{
+	static mach_timebase_info_data_t timebase;
+	if (timebase.denom == 0)
+		mach_timebase_info(&timebase);
+
+	return (unsigned long long) mach_absolute_time() * timebase.numer / timebase.denom;
+}
+
 static void process_pending_events(void) {
 	SInt32 res;
 	do {
@@ -386,17 +435,26 @@ static void process_pending_events(void) {
 	} while(res != kCFRunLoopRunFinished && res != kCFRunLoopRunTimedOut);
 }
 
-struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_filtered(const struct hid_enumerate_filter *filter)
 {
 	struct hid_device_info *root = NULL; /* return object */
 	struct hid_device_info *cur_dev = NULL;
+	struct enum_arena arena; /* owns root, every node and every string */
+	struct hid_enumerate_filter match_all;
 	CFIndex num_devices;
 	int i;
 
+	if (!filter) {
+		memset(&match_all, 0, sizeof(match_all));
+		filter = &match_all;
+	}
+
 	/* Set up the HID Manager if it hasn't been done */
 	if (hid_init() < 0)
 		return NULL;
 
+	enum_arena_init(&arena);
+
 	/* give the IOHIDManager a chance to update itself */
 	process_pending_events();
 
@@ -411,8 +469,11 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 
 	/* Iterate over each device, making an entry for it. */
 	for (i = 0; i < num_devices; i++) {
-		unsigned short dev_vid;
-		unsigned short dev_pid;
+		struct hid_device_info candidate;
+		struct hid_device_info *tmp;
+		io_object_t iokit_dev;
+		kern_return_t res;
+		io_string_t path;
 		#define BUF_LEN 256
 		wchar_t buf[BUF_LEN];
 
@@ -421,62 +482,68 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
         if (!dev) {
             continue;
         }
-		dev_vid = get_vendor_id(dev);
-		dev_pid = get_product_id(dev);
-
-		/* Check the VID/PID against the arguments */
-		if ((vendor_id == 0x0 || vendor_id == dev_vid) &&
-		    (product_id == 0x0 || product_id == dev_pid)) {
-			struct hid_device_info *tmp;
-			io_object_t iokit_dev;
-			kern_return_t res;
-			io_string_t path;
-
-			/* VID/PID match. Create the record. */
-			tmp = (struct hid_device_info *) malloc(sizeof(struct hid_device_info));
-			if (cur_dev) {
-				cur_dev->next = tmp;
-			}
-			else {
-				root = tmp;
-			}
-			cur_dev = tmp;
-
-			/* Get the Usage Page and Usage for this device. */
-			cur_dev->usage_page = (unsigned short) get_int_property(dev, CFSTR(kIOHIDPrimaryUsagePageKey));
-			cur_dev->usage = (unsigned short) get_int_property(dev, CFSTR(kIOHIDPrimaryUsageKey));
-
-			/* Fill out the record */
-			cur_dev->next = NULL;
-
-			/* Fill in the path (IOService plane) */
-			iokit_dev = hidapi_IOHIDDeviceGetService(dev);
-			res = IORegistryEntryGetPath(iokit_dev, kIOServicePlane, path);
-			if (res == KERN_SUCCESS)
-				cur_dev->path = strdup(path);
-			else
-				cur_dev->path = strdup("");
-
-			/* Serial Number */
-			get_serial_number(dev, buf, BUF_LEN);
-			cur_dev->serial_number = dup_wcs(buf);
-
-			/* Manufacturer and Product strings */
-			get_manufacturer_string(dev, buf, BUF_LEN);
-			cur_dev->manufacturer_string = dup_wcs(buf);
-			get_product_string(dev, buf, BUF_LEN);
-			cur_dev->product_string = dup_wcs(buf);
-
-			/* VID/PID */
-			cur_dev->vendor_id = dev_vid;
-			cur_dev->product_id = dev_pid;
-
-			/* Release Number */
-			cur_dev->release_number = (unsigned short) get_int_property(dev, CFSTR(kIOHIDVersionNumberKey));
-
-			/* Interface Number (Unsupported on Mac)*/
-			cur_dev->interface_number = -1;
+
+		/* Check the cheap integer properties against the filter first,
+		   then the path, and only build a record for devices that pass. */
+		memset(&candidate, 0, sizeof(candidate));
+		candidate.vendor_id = get_vendor_id(dev);
+		candidate.product_id = get_product_id(dev);
+		if (!filter_matches_ids(filter, candidate.vendor_id, candidate.product_id))
+			continue;
+
+		/* Get the Usage Page and Usage for this device. */
+		candidate.usage_page = (unsigned short) get_int_property(dev, CFSTR(kIOHIDPrimaryUsagePageKey));
+		candidate.usage = (unsigned short) get_int_property(dev, CFSTR(kIOHIDPrimaryUsageKey));
+		if (!filter_matches_usage(filter, candidate.usage_page, candidate.usage))
+			continue;
+
+		/* Interface Number (Unsupported on Mac)*/
+		candidate.interface_number = -1;
+		if (!filter_matches_interface(filter, candidate.interface_number))
+			continue;
+
+		/* Fill in the path (IOService plane) */
+		iokit_dev = hidapi_IOHIDDeviceGetService(dev);
+		res = IORegistryEntryGetPath(iokit_dev, kIOServicePlane, path);
+		candidate.path = (res == KERN_SUCCESS) ? path : (char *) "";
+		if (!filter_matches_path(filter, candidate.path))
+			continue;
+
+		/* Release Number */
+		candidate.release_number = (unsigned short) get_int_property(dev, CFSTR(kIOHIDVersionNumberKey));
+
+		if (!filter_accepts(filter, &candidate))
+			continue;
+
+		/* Match. Create the record. */
+		tmp = enum_arena_new_info(&arena);
+		if (!tmp)
+			break;
+		if (cur_dev) {
+			cur_dev->next = tmp;
 		}
+		else {
+			root = tmp;
+		}
+		cur_dev = tmp;
+
+		/* Fill out the record */
+		*cur_dev = candidate;
+		cur_dev->next = NULL;
+		cur_dev->path = enum_arena_strdup(&arena, candidate.path);
+
+		if (filter->skip_strings)
+			continue;
+
+		/* Serial Number */
+		get_serial_number(dev, buf, BUF_LEN);
+		cur_dev->serial_number = enum_arena_wcsdup(&arena, buf);
+
+		/* Manufacturer and Product strings */
+		get_manufacturer_string(dev, buf, BUF_LEN);
+		cur_dev->manufacturer_string = enum_arena_wcsdup(&arena, buf);
+		get_product_string(dev, buf, BUF_LEN);
+		cur_dev->product_string = enum_arena_wcsdup(&arena, buf);
 	}
 
 	free(device_array);
@@ -485,19 +552,47 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 	return root;
 }
 
+int HID_API_EXPORT_CALL hid_get_strings_by_path(const char *path, wchar_t *serial_number, wchar_t *manufacturer_string, wchar_t *product_string, size_t maxlen)
+{
+	io_registry_entry_t entry;
+	IOHIDDeviceRef device;
+
+	/* The properties live on the registry entry, so an IOHIDDevice
+	   that is never opened is enough to read them. */
+	entry = IORegistryEntryFromPath(kIOMasterPortDefault, path);
+	if (entry == MACH_PORT_NULL)
+		return -1;
+
+	device = IOHIDDeviceCreate(kCFAllocatorDefault, entry);
+	IOObjectRelease(entry);
+	if (device == NULL)
+		return -1;
+
+	if (serial_number)
+		get_serial_number(device, serial_number, maxlen);
+	if (manufacturer_string)
+		get_manufacturer_string(device, manufacturer_string, maxlen);
+	if (product_string)
+		get_product_string(device, product_string, maxlen);
+
+	CFRelease(device);
+	return 0;
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	struct hid_enumerate_filter filter;
+	memset(&filter, 0, sizeof(filter));
+	filter.vendor_id = vendor_id;
+	filter.product_id = product_id;
+
+	return hid_enumerate_filtered(&filter);
+}
+
 void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
 {
-	/* This function is identical to the Linux version. Platform independent. */
-	struct hid_device_info *d = devs;
-	while (d) {
-		struct hid_device_info *next = d->next;
-		free(d->path);
-		free(d->serial_number);
-		free(d->manufacturer_string);
-		free(d->product_string);
-		free(d);
-		d = next;
-	}
+	/* The whole list lives in one arena. */
+	enum_arena_free_list(devs);
 }
 
 hid_device * HID_API_EXPORT hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
@@ -553,48 +648,176 @@ static void hid_report_callback(void *context, IOReturn result, void *sender,
                          IOHIDReportType report_type, uint32_t report_id,
                          uint8_t *report, CFIndex report_length)
 {
-	struct input_report *rpt;
+	struct report_slab *rpt;
 	hid_device *dev = (hid_device *) context;
+	size_t len = (size_t) report_length;
+	int limit, dropped = 0;
 
-	/* Make a new Input Report object */
-	rpt = (struct input_report *) calloc(1, sizeof(struct input_report));
-	rpt->data = (uint8_t *) calloc(1, (size_t) report_length);
-	memcpy(rpt->data, report, (size_t) report_length);
-	rpt->len = (size_t) report_length;
-	rpt->next = NULL;
+	/* Copy the report into a pooled buffer. This is the only copy
+	   it gets until the user reads it. */
+	metrics_add(&dev->metrics.reports_received, 1);
+
+	rpt = report_pool_acquire(dev->report_pool);
+	if (!rpt) {
+		metrics_add(&dev->metrics.reports_dropped, 1);
+		notify_dropped(dev);
+		return;
+	}
+	if (len > dev->report_pool->slab_size)
+		len = dev->report_pool->slab_size;
+	memcpy(rpt->storage, report, len);
+	rpt->report.length = len;
+	rpt->report.report_id = (unsigned char) report_id;
+	rpt->report.timestamp = hid_get_monotonic_time();
 
 	/* Lock this section */
 	pthread_mutex_lock(&dev->mutex);
 
-	/* Attach the new report object to the end of the list. */
+	if (dev->num_queued >= dev->queue_depth) {
+		if (dev->overflow_policy == HID_OVERFLOW_BLOCK) {
+			/* Hold up the run loop until there's room. */
+			while (dev->num_queued >= dev->queue_depth && !dev->shutdown_thread
+			       && dev->overflow_policy == HID_OVERFLOW_BLOCK)
+				pthread_cond_wait(&dev->space_available, &dev->mutex);
+		}
+		if (dev->shutdown_thread || (dev->overflow_policy == HID_OVERFLOW_DROP_NEWEST
+		                             && dev->num_queued >= dev->queue_depth)) {
+			pthread_mutex_unlock(&dev->mutex);
+			report_slab_release(rpt);
+			if (!dev->shutdown_thread) {
+				metrics_add(&dev->metrics.reports_dropped, 1);
+				notify_dropped(dev);
+			}
+			return;
+		}
+	}
+
+	/* Attach the new report object to the end of the list. The
+	   tail is kept so a long (HID_OVERFLOW_GROW) queue doesn't have
+	   to be walked. */
 	if (dev->input_reports == NULL) {
 		/* The list is empty. Put it at the root. */
 		dev->input_reports = rpt;
 	}
 	else {
-		/* Find the end of the list and attach. */
-		struct input_report *cur = dev->input_reports;
-		int num_queued = 0;
-		while (cur->next != NULL) {
-			cur = cur->next;
-			num_queued++;
-		}
-		cur->next = rpt;
-
-		/* Pop one off if we've reached 30 in the queue. This
-		   way we don't grow forever if the user never reads
-		   anything from the device. */
-		if (num_queued > 30) {
-			return_data(dev, NULL, 0);
-		}
+		dev->input_reports_tail->next = rpt;
+	}
+	dev->input_reports_tail = rpt;
+	dev->num_queued++;
+	metrics_max(&dev->metrics.queue_high_water, (unsigned long long) dev->num_queued);
+
+	/* Pop the oldest off if we've gone past the limit. This
+	   way we don't grow forever if the user never reads
+	   anything from the device. */
+	limit = dev->overflow_policy == HID_OVERFLOW_GROW ? dev->queue_max_depth : dev->queue_depth;
+	while (dev->num_queued > limit) {
+		drop_oldest(dev);
+		dropped = 1;
 	}
 
 	/* Signal a waiting thread that there is data. */
 	pthread_cond_signal(&dev->condition);
+	if (dev->input_callback)
+		dev->input_callback(dev, dev->input_context);
 
 	/* Unlock */
 	pthread_mutex_unlock(&dev->mutex);
 
+	if (dropped)
+		notify_dropped(dev);
+}
+
+/* Applies settings to the calling thread. */
+static int apply_thread_settings(const struct thread_settings *settings)
+{
+	int ret = 0;
+
+	if (settings->name[0])
+		pthread_setname_np(settings->name);
+
+	if (settings->policy != HID_THREAD_POLICY_DEFAULT) {
+		struct sched_param param;
+		int policy = settings->policy == HID_THREAD_POLICY_FIFO ? SCHED_FIFO : SCHED_RR;
+		param.sched_priority = thread_settings_scale_priority(settings->priority,
+			sched_get_priority_min(policy), sched_get_priority_max(policy));
+		if (pthread_setschedparam(pthread_self(), policy, &param) != 0)
+			ret = -1;
+	}
+
+	if (settings->affinity_mask) {
+		/* There's no hard CPU pinning on macOS. Threads sharing an
+		   affinity tag are kept on CPUs that share a cache, so use
+		   the lowest allowed CPU as the tag. */
+		thread_affinity_policy_data_t policy;
+		integer_t tag = 1;
+		while (!(settings->affinity_mask & (1ULL << (tag - 1))))
+			tag++;
+		policy.affinity_tag = tag;
+		if (thread_policy_set(pthread_mach_thread_np(pthread_self()), THREAD_AFFINITY_POLICY,
+			(thread_policy_t) &policy, THREAD_AFFINITY_POLICY_COUNT) != KERN_SUCCESS)
+			ret = -1;
+	}
+
+	return ret;
+}
+
+/* Fires every latency_probe_ms on the read thread. How late it fires
+   is how long the scheduler kept the thread waiting. */
+static void probe_timer_callback(CFRunLoopTimerRef timer, void *context)
+{
+	hid_device *dev = (hid_device *) context;
+	unsigned long long now = hid_get_monotonic_time();
+	unsigned long long interval;
+
+	pthread_mutex_lock(&dev->mutex);
+	interval = (unsigned long long) dev->thread_settings.latency_probe_ms * 1000000ULL;
+	thread_stats_add_sample(&dev->thread_stats, now > dev->probe_expected ? now - dev->probe_expected : 0);
+	pthread_mutex_unlock(&dev->mutex);
+
+	/* Skip the periods we slept through. */
+	while (interval && dev->probe_expected <= now)
+		dev->probe_expected += interval;
+}
+
+static void stop_latency_probe(hid_device *dev)
+{
+	if (dev->probe_timer) {
+		CFRunLoopTimerInvalidate(dev->probe_timer);
+		CFRelease(dev->probe_timer);
+		dev->probe_timer = NULL;
+	}
+}
+
+static void start_latency_probe(hid_device *dev, int interval_ms)
+{
+	CFRunLoopTimerContext ctx;
+	CFTimeInterval interval = interval_ms / 1000.0;
+
+	stop_latency_probe(dev);
+	if (interval_ms <= 0)
+		return;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.info = dev;
+	dev->probe_expected = hid_get_monotonic_time() + (unsigned long long) interval_ms * 1000000ULL;
+	dev->probe_timer = CFRunLoopTimerCreate(kCFAllocatorDefault,
+		CFAbsoluteTimeGetCurrent() + interval, interval, 0, 0, &probe_timer_callback, &ctx);
+	CFRunLoopAddTimer(CFRunLoopGetCurrent(), dev->probe_timer, dev->run_loop_mode);
+}
+
+/* This gets called on the read thread when hid_set_thread_options()
+   signals settings_source. */
+static void settings_signal_callback(void *context)
+{
+	hid_device *dev = (hid_device *) context;
+	struct thread_settings settings;
+
+	pthread_mutex_lock(&dev->mutex);
+	settings = dev->thread_settings;
+	pthread_mutex_unlock(&dev->mutex);
+
+	apply_thread_settings(&settings);
+	start_latency_probe(dev, settings.latency_probe_ms);
 }
 
 /* This gets called when the read_thread's run loop gets signaled by
@@ -610,6 +833,8 @@ static void *read_thread(void *param)
 	hid_device *dev = (hid_device *) param;
 	SInt32 code;
 
+	apply_thread_settings(&dev->thread_settings);
+
 	/* Move the device's run loop to this thread. */
 	IOHIDDeviceScheduleWithRunLoop(dev->device_handle, CFRunLoopGetCurrent(), dev->run_loop_mode);
 
@@ -623,6 +848,14 @@ static void *read_thread(void *param)
 	dev->source = CFRunLoopSourceCreate(kCFAllocatorDefault, 0/*order*/, &ctx);
 	CFRunLoopAddSource(CFRunLoopGetCurrent(), dev->source, dev->run_loop_mode);
 
+	/* And the one hid_set_thread_options() uses to get new settings
+	   applied on this thread. */
+	ctx.perform = &settings_signal_callback;
+	dev->settings_source = CFRunLoopSourceCreate(kCFAllocatorDefault, 0/*order*/, &ctx);
+	CFRunLoopAddSource(CFRunLoopGetCurrent(), dev->settings_source, dev->run_loop_mode);
+
+	start_latency_probe(dev, dev->thread_settings.latency_probe_ms);
+
 	/* Store off the Run Loop so it can be stopped from hid_close()
 	   and on device disconnection. */
 	dev->run_loop = CFRunLoopGetCurrent();
@@ -659,8 +892,12 @@ static void *read_thread(void *param)
 	   signaled. */
 	pthread_mutex_lock(&dev->mutex);
 	pthread_cond_broadcast(&dev->condition);
+	if (dev->input_callback)
+		dev->input_callback(dev, dev->input_context);
 	pthread_mutex_unlock(&dev->mutex);
 
+	stop_latency_probe(dev);
+
 	/* Wait here until hid_close() is called and makes it past
 	   the call to CFRunLoopWakeUp(). This thread still needs to
 	   be valid when that function is called on the other thread. */
@@ -722,7 +959,17 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 
 		/* Create the buffers for receiving data */
 		dev->max_input_report_len = (CFIndex) get_max_report_length(dev->device_handle);
+		dev->max_output_report_len = (size_t) get_int_property(dev->device_handle, CFSTR(kIOHIDMaxOutputReportSizeKey));
+		dev->max_feature_report_len = (size_t) get_int_property(dev->device_handle, CFSTR(kIOHIDMaxFeatureReportSizeKey));
 		dev->input_report_buf = (uint8_t *) calloc((size_t) dev->max_input_report_len, sizeof(uint8_t));
+		dev->report_pool = report_pool_create((size_t) dev->max_input_report_len);
+		if (!dev->report_pool) {
+			IOHIDDeviceClose(dev->device_handle, kIOHIDOptionsTypeSeizeDevice);
+			CFRelease(dev->device_handle);
+			IOObjectRelease(entry);
+			free_hid_device(dev);
+			return NULL;
+		}
 
 		/* Create the Run Loop Mode for this device.
 		   printing the reference seems to work. */
@@ -810,23 +1057,96 @@ static int set_report(hid_device *dev, IOHIDReportType type, const unsigned char
 
 int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length)
 {
-	return set_report(dev, kIOHIDReportTypeOutput, data, length);
+	unsigned long long start = hid_get_monotonic_time();
+	int res = set_report(dev, kIOHIDReportTypeOutput, data, length);
+	metrics_report_written(&dev->metrics, res, start);
+	return res;
+}
+
+/* IOHIDDeviceSetReport() blocks until the transfer is done, so
+   there is nothing to overlap; this just saves the caller a call
+   per report. */
+int HID_API_EXPORT hid_write_many(hid_device *dev, const struct hid_output_report *reports, size_t count, int *results)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		unsigned long long start = hid_get_monotonic_time();
+		int res = set_report(dev, kIOHIDReportTypeOutput, reports[i].data, reports[i].length);
+		metrics_report_written(&dev->metrics, res, start);
+		if (results)
+			results[i] = res;
+		if (res < 0)
+			break;
+	}
+
+	if (results && i < count) {
+		size_t j;
+		for (j = i + 1; j < count; j++)
+			results[j] = 0;
+	}
+
+	return (int) i;
 }
 
 /* Helper function, so that this isn't duplicated in hid_read(). */
 static int return_data(hid_device *dev, unsigned char *data, size_t length)
 {
 	/* Copy the data out of the linked list item (rpt) into the
-	   return buffer (data), and delete the liked list item. */
-	struct input_report *rpt = dev->input_reports;
-	size_t len = (length < rpt->len)? length: rpt->len;
-	memcpy(data, rpt->data, len);
+	   return buffer (data), and give the item back to the pool. */
+	struct report_slab *rpt = dev->input_reports;
+	size_t len = (length < rpt->report.length)? length: rpt->report.length;
+	if (len)
+		memcpy(data, rpt->report.data, len);
 	dev->input_reports = rpt->next;
-	free(rpt->data);
-	free(rpt);
+	dev->num_queued--;
+	pthread_cond_signal(&dev->space_available);
+	metrics_report_read(&dev->metrics, &rpt->report);
+	report_slab_release(rpt);
 	return (int) len;
 }
 
+/* Unlinks the first queued report and hands it to the caller, who
+   now owns the reference the queue held. */
+static int return_report(hid_device *dev, struct hid_report **report)
+{
+	struct report_slab *rpt = dev->input_reports;
+	dev->input_reports = rpt->next;
+	dev->num_queued--;
+	pthread_cond_signal(&dev->space_available);
+	rpt->next = NULL;
+	*report = &rpt->report;
+	metrics_report_read(&dev->metrics, *report);
+	return (int) rpt->report.length;
+}
+
+/* Throws away the oldest queued report. Must be called with
+   dev->mutex held. */
+static void drop_oldest(hid_device *dev)
+{
+	struct report_slab *rpt = dev->input_reports;
+	dev->input_reports = rpt->next;
+	dev->num_queued--;
+	report_slab_release(rpt);
+	metrics_add(&dev->metrics.reports_dropped, 1);
+}
+
+/* Tells the drop callback, if there is one, that reports were
+   dropped. Must be called without dev->mutex held. */
+static void notify_dropped(hid_device *dev)
+{
+	hid_drop_callback callback;
+	void *context;
+
+	pthread_mutex_lock(&dev->mutex);
+	callback = dev->drop_callback;
+	context = dev->drop_context;
+	pthread_mutex_unlock(&dev->mutex);
+
+	if (callback)
+		callback(dev, metrics_load(&dev->metrics.reports_dropped), context);
+}
+
 static int cond_wait(const hid_device *dev, pthread_cond_t *cond, pthread_mutex_t *mutex)
 {
 	while (!dev->input_reports) {
@@ -868,32 +1188,24 @@ static int cond_timedwait(const hid_device *dev, pthread_cond_t *cond, pthread_m
 
 }
 
-int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+/* Waits until a report is queued. Must be called with dev->mutex held.
+   Returns 1 if there is a report to return, 0 on timeout or in
+   non-blocking mode, and -1 on error or disconnection. */
+static int wait_for_report(hid_device *dev, int milliseconds)
 {
-	int bytes_read = -1;
-
-	/* Lock the access to the report list. */
-	pthread_mutex_lock(&dev->mutex);
-
 	/* There's an input report queued up. Return it. */
-	if (dev->input_reports) {
-		/* Return the first one */
-		bytes_read = return_data(dev, data, length);
-		goto ret;
-	}
+	if (dev->input_reports)
+		return 1;
 
 	/* Return if the device has been disconnected. */
-	if (dev->disconnected) {
-		bytes_read = -1;
-		goto ret;
-	}
+	if (dev->disconnected)
+		return -1;
 
 	if (dev->shutdown_thread) {
 		/* This means the device has been closed (or there
 		   has been an error. An error code of -1 should
 		   be returned. */
-		bytes_read = -1;
-		goto ret;
+		return -1;
 	}
 
 	/* There is no data. Go to sleep and wait for data. */
@@ -903,10 +1215,10 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 		int res;
 		res = cond_wait(dev, &dev->condition, &dev->mutex);
 		if (res == 0)
-			bytes_read = return_data(dev, data, length);
+			return 1;
 		else {
 			/* There was an error, or a device disconnection. */
-			bytes_read = -1;
+			return -1;
 		}
 	}
 	else if (milliseconds > 0) {
@@ -925,23 +1237,65 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 
 		res = cond_timedwait(dev, &dev->condition, &dev->mutex, &ts);
 		if (res == 0)
-			bytes_read = return_data(dev, data, length);
+			return 1;
 		else if (res == ETIMEDOUT)
-			bytes_read = 0;
+			return 0;
 		else
-			bytes_read = -1;
-	}
-	else {
-		/* Purely non-blocking */
-		bytes_read = 0;
+			return -1;
 	}
 
-ret:
+	/* Purely non-blocking */
+	return 0;
+}
+
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	int bytes_read;
+
+	/* Lock the access to the report list. */
+	pthread_mutex_lock(&dev->mutex);
+
+	bytes_read = wait_for_report(dev, milliseconds);
+	if (bytes_read > 0)
+		bytes_read = return_data(dev, data, length);
+	else if (bytes_read < 0)
+		metrics_add(&dev->metrics.read_errors, 1);
+
 	/* Unlock */
 	pthread_mutex_unlock(&dev->mutex);
 	return bytes_read;
 }
 
+int HID_API_EXPORT hid_read_report_timeout(hid_device *dev, struct hid_report **report, int milliseconds)
+{
+	int bytes_read;
+
+	*report = NULL;
+
+	/* Lock the access to the report list. */
+	pthread_mutex_lock(&dev->mutex);
+
+	bytes_read = wait_for_report(dev, milliseconds);
+	if (bytes_read > 0)
+		bytes_read = return_report(dev, report);
+	else if (bytes_read < 0)
+		metrics_add(&dev->metrics.read_errors, 1);
+
+	/* Unlock */
+	pthread_mutex_unlock(&dev->mutex);
+	return bytes_read;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_input_callback(hid_device *dev, hid_input_callback callback, void *context)
+{
+	/* Taking the mutex waits out a call that's in progress. */
+	pthread_mutex_lock(&dev->mutex);
+	dev->input_callback = callback;
+	dev->input_context = context;
+	pthread_mutex_unlock(&dev->mutex);
+	return 0;
+}
+
 int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 {
 	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
@@ -957,10 +1311,13 @@ int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 
 int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
 {
-	return set_report(dev, kIOHIDReportTypeFeature, data, length);
+	int res = set_report(dev, kIOHIDReportTypeFeature, data, length);
+	if (length > 0)
+		feature_cache_invalidate(&dev->feature_cache, data[0]);
+	return res;
 }
 
-int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data, size_t length)
+static int get_feature_report(hid_device *dev, unsigned char *data, size_t length)
 {
 	CFIndex len = (CFIndex) length;
 	IOReturn res;
@@ -979,6 +1336,22 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 		return -1;
 }
 
+int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data, size_t length)
+{
+	return feature_cache_get_report(&dev->feature_cache, dev, data, length,
+	                                hid_get_monotonic_time(), get_feature_report);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_feature_report_cache(hid_device *dev, int ttl_ms)
+{
+	return feature_cache_set_ttl(&dev->feature_cache, ttl_ms);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_invalidate_feature_report_cache(hid_device *dev, int report_id)
+{
+	return feature_cache_invalidate(&dev->feature_cache, report_id);
+}
+
 
 void HID_API_EXPORT hid_close(hid_device *dev)
 {
@@ -995,8 +1368,12 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 		IOHIDDeviceScheduleWithRunLoop(dev->device_handle, CFRunLoopGetMain(), kCFRunLoopDefaultMode);
 	}
 
-	/* Cause read_thread() to stop. */
+	/* Cause read_thread() to stop, and wake its report callback
+	   if it's waiting for room in the queue. */
+	pthread_mutex_lock(&dev->mutex);
 	dev->shutdown_thread = 1;
+	pthread_cond_broadcast(&dev->space_available);
+	pthread_mutex_unlock(&dev->mutex);
 
 	/* Wake up the run thread's event loop so that the thread can exit. */
 	CFRunLoopSourceSignal(dev->source);
@@ -1041,6 +1418,95 @@ int HID_API_EXPORT_CALL hid_get_serial_number_string(hid_device *dev, wchar_t *s
 	return get_serial_number(dev->device_handle, string, maxlen);
 }
 
+int HID_API_EXPORT HID_API_CALL hid_set_thread_options(hid_device *dev, const struct hid_thread_options *options)
+{
+	if (dev->disconnected || dev->shutdown_thread)
+		return -1;
+
+	pthread_mutex_lock(&dev->mutex);
+	thread_settings_from_options(&dev->thread_settings, options);
+	pthread_mutex_unlock(&dev->mutex);
+
+	/* Names can only be set from the thread itself, so the settings
+	   are applied by settings_signal_callback() on the read thread. */
+	CFRunLoopSourceSignal(dev->settings_source);
+	CFRunLoopWakeUp(dev->run_loop);
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_current_thread_options(const struct hid_thread_options *options)
+{
+	struct thread_settings settings;
+	thread_settings_from_options(&settings, options);
+	return apply_thread_settings(&settings);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_thread_stats(hid_device *dev, struct hid_thread_stats *stats)
+{
+	pthread_mutex_lock(&dev->mutex);
+	*stats = dev->thread_stats;
+	pthread_mutex_unlock(&dev->mutex);
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_input_queue(hid_device *dev, int depth, int policy, int max_depth)
+{
+	if (depth < 1 || policy < HID_OVERFLOW_DROP_OLDEST || policy > HID_OVERFLOW_GROW)
+		return -1;
+	if (policy == HID_OVERFLOW_GROW && max_depth < depth)
+		return -1;
+
+	pthread_mutex_lock(&dev->mutex);
+	dev->queue_depth = depth;
+	dev->queue_max_depth = policy == HID_OVERFLOW_GROW ? max_depth : depth;
+	dev->overflow_policy = policy;
+
+	/* The blocking and drop-newest policies leave what's already
+	   queued for the reader; a shorter drop-oldest queue is trimmed
+	   right away. */
+	if (policy == HID_OVERFLOW_DROP_OLDEST || policy == HID_OVERFLOW_GROW) {
+		while (dev->num_queued > dev->queue_max_depth)
+			drop_oldest(dev);
+	}
+	pthread_cond_broadcast(&dev->space_available);
+	pthread_mutex_unlock(&dev->mutex);
+
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_drop_callback(hid_device *dev, hid_drop_callback callback, void *context)
+{
+	pthread_mutex_lock(&dev->mutex);
+	dev->drop_callback = callback;
+	dev->drop_context = context;
+	pthread_mutex_unlock(&dev->mutex);
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_device_metrics(hid_device *dev, struct hid_device_metrics *metrics)
+{
+	metrics_snapshot(&dev->metrics, metrics);
+	return 0;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_reset_device_metrics(hid_device *dev)
+{
+	metrics_reset(&dev->metrics);
+}
+
+int HID_API_EXPORT_CALL hid_get_max_report_lengths(hid_device *dev, size_t *input, size_t *output, size_t *feature)
+{
+	/* Read once, in hid_open_path(). */
+	if (input)
+		*input = (size_t) dev->max_input_report_len;
+	if (output)
+		*output = dev->max_output_report_len;
+	if (feature)
+		*feature = dev->max_feature_report_len;
+
+	return 0;
+}
+
 int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index, wchar_t *string, size_t maxlen)
 {
 	/* TODO: */
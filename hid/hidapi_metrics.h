@@ -0,0 +1,162 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Per-device counters, shared by the Mac and Windows
+ backends. Include this after hidapi.h.
+
+ Counters are only ever changed with relaxed atomic
+ operations, from whichever thread does the work, and
+ hid_get_device_metrics() reads them the same way. Nothing
+ on the read or write paths takes a lock for them.
+********************************************************/
+
+#ifndef HIDAPI_METRICS_H__
+#define HIDAPI_METRICS_H__
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <intrin.h>
+
+static void metrics_add(unsigned long long *counter, unsigned long long value)
+{
+	InterlockedExchangeAdd64((volatile LONG64 *) counter, (LONG64) value);
+}
+
+static unsigned long long metrics_load(unsigned long long *counter)
+{
+	return (unsigned long long) InterlockedCompareExchange64((volatile LONG64 *) counter, 0, 0);
+}
+
+static void metrics_store(unsigned long long *counter, unsigned long long value)
+{
+	InterlockedExchange64((volatile LONG64 *) counter, (LONG64) value);
+}
+
+static int metrics_cas(unsigned long long *counter, unsigned long long expected, unsigned long long value)
+{
+	return InterlockedCompareExchange64((volatile LONG64 *) counter, (LONG64) value, (LONG64) expected) == (LONG64) expected;
+}
+
+static int metrics_highest_bit(unsigned long long value)
+{
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return (int) index;
+}
+#else
+static void metrics_add(unsigned long long *counter, unsigned long long value)
+{
+	__atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static unsigned long long metrics_load(unsigned long long *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void metrics_store(unsigned long long *counter, unsigned long long value)
+{
+	__atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+static int metrics_cas(unsigned long long *counter, unsigned long long expected, unsigned long long value)
+{
+	return __atomic_compare_exchange_n(counter, &expected, value, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static int metrics_highest_bit(unsigned long long value)
+{
+	return 63 - __builtin_clzll(value);
+}
+#endif
+
+static void metrics_max(unsigned long long *counter, unsigned long long value)
+{
+	unsigned long long current = metrics_load(counter);
+	while (value > current && !metrics_cas(counter, current, value))
+		current = metrics_load(counter);
+}
+
+/* Four buckets per power of two, see hid_latency_histogram. */
+static int latency_bucket(unsigned long long ns)
+{
+	int bit, bucket;
+
+	if (ns < 4)
+		return (int) ns;
+
+	bit = metrics_highest_bit(ns);
+	bucket = (bit - 1) * 4 + (int) ((ns >> (bit - 2)) & 3);
+	return bucket < HID_LATENCY_HISTOGRAM_BUCKETS ? bucket : HID_LATENCY_HISTOGRAM_BUCKETS - 1;
+}
+
+static void latency_histogram_add(struct hid_latency_histogram *histogram, unsigned long long ns)
+{
+	metrics_add(&histogram->count, 1);
+	metrics_add(&histogram->total_ns, ns);
+	metrics_max(&histogram->max_ns, ns);
+	metrics_add(&histogram->buckets[latency_bucket(ns)], 1);
+}
+
+/* Counts a report handed out by a hid_read function. */
+static void metrics_report_read(struct hid_device_metrics *metrics, const struct hid_report *report)
+{
+	unsigned long long now = hid_get_monotonic_time();
+
+	metrics_add(&metrics->reports_read, 1);
+	metrics_add(&metrics->bytes_read, report->length);
+	latency_histogram_add(&metrics->consume_latency, now > report->timestamp ? now - report->timestamp : 0);
+}
+
+/* Counts a hid_write() that started at start (hid_get_monotonic_time()). */
+static void metrics_report_written(struct hid_device_metrics *metrics, int bytes_written, unsigned long long start)
+{
+	if (bytes_written < 0) {
+		metrics_add(&metrics->write_errors, 1);
+		return;
+	}
+
+	metrics_add(&metrics->reports_written, 1);
+	metrics_add(&metrics->bytes_written, (unsigned long long) bytes_written);
+	latency_histogram_add(&metrics->write_latency, hid_get_monotonic_time() - start);
+}
+
+/* hid_device_metrics is nothing but unsigned long longs, so it's
+   copied and cleared as an array of them. */
+#define METRICS_NUM_COUNTERS (sizeof(struct hid_device_metrics) / sizeof(unsigned long long))
+
+static void metrics_snapshot(struct hid_device_metrics *source, struct hid_device_metrics *dest)
+{
+	unsigned long long *from = (unsigned long long *) source;
+	unsigned long long *to = (unsigned long long *) dest;
+	size_t i;
+
+	for (i = 0; i < METRICS_NUM_COUNTERS; i++)
+		to[i] = metrics_load(&from[i]);
+}
+
+static void metrics_reset(struct hid_device_metrics *metrics)
+{
+	unsigned long long *counters = (unsigned long long *) metrics;
+	size_t i;
+
+	for (i = 0; i < METRICS_NUM_COUNTERS; i++)
+		metrics_store(&counters[i], 0);
+}
+
+unsigned long long HID_API_EXPORT HID_API_CALL hid_latency_bucket_lower_bound(int bucket)
+{
+	if (bucket < 4)
+		return bucket < 0 ? 0 : (unsigned long long) bucket;
+
+	return (unsigned long long) (4 + (bucket & 3)) << (bucket / 4 - 1);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_latency_bucket(unsigned long long ns)
+{
+	return latency_bucket(ns);
+}
+
+#endif
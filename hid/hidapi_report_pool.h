@@ -0,0 +1,208 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Pooled input report buffers, shared by the Mac and
+ Windows backends. Include this after hidapi.h.
+
+ Each open device owns a report_pool. Input reports are
+ received straight into a slab taken from the pool, queued
+ as-is and either copied out by hid_read_timeout() or handed
+ to the caller by hid_read_report_timeout(). Slabs go back
+ onto the pool's free list when released.
+
+ The pool is reference counted: the device holds one
+ reference and every slab that is out of the free list holds
+ another, so reports handed to the caller stay valid after
+ hid_close().
+********************************************************/
+
+#ifndef HIDAPI_REPORT_POOL_H__
+#define HIDAPI_REPORT_POOL_H__
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+	typedef CRITICAL_SECTION report_pool_mutex;
+	#define report_pool_mutex_init(m)    InitializeCriticalSection(m)
+	#define report_pool_mutex_destroy(m) DeleteCriticalSection(m)
+	#define report_pool_mutex_lock(m)    EnterCriticalSection(m)
+	#define report_pool_mutex_unlock(m)  LeaveCriticalSection(m)
+#else
+	#include <pthread.h>
+	typedef pthread_mutex_t report_pool_mutex;
+	#define report_pool_mutex_init(m)    pthread_mutex_init(m, NULL)
+	#define report_pool_mutex_destroy(m) pthread_mutex_destroy(m)
+	#define report_pool_mutex_lock(m)    pthread_mutex_lock(m)
+	#define report_pool_mutex_unlock(m)  pthread_mutex_unlock(m)
+#endif
+
+/* Number of slabs allocated at once when the pool runs dry. */
+#define REPORT_POOL_CHUNK_SLABS 32
+
+struct report_pool;
+
+/* One pooled report buffer. The public hid_report must stay the
+   first member so the two can be cast into each other. */
+struct report_slab {
+	struct hid_report report;
+	struct report_pool *pool;
+	struct report_slab *next; /* Free list, or the device's queue. */
+	unsigned char *storage;
+	int ref_count;
+};
+
+/* Slabs and their storage are allocated together, one chunk
+   at a time, and only freed when the pool is. */
+struct report_chunk {
+	struct report_chunk *next;
+};
+
+struct report_pool {
+	report_pool_mutex mutex;
+	size_t slab_size;
+	int ref_count;
+	struct report_slab *free_list;
+	struct report_chunk *chunks;
+};
+
+static int report_pool_grow(struct report_pool *pool)
+{
+	size_t header = sizeof(struct report_chunk) + REPORT_POOL_CHUNK_SLABS * sizeof(struct report_slab);
+	struct report_chunk *chunk = (struct report_chunk *) calloc(1, header + REPORT_POOL_CHUNK_SLABS * pool->slab_size);
+	struct report_slab *slabs;
+	unsigned char *storage;
+	int i;
+
+	if (!chunk)
+		return -1;
+
+	slabs = (struct report_slab *) (chunk + 1);
+	storage = (unsigned char *) chunk + header;
+
+	for (i = 0; i < REPORT_POOL_CHUNK_SLABS; i++) {
+		slabs[i].pool = pool;
+		slabs[i].storage = storage + (size_t) i * pool->slab_size;
+		slabs[i].next = pool->free_list;
+		pool->free_list = &slabs[i];
+	}
+
+	chunk->next = pool->chunks;
+	pool->chunks = chunk;
+	return 0;
+}
+
+static void report_pool_free(struct report_pool *pool)
+{
+	struct report_chunk *chunk = pool->chunks;
+	while (chunk) {
+		struct report_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	report_pool_mutex_destroy(&pool->mutex);
+	free(pool);
+}
+
+static struct report_pool *report_pool_create(size_t slab_size)
+{
+	struct report_pool *pool = (struct report_pool *) calloc(1, sizeof(struct report_pool));
+	if (!pool)
+		return NULL;
+
+	/* Keep the storage of consecutive slabs pointer aligned. */
+	pool->slab_size = (slab_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	if (pool->slab_size == 0)
+		pool->slab_size = sizeof(void *);
+	pool->ref_count = 1;
+	report_pool_mutex_init(&pool->mutex);
+
+	if (report_pool_grow(pool) < 0) {
+		report_pool_free(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+/* Drops the owning device's reference. The memory is freed once
+   every outstanding slab has been released as well. */
+static void report_pool_destroy(struct report_pool *pool)
+{
+	int remaining;
+
+	if (!pool)
+		return;
+
+	report_pool_mutex_lock(&pool->mutex);
+	remaining = --pool->ref_count;
+	report_pool_mutex_unlock(&pool->mutex);
+
+	if (remaining == 0)
+		report_pool_free(pool);
+}
+
+/* Returns an empty slab with a reference count of one,
+   or NULL if the pool could not grow. */
+static struct report_slab *report_pool_acquire(struct report_pool *pool)
+{
+	struct report_slab *slab = NULL;
+
+	report_pool_mutex_lock(&pool->mutex);
+	if (pool->free_list || report_pool_grow(pool) == 0) {
+		slab = pool->free_list;
+		pool->free_list = slab->next;
+		slab->next = NULL;
+		slab->ref_count = 1;
+		slab->report.data = slab->storage;
+		slab->report.length = 0;
+		slab->report.report_id = 0;
+		slab->report.timestamp = 0;
+		pool->ref_count++;
+	}
+	report_pool_mutex_unlock(&pool->mutex);
+
+	return slab;
+}
+
+static void report_slab_retain(struct report_slab *slab)
+{
+	report_pool_mutex_lock(&slab->pool->mutex);
+	slab->ref_count++;
+	report_pool_mutex_unlock(&slab->pool->mutex);
+}
+
+static void report_slab_release(struct report_slab *slab)
+{
+	struct report_pool *pool;
+	int remaining = 1;
+
+	if (!slab)
+		return;
+
+	pool = slab->pool;
+	report_pool_mutex_lock(&pool->mutex);
+	if (--slab->ref_count == 0) {
+		slab->next = pool->free_list;
+		pool->free_list = slab;
+		remaining = --pool->ref_count;
+	}
+	report_pool_mutex_unlock(&pool->mutex);
+
+	if (remaining == 0)
+		report_pool_free(pool);
+}
+
+void HID_API_EXPORT HID_API_CALL hid_report_retain(struct hid_report *report)
+{
+	if (report)
+		report_slab_retain((struct report_slab *) report);
+}
+
+void HID_API_EXPORT HID_API_CALL hid_report_release(struct hid_report *report)
+{
+	report_slab_release((struct report_slab *) report);
+}
+
+#endif
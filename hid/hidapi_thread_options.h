@@ -0,0 +1,74 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Scheduling options for threads, shared by the Mac and
+ Windows backends. Include this after hidapi.h.
+
+ The options a caller passes in are copied into a
+ thread_settings, which owns its copy of the name, so they
+ can be applied later from the thread they are meant for.
+ How they are applied is up to each backend, in its
+ apply_thread_settings().
+********************************************************/
+
+#ifndef HIDAPI_THREAD_OPTIONS_H__
+#define HIDAPI_THREAD_OPTIONS_H__
+
+#include <string.h>
+
+#define THREAD_SETTINGS_NAME_LEN 64
+
+struct thread_settings {
+	int policy;
+	int priority;
+	unsigned long long affinity_mask;
+	char name[THREAD_SETTINGS_NAME_LEN]; /* Empty to leave it alone */
+	int latency_probe_ms;
+};
+
+/* Applied to the reader threads of devices opened after
+   hid_set_default_thread_options(). All zero means "leave the
+   thread as the OS created it". */
+static struct thread_settings default_thread_settings;
+
+static void thread_settings_from_options(struct thread_settings *settings, const struct hid_thread_options *options)
+{
+	memset(settings, 0, sizeof(*settings));
+	if (!options)
+		return;
+
+	settings->policy = options->policy;
+	settings->priority = options->priority;
+	if (settings->priority < 1)
+		settings->priority = 1;
+	if (settings->priority > 99)
+		settings->priority = 99;
+	settings->affinity_mask = options->affinity_mask;
+	if (options->name)
+		strncpy(settings->name, options->name, THREAD_SETTINGS_NAME_LEN - 1);
+	settings->latency_probe_ms = options->latency_probe_ms > 0 ? options->latency_probe_ms : 0;
+}
+
+/* Maps 1 - 99 onto the platform's lo - hi range. */
+static int thread_settings_scale_priority(int priority, int lo, int hi)
+{
+	return lo + (hi - lo) * (priority - 1) / 98;
+}
+
+/* Inline, as only backends with a reader thread of their own use it. */
+static inline void thread_stats_add_sample(struct hid_thread_stats *stats, unsigned long long latency_ns)
+{
+	stats->num_samples++;
+	stats->total_latency_ns += latency_ns;
+	stats->last_latency_ns = latency_ns;
+	if (latency_ns > stats->max_latency_ns)
+		stats->max_latency_ns = latency_ns;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_set_default_thread_options(const struct hid_thread_options *options)
+{
+	thread_settings_from_options(&default_thread_settings, options);
+}
+
+#endif
@@ -62,6 +62,12 @@ extern "C" {
 
 
 #include "hidapi.h"
+#include "hidapi_report_pool.h"
+#include "hidapi_enum_arena.h"
+#include "hidapi_enum_filter.h"
+#include "hidapi_thread_options.h"
+#include "hidapi_metrics.h"
+#include "hidapi_feature_cache.h"
 
 #undef MIN
 #define MIN(x,y) ((x) < (y)? (x): (y))
@@ -128,16 +134,28 @@ extern "C" {
 	static BOOLEAN initialized = FALSE;
 #endif /* HIDAPI_USE_DDK */
 
+	/* How many writes hid_write_many() keeps in flight */
+	#define WRITE_MANY_WINDOW 16
+
 	struct hid_device_ {
 		HANDLE device_handle;
 		BOOL blocking;
 		USHORT output_report_length;
 		size_t input_report_length;
+		USHORT feature_report_length;
 		void *last_error_str;
 		DWORD last_error_num;
 		BOOL read_pending;
-		char *read_buf;
+		struct report_pool *report_pool;
+		struct report_slab *read_slab; /* Target of the overlapped read */
 		OVERLAPPED ol;
+		struct hid_device_metrics metrics;
+		struct hid_feature_cache feature_cache;
+		/* For hid_write_many(): an event per write in flight, made
+		when first needed, and WRITE_MANY_WINDOW buffers of
+		output_report_length bytes for padding short reports */
+		HANDLE write_events[WRITE_MANY_WINDOW];
+		unsigned char *write_buffers;
 	};
 
 	static hid_device *new_hid_device()
@@ -147,22 +165,35 @@ extern "C" {
 		dev->blocking = TRUE;
 		dev->output_report_length = 0;
 		dev->input_report_length = 0;
+		dev->feature_report_length = 0;
 		dev->last_error_str = NULL;
 		dev->last_error_num = 0;
 		dev->read_pending = FALSE;
-		dev->read_buf = NULL;
+		dev->report_pool = NULL;
+		dev->read_slab = NULL;
 		memset(&dev->ol, 0, sizeof(dev->ol));
 		dev->ol.hEvent = CreateEvent(NULL, FALSE, FALSE /*initial state f=nonsignaled*/, NULL);
+		memset(dev->write_events, 0, sizeof(dev->write_events));
+		dev->write_buffers = NULL;
 
 		return dev;
 	}
 
 	static void free_hid_device(hid_device *dev)
 	{
+		int i;
+
+		for (i = 0; i < WRITE_MANY_WINDOW; i++) {
+			if (dev->write_events[i])
+				CloseHandle(dev->write_events[i]);
+		}
+		free(dev->write_buffers);
 		CloseHandle(dev->ol.hEvent);
 		CloseHandle(dev->device_handle);
 		LocalFree(dev->last_error_str);
-		free(dev->read_buf);
+		report_slab_release(dev->read_slab);
+		report_pool_destroy(dev->report_pool);
+		feature_cache_free(&dev->feature_cache);
 		free(dev);
 	}
 
@@ -264,11 +295,50 @@ extern "C" {
 		return 0;
 	}
 
-	struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+	unsigned long long HID_API_EXPORT HID_API_CALL hid_get_monotonic_time(void)
+	{
+		static LARGE_INTEGER frequency;
+		LARGE_INTEGER counter;
+
+		if (frequency.QuadPart == 0)
+			QueryPerformanceFrequency(&frequency);
+		QueryPerformanceCounter(&counter);
+
+		/* Split the conversion so the multiplication can't overflow. */
+		return (unsigned long long) (counter.QuadPart / frequency.QuadPart) * 1000000000ULL
+			+ (unsigned long long) (counter.QuadPart % frequency.QuadPart) * 1000000000ULL / frequency.QuadPart;
+	}
+
+	/* Interface Number. It can sometimes be parsed out of the path
+	on Windows if a device has multiple interfaces. See
+	http://msdn.microsoft.com/en-us/windows/hardware/gg487473 or
+	search for "Hardware IDs for HID Devices" at MSDN. If it's not
+	in the path, it's -1. */
+	static int parse_interface_number(const char *path)
+	{
+		int interface_number = -1;
+		if (path) {
+			const char *interface_component = strstr(path, "&mi_");
+			if (interface_component) {
+				const char *hex_str = interface_component + 4;
+				char *endptr = NULL;
+				interface_number = strtol(hex_str, &endptr, 16);
+				if (endptr == hex_str) {
+					/* The parsing failed. Set interface_number to -1. */
+					interface_number = -1;
+				}
+			}
+		}
+		return interface_number;
+	}
+
+	struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate_filtered(const struct hid_enumerate_filter *filter)
 	{
 		BOOL res;
 		struct hid_device_info *root = NULL; /* return object */
 		struct hid_device_info *cur_dev = NULL;
+		struct enum_arena arena; /* owns root, every node and every string */
+		struct hid_enumerate_filter match_all;
 
 		/* Windows objects for interacting with the driver. */
 		GUID InterfaceClassGuid = { 0x4d1e55b2, 0xf16f, 0x11cf,{ 0x88, 0xcb, 0x00, 0x11, 0x11, 0x00, 0x00, 0x30 } };
@@ -279,9 +349,16 @@ extern "C" {
 		int device_index = 0;
 		int i;
 
+		if (!filter) {
+			memset(&match_all, 0, sizeof(match_all));
+			filter = &match_all;
+		}
+
 		if (hid_init() < 0)
 			return NULL;
 
+		enum_arena_init(&arena);
+
 		/* Initialize the Windows objects. */
 		memset(&devinfo_data, 0x0, sizeof(devinfo_data));
 		devinfo_data.cbSize = sizeof(SP_DEVINFO_DATA);
@@ -296,6 +373,10 @@ extern "C" {
 			HANDLE write_handle = INVALID_HANDLE_VALUE;
 			DWORD required_size = 0;
 			HIDD_ATTRIBUTES attrib;
+			struct hid_device_info candidate;
+			PHIDP_PREPARSED_DATA pp_data = NULL;
+			HIDP_CAPS caps;
+			NTSTATUS nt_res;
 
 			res = SetupDiEnumDeviceInterfaces(device_info_set,
 				NULL,
@@ -366,6 +447,15 @@ extern "C" {
 
 			//wprintf(L"HandleName: %s\n", device_interface_detail_data->DevicePath);
 
+			/* The path and the interface number parsed out of it are free,
+			so check those before opening the device at all. */
+			memset(&candidate, 0, sizeof(candidate));
+			candidate.path = device_interface_detail_data->DevicePath;
+			candidate.interface_number = parse_interface_number(candidate.path);
+			if (!filter_matches_path(filter, candidate.path) ||
+				!filter_matches_interface(filter, candidate.interface_number))
+				goto cont;
+
 			/* Open a handle to the device */
 			write_handle = open_device(device_interface_detail_data->DevicePath, TRUE);
 
@@ -384,20 +474,38 @@ extern "C" {
 
 			/* Check the VID/PID to see if we should add this
 			device to the enumeration list. */
-			if ((vendor_id == 0x0 || attrib.VendorID == vendor_id) &&
-				(product_id == 0x0 || attrib.ProductID == product_id)) {
+			if (!filter_matches_ids(filter, attrib.VendorID, attrib.ProductID))
+				goto cont_close;
+
+			candidate.vendor_id = attrib.VendorID;
+			candidate.product_id = attrib.ProductID;
+			candidate.release_number = attrib.VersionNumber;
+
+			/* Get the Usage Page and Usage for this device. */
+			res = HidD_GetPreparsedData(write_handle, &pp_data);
+			if (res) {
+				nt_res = HidP_GetCaps(pp_data, &caps);
+				if (nt_res == HIDP_STATUS_SUCCESS) {
+					candidate.usage_page = caps.UsagePage;
+					candidate.usage = caps.Usage;
+				}
+
+				HidD_FreePreparsedData(pp_data);
+			}
 
+			if (!filter_matches_usage(filter, candidate.usage_page, candidate.usage) ||
+				!filter_accepts(filter, &candidate))
+				goto cont_close;
+
+			{
 #define WSTR_LEN 512
-				const char *str;
 				struct hid_device_info *tmp;
-				PHIDP_PREPARSED_DATA pp_data = NULL;
-				HIDP_CAPS caps;
-				NTSTATUS nt_res;
 				wchar_t wstr[WSTR_LEN]; /* TODO: Determine Size */
-				size_t len;
 
-				/* VID/PID match. Create the record. */
-				tmp = (struct hid_device_info*) calloc(1, sizeof(struct hid_device_info));
+				/* Match. Create the record. */
+				tmp = enum_arena_new_info(&arena);
+				if (!tmp)
+					goto cont_close;
 				if (cur_dev) {
 					cur_dev->next = tmp;
 				}
@@ -406,75 +514,34 @@ extern "C" {
 				}
 				cur_dev = tmp;
 
-				/* Get the Usage Page and Usage for this device. */
-				res = HidD_GetPreparsedData(write_handle, &pp_data);
-				if (res) {
-					nt_res = HidP_GetCaps(pp_data, &caps);
-					if (nt_res == HIDP_STATUS_SUCCESS) {
-						cur_dev->usage_page = caps.UsagePage;
-						cur_dev->usage = caps.Usage;
-					}
-
-					HidD_FreePreparsedData(pp_data);
-				}
-
 				/* Fill out the record */
+				*cur_dev = candidate;
 				cur_dev->next = NULL;
-				str = device_interface_detail_data->DevicePath;
-				if (str) {
-					len = strlen(str);
-					cur_dev->path = (char*)calloc(len + 1, sizeof(char));
-					strncpy(cur_dev->path, str, len + 1);
-					cur_dev->path[len] = '\0';
-				}
-				else
-					cur_dev->path = NULL;
+				if (candidate.path)
+					cur_dev->path = enum_arena_strdup(&arena, candidate.path);
+
+				if (filter->skip_strings)
+					goto cont_close;
 
 				/* Serial Number */
 				res = HidD_GetSerialNumberString(write_handle, wstr, sizeof(wstr));
 				wstr[WSTR_LEN - 1] = 0x0000;
 				if (res) {
-					cur_dev->serial_number = _wcsdup(wstr);
+					cur_dev->serial_number = enum_arena_wcsdup(&arena, wstr);
 				}
 
 				/* Manufacturer String */
 				res = HidD_GetManufacturerString(write_handle, wstr, sizeof(wstr));
 				wstr[WSTR_LEN - 1] = 0x0000;
 				if (res) {
-					cur_dev->manufacturer_string = _wcsdup(wstr);
+					cur_dev->manufacturer_string = enum_arena_wcsdup(&arena, wstr);
 				}
 
 				/* Product String */
 				res = HidD_GetProductString(write_handle, wstr, sizeof(wstr));
 				wstr[WSTR_LEN - 1] = 0x0000;
 				if (res) {
-					cur_dev->product_string = _wcsdup(wstr);
-				}
-
-				/* VID/PID */
-				cur_dev->vendor_id = attrib.VendorID;
-				cur_dev->product_id = attrib.ProductID;
-
-				/* Release Number */
-				cur_dev->release_number = attrib.VersionNumber;
-
-				/* Interface Number. It can sometimes be parsed out of the path
-				on Windows if a device has multiple interfaces. See
-				http://msdn.microsoft.com/en-us/windows/hardware/gg487473 or
-				search for "Hardware IDs for HID Devices" at MSDN. If it's not
-				in the path, it's set to -1. */
-				cur_dev->interface_number = -1;
-				if (cur_dev->path) {
-					char *interface_component = strstr(cur_dev->path, "&mi_");
-					if (interface_component) {
-						char *hex_str = interface_component + 4;
-						char *endptr = NULL;
-						cur_dev->interface_number = strtol(hex_str, &endptr, 16);
-						if (endptr == hex_str) {
-							/* The parsing failed. Set interface_number to -1. */
-							cur_dev->interface_number = -1;
-						}
-					}
+					cur_dev->product_string = enum_arena_wcsdup(&arena, wstr);
 				}
 			}
 
@@ -495,19 +562,53 @@ extern "C" {
 
 	}
 
+	/* Reads one string with the given HidD_Get*String function,
+	leaving the buffer empty if the device doesn't have it. */
+	static void get_string_by_handle(HANDLE handle, BOOLEAN (__stdcall *get_string)(HANDLE, PVOID, ULONG), wchar_t *string, size_t maxlen)
+	{
+		if (!string || maxlen == 0)
+			return;
+
+		if (get_string(handle, string, (ULONG) (sizeof(wchar_t) * MIN(maxlen, MAX_STRING_WCHARS))))
+			string[MIN(maxlen, MAX_STRING_WCHARS) - 1] = 0x0000;
+		else
+			string[0] = 0x0000;
+	}
+
+	int HID_API_EXPORT_CALL HID_API_CALL hid_get_strings_by_path(const char *path, wchar_t *serial_number, wchar_t *manufacturer_string, wchar_t *product_string, size_t maxlen)
+	{
+		HANDLE handle;
+
+		if (hid_init() < 0)
+			return -1;
+
+		/* No read or write access is needed for the strings. */
+		handle = open_device(path, TRUE);
+		if (handle == INVALID_HANDLE_VALUE)
+			return -1;
+
+		get_string_by_handle(handle, HidD_GetSerialNumberString, serial_number, maxlen);
+		get_string_by_handle(handle, HidD_GetManufacturerString, manufacturer_string, maxlen);
+		get_string_by_handle(handle, HidD_GetProductString, product_string, maxlen);
+
+		CloseHandle(handle);
+		return 0;
+	}
+
+	struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+	{
+		struct hid_enumerate_filter filter;
+		memset(&filter, 0, sizeof(filter));
+		filter.vendor_id = vendor_id;
+		filter.product_id = product_id;
+
+		return hid_enumerate_filtered(&filter);
+	}
+
 	void  HID_API_EXPORT HID_API_CALL hid_free_enumeration(struct hid_device_info *devs)
 	{
-		/* TODO: Merge this with the Linux version. This function is platform-independent. */
-		struct hid_device_info *d = devs;
-		while (d) {
-			struct hid_device_info *next = d->next;
-			free(d->path);
-			free(d->serial_number);
-			free(d->manufacturer_string);
-			free(d->product_string);
-			free(d);
-			d = next;
-		}
+		/* The whole list lives in one arena. */
+		enum_arena_free_list(devs);
 	}
 
 
@@ -591,9 +692,14 @@ extern "C" {
 		}
 		dev->output_report_length = caps.OutputReportByteLength;
 		dev->input_report_length = caps.InputReportByteLength;
+		dev->feature_report_length = caps.FeatureReportByteLength;
 		HidD_FreePreparsedData(pp_data);
 
-		dev->read_buf = (char*)malloc(dev->input_report_length);
+		dev->report_pool = report_pool_create(dev->input_report_length);
+		if (!dev->report_pool) {
+			register_error(dev, "report_pool_create");
+			goto err;
+		}
 
 		return dev;
 
@@ -611,6 +717,7 @@ extern "C" {
 
 		OVERLAPPED ol;
 		unsigned char *buf;
+		unsigned long long start = hid_get_monotonic_time();
 		memset(&ol, 0, sizeof(ol));
 
 		/* Make sure the right number of bytes are passed to WriteFile. Windows
@@ -656,25 +763,151 @@ extern "C" {
 		if (buf != data)
 			free(buf);
 
+		metrics_report_written(&dev->metrics, (int) bytes_written, start);
 		return bytes_written;
 	}
 
+	/* Starts an overlapped write of one report for hid_write_many().
+	Returns FALSE if WriteFile() failed outright. */
+	static BOOL start_write(hid_device *dev, int slot, OVERLAPPED *ol, const struct hid_output_report *report)
+	{
+		const unsigned char *buf = report->data;
+		DWORD length = (DWORD) report->length;
+		BOOL res;
 
-	int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+		/* Short reports are padded as in hid_write(), but into the
+		slot's buffer instead of a fresh allocation. */
+		if (report->length < dev->output_report_length) {
+			unsigned char *padded = dev->write_buffers + (size_t) slot * dev->output_report_length;
+			memcpy(padded, report->data, report->length);
+			memset(padded + report->length, 0, dev->output_report_length - report->length);
+			buf = padded;
+			length = dev->output_report_length;
+		}
+
+		memset(ol, 0, sizeof(*ol));
+		ol->hEvent = dev->write_events[slot];
+
+		res = WriteFile(dev->device_handle, buf, length, NULL, ol);
+		if (!res && GetLastError() != ERROR_IO_PENDING) {
+			register_error(dev, "WriteFile");
+			return FALSE;
+		}
+
+		return TRUE;
+	}
+
+	int HID_API_EXPORT HID_API_CALL hid_write_many(hid_device *dev, const struct hid_output_report *reports, size_t count, int *results)
+	{
+		OVERLAPPED ol[WRITE_MANY_WINDOW];
+		BOOL started[WRITE_MANY_WINDOW];
+		unsigned long long start[WRITE_MANY_WINDOW];
+		size_t submitted = 0, completed = 0, num_written = 0;
+		BOOL failed = FALSE;
+		size_t i;
+
+		if (count == 0)
+			return 0;
+
+		if (results) {
+			for (i = 0; i < count; i++)
+				results[i] = 0;
+		}
+
+		for (i = 0; i < WRITE_MANY_WINDOW; i++) {
+			if (!dev->write_events[i]) {
+				/* Manual reset, as WriteFile() resets it when it starts. */
+				dev->write_events[i] = CreateEvent(NULL, TRUE, FALSE, NULL);
+				if (!dev->write_events[i]) {
+					register_error(dev, "CreateEvent");
+					goto fail_before_start;
+				}
+			}
+		}
+
+		if (!dev->write_buffers && dev->output_report_length > 0) {
+			dev->write_buffers = (unsigned char *)malloc((size_t) WRITE_MANY_WINDOW * dev->output_report_length);
+			if (!dev->write_buffers) {
+				register_error(dev, "malloc");
+				goto fail_before_start;
+			}
+		}
+
+		/* Keep up to WRITE_MANY_WINDOW writes queued in the driver and
+		collect them in order. Nothing new is started once a report
+		has failed, but any writes already in flight are waited for,
+		as their buffers must stay put until they finish. */
+		while (completed < count) {
+			while (!failed && submitted < count && submitted - completed < WRITE_MANY_WINDOW) {
+				int slot = (int) (submitted % WRITE_MANY_WINDOW);
+				start[slot] = hid_get_monotonic_time();
+				started[slot] = start_write(dev, slot, &ol[slot], &reports[submitted]);
+				if (!started[slot])
+					failed = TRUE;
+				submitted++;
+			}
+
+			if (completed == submitted)
+				break;
+
+			{
+				int slot = (int) (completed % WRITE_MANY_WINDOW);
+				DWORD bytes_written = 0;
+				int res = -1;
+
+				if (started[slot]) {
+					if (GetOverlappedResult(dev->device_handle, &ol[slot], &bytes_written, TRUE/*wait*/))
+						res = (int) bytes_written;
+					else
+						register_error(dev, "WriteFile");
+				}
+
+				metrics_report_written(&dev->metrics, res, start[slot]);
+				if (results)
+					results[completed] = res;
+
+				if (res < 0)
+					failed = TRUE;
+				else if (num_written == completed)
+					num_written++;
+
+				completed++;
+			}
+		}
+
+		return (int) num_written;
+
+	fail_before_start:
+		if (results)
+			results[0] = -1;
+		metrics_report_written(&dev->metrics, -1, 0);
+		return 0;
+	}
+
+
+	/* Waits for the overlapped read into dev->read_slab, starting one if
+	none is pending. Returns 1 when the read has completed, 0 if there
+	was no data within the timeout and -1 on error. */
+	static int wait_for_report(hid_device *dev, int milliseconds, DWORD *bytes_read)
 	{
-		DWORD bytes_read = 0;
-		size_t copy_len = 0;
 		BOOL res;
 
 		/* Copy the handle for convenience. */
 		HANDLE ev = dev->ol.hEvent;
 
+		*bytes_read = 0;
+
 		if (!dev->read_pending) {
-			/* Start an Overlapped I/O read. */
+			/* Start an Overlapped I/O read straight into a pooled buffer. */
+			if (!dev->read_slab) {
+				dev->read_slab = report_pool_acquire(dev->report_pool);
+				if (!dev->read_slab)
+					return -1;
+			}
 			dev->read_pending = TRUE;
-			memset(dev->read_buf, 0, dev->input_report_length);
+			memset(dev->read_slab->storage, 0, dev->input_report_length);
 			ResetEvent(ev);
-			res = ReadFile(dev->device_handle, dev->read_buf, dev->input_report_length, &bytes_read, &dev->ol);
+			res = ReadFile(dev->device_handle, dev->read_slab->storage, dev->input_report_length, bytes_read, &dev->ol);
 
 			if (!res) {
 				if (GetLastError() != ERROR_IO_PENDING) {
@@ -682,7 +915,8 @@ extern "C" {
 					Clean up and return error. */
 					CancelIo(dev->device_handle);
 					dev->read_pending = FALSE;
-					goto end_of_function;
+					register_error(dev, "GetOverlappedResult");
+					return -1;
 				}
 			}
 		}
@@ -699,38 +933,96 @@ extern "C" {
 
 		/* Either WaitForSingleObject() told us that ReadFile has completed, or
 		we are in non-blocking mode. Get the number of bytes read. The actual
-		data has been copied to the data[] array which was passed to ReadFile(). */
-		res = GetOverlappedResult(dev->device_handle, &dev->ol, &bytes_read, TRUE/*wait*/);
+		data has been written into the slab passed to ReadFile(). */
+		res = GetOverlappedResult(dev->device_handle, &dev->ol, bytes_read, TRUE/*wait*/);
 
 		/* Set pending back to false, even if GetOverlappedResult() returned error. */
 		dev->read_pending = FALSE;
 
-		if (res && bytes_read > 0) {
-			if (dev->read_buf[0] == 0x0) {
-				/* If report numbers aren't being used, but Windows sticks a report
-				number (0x0) on the beginning of the report anyway. To make this
-				work like the other platforms, and to make it work more like the
-				HID spec, we'll skip over this byte. */
-				bytes_read--;
-				copy_len = length > bytes_read ? bytes_read : length;
-				memcpy(data, dev->read_buf + 1, copy_len);
-			}
-			else {
-				/* Copy the whole buffer, report number and all. */
-				copy_len = length > bytes_read ? bytes_read : length;
-				memcpy(data, dev->read_buf, copy_len);
-			}
-		}
-
-	end_of_function:
 		if (!res) {
 			register_error(dev, "GetOverlappedResult");
 			return -1;
 		}
 
+		return 1;
+	}
+
+	/* Fills in the public part of dev->read_slab after a completed read.
+	There's no queue here: reports wait in the OS until they're read, so
+	they're stamped, received and read all at once, and any the OS drops
+	aren't seen. */
+	static void finish_report(hid_device *dev, DWORD bytes_read)
+	{
+		struct hid_report *report = &dev->read_slab->report;
+
+		report->data = dev->read_slab->storage;
+		report->length = bytes_read;
+		report->report_id = bytes_read > 0 ? dev->read_slab->storage[0] : 0;
+		report->timestamp = hid_get_monotonic_time();
+
+		if (bytes_read > 0 && report->report_id == 0x0) {
+			/* If report numbers aren't being used, but Windows sticks a report
+			number (0x0) on the beginning of the report anyway. To make this
+			work like the other platforms, and to make it work more like the
+			HID spec, we'll skip over this byte. */
+			report->data++;
+			report->length--;
+		}
+
+		metrics_add(&dev->metrics.reports_received, 1);
+		metrics_report_read(&dev->metrics, report);
+	}
+
+	int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+	{
+		DWORD bytes_read = 0;
+		size_t copy_len = 0;
+		int res = wait_for_report(dev, milliseconds, &bytes_read);
+
+		if (res < 0)
+			metrics_add(&dev->metrics.read_errors, 1);
+		if (res <= 0)
+			return res;
+
+		finish_report(dev, bytes_read);
+
+		/* Copy the report out and keep the slab for the next read. */
+		copy_len = length > dev->read_slab->report.length ? dev->read_slab->report.length : length;
+		memcpy(data, dev->read_slab->report.data, copy_len);
+
 		return copy_len;
 	}
 
+	int HID_API_EXPORT HID_API_CALL hid_read_report_timeout(hid_device *dev, struct hid_report **report, int milliseconds)
+	{
+		DWORD bytes_read = 0;
+		int res = wait_for_report(dev, milliseconds, &bytes_read);
+
+		*report = NULL;
+
+		if (res < 0)
+			metrics_add(&dev->metrics.read_errors, 1);
+		if (res <= 0 || bytes_read == 0)
+			return res <= 0 ? res : 0;
+
+		finish_report(dev, bytes_read);
+
+		/* Hand the slab itself to the caller. The next read gets a fresh one. */
+		*report = &dev->read_slab->report;
+		dev->read_slab = NULL;
+
+		return (int) (*report)->length;
+	}
+
+	int HID_API_EXPORT HID_API_CALL hid_set_input_callback(hid_device *dev, hid_input_callback callback, void *context)
+	{
+		/* Reads are overlapped I/O started by the reader, so nothing
+		   is watching the device in between. */
+		SetLastError(ERROR_NOT_SUPPORTED);
+		register_error(dev, "hid_set_input_callback");
+		return -1;
+	}
+
 	int HID_API_EXPORT HID_API_CALL hid_read(hid_device *dev, unsigned char *data, size_t length)
 	{
 		return hid_read_timeout(dev, data, length, (dev->blocking) ? -1 : 0);
@@ -745,6 +1037,8 @@ extern "C" {
 	int HID_API_EXPORT HID_API_CALL hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
 	{
 		BOOL res = HidD_SetFeature(dev->device_handle, (PVOID)data, length);
+		if (length > 0)
+			feature_cache_invalidate(&dev->feature_cache, data[0]);
 		if (!res) {
 			register_error(dev, "HidD_SetFeature");
 			return -1;
@@ -754,7 +1048,7 @@ extern "C" {
 	}
 
 
-	int HID_API_EXPORT HID_API_CALL hid_get_feature_report(hid_device *dev, unsigned char *data, size_t length)
+	static int get_feature_report(hid_device *dev, unsigned char *data, size_t length)
 	{
 		BOOL res;
 #if 0
@@ -802,6 +1096,22 @@ extern "C" {
 #endif
 	}
 
+	int HID_API_EXPORT HID_API_CALL hid_get_feature_report(hid_device *dev, unsigned char *data, size_t length)
+	{
+		return feature_cache_get_report(&dev->feature_cache, dev, data, length,
+		                                hid_get_monotonic_time(), get_feature_report);
+	}
+
+	int HID_API_EXPORT HID_API_CALL hid_set_feature_report_cache(hid_device *dev, int ttl_ms)
+	{
+		return feature_cache_set_ttl(&dev->feature_cache, ttl_ms);
+	}
+
+	int HID_API_EXPORT HID_API_CALL hid_invalidate_feature_report_cache(hid_device *dev, int report_id)
+	{
+		return feature_cache_invalidate(&dev->feature_cache, report_id);
+	}
+
 	void HID_API_EXPORT HID_API_CALL hid_close(hid_device *dev)
 	{
 		if (!dev)
@@ -849,6 +1159,120 @@ extern "C" {
 		return 0;
 	}
 
+	/* SetThreadDescription() only exists from Windows 10 1607 on,
+	so it's looked up at runtime. */
+	typedef HRESULT (WINAPI *SetThreadDescription_)(HANDLE thread, PCWSTR description);
+
+	static int apply_thread_settings(const struct thread_settings *settings)
+	{
+		int ret = 0;
+
+		if (settings->name[0]) {
+			SetThreadDescription_ set_description = (SetThreadDescription_)
+				GetProcAddress(GetModuleHandleA("kernel32.dll"), "SetThreadDescription");
+			if (set_description) {
+				wchar_t name[THREAD_SETTINGS_NAME_LEN];
+				if (MultiByteToWideChar(CP_UTF8, 0, settings->name, -1, name, THREAD_SETTINGS_NAME_LEN) > 0)
+					set_description(GetCurrentThread(), name);
+			}
+		}
+
+		if (settings->policy != HID_THREAD_POLICY_DEFAULT) {
+			/* Windows has no FIFO/RR distinction for a single thread;
+			both map onto the top of the priority range. */
+			int priority = settings->priority >= 90 ? THREAD_PRIORITY_TIME_CRITICAL
+				: settings->priority >= 50 ? THREAD_PRIORITY_HIGHEST
+				: THREAD_PRIORITY_ABOVE_NORMAL;
+			if (!SetThreadPriority(GetCurrentThread(), priority))
+				ret = -1;
+		}
+
+		if (settings->affinity_mask) {
+			if (!SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) settings->affinity_mask))
+				ret = -1;
+		}
+
+		return ret;
+	}
+
+	int HID_API_EXPORT HID_API_CALL hid_set_thread_options(hid_device *dev, const struct hid_thread_options *options)
+	{
+		/* Reads happen on the caller's thread here; there's no reader
+		thread to configure. Use hid_set_current_thread_options(). */
+		SetLastError(ERROR_NOT_SUPPORTED);
+		register_error(dev, "hid_set_thread_options");
+		return -1;
+	}
+
+	int HID_API_EXPORT HID_API_CALL hid_set_current_thread_options(const struct hid_thread_options *options)
+	{
+		struct thread_settings settings;
+		thread_settings_from_options(&settings, options);
+		return apply_thread_settings(&settings);
+	}
+
+	int HID_API_EXPORT HID_API_CALL hid_get_thread_stats(hid_device *dev, struct hid_thread_stats *stats)
+	{
+		memset(stats, 0, sizeof(*stats));
+		return -1;
+	}
+
+	int HID_API_EXPORT HID_API_CALL hid_set_input_queue(hid_device *dev, int depth, int policy, int max_depth)
+	{
+		BOOLEAN res;
+
+		/* The queue is the HID class driver's, which always drops the
+		oldest report when it's full and can't grow on demand, so
+		HID_OVERFLOW_GROW gets the whole bound up front. */
+		if (policy == HID_OVERFLOW_GROW)
+			depth = max_depth;
+		else if (policy != HID_OVERFLOW_DROP_OLDEST) {
+			SetLastError(ERROR_NOT_SUPPORTED);
+			register_error(dev, "hid_set_input_queue");
+			return -1;
+		}
+
+		res = HidD_SetNumInputBuffers(dev->device_handle, (ULONG) depth);
+		if (!res) {
+			register_error(dev, "HidD_SetNumInputBuffers");
+			return -1;
+		}
+
+		return 0;
+	}
+
+	int HID_API_EXPORT HID_API_CALL hid_set_drop_callback(hid_device *dev, hid_drop_callback callback, void *context)
+	{
+		/* The driver drops reports without telling anyone. */
+		SetLastError(ERROR_NOT_SUPPORTED);
+		register_error(dev, "hid_set_drop_callback");
+		return -1;
+	}
+
+	int HID_API_EXPORT HID_API_CALL hid_get_device_metrics(hid_device *dev, struct hid_device_metrics *metrics)
+	{
+		metrics_snapshot(&dev->metrics, metrics);
+		return 0;
+	}
+
+	void HID_API_EXPORT HID_API_CALL hid_reset_device_metrics(hid_device *dev)
+	{
+		metrics_reset(&dev->metrics);
+	}
+
+	int HID_API_EXPORT_CALL HID_API_CALL hid_get_max_report_lengths(hid_device *dev, size_t *input, size_t *output, size_t *feature)
+	{
+		/* Read from the caps once, in hid_open_path(). */
+		if (input)
+			*input = dev->input_report_length;
+		if (output)
+			*output = dev->output_report_length;
+		if (feature)
+			*feature = dev->feature_report_length;
+
+		return 0;
+	}
+
 	int HID_API_EXPORT_CALL HID_API_CALL hid_get_indexed_string(hid_device *dev, int string_index, wchar_t *string, size_t maxlen)
 	{
 		BOOL res;
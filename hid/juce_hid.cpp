@@ -1,705 +1,4180 @@
-/*
-  ==============================================================================
-
-    juce_hid.cpp
-    Created: 7 Dec 2017 3:16:59pm
-    Author:  Chris Penny
-
-  ==============================================================================
-*/
-
-#define HID_ERROR -1
-#ifndef DEFAULT_SIZE
-    #define DEFAULT_SIZE 2048
-#endif
-
-using namespace juce;
-
-Result hid::init()
-{
-    int res = hid_init();
-    return res == HID_ERROR
-        ? Result::fail(TRANS("could not initialize hidapi"))
-        : Result::ok();
-}
-
-Result hid::exit()
-{
-    int res = hid_exit();
-    return res == HID_ERROR
-        ? Result::fail(TRANS("could not exit hidapi"))
-        : Result::ok();
-}
-
-hid::DeviceInfo::DeviceInfo()
-: vendorId(0)
-, productId(0)
-, releaseNumber(0)
-, usagePage(0)
-, usage(0)
-, interfaceNumber (0) {};
-
-hid::DeviceInfo::DeviceInfo (const hid_device_info& info)
-: path               (info.path)
-, vendorId           (info.vendor_id)
-, productId          (info.product_id)
-, serialNumber       (info.serial_number)
-, releaseNumber      (info.release_number)
-, manufacturerString (info.manufacturer_string)
-, productString      (info.product_string)
-, usagePage          (info.usage_page)
-, usage              (info.usage)
-, interfaceNumber    (info.interface_number) {}
-
-hid::DeviceInfo::DeviceInfo (const DeviceInfo& other)
-: path               (other.path)
-, vendorId           (other.vendorId)
-, productId          (other.productId)
-, serialNumber       (other.serialNumber)
-, releaseNumber      (other.releaseNumber)
-, manufacturerString (other.manufacturerString)
-, productString      (other.productString)
-, usagePage          (other.usagePage)
-, usage              (other.usage)
-, interfaceNumber    (other.interfaceNumber) {}
-
-hid::DeviceInfo::DeviceInfo (const MutableDeviceInfo& other)
-: path               (other.getPath())
-, vendorId           (other.getVendorId())
-, productId          (other.getProductId())
-, serialNumber       (other.getSerialNumber())
-, releaseNumber      (other.getReleaseNumber())
-, manufacturerString (other.getManufacturerString())
-, productString      (other.getProductString())
-, usagePage          (other.getUsagePage())
-, usage              (other.getUsage())
-, interfaceNumber    (other.getInterfaceNumber()) {}
-
-bool hid::DeviceInfo::operator== (const DeviceInfo& other) const
-{
-    return
-       this->path               == other.path
-    && this->vendorId           == other.vendorId
-    && this->productId          == other.productId
-    && this->serialNumber       == other.serialNumber
-    && this->releaseNumber      == other.releaseNumber
-    && this->manufacturerString == other.manufacturerString
-    && this->productString      == other.productString
-    && this->usagePage          == other.usagePage
-    && this->usage              == other.usage
-    && this->interfaceNumber    == other.interfaceNumber;
-}
-
-bool hid::DeviceInfo::operator== (const MutableDeviceInfo& other) const
-{
-    return
-       this->path               == other.path
-    && this->vendorId           == other.vendorId
-    && this->productId          == other.productId
-    && this->serialNumber       == other.serialNumber
-    && this->releaseNumber      == other.releaseNumber
-    && this->manufacturerString == other.manufacturerString
-    && this->productString      == other.productString
-    && this->usagePage          == other.usagePage
-    && this->usage              == other.usage
-    && this->interfaceNumber    == other.interfaceNumber;
-}
-
-bool hid::DeviceInfo::operator== (const DeviceIO& other) const
-{
-    return *this == other.getInfo();
-}
-
-const String&        hid::DeviceInfo::getPath()               const { return path; }
-const unsigned short hid::DeviceInfo::getVendorId()           const { return vendorId; };
-const unsigned short hid::DeviceInfo::getProductId()          const { return productId; };
-const String&        hid::DeviceInfo::getSerialNumber()       const { return serialNumber; };
-const unsigned short hid::DeviceInfo::getReleaseNumber()      const { return releaseNumber; };
-const String&        hid::DeviceInfo::getManufacturerString() const { return manufacturerString; };
-const String&        hid::DeviceInfo::getProductString()      const { return productString; };
-const unsigned short hid::DeviceInfo::getUsagePage()          const { return usagePage; };
-const unsigned short hid::DeviceInfo::getUsage()              const { return usage; };
-const int            hid::DeviceInfo::getInterfaceNumber()    const { return interfaceNumber; };
-const String         hid::DeviceInfo::getName()               const {
-    return manufacturerString + " " + productString;
-}
-
-const hid::DeviceIO hid::DeviceInfo::connect() const
-{
-    return hid::connect(*this);
-}
-
-void hid::DeviceInfo::disconnect() const
-{
-    hid::disconnect();
-}
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-hid::MutableDeviceInfo::MutableDeviceInfo() {}
-hid::MutableDeviceInfo::MutableDeviceInfo (const hid_device_info& info)
-{
-    path                = info.path;
-    vendorId            = info.vendor_id;
-    productId           = info.product_id;
-    serialNumber        = info.serial_number;
-    releaseNumber       = info.release_number;
-    manufacturerString  = info.manufacturer_string;
-    productString       = info.product_string;
-    usagePage           = info.usage_page;
-    usage               = info.usage;
-    interfaceNumber     = info.interface_number;
-}
-
-hid::MutableDeviceInfo::MutableDeviceInfo (const hid::DeviceInfo& other)
-{
-    path                = other.getPath();
-    vendorId            = other.getVendorId();
-    productId           = other.getProductId();
-    serialNumber        = other.getSerialNumber();
-    releaseNumber       = other.getReleaseNumber();
-    manufacturerString  = other.getManufacturerString();
-    productString       = other.getProductString();
-    usagePage           = other.getUsagePage();
-    usage               = other.getUsage();
-    interfaceNumber     = other.getInterfaceNumber();
-}
-
-hid::MutableDeviceInfo::MutableDeviceInfo (const hid::MutableDeviceInfo& other)
-{
-    path                = other.getPath();
-    vendorId            = other.getVendorId();
-    productId           = other.getProductId();
-    serialNumber        = other.getSerialNumber();
-    releaseNumber       = other.getReleaseNumber();
-    manufacturerString  = other.getManufacturerString();
-    productString       = other.getProductString();
-    usagePage           = other.getUsagePage();
-    usage               = other.getUsage();
-    interfaceNumber     = other.getInterfaceNumber();
-}
-
-bool hid::MutableDeviceInfo::operator== (const DeviceInfo& other) const
-{
-    return
-       this->path               == other.path
-    && this->vendorId           == other.vendorId
-    && this->productId          == other.productId
-    && this->serialNumber       == other.serialNumber
-    && this->releaseNumber      == other.releaseNumber
-    && this->manufacturerString == other.manufacturerString
-    && this->productString      == other.productString
-    && this->usagePage          == other.usagePage
-    && this->usage              == other.usage
-    && this->interfaceNumber    == other.interfaceNumber;
-}
-
-bool hid::MutableDeviceInfo::operator== (const MutableDeviceInfo& other) const
-{
-    return
-       this->path               == other.path
-    && this->vendorId           == other.vendorId
-    && this->productId          == other.productId
-    && this->serialNumber       == other.serialNumber
-    && this->releaseNumber      == other.releaseNumber
-    && this->manufacturerString == other.manufacturerString
-    && this->productString      == other.productString
-    && this->usagePage          == other.usagePage
-    && this->usage              == other.usage
-    && this->interfaceNumber    == other.interfaceNumber;
-}
-
-bool hid::MutableDeviceInfo::operator== (const DeviceIO& other) const
-{
-    return *this == other.getInfo();
-}
-
-const String&        hid::MutableDeviceInfo::getPath()               const { return path; }
-const unsigned short hid::MutableDeviceInfo::getVendorId()           const { return vendorId; };
-const unsigned short hid::MutableDeviceInfo::getProductId()          const { return productId; };
-const String&        hid::MutableDeviceInfo::getSerialNumber()       const { return serialNumber; };
-const unsigned short hid::MutableDeviceInfo::getReleaseNumber()      const { return releaseNumber; };
-const String&        hid::MutableDeviceInfo::getManufacturerString() const { return manufacturerString; };
-const String&        hid::MutableDeviceInfo::getProductString()      const { return productString; };
-const unsigned short hid::MutableDeviceInfo::getUsagePage()          const { return usagePage; };
-const unsigned short hid::MutableDeviceInfo::getUsage()              const { return usage; };
-const int            hid::MutableDeviceInfo::getInterfaceNumber()    const { return interfaceNumber; };
-const String         hid::MutableDeviceInfo::getName()               const {
-    return manufacturerString + " " + productString;
-}
-
-hid::DeviceIO hid::MutableDeviceInfo::connect() const
-{
-    return hid::connect(*this);
-}
-
-void hid::MutableDeviceInfo::disconnect() const
-{
-    hid::disconnect();
-}
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-hid::DeviceIterator::DeviceIterator (unsigned short vid, unsigned short pid)
-: current(hid_enumerate(vid, pid)) 
-{
-	DeleteThis = current;
-}
-
-hid::DeviceIterator::~DeviceIterator()
-{
-    hid_free_enumeration(DeleteThis);
-}
-
-bool hid::DeviceIterator::hasNext()
-{
-    return current != nullptr;
-}
-
-hid::DeviceInfo hid::DeviceIterator::getNext()
-{
-    // You must call hasNext() first to see if there is one available!
-    // Program will crash if you try to getNext() when there are none.
-    jassert(current != nullptr);
-    
-    hid_device_info* deviceToReturn = current;
-    current = current->next;
-    
-    return *deviceToReturn;
-}
-
-
-
-
-
-
-
-
-
-
-
-
-hid::DeviceIO::DeviceIO (Device deviceToUse, const DeviceInfo& deviceInfo)
-                      : device(deviceToUse), info(deviceInfo) {}
-
-hid::DeviceIO::DeviceIO (const DeviceIO& other) : device(other.device), info(other.info) {}
-
-bool hid::DeviceIO::operator==(const DeviceIO& other) const
-{
-    return
-       this->device == other.device
-    && DeviceInfo(this->info) == DeviceInfo(other.info);
-}
-
-bool hid::DeviceIO::operator==(const DeviceInfo& other) const
-{
-    return getInfo() == other;
-}
-
-bool hid::DeviceIO::operator==(const MutableDeviceInfo& other) const
-{
-    return getInfo() == other;
-}
-
-Result hid::DeviceIO::setNonblocking(bool shouldBeNonblocking)
-{
-    int r = hid_set_nonblocking(device, shouldBeNonblocking);
-    return r == HID_ERROR
-        ? Result::fail(TRANS(hid_error(device)))
-        : Result::ok();
-}
-
-Result hid::DeviceIO::write(const unsigned char *data, size_t length, size_t* bytesWritten)
-{
-    int r = hid_write(device, data, length);
-    if (bytesWritten != nullptr) {
-        *bytesWritten = (size_t) r;
-    }
-    return r == 0
-        ? Result::fail(TRANS("no bytes written"))
-        : r == HID_ERROR
-            ? Result::fail(TRANS(hid_error(device)))
-            : Result::ok();
-}
-
-Result hid::DeviceIO::read(unsigned char *data, size_t length, size_t* bytesRead)
-{
-    int r = hid_read(device, data, length);
-    
-    if (bytesRead != nullptr) {
-        *bytesRead = (size_t) r;
-    }
-    return r == 0
-        ? Result::fail(TRANS("no bytes read"))
-        : r == HID_ERROR
-            ? Result::fail(TRANS(hid_error(device)))
-            : Result::ok();
-}
-
-Result hid::DeviceIO::readTimeout(unsigned char *data, size_t length, int milliseconds, size_t* bytesRead)
-{
-    int r = hid_read_timeout (device, data, length, milliseconds);
-
-    if (bytesRead != nullptr) {
-        *bytesRead = (size_t) r;
-    }
-    return r == 0
-        ? Result::fail(TRANS("no bytes read"))
-        : r == HID_ERROR
-            ? Result::fail(TRANS(hid_error(device)))
-            : Result::ok();
-}
-
-Result hid::DeviceIO::sendFeatureReport(const unsigned char *data, size_t length, size_t* bytesWritten)
-{
-    int r = hid_send_feature_report(device, data, length);
-    if (bytesWritten != nullptr) {
-        *bytesWritten = (size_t) r;
-    }
-    return r == 0
-        ? Result::fail(TRANS("no bytes written"))
-        : r == HID_ERROR
-            ? Result::fail(TRANS(hid_error(device)))
-            : Result::ok();
-}
-
-Result hid::DeviceIO::getFeatureReport(unsigned char *data, size_t length, size_t* bytesRead)
-{
-    int r = hid_get_feature_report(device, data, length);
-
-    if (bytesRead != nullptr) {
-        *bytesRead = (size_t) r;
-    }
-    return r == 0 || r == 1
-        ? Result::fail(TRANS("no bytes read"))
-        : r == HID_ERROR
-            ? Result::fail(TRANS(hid_error(device)))
-            : Result::ok();
-}
-
-Result hid::DeviceIO::getManufacturerString(wchar_t* string, size_t maxLength)
-{
-    int r = hid_get_manufacturer_string(device, string, maxLength);
-    return r == HID_ERROR
-        ? Result::fail(TRANS(hid_error(device)))
-        : Result::ok();
-}
-
-Result hid::DeviceIO::getProductString(wchar_t* string, size_t maxLength)
-{
-    int r = hid_get_product_string(device, string, maxLength);
-    return r == HID_ERROR
-        ? Result::fail(TRANS(hid_error(device)))
-        : Result::ok();
-}
-
-Result hid::DeviceIO::getSerialNumberString(wchar_t* string, size_t maxLength)
-{
-    int r = hid_get_serial_number_string(device, string, maxLength);
-    return r == HID_ERROR
-        ? Result::fail(TRANS(hid_error(device)))
-        : Result::ok();
-}
-
-Result hid::DeviceIO::getIndexedString(int index, wchar_t* string, size_t maxLength)
-{
-    int r = hid_get_indexed_string(device, index, string, maxLength);
-    return r == HID_ERROR
-        ? Result::fail(TRANS("hid_get_indexed_string not implemented on macOS"))
-        : Result::ok();
-}
-
-void hid::DeviceIO::disconnect()
-{
-    if (device == nullptr || ! hid::isConnected()) {
-        DBG("    Warning: disconnecting device when none are connected.");
-    }
-    hid_close(device);
-    device = nullptr;
-}
-
-Result hid::DeviceIO::connect()
-{
-    if (device != nullptr || hid::isConnected()) {
-        return Result::fail(TRANS("Already connected to device"));
-    }
-    
-    *this = info.connect();
-    
-    if (device == nullptr) {
-        return Result::fail(TRANS("failed to connect to device"));
-    }
-    
-    return Result::ok();
-}
-
-const hid::DeviceInfo hid::DeviceIO::getInfo() const
-{
-    return info;
-}
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-hid::DeviceScanner::DeviceScanner() : DeviceScanner (nullptr) {}
-hid::DeviceScanner::DeviceScanner(ChangeListener* listener, int intervalInMilliseconds)
-{
-    if (listener != nullptr) {
-        addChangeListener(listener);
-    }
-    startTimer(intervalInMilliseconds);
-}
-
-hid::DeviceScanner::~DeviceScanner()
-{
-    removeAllChangeListeners();
-    stopTimer();
-}
-
-void hid::DeviceScanner::timerCallback()
-{
-    scanNow();
-}
-
-const Array<hid::DeviceInfo>& hid::DeviceScanner::getCurrentDevices() const
-{
-    return devices;
-}
-
-void hid::DeviceScanner::scanNow()
-{
-    Array<DeviceInfo> newDevices = hid::getAllDevicesAvailable();
-    
-    // Device removed or connected
-    if (newDevices.size() != devices.size()) {
-        devices = newDevices;
-        sendChangeMessage();
-    }
-}
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-bool hid::isDeviceAvailable (unsigned short vid, unsigned short pid)
-{
-    hid::DeviceIterator iterator (vid, pid);
-    return iterator.hasNext();
-}
-
-hid::DeviceInfo hid::getDeviceInfo(unsigned short vid, unsigned short pid)
-{
-    hid::DeviceIterator iterator (vid, pid);
-    
-    // Can't get the next device when there are none! Check if it's availiable with
-    // isDeviceAvailable (unsigned short vid, unsigned short pid).
-    jassert(iterator.hasNext());
-    return iterator.getNext();
-}
-
-Array<hid::DeviceInfo> hid::getAllDevicesAvailable()
-{
-    Array<DeviceInfo> allDevices;
-    hid::DeviceIterator iterator;
-    while (iterator.hasNext()) {
-        allDevices.add(iterator.getNext());
-    }
-    return allDevices;
-}
-
-void hid::printAllDevices()
-{
-    hid::DeviceIterator iterator;
-    
-    while (iterator.hasNext())
-    {
-        DeviceInfo currentDevice (iterator.getNext());
-        
-        String s;
-        String usage_str;
-        s += "0x" + String::toHexString (currentDevice.getVendorId()).paddedLeft('0', 4) + ":";
-        s += "0x" + String::toHexString (currentDevice.getProductId()).paddedLeft('0', 4);
-        s += String(" ") + currentDevice.getManufacturerString();
-        s += String(" ") + currentDevice.getProductString();
-        
-        usage_str += "0x" + String::toHexString (currentDevice.getUsagePage()).paddedLeft('0', 4);
-        usage_str += ":0x" + String::toHexString (currentDevice.getUsage()).paddedLeft('0', 4);
-        s += " " + usage_str;
-        
-        std::cout << s << "\n";
-        std::cout << currentDevice.getPath() << "\n\n";
-    }
-}
-
-hid::DeviceIO hid::getConnectedDevice()
-{
-    // Don't call this function if no device is connected!!!!!!!
-    jassert(isConnected());
-    
-    return changeConnection(false, DeviceInfo(hid_device_info()), true);
-}
-
-const hid::DeviceInfo hid::getConnectedDeviceInfo()
-{
-    // Don't call this function if no device is connected!!!!!!!
-    jassert(isConnected());
-    
-    return getConnectedDevice().getInfo();
-}
-
-bool hid::isConnected()
-{
-    return connectionStatus(false);
-}
-
-hid::DeviceIO hid::connect (const DeviceInfo& device)
-{
-    return changeConnection(true, device);
-}
-
-void hid::disconnect()
-{
-    changeConnection(false);
-}
-
-const unsigned int hid::reportID()
-{
-    static unsigned int idCounter = 0;
-    return idCounter++;
-}
-
-// Why use a class when you could use a function
-// Don't worry it's a rhetorical question — this approach worked for my
-// specific use case, but this could easily be replaced with something
-// a little more clear.
-//
-// These functions maintain an internal static device representation and 
-// are the single point of entry for all connection/disconnection related things.
-// Note that this only supports one connection at a time.
-bool hid::connectionStatus (bool shouldSet, bool shouldBeConnected)
-{
-    static bool isConnected = false;
-
-    if (shouldSet) {
-        isConnected = shouldBeConnected;
-    }
-    
-    return isConnected;
-}
-
-hid::DeviceIO hid::changeConnection(bool shouldConnect, const DeviceInfo& deviceInfo, bool get)
-{
-    static MutableDeviceInfo connectedDeviceInfo;
-    static Device connectedDevice = nullptr;
-    
-    if (get) {
-        return DeviceIO(connectedDevice, connectedDeviceInfo);
-    }
-    connectionStatus(true, false);
-    if (shouldConnect) {
-        if ((connectedDevice = hid_open_path(deviceInfo.getPath().toRawUTF8())) != nullptr) {
-            // Connection Success
-            connectedDeviceInfo = deviceInfo;
-            DBG("    HID Device Connected: " << deviceInfo.getName());
-            connectionStatus(true, true);
-        }
-        else {
-            DBG("    HID Device Failed To Connect: " << deviceInfo.getName());
-        }
-    }
-    else if (connectedDevice != nullptr) {
-        hid_close(connectedDevice);
-        connectedDevice = nullptr;
-        DBG("    HID Device Disconnected: " << connectedDeviceInfo.getName());
-    }
-    else {
-        DBG("    Could not disconnect HID Device - none connected.");
-    }
-
-    return DeviceIO(connectedDevice, connectedDeviceInfo);
-}
+/*
+  ==============================================================================
+
+    juce_hid.cpp
+    Created: 7 Dec 2017 3:16:59pm
+    Author:  Chris Penny
+
+  ==============================================================================
+*/
+
+#define HID_ERROR -1
+#ifndef DEFAULT_SIZE
+    #define DEFAULT_SIZE 2048
+#endif
+
+using namespace juce;
+
+Result hid::init()
+{
+    int res = hid_init();
+    return res == HID_ERROR
+        ? Result::fail(TRANS("could not initialize hidapi"))
+        : Result::ok();
+}
+
+Result hid::exit()
+{
+    int res = hid_exit();
+    return res == HID_ERROR
+        ? Result::fail(TRANS("could not exit hidapi"))
+        : Result::ok();
+}
+
+namespace
+{
+    // Interned records, keyed by their hash. The table holds a reference to
+    // each record, so a record with a reference count of 1 is unused.
+    struct DeviceRecordTable
+    {
+        CriticalSection lock;
+        HashMap<int64, hid::DeviceRecord::Ptr> records;
+        int purgeThreshold = 64;
+    };
+    
+    DeviceRecordTable& getDeviceRecordTable()
+    {
+        static DeviceRecordTable table;
+        return table;
+    }
+    
+    // 64-bit FNV-1a, fed field by field.
+    const uint64 fnvOffsetBasis = 14695981039346656037ULL;
+    const uint64 fnvPrime       = 1099511628211ULL;
+    
+    uint64 hashBytes (uint64 hash, const void* data, size_t numBytes)
+    {
+        const uint8* bytes = static_cast<const uint8*> (data);
+        for (size_t i = 0; i < numBytes; ++i) {
+            hash = (hash ^ bytes[i]) * fnvPrime;
+        }
+        return hash;
+    }
+    
+    uint64 hashString (uint64 hash, const char* s)
+    {
+        hash = hashBytes (hash, s, s != nullptr ? strlen(s) : 0);
+        return (hash ^ 0xff) * fnvPrime;
+    }
+    
+    uint64 hashString (uint64 hash, const wchar_t* s)
+    {
+        hash = hashBytes (hash, s, s != nullptr ? wcslen(s) * sizeof(wchar_t) : 0);
+        return (hash ^ 0xff) * fnvPrime;
+    }
+    
+    template <typename Number>
+    uint64 hashNumber (uint64 hash, Number n)
+    {
+        return hashBytes (hash, &n, sizeof(n));
+    }
+    
+    bool stringMatches (const String& s, const char* raw)
+    {
+        return raw != nullptr ? s == raw : s.isEmpty();
+    }
+    
+    bool stringMatches (const String& s, const wchar_t* raw)
+    {
+        return raw != nullptr ? s == raw : s.isEmpty();
+    }
+    
+    // Scans that skip strings leave all three NULL.
+    bool infoHasStrings (const hid_device_info& info)
+    {
+        return info.serial_number != nullptr
+            || info.manufacturer_string != nullptr
+            || info.product_string != nullptr;
+    }
+}
+
+hid::DeviceRecord::DeviceRecord (const hid_device_info& info, uint64 hashToUse)
+: path               (info.path)
+, vendorId           (info.vendor_id)
+, productId          (info.product_id)
+, releaseNumber      (info.release_number)
+, usagePage          (info.usage_page)
+, usage              (info.usage)
+, interfaceNumber    (info.interface_number)
+, hash               (hashToUse)
+, stringsRead        (0)
+{
+    if (infoHasStrings (info)) {
+        setStrings (info.serial_number, info.manufacturer_string, info.product_string);
+    }
+}
+
+// The strings are left out, so that a record looked up from a scan that
+// skipped them is the same record as one that has them.
+uint64 hid::DeviceRecord::hashOf (const hid_device_info& info)
+{
+    uint64 h = fnvOffsetBasis;
+    h = hashString (h, info.path);
+    h = hashNumber (h, info.vendor_id);
+    h = hashNumber (h, info.product_id);
+    h = hashNumber (h, info.release_number);
+    h = hashNumber (h, info.usage_page);
+    h = hashNumber (h, info.usage);
+    h = hashNumber (h, info.interface_number);
+    return h;
+}
+
+hid::DeviceRecord::Ptr hid::DeviceRecord::intern (const hid_device_info& info)
+{
+    const uint64 h = hashOf (info);
+    DeviceRecordTable& table = getDeviceRecordTable();
+    const ScopedLock sl (table.lock);
+    
+    if (table.records.contains ((int64) h)) {
+        Ptr existing = table.records[(int64) h];
+        
+        if (! existing->hasSameAddress (info)) {
+            // Hash collision — hand out a private record rather than evicting.
+            return new DeviceRecord (info, h);
+        }
+        
+        if (! existing->hasStrings()) {
+            existing->adoptStrings (info);
+            return existing;
+        }
+        
+        if (infoHasStrings (info)) {
+            if (existing->matches (info)) {
+                return existing;
+            }
+            // Another unit at the same path. Anyone still holding the old
+            // record keeps it; new lookups get this one.
+            Ptr record = new DeviceRecord (info, h);
+            table.records.set ((int64) h, record);
+            return record;
+        }
+        
+        // A scan without strings can't tell whether this is still the unit
+        // the strings came from, as a path can belong to a port rather than
+        // a unit. If only the table and we hold the record nobody relies on
+        // them, so forget them. Otherwise keep the record as it is: checking
+        // would cost OS calls on every scan for exactly the devices in use.
+        if (existing->getReferenceCount() == 2) {
+            existing->forgetStrings();
+        }
+        return existing;
+    }
+    
+    if (table.records.size() >= table.purgeThreshold) {
+        purgeUnused();
+        table.purgeThreshold = jmax (64, table.records.size() * 2);
+    }
+    
+    Ptr record = new DeviceRecord (info, h);
+    table.records.set ((int64) h, record);
+    return record;
+}
+
+void hid::DeviceRecord::purgeUnused()
+{
+    DeviceRecordTable& table = getDeviceRecordTable();
+    const ScopedLock sl (table.lock);
+    
+    Array<int64> unused;
+    for (HashMap<int64, Ptr>::Iterator i (table.records); i.next();) {
+        if (i.getValue()->getReferenceCount() == 1) {
+            unused.add (i.getKey());
+        }
+    }
+    for (int64 key : unused) {
+        table.records.remove (key);
+    }
+}
+
+bool hid::DeviceRecord::matches (const DeviceRecord& other) const
+{
+    return
+       this->path               == other.path
+    && this->vendorId           == other.vendorId
+    && this->productId          == other.productId
+    && this->releaseNumber      == other.releaseNumber
+    && this->usagePage          == other.usagePage
+    && this->usage              == other.usage
+    && this->interfaceNumber    == other.interfaceNumber
+    && stringsMatch (other);
+}
+
+bool hid::DeviceRecord::matches (const hid_device_info& info) const
+{
+    if (! hasSameAddress (info)) {
+        return false;
+    }
+    
+    if (! infoHasStrings (info) || ! this->hasStrings()) {
+        return true;
+    }
+    
+    return
+       stringMatches (this->serialNumber,       info.serial_number)
+    && stringMatches (this->manufacturerString, info.manufacturer_string)
+    && stringMatches (this->productString,      info.product_string);
+}
+
+// Everything but the strings, i.e. what hashOf() covers.
+bool hid::DeviceRecord::hasSameAddress (const hid_device_info& info) const
+{
+    return
+       stringMatches (this->path,       info.path)
+    && this->vendorId           == info.vendor_id
+    && this->productId          == info.product_id
+    && this->releaseNumber      == info.release_number
+    && this->usagePage          == info.usage_page
+    && this->usage              == info.usage
+    && this->interfaceNumber    == info.interface_number;
+}
+
+bool hid::DeviceRecord::stringsMatch (const DeviceRecord& other) const
+{
+    if (! this->hasStrings() || ! other.hasStrings()) {
+        return true;
+    }
+    
+    return
+       this->serialNumber       == other.serialNumber
+    && this->manufacturerString == other.manufacturerString
+    && this->productString      == other.productString;
+}
+
+bool hid::DeviceRecord::hasStrings() const
+{
+    return stringsRead.get() != 0;
+}
+
+const String& hid::DeviceRecord::getSerialNumber() const
+{
+    fetchStrings();
+    return serialNumber;
+}
+
+const String& hid::DeviceRecord::getManufacturerString() const
+{
+    fetchStrings();
+    return manufacturerString;
+}
+
+const String& hid::DeviceRecord::getProductString() const
+{
+    fetchStrings();
+    return productString;
+}
+
+const std::wstring& hid::DeviceRecord::getSerialNumberWide() const
+{
+    fetchStrings();
+    return serialNumberWide;
+}
+
+const std::wstring& hid::DeviceRecord::getManufacturerStringWide() const
+{
+    fetchStrings();
+    return manufacturerStringWide;
+}
+
+const std::wstring& hid::DeviceRecord::getProductStringWide() const
+{
+    fetchStrings();
+    return productStringWide;
+}
+
+void hid::DeviceRecord::fetchStrings() const
+{
+    if (hasStrings() || path.isEmpty()) {
+        return;
+    }
+    
+    const ScopedLock sl (stringLock);
+    if (hasStrings()) {
+        return;
+    }
+    
+    const size_t maxLength = 256;
+    wchar_t serial[maxLength]       = { 0 };
+    wchar_t manufacturer[maxLength] = { 0 };
+    wchar_t product[maxLength]      = { 0 };
+    
+    // If the device has gone away the strings stay empty, and we'll try again
+    // next time rather than caching that.
+    if (hid_get_strings_by_path (path.toRawUTF8(), serial, manufacturer, product, maxLength) == HID_ERROR) {
+        return;
+    }
+    
+    setStrings (serial, manufacturer, product);
+}
+
+bool hid::DeviceRecord::readStrings (hid_device* device) const
+{
+    if (hasStrings() || device == nullptr || path.isEmpty()) {
+        return hasStrings();
+    }
+    
+    {
+        const ScopedLock sl (stringLock);
+        if (hasStrings()) {
+            return true;
+        }
+        
+        const size_t maxLength = 256;
+        wchar_t serial[maxLength]       = { 0 };
+        wchar_t manufacturer[maxLength] = { 0 };
+        wchar_t product[maxLength]      = { 0 };
+        
+        if (hid_get_serial_number_string (device, serial, maxLength) != HID_ERROR
+         && hid_get_manufacturer_string (device, manufacturer, maxLength) != HID_ERROR
+         && hid_get_product_string (device, product, maxLength) != HID_ERROR) {
+            setStrings (serial, manufacturer, product);
+            return true;
+        }
+    }
+    
+    // Some backends can't read every string through a handle; try by path.
+    fetchStrings();
+    return hasStrings();
+}
+
+const hid::DeviceRecord::IndexedString* hid::DeviceRecord::getIndexedString (hid_device* device, int index) const
+{
+    const ScopedLock sl (stringLock);
+    
+    for (const IndexedString* s : indexedStrings) {
+        if (s->index == index) {
+            return s;
+        }
+    }
+    
+    if (device == nullptr) {
+        return nullptr;
+    }
+    
+    // Failures aren't remembered, as the device may just have been busy.
+    const size_t maxLength = 256;
+    wchar_t text[maxLength] = { 0 };
+    if (hid_get_indexed_string (device, index, text, maxLength) == HID_ERROR) {
+        return nullptr;
+    }
+    
+    IndexedString* s = new IndexedString();
+    s->index = index;
+    s->text = text;
+    s->wide = text;
+    return indexedStrings.add (s);
+}
+
+// Called with stringLock held, or from the constructor.
+void hid::DeviceRecord::setStrings (const wchar_t* serial, const wchar_t* manufacturer, const wchar_t* product) const
+{
+    serialNumberWide       = serial       != nullptr ? serial       : L"";
+    manufacturerStringWide = manufacturer != nullptr ? manufacturer : L"";
+    productStringWide      = product      != nullptr ? product      : L"";
+    serialNumber       = serialNumberWide.c_str();
+    manufacturerString = manufacturerStringWide.c_str();
+    productString      = productStringWide.c_str();
+    stringsRead = 1;
+}
+
+// Only called by intern() when nothing else holds the record, so no one
+// has a reference to the strings or indexed strings being dropped.
+void hid::DeviceRecord::forgetStrings() const
+{
+    const ScopedLock sl (stringLock);
+    stringsRead = 0;
+    serialNumber       = String();
+    manufacturerString = String();
+    productString      = String();
+    serialNumberWide.clear();
+    manufacturerStringWide.clear();
+    productStringWide.clear();
+    indexedStrings.clear();
+}
+
+// Fills in the strings from a scan that read them, saving a fetch later.
+void hid::DeviceRecord::adoptStrings (const hid_device_info& info) const
+{
+    if (hasStrings() || ! infoHasStrings (info)) {
+        return;
+    }
+    
+    const ScopedLock sl (stringLock);
+    if (hasStrings()) {
+        return;
+    }
+    
+    setStrings (info.serial_number, info.manufacturer_string, info.product_string);
+}
+
+// Same record, or same hash and same contents (only reachable after a collision)
+static bool sameRecord (const hid::DeviceRecord::Ptr& a, const hid::DeviceRecord::Ptr& b)
+{
+    return a == b || (a->hash == b->hash && a->matches (*b));
+}
+
+
+
+
+
+
+
+
+
+
+
+// Shared by every default-constructed and moved-from DeviceInfo. Held here
+// as well as in the table, so it's never purged and a move never has to
+// intern it again.
+static const hid::DeviceRecord::Ptr& getEmptyRecord()
+{
+    static const hid::DeviceRecord::Ptr empty (hid::DeviceRecord::intern (hid_device_info()));
+    return empty;
+}
+
+hid::DeviceInfo::DeviceInfo()
+: record (getEmptyRecord()) {}
+
+hid::DeviceInfo::DeviceInfo (const hid_device_info& info)
+: record (DeviceRecord::intern (info)) {}
+
+// The copy and move are done in the body, so they're inside the guard.
+hid::DeviceInfo::DeviceInfo (const DeviceInfo& other) noexcept
+{
+    HID_FORBID_ALLOCATIONS ("DeviceInfo copy");
+    record = other.record;
+}
+
+hid::DeviceInfo::DeviceInfo (DeviceInfo&& other) noexcept
+{
+    HID_FORBID_ALLOCATIONS ("DeviceInfo move");
+    record = std::move (other.record);
+    other.record = getEmptyRecord();
+}
+
+hid::DeviceInfo& hid::DeviceInfo::operator= (const DeviceInfo& other) noexcept
+{
+    HID_FORBID_ALLOCATIONS ("DeviceInfo::operator=");
+    record = other.record;
+    return *this;
+}
+
+hid::DeviceInfo& hid::DeviceInfo::operator= (DeviceInfo&& other) noexcept
+{
+    HID_FORBID_ALLOCATIONS ("DeviceInfo move assignment");
+    if (this != &other) {
+        record = std::move (other.record);
+        other.record = getEmptyRecord();
+    }
+    return *this;
+}
+
+bool hid::DeviceInfo::operator== (const DeviceInfo& other) const
+{
+    HID_FORBID_ALLOCATIONS ("DeviceInfo::operator==");
+    return sameRecord (record, other.record);
+}
+
+bool hid::DeviceInfo::operator== (const DeviceIO& other) const
+{
+    return *this == other.getInfo();
+}
+
+const String&        hid::DeviceInfo::getPath()               const { return record->path; }
+const unsigned short hid::DeviceInfo::getVendorId()           const { return record->vendorId; };
+const unsigned short hid::DeviceInfo::getProductId()          const { return record->productId; };
+const String&        hid::DeviceInfo::getSerialNumber()       const { return record->getSerialNumber(); };
+const unsigned short hid::DeviceInfo::getReleaseNumber()      const { return record->releaseNumber; };
+const String&        hid::DeviceInfo::getManufacturerString() const { return record->getManufacturerString(); };
+const String&        hid::DeviceInfo::getProductString()      const { return record->getProductString(); };
+const unsigned short hid::DeviceInfo::getUsagePage()          const { return record->usagePage; };
+const unsigned short hid::DeviceInfo::getUsage()              const { return record->usage; };
+const int            hid::DeviceInfo::getInterfaceNumber()    const { return record->interfaceNumber; };
+const String         hid::DeviceInfo::getName()               const {
+    return record->getManufacturerString() + " " + record->getProductString();
+}
+
+hid::DeviceIO hid::DeviceInfo::connect() const
+{
+    return hid::connect(*this);
+}
+
+void hid::DeviceInfo::disconnect() const
+{
+    hid::disconnect();
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+namespace
+{
+    hid::ThreadOptions& getDefaultThreadOptionsStorage()
+    {
+        static hid::ThreadOptions options;
+        return options;
+    }
+    
+    // The name pointer is only valid as long as options is.
+    hid_thread_options toBackendOptions (const hid::ThreadOptions& options)
+    {
+        hid_thread_options o;
+        zerostruct (o);
+        o.policy = (int) options.policy;
+        o.priority = options.priority;
+        o.affinity_mask = options.affinityMask;
+        o.name = options.name.isNotEmpty() ? options.name.toRawUTF8() : nullptr;
+        o.latency_probe_ms = options.latencyProbeInterval;
+        return o;
+    }
+    
+    void HID_API_CALL callDropListener (hid_device*, unsigned long long totalDropped, void* context)
+    {
+        static_cast<hid::DropListener*> (context)->inputReportsDropped (totalDropped);
+    }
+    
+    hid::ThreadStats toThreadStats (const hid_thread_stats& s)
+    {
+        hid::ThreadStats stats;
+        stats.numSamples  = s.num_samples;
+        stats.meanLatency = s.num_samples > 0 ? s.total_latency_ns / s.num_samples : 0;
+        stats.maxLatency  = s.max_latency_ns;
+        stats.lastLatency = s.last_latency_ns;
+        return stats;
+    }
+}
+
+hid::LatencyHistogram::LatencyHistogram() noexcept
+{
+    zerostruct (histogram);
+}
+
+hid::LatencyHistogram::LatencyHistogram (const hid_latency_histogram& other) noexcept
+: histogram (other) {}
+
+uint64 hid::LatencyHistogram::getCount() const noexcept
+{
+    return histogram.count;
+}
+
+uint64 hid::LatencyHistogram::getMean() const noexcept
+{
+    return histogram.count > 0 ? histogram.total_ns / histogram.count : 0;
+}
+
+uint64 hid::LatencyHistogram::getMax() const noexcept
+{
+    return histogram.max_ns;
+}
+
+uint64 hid::LatencyHistogram::getPercentile (double proportion) const noexcept
+{
+    // The counts are copied one at a time while the backend keeps adding to
+    // them, so they may not quite add up to count.
+    uint64 total = 0;
+    for (int i = 0; i < HID_LATENCY_HISTOGRAM_BUCKETS; ++i) {
+        total += histogram.buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    
+    const uint64 target = jmax ((uint64) 1, (uint64) std::ceil (jlimit (0.0, 1.0, proportion) * (double) total));
+    uint64 seen = 0;
+    
+    for (int i = 0; i < HID_LATENCY_HISTOGRAM_BUCKETS - 1; ++i) {
+        seen += histogram.buckets[i];
+        if (seen >= target) {
+            // The top of the bucket, as the whole bucket is at or below it.
+            return jmin ((uint64) (hid_latency_bucket_lower_bound (i + 1) - 1), (uint64) histogram.max_ns);
+        }
+    }
+    return histogram.max_ns;
+}
+
+void hid::LatencyHistogram::addSample (uint64 nanoseconds) noexcept
+{
+    histogram.count++;
+    histogram.total_ns += nanoseconds;
+    histogram.max_ns = jmax ((uint64) histogram.max_ns, nanoseconds);
+    histogram.buckets[hid_latency_bucket (nanoseconds)]++;
+}
+
+void hid::LatencyHistogram::merge (const LatencyHistogram& other) noexcept
+{
+    histogram.count += other.histogram.count;
+    histogram.total_ns += other.histogram.total_ns;
+    histogram.max_ns = jmax ((uint64) histogram.max_ns, (uint64) other.histogram.max_ns);
+    for (int i = 0; i < HID_LATENCY_HISTOGRAM_BUCKETS; ++i) {
+        histogram.buckets[i] += other.histogram.buckets[i];
+    }
+}
+
+hid::RealtimeReportQueue::RealtimeReportQueue (int capacity, size_t maxReportSizeToUse)
+: fifo (capacity + 1) // AbstractFifo keeps one slot free
+, slots ((size_t) capacity + 1)
+, storage (((size_t) capacity + 1) * maxReportSizeToUse)
+, maxReportSize (maxReportSizeToUse)
+, numDropped (0) {}
+
+unsigned char* hid::RealtimeReportQueue::getSlotData (int index) const noexcept
+{
+    return storage + (size_t) index * maxReportSize;
+}
+
+bool hid::RealtimeReportQueue::push (const unsigned char* data, size_t length, uint64 timestamp) noexcept
+{
+    HID_FORBID_ALLOCATIONS ("RealtimeReportQueue::push");
+    if (length > maxReportSize || fifo.getFreeSpace() == 0) {
+        ++numDropped;
+        return false;
+    }
+    
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite (1, start1, size1, start2, size2);
+    const int index = size1 > 0 ? start1 : start2;
+    
+    memcpy (getSlotData (index), data, length);
+    slots[index].length = length;
+    slots[index].timestamp = timestamp;
+    
+    fifo.finishedWrite (1);
+    return true;
+}
+
+bool hid::RealtimeReportQueue::pop (unsigned char* data, size_t& length, uint64& timestamp) noexcept
+{
+    HID_FORBID_ALLOCATIONS ("RealtimeReportQueue::pop");
+    int start1, size1, start2, size2;
+    fifo.prepareToRead (1, start1, size1, start2, size2);
+    if (size1 + size2 == 0) {
+        return false;
+    }
+    
+    const int index = size1 > 0 ? start1 : start2;
+    length = slots[index].length;
+    timestamp = slots[index].timestamp;
+    memcpy (data, getSlotData (index), length);
+    
+    fifo.finishedRead (1);
+    return true;
+}
+
+int hid::RealtimeReportQueue::getNumReady() const noexcept
+{
+    return fifo.getNumReady();
+}
+
+int hid::RealtimeReportQueue::getCapacity() const noexcept
+{
+    return fifo.getTotalSize() - 1;
+}
+
+size_t hid::RealtimeReportQueue::getMaxReportSize() const noexcept
+{
+    return maxReportSize;
+}
+
+int hid::RealtimeReportQueue::getNumDropped() const noexcept
+{
+    return numDropped.get();
+}
+
+void hid::RealtimeReportQueue::reset() noexcept
+{
+    fifo.reset();
+    numDropped = 0;
+}
+
+hid::ReportReader::ReportReader (const DeviceIO& deviceToRead, RealtimeReportQueue& queueToFill)
+: Thread ("HID Report Reader")
+, device (deviceToRead)
+, queue (&queueToFill)
+, pool (nullptr)
+, lane (-1)
+, failed (0)
+, options (hid::getDefaultReaderThreadOptions())
+, optionsChanged (1)
+{
+    zerostruct (stats);
+}
+
+hid::ReportReader::ReportReader (const DeviceIO& deviceToRead, DecodePool& poolToFeed, int laneToFeed)
+: Thread ("HID Report Reader")
+, device (deviceToRead)
+, queue (nullptr)
+, pool (&poolToFeed)
+, lane (laneToFeed)
+, failed (0)
+, options (hid::getDefaultReaderThreadOptions())
+, optionsChanged (1)
+{
+    zerostruct (stats);
+}
+
+hid::ReportReader::~ReportReader()
+{
+    stop();
+}
+
+void hid::ReportReader::start()
+{
+    failed = 0;
+    optionsChanged = 1;
+    startThread();
+}
+
+void hid::ReportReader::setThreadOptions (const ThreadOptions& newOptions)
+{
+    {
+        const SpinLock::ScopedLockType sl (statsLock);
+        options = newOptions;
+    }
+    optionsChanged = 1;
+}
+
+hid::ThreadStats hid::ReportReader::getStats() const
+{
+    const SpinLock::ScopedLockType sl (statsLock);
+    return toThreadStats (stats);
+}
+
+void hid::ReportReader::stop()
+{
+    stopThread (1000);
+}
+
+bool hid::ReportReader::isRunning() const
+{
+    return isThreadRunning();
+}
+
+bool hid::ReportReader::hasFailed() const
+{
+    return failed.get() != 0;
+}
+
+void hid::ReportReader::run()
+{
+    HID_TRACE_PREPARE_THREAD();
+    
+    // Goes straight to the backend: DeviceIO::readReport() builds a Result
+    // string for every timeout, and can't tell a timeout from an error.
+    while (! threadShouldExit()) {
+        if (optionsChanged.exchange (0) != 0) {
+            ThreadOptions current;
+            {
+                const SpinLock::ScopedLockType sl (statsLock);
+                current = options;
+            }
+            hid::setCurrentThreadOptions (current);
+        }
+        
+        hid_report* report = nullptr;
+        int r;
+        {
+            // Counted rather than forbidden: the backend's report pool can
+            // still grow while the reader gets going.
+            HID_COUNT_ALLOCATIONS ("ReportReader: read");
+            r = hid_read_report_timeout (device.device, &report, 100);
+        }
+        
+        if (r == HID_ERROR) {
+            failed = 1;
+            break;
+        }
+        
+        if (report != nullptr) {
+            HID_TRACE_SCOPE ("ReportReader: report");
+            const uint64 now = hid_get_monotonic_time();
+            const uint64 latency = now > report->timestamp ? now - report->timestamp : 0;
+            
+            if (pool != nullptr) {
+                pool->submit (lane, ReportView (report));
+            } else {
+                queue->push (report->data, report->length, report->timestamp);
+                hid_report_release (report);
+            }
+            
+            const SpinLock::ScopedLockType sl (statsLock);
+            stats.num_samples++;
+            stats.total_latency_ns += latency;
+            stats.last_latency_ns = latency;
+            stats.max_latency_ns = jmax (stats.max_latency_ns, (unsigned long long) latency);
+        }
+    }
+}
+
+hid::FeatureReportBatch::FeatureReportBatch()
+: Thread ("HID Feature Report Batch")
+, dataSize (0)
+, readbackBufferSize (0)
+, stopOnError (true)
+, device (nullptr, DeviceInfo())
+, listener (nullptr)
+, numDone (0)
+, numFailed (0)
+, totalTime (0)
+, result (Result::ok()) {}
+
+hid::FeatureReportBatch::~FeatureReportBatch()
+{
+    cancel();
+}
+
+void hid::FeatureReportBatch::add (const unsigned char* report, size_t length)
+{
+    add (report, length, nullptr, 0);
+}
+
+void hid::FeatureReportBatch::add (const unsigned char* report, size_t length,
+                                   const unsigned char* expected, size_t expectedLength)
+{
+    jassert (! isThreadRunning()); // don't change a batch that's being sent
+    jassert (report != nullptr && length > 0);
+    
+    const size_t needed = dataSize + length + expectedLength;
+    if (data.getSize() < needed) {
+        data.setSize (jmax (needed, data.getSize() * 2), false);
+    }
+    
+    Item item;
+    item.offset = dataSize;
+    item.length = length;
+    item.expectedOffset = dataSize + length;
+    item.expectedLength = expected != nullptr ? expectedLength : 0;
+    
+    unsigned char* const base = static_cast<unsigned char*> (data.getData());
+    memcpy (base + item.offset, report, length);
+    if (item.expectedLength > 0) {
+        memcpy (base + item.expectedOffset, expected, item.expectedLength);
+    }
+    dataSize = item.expectedOffset + item.expectedLength;
+    
+    if (item.expectedLength > readbackBufferSize) {
+        readbackBufferSize = item.expectedLength;
+        readbackBuffer.realloc (readbackBufferSize);
+    }
+    items.add (item);
+}
+
+void hid::FeatureReportBatch::add (const MemoryBlock& report)
+{
+    add (static_cast<const unsigned char*> (report.getData()), report.getSize());
+}
+
+void hid::FeatureReportBatch::add (const MemoryBlock& report, const MemoryBlock& expected)
+{
+    add (static_cast<const unsigned char*> (report.getData()), report.getSize(),
+         static_cast<const unsigned char*> (expected.getData()), expected.getSize());
+}
+
+void hid::FeatureReportBatch::clear()
+{
+    jassert (! isThreadRunning());
+    
+    items.clearQuick();
+    dataSize = 0;
+    numDone = 0;
+    numFailed = 0;
+    totalTime = 0;
+    
+    const ScopedLock sl (resultLock);
+    result = Result::ok();
+}
+
+int hid::FeatureReportBatch::size() const
+{
+    return items.size();
+}
+
+void hid::FeatureReportBatch::setStopOnError (bool shouldStop)
+{
+    stopOnError = shouldStop;
+}
+
+Result hid::FeatureReportBatch::send (DeviceIO& deviceToUse)
+{
+    if (isThreadRunning()) {
+        return Result::fail(TRANS("the batch is already being sent"));
+    }
+    if (deviceToUse.device == nullptr) {
+        return Result::fail(TRANS("no device"));
+    }
+    return sendAll (deviceToUse.device, nullptr);
+}
+
+Result hid::FeatureReportBatch::sendInBackground (const DeviceIO& deviceToUse, Listener* listenerToUse)
+{
+    if (isThreadRunning()) {
+        return Result::fail(TRANS("the batch is already being sent"));
+    }
+    if (deviceToUse.device == nullptr) {
+        return Result::fail(TRANS("no device"));
+    }
+    
+    device = deviceToUse;
+    listener = listenerToUse;
+    startThread();
+    return Result::ok();
+}
+
+bool hid::FeatureReportBatch::isSending() const
+{
+    return isThreadRunning();
+}
+
+void hid::FeatureReportBatch::cancel()
+{
+    // The report being sent can't be interrupted, so wait for it.
+    stopThread (-1);
+}
+
+bool hid::FeatureReportBatch::waitUntilFinished (int timeoutMs) const
+{
+    return waitForThreadToExit (timeoutMs);
+}
+
+hid::FeatureReportBatch::ItemResult hid::FeatureReportBatch::getItemResult (int index) const
+{
+    return isPositiveAndBelow (index, numDone.get())
+        ? items.getReference (index).result
+        : ItemResult();
+}
+
+int hid::FeatureReportBatch::getNumDone() const
+{
+    return numDone.get();
+}
+
+int hid::FeatureReportBatch::getNumSucceeded() const
+{
+    return numDone.get() - numFailed.get();
+}
+
+int hid::FeatureReportBatch::getNumFailed() const
+{
+    return numFailed.get();
+}
+
+uint64 hid::FeatureReportBatch::getTotalTime() const
+{
+    return totalTime.get();
+}
+
+Result hid::FeatureReportBatch::getResult() const
+{
+    const ScopedLock sl (resultLock);
+    return result;
+}
+
+void hid::FeatureReportBatch::run()
+{
+    const Result r = sendAll (device.device, listener);
+    
+    if (listener != nullptr) {
+        listener->featureReportBatchFinished (r);
+    }
+}
+
+Result hid::FeatureReportBatch::sendAll (Device handle, Listener* listenerToTell)
+{
+    HID_TRACE_SCOPE ("FeatureReportBatch::send");
+    HID_COUNT_ALLOCATIONS ("FeatureReportBatch::send");
+    
+    numDone = 0;
+    numFailed = 0;
+    
+    // Goes straight to the backend, like ReportReader, so that a report costs
+    // a status in the item rather than a Result; only the first error's
+    // message is built.
+    const unsigned char* const base = static_cast<const unsigned char*> (data.getData());
+    const int numItems = items.size();
+    const uint64 batchStart = hid_get_monotonic_time();
+    int firstFailure = -1;
+    String firstError;
+    
+    for (int i = 0; i < numItems; ++i) {
+        if (threadShouldExit() || (stopOnError && firstFailure >= 0)) {
+            break;
+        }
+        
+        Item& item = items.getReference (i);
+        item.result = ItemResult();
+        const uint64 start = hid_get_monotonic_time();
+        
+        int r = hid_send_feature_report (handle, base + item.offset, item.length);
+        if (r > 0) {
+            item.result.numBytes = (size_t) r;
+            item.result.status = sent;
+            
+            if (item.expectedLength > 0) {
+                readbackBuffer[0] = base[item.expectedOffset];
+                r = hid_get_feature_report (handle, readbackBuffer, item.expectedLength);
+                
+                // As in getFeatureReport(), 1 byte is just the report ID.
+                item.result.status = r <= 1 ? readbackFailed
+                                   : (size_t) r < item.expectedLength
+                                     || memcmp (readbackBuffer, base + item.expectedOffset, item.expectedLength) != 0
+                                       ? mismatch
+                                       : verified;
+            }
+        }
+        else {
+            item.result.status = sendFailed;
+        }
+        item.result.nanoseconds = hid_get_monotonic_time() - start;
+        
+        const Status status = item.result.status;
+        if (status != sent && status != verified) {
+            if (firstFailure < 0) {
+                firstFailure = i;
+                firstError = status == mismatch   ? TRANS("read back different")
+                           : r == HID_ERROR       ? TRANS(hid_error(handle))
+                           : status == sendFailed ? TRANS("no bytes written")
+                                                  : TRANS("no bytes read");
+            }
+            numFailed += 1;
+        }
+        numDone = i + 1;
+        
+        if (listenerToTell != nullptr) {
+            listenerToTell->featureReportsSent (i + 1, numItems);
+        }
+    }
+    totalTime = hid_get_monotonic_time() - batchStart;
+    
+    Result r = Result::ok();
+    if (firstFailure >= 0) {
+        r = Result::fail(TRANS("feature report") + " " + String (firstFailure + 1) + "/" + String (numItems) + ": " + firstError);
+    }
+    else if (numDone.get() < numItems) {
+        r = Result::fail(TRANS("the batch was cancelled"));
+    }
+    
+    const ScopedLock sl (resultLock);
+    result = r;
+    return r;
+}
+
+#if JUCE_HID_COROUTINES
+hid::AsyncOperation::AsyncOperation (AsyncLoop& loopToUse, Type typeToUse, Device deviceToUse,
+                                     unsigned char* dataToUse, size_t lengthToUse, int timeout) noexcept
+: loop (loopToUse)
+, type (typeToUse)
+, device (deviceToUse)
+, data (dataToUse)
+, length (lengthToUse)
+, milliseconds (timeout) {}
+
+void hid::AsyncOperation::await_suspend (std::coroutine_handle<> handleToResume)
+{
+    handle = handleToResume;
+    if (type == readType && milliseconds >= 0) {
+        deadline = hid_get_monotonic_time() + (uint64) milliseconds * 1000000;
+    }
+    // May be resumed on the loop's thread before submit() returns, so this
+    // mustn't be touched afterwards.
+    loop.submit (this);
+}
+
+hid::AsyncLoop::AsyncLoop()
+: Thread ("HID Async Loop")
+, numPending (0)
+, numTransfers (0)
+, wakeRequested (0)
+, wakeUp (false)
+, transfers (numTransferThreads)
+{
+    startThread();
+}
+
+hid::AsyncLoop::~AsyncLoop()
+{
+    signalThreadShouldExit();
+    wakeUp.signal();
+    // Long enough for transfers that are already running to finish.
+    stopThread (5000);
+}
+
+hid::AsyncLoop& hid::AsyncLoop::getDefault()
+{
+    static AsyncLoop loop;
+    return loop;
+}
+
+int hid::AsyncLoop::getNumPending() const
+{
+    return numPending.get();
+}
+
+void hid::AsyncLoop::submit (AsyncOperation* operation)
+{
+    ++numPending;
+    {
+        const ScopedLock sl (lock);
+        incoming.add (operation);
+    }
+    wake();
+}
+
+// Lots of reports can arrive between two passes; one signal covers them all.
+void hid::AsyncLoop::wake()
+{
+    if (wakeRequested.compareAndSetBool (1, 0)) {
+        wakeUp.signal();
+    }
+}
+
+void HID_API_CALL hid::AsyncLoop::inputArrived (hid_device*, void* context)
+{
+    static_cast<AsyncLoop*> (context)->wake();
+}
+
+// Only reads are polled; everything else goes to the transfer threads.
+bool hid::AsyncLoop::poll (AsyncOperation& op, uint64 now)
+{
+    AsyncResult& result = op.result;
+    hid_report* report = nullptr;
+    int r = hid_read_report_timeout (op.device, &report, 0);
+    
+    if (r == 0 && (op.deadline == 0 || now < op.deadline)) {
+        return false;
+    }
+    result.report = ReportView (report);
+    result.result = r == 0
+        ? Result::fail(TRANS("no bytes read"))
+        : r == HID_ERROR
+            ? Result::fail(TRANS(hid_error(op.device)))
+            : Result::ok();
+    result.numBytes = (size_t) r;
+    return true;
+}
+
+void hid::AsyncLoop::startTransfer (AsyncOperation* op)
+{
+    ++numTransfers;
+    transfers.addJob ([this, op]
+    {
+        transfer (*op);
+        {
+            const ScopedLock sl (lock);
+            transferred.add (op);
+        }
+        wake();
+        // The loop waits for this before it stops, so it's the last use of this.
+        --numTransfers;
+    });
+}
+
+void hid::AsyncLoop::transfer (AsyncOperation& op)
+{
+    AsyncResult& result = op.result;
+    int r;
+    
+    switch (op.type)
+    {
+        case AsyncOperation::writeType:
+            r = hid_write (op.device, op.data, op.length);
+            result.result = r == HID_ERROR
+                ? Result::fail(TRANS(hid_error(op.device)))
+                : Result::ok();
+            break;
+            
+        case AsyncOperation::getFeatureReportType:
+            r = hid_get_feature_report (op.device, op.data, op.length);
+            result.result = r == 0 || r == 1
+                ? Result::fail(TRANS("no bytes read"))
+                : r == HID_ERROR
+                    ? Result::fail(TRANS(hid_error(op.device)))
+                    : Result::ok();
+            break;
+            
+        default:
+            jassertfalse;
+            r = HID_ERROR;
+            result.result = Result::fail(TRANS("not a transfer"));
+            break;
+    }
+    
+    result.numBytes = (size_t) r;
+}
+
+void hid::AsyncLoop::run()
+{
+    while (! threadShouldExit()) {
+        wakeRequested = 0;
+        {
+            const ScopedLock sl (lock);
+            arrived.swapWith (incoming);
+            completed.addArray (transferred);
+            transferred.clearQuick();
+        }
+        
+        for (auto* op : arrived) {
+            if (op->type == AsyncOperation::readType) {
+                // Set before the first poll, so nothing arrives unnoticed in
+                // between. A backend that can't do it once never will.
+                op->polled = ! hasInputCallbacks
+                          || hid_set_input_callback (op->device, inputArrived, this) == HID_ERROR;
+                hasInputCallbacks = ! op->polled;
+                pending.add (op);
+            } else {
+                startTransfer (op);
+            }
+        }
+        arrived.clearQuick();
+        
+        const uint64 now = hid_get_monotonic_time();
+        uint64 nextDeadline = 0;
+        bool anyPolled = false;
+        
+        for (int i = pending.size(); --i >= 0;) {
+            AsyncOperation* op = pending.getUnchecked (i);
+            if (poll (*op, now)) {
+                if (! op->polled) {
+                    hid_set_input_callback (op->device, nullptr, nullptr);
+                }
+                completed.add (op);
+                pending.remove (i);
+                continue;
+            }
+            
+            anyPolled = anyPolled || op->polled;
+            if (op->deadline != 0 && (nextDeadline == 0 || op->deadline < nextDeadline)) {
+                nextDeadline = op->deadline;
+            }
+        }
+        
+        // Oldest first. Resuming can submit the coroutine's next operation,
+        // which is picked up on the next pass.
+        for (int i = completed.size(); --i >= 0;) {
+            --numPending;
+            completed.getUnchecked (i)->handle.resume();
+        }
+        
+        if (! completed.isEmpty()) {
+            completed.clearQuick();
+        } else if (anyPolled) {
+            // A backend without input callbacks has nothing to wait on.
+            wakeUp.wait (1);
+        } else if (nextDeadline != 0) {
+            const uint64 untilDeadline = nextDeadline - now;
+            wakeUp.wait ((int) jlimit ((uint64) 1, (uint64) 100, (untilDeadline + 999999) / 1000000));
+        } else {
+            wakeUp.wait (100);
+        }
+    }
+    
+    // Transfers already handed out are waited for, so their coroutines get
+    // their results.
+    while (numTransfers.get() > 0) {
+        wakeUp.wait (1);
+    }
+    
+    {
+        const ScopedLock sl (lock);
+        completed.addArray (transferred);
+        transferred.clearQuick();
+        pending.addArray (incoming);
+        incoming.clearQuick();
+    }
+    for (auto* op : completed) {
+        --numPending;
+        op->handle.resume();
+    }
+    completed.clearQuick();
+    
+    for (auto* op : pending) {
+        if (op->type == AsyncOperation::readType && ! op->polled) {
+            hid_set_input_callback (op->device, nullptr, nullptr);
+        }
+        op->result.result = Result::fail(TRANS("the async loop was stopped"));
+        op->result.numBytes = (size_t) HID_ERROR;
+        --numPending;
+        op->handle.resume();
+    }
+    pending.clearQuick();
+}
+#endif
+
+struct hid::DecodePool::Lane
+{
+    Lane (int laneIndex, int homeWorker) : index (laneIndex), home (homeWorker), scheduled (false) {}
+    
+    const int index, home;
+    CriticalSection lock;
+    Array<ReportView> pending;      // guarded by lock
+    Array<ReportView> batch;        // only touched by the thread that holds the lane
+    bool scheduled;                 // guarded by lock: waiting on a worker or being handled
+};
+
+class hid::DecodePool::Worker :   public Thread
+{
+public:
+    
+    Worker (DecodePool& owner, int workerIndex)
+    : Thread ("HID Decode Worker")
+    , pool (owner)
+    , index (workerIndex)
+    , wakeUp (false)
+    , busy (0)
+    , idle (0) {}
+    
+    void run()
+    {
+        HID_TRACE_PREPARE_THREAD();
+        int idleTimeout = minIdleTimeout;
+        
+        while (! threadShouldExit()) {
+            // Marked idle before looking, so that a lane scheduled after the
+            // look finds this worker to wake.
+            idle = 1;
+            Lane* lane = takeOwn();
+            if (lane == nullptr) {
+                lane = pool.steal (index);
+            }
+            if (lane == nullptr) {
+                // schedule() wakes an idle worker whenever there's a lane to
+                // steal. The timeout only covers a steal that lost a race for
+                // a queue's lock, so it backs off while nothing happens.
+                if (! wakeUp.wait (idleTimeout)) {
+                    idleTimeout = jmin (idleTimeout * 2, (int) maxIdleTimeout);
+                }
+                continue;
+            }
+            
+            idle = 0;
+            busy = 1;
+            pool.handleLane (*lane, index);
+            busy = 0;
+            idleTimeout = minIdleTimeout;
+        }
+    }
+    
+    /** Returns true if the lane has to wait for this worker to finish
+     *  something else first.
+     */
+    bool add (Lane* lane)
+    {
+        bool hasToWait;
+        {
+            const ScopedLock sl (lock);
+            waiting.add (lane);
+            hasToWait = waiting.size() > 1 || busy.get() != 0;
+        }
+        wakeUp.signal();
+        return hasToWait;
+    }
+    
+    bool isIdle() const
+    {
+        return idle.get() != 0;
+    }
+    
+    // The owner takes from the front, thieves from the back, so they rarely
+    // want the same lane.
+    Lane* takeOwn()
+    {
+        const ScopedLock sl (lock);
+        if (waiting.isEmpty()) {
+            return nullptr;
+        }
+        Lane* lane = waiting.getFirst();
+        waiting.remove (0);
+        return lane;
+    }
+    
+    Lane* takeForThief()
+    {
+        const ScopedTryLock sl (lock);
+        if (! sl.isLocked() || waiting.isEmpty()) {
+            return nullptr;
+        }
+        Lane* lane = waiting.getLast();
+        waiting.removeLast();
+        return lane;
+    }
+    
+    void wake()
+    {
+        wakeUp.signal();
+    }
+    
+private:
+    
+    enum { minIdleTimeout = 5, maxIdleTimeout = 1000 };
+    
+    DecodePool& pool;
+    const int index;
+    CriticalSection lock;
+    Array<Lane*> waiting;
+    WaitableEvent wakeUp;
+    Atomic<int> busy, idle;
+};
+
+hid::DecodePool::DecodePool (Handler handlerToUse, int numThreads)
+: handler (handlerToUse)
+{
+    if (numThreads <= 0) {
+        numThreads = SystemStats::getNumCpus();
+    }
+    
+    for (int i = 0; i < numThreads; ++i) {
+        workers.add (new Worker (*this, i));
+    }
+    for (auto* worker : workers) {
+        worker->startThread();
+    }
+}
+
+hid::DecodePool::~DecodePool()
+{
+    for (auto* worker : workers) {
+        worker->signalThreadShouldExit();
+        worker->wake();
+    }
+    for (auto* worker : workers) {
+        worker->stopThread (1000);
+    }
+}
+
+int hid::DecodePool::addLane()
+{
+    const ScopedWriteLock sl (lanesLock);
+    const int index = lanes.size();
+    lanes.add (new Lane (index, index % workers.size()));
+    return index;
+}
+
+int hid::DecodePool::getNumLanes() const
+{
+    const ScopedReadLock sl (lanesLock);
+    return lanes.size();
+}
+
+int hid::DecodePool::getNumThreads() const
+{
+    return workers.size();
+}
+
+bool hid::DecodePool::submit (int laneIndex, const ReportView& report)
+{
+    HID_COUNT_ALLOCATIONS ("DecodePool::submit");
+    Lane* lane;
+    {
+        const ScopedReadLock sl (lanesLock);
+        if (! isPositiveAndBelow (laneIndex, lanes.size())) {
+            return false;
+        }
+        lane = lanes.getUnchecked (laneIndex);
+    }
+    
+    ++numSubmitted;
+    
+    bool needsScheduling;
+    {
+        const ScopedLock sl (lane->lock);
+        lane->pending.add (report);
+        needsScheduling = ! lane->scheduled;
+        lane->scheduled = true;
+    }
+    
+    if (needsScheduling) {
+        schedule (lane, lane->home);
+    }
+    return true;
+}
+
+void hid::DecodePool::schedule (Lane* lane, int workerIndex)
+{
+    if (workers.getUnchecked (workerIndex)->add (lane)) {
+        wakeThief (workerIndex);
+    }
+}
+
+void hid::DecodePool::wakeThief (int busyWorkerIndex)
+{
+    const int numWorkers = workers.size();
+    for (int i = 1; i < numWorkers; ++i) {
+        Worker* worker = workers.getUnchecked ((busyWorkerIndex + i) % numWorkers);
+        if (worker->isIdle()) {
+            worker->wake();
+            return;
+        }
+    }
+}
+
+hid::DecodePool::Lane* hid::DecodePool::steal (int thiefIndex)
+{
+    const int numWorkers = workers.size();
+    for (int i = 1; i < numWorkers; ++i) {
+        if (Lane* lane = workers.getUnchecked ((thiefIndex + i) % numWorkers)->takeForThief()) {
+            ++numStolen;
+            return lane;
+        }
+    }
+    return nullptr;
+}
+
+void hid::DecodePool::handleLane (Lane& lane, int workerIndex)
+{
+    HID_TRACE_SCOPE ("DecodePool::handleLane");
+    
+    {
+        const ScopedLock sl (lane.lock);
+        lane.batch.swapWith (lane.pending);
+    }
+    
+    for (const auto& report : lane.batch) {
+        handler (lane.index, report);
+    }
+    
+    const int numInBatch = lane.batch.size();
+    lane.batch.clearQuick();     // keeps its storage for the next batch
+    numHandled += numInBatch;
+    
+    bool hasMore;
+    {
+        const ScopedLock sl (lane.lock);
+        hasMore = ! lane.pending.isEmpty();
+        lane.scheduled = hasMore;
+    }
+    
+    // Goes to the back of this worker's queue so other lanes get a turn, and
+    // stays there for thieves if this worker falls behind. No thief is woken
+    // for it: this worker is about to look at its queue again, and any lane
+    // already waiting there woke one when it was scheduled.
+    if (hasMore) {
+        workers.getUnchecked (workerIndex)->add (&lane);
+    }
+}
+
+bool hid::DecodePool::waitUntilIdle (int timeoutMs) const
+{
+    const uint32 start = Time::getMillisecondCounter();
+    
+    while (numHandled.get() < numSubmitted.get()) {
+        if (timeoutMs >= 0 && (int) (Time::getMillisecondCounter() - start) >= timeoutMs) {
+            return false;
+        }
+        Thread::sleep (1);
+    }
+    return true;
+}
+
+int64 hid::DecodePool::getNumHandled() const
+{
+    return numHandled.get();
+}
+
+int64 hid::DecodePool::getNumStolen() const
+{
+    return numStolen.get();
+}
+
+
+
+
+
+
+
+
+
+
+
+hid::ControlEventBuffer::ControlEventBuffer (int capacityToUse)
+: events ((size_t) capacityToUse)
+, capacity (capacityToUse)
+, numEvents (0)
+, numDropped (0) {}
+
+bool hid::ControlEventBuffer::addEvent (int samplePosition, int controller, int value, uint64 timestamp) noexcept
+{
+    HID_FORBID_ALLOCATIONS ("ControlEventBuffer::addEvent");
+    if (numEvents >= capacity) {
+        ++numDropped;
+        return false;
+    }
+    
+    ControlEvent& e = events[numEvents++];
+    e.samplePosition = samplePosition;
+    e.controller = controller;
+    e.value = value;
+    e.timestamp = timestamp;
+    return true;
+}
+
+void hid::ControlEventBuffer::clear() noexcept
+{
+    numEvents = 0;
+}
+
+bool hid::ControlEventBuffer::isEmpty() const noexcept
+{
+    return numEvents == 0;
+}
+
+int hid::ControlEventBuffer::getNumEvents() const noexcept
+{
+    return numEvents;
+}
+
+int hid::ControlEventBuffer::getNumDropped() const noexcept
+{
+    return numDropped;
+}
+
+const hid::ControlEvent* hid::ControlEventBuffer::begin() const noexcept
+{
+    return events.getData();
+}
+
+const hid::ControlEvent* hid::ControlEventBuffer::end() const noexcept
+{
+    return events.getData() + numEvents;
+}
+
+hid::SampleAligner::SampleAligner() : sampleRate (44100.0), latency (0) {}
+
+void hid::SampleAligner::prepare (double newSampleRate, int samplesPerBlock)
+{
+    sampleRate = newSampleRate;
+    latency = samplesToNanoseconds (samplesPerBlock);
+}
+
+void hid::SampleAligner::setLatency (uint64 nanoseconds) noexcept
+{
+    latency = nanoseconds;
+}
+
+uint64 hid::SampleAligner::getLatency() const noexcept
+{
+    return latency;
+}
+
+uint64 hid::SampleAligner::samplesToNanoseconds (int numSamples) const noexcept
+{
+    return (uint64) ((double) numSamples * 1.0e9 / sampleRate);
+}
+
+int hid::SampleAligner::getSamplePosition (uint64 timestamp, uint64 blockStartTime, int numSamples) const noexcept
+{
+    const uint64 due = timestamp + latency;
+    if (due <= blockStartTime || numSamples <= 0) {
+        return 0; // Late: play it as soon as possible
+    }
+    
+    const int position = (int) ((double) (due - blockStartTime) * sampleRate / 1.0e9);
+    return jmin (position, numSamples - 1);
+}
+
+
+
+
+
+
+
+
+
+
+
+hid::DeviceFilter::DeviceFilter()
+{
+    zerostruct (filter);
+    filter.skip_strings = 1;
+}
+
+hid::DeviceFilter& hid::DeviceFilter::setIds (unsigned short vid, unsigned short pid)
+{
+    filter.vendor_id = vid;
+    filter.product_id = pid;
+    return *this;
+}
+
+hid::DeviceFilter& hid::DeviceFilter::setUsage (unsigned short usagePage, unsigned short usage)
+{
+    filter.usage_page = usagePage;
+    filter.usage = usage;
+    return *this;
+}
+
+hid::DeviceFilter& hid::DeviceFilter::setInterfaceNumber (int interfaceNumber)
+{
+    filter.match_interface_number = 1;
+    filter.interface_number = interfaceNumber;
+    return *this;
+}
+
+hid::DeviceFilter& hid::DeviceFilter::setPathPrefix (const String& prefix)
+{
+    pathPrefix = prefix;
+    return *this;
+}
+
+hid::DeviceFilter& hid::DeviceFilter::setReadStrings (bool shouldReadStrings)
+{
+    filter.skip_strings = shouldReadStrings ? 0 : 1;
+    return *this;
+}
+
+hid::DeviceFilter& hid::DeviceFilter::setPredicate (Predicate newPredicate)
+{
+    predicate = std::move (newPredicate);
+    return *this;
+}
+
+int hid::DeviceFilter::callPredicate (const hid_device_info* info, void* context)
+{
+    const DeviceFilter* owner = static_cast<const DeviceFilter*> (context);
+    return owner->predicate (*info) ? 1 : 0;
+}
+
+hid_device_info* hid::DeviceFilter::enumerate() const
+{
+    HID_TRACE_SCOPE ("DeviceFilter::enumerate");
+    HID_COUNT_ALLOCATIONS ("DeviceFilter::enumerate");
+    
+    // The C filter only borrows the prefix and the predicate for the duration
+    // of the call, so they're wired up here rather than stored in it.
+    hid_enumerate_filter f (filter);
+    f.path_prefix = pathPrefix.isNotEmpty() ? pathPrefix.toRawUTF8() : nullptr;
+    f.predicate = predicate ? &DeviceFilter::callPredicate : nullptr;
+    f.context = const_cast<DeviceFilter*> (this);
+    return hid_enumerate_filtered (&f);
+}
+
+hid::DeviceIterator::DeviceIterator (unsigned short vid, unsigned short pid)
+: current(DeviceFilter().setIds(vid, pid).enumerate()) 
+{
+	DeleteThis = current;
+}
+
+hid::DeviceIterator::DeviceIterator (const DeviceFilter& filter)
+: current(filter.enumerate())
+{
+    DeleteThis = current;
+}
+
+hid::DeviceIterator::~DeviceIterator()
+{
+    hid_free_enumeration(DeleteThis);
+}
+
+bool hid::DeviceIterator::hasNext()
+{
+    return current != nullptr;
+}
+
+hid::DeviceInfo hid::DeviceIterator::getNext()
+{
+    // You must call hasNext() first to see if there is one available!
+    // Program will crash if you try to getNext() when there are none.
+    jassert(current != nullptr);
+    
+    hid_device_info* deviceToReturn = current;
+    current = current->next;
+    
+    return *deviceToReturn;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+hid::ReportView::ReportView() noexcept : report(nullptr) {}
+
+hid::ReportView::ReportView (hid_report* reportToUse) noexcept : report(reportToUse) {}
+
+hid::ReportView::ReportView (const ReportView& other) noexcept : report(other.report)
+{
+    HID_FORBID_ALLOCATIONS ("ReportView copy");
+    hid_report_retain(report);
+}
+
+hid::ReportView::ReportView (ReportView&& other) noexcept : report(other.report)
+{
+    other.report = nullptr;
+}
+
+hid::ReportView& hid::ReportView::operator= (const ReportView& other) noexcept
+{
+    HID_FORBID_ALLOCATIONS ("ReportView::operator=");
+    if (report != other.report) {
+        hid_report_retain(other.report);
+        hid_report_release(report);
+        report = other.report;
+    }
+    return *this;
+}
+
+hid::ReportView& hid::ReportView::operator= (ReportView&& other) noexcept
+{
+    std::swap(report, other.report);
+    return *this;
+}
+
+hid::ReportView::~ReportView()
+{
+    release();
+}
+
+bool                 hid::ReportView::isValid()     const noexcept { return report != nullptr; }
+const unsigned char* hid::ReportView::getData()     const noexcept { return report != nullptr ? report->data : nullptr; }
+size_t               hid::ReportView::getSize()     const noexcept { return report != nullptr ? report->length : 0; }
+unsigned char        hid::ReportView::getReportID() const noexcept { return report != nullptr ? report->report_id : 0; }
+uint64               hid::ReportView::getTimestamp() const noexcept { return report != nullptr ? report->timestamp : 0; }
+
+void hid::ReportView::release() noexcept
+{
+    hid_report_release(report);
+    report = nullptr;
+}
+
+
+
+
+
+
+
+
+
+
+
+hid::DeviceIO::DeviceIO (Device deviceToUse, const DeviceInfo& deviceInfo)
+                      : device(deviceToUse), info(deviceInfo)
+{
+    // Kept here so the buffer-based calls don't have to ask. The backends read
+    // the lengths when the device is opened, so this doesn't talk to the OS.
+    // The strings go into the shared record, so only the first DeviceIO for a
+    // device reads them.
+    if (device != nullptr) {
+        hid_get_max_report_lengths(device, &reportLengths.input, &reportLengths.output, &reportLengths.feature);
+        info.record->readStrings(device);
+    }
+}
+
+hid::DeviceIO::DeviceIO (const DeviceIO& other)
+                      : device(other.device), info(other.info), reportLengths(other.reportLengths) {}
+
+hid::DeviceIO::DeviceIO (DeviceIO&& other) noexcept
+                      : device(other.device), info(std::move(other.info)), reportLengths(other.reportLengths)
+{
+    other.device = nullptr;
+}
+
+hid::DeviceIO& hid::DeviceIO::operator= (const DeviceIO& other)
+{
+    device = other.device;
+    info = other.info;
+    reportLengths = other.reportLengths;
+    return *this;
+}
+
+hid::DeviceIO& hid::DeviceIO::operator= (DeviceIO&& other) noexcept
+{
+    device = other.device;
+    info = std::move(other.info);
+    reportLengths = other.reportLengths;
+    other.device = nullptr;
+    return *this;
+}
+
+bool hid::DeviceIO::operator==(const DeviceIO& other) const
+{
+    return
+       this->device == other.device
+    && this->info   == other.info;
+}
+
+bool hid::DeviceIO::operator==(const DeviceInfo& other) const
+{
+    return info == other;
+}
+
+Result hid::DeviceIO::setNonblocking(bool shouldBeNonblocking)
+{
+    int r = hid_set_nonblocking(device, shouldBeNonblocking);
+    return r == HID_ERROR
+        ? Result::fail(TRANS(hid_error(device)))
+        : Result::ok();
+}
+
+Result hid::DeviceIO::write(const unsigned char *data, size_t length, size_t* bytesWritten)
+{
+    HID_TRACE_SCOPE ("DeviceIO::write");
+    HID_COUNT_ALLOCATIONS ("DeviceIO::write");
+    int r = hid_write(device, data, length);
+    if (bytesWritten != nullptr) {
+        *bytesWritten = (size_t) r;
+    }
+    return r == 0
+        ? Result::fail(TRANS("no bytes written"))
+        : r == HID_ERROR
+            ? Result::fail(TRANS(hid_error(device)))
+            : Result::ok();
+}
+
+Result hid::DeviceIO::writeMany (const hid_output_report* reports, size_t count, size_t* numWritten)
+{
+    HID_TRACE_SCOPE ("DeviceIO::writeMany");
+    HID_COUNT_ALLOCATIONS ("DeviceIO::writeMany");
+    int r = count > 0 ? hid_write_many (device, reports, count, nullptr) : 0;
+    if (numWritten != nullptr) {
+        *numWritten = (size_t) r;
+    }
+    return (size_t) r == count
+        ? Result::ok()
+        : Result::fail(TRANS(hid_error(device)));
+}
+
+Result hid::DeviceIO::read(unsigned char *data, size_t length, size_t* bytesRead)
+{
+    HID_TRACE_SCOPE ("DeviceIO::read");
+    HID_COUNT_ALLOCATIONS ("DeviceIO::read");
+    int r = hid_read(device, data, length);
+    
+    if (bytesRead != nullptr) {
+        *bytesRead = (size_t) r;
+    }
+    return r == 0
+        ? Result::fail(TRANS("no bytes read"))
+        : r == HID_ERROR
+            ? Result::fail(TRANS(hid_error(device)))
+            : Result::ok();
+}
+
+Result hid::DeviceIO::readTimeout(unsigned char *data, size_t length, int milliseconds, size_t* bytesRead)
+{
+    HID_TRACE_SCOPE ("DeviceIO::readTimeout");
+    HID_COUNT_ALLOCATIONS ("DeviceIO::readTimeout");
+    int r = hid_read_timeout (device, data, length, milliseconds);
+
+    if (bytesRead != nullptr) {
+        *bytesRead = (size_t) r;
+    }
+    return r == 0
+        ? Result::fail(TRANS("no bytes read"))
+        : r == HID_ERROR
+            ? Result::fail(TRANS(hid_error(device)))
+            : Result::ok();
+}
+
+Result hid::DeviceIO::readReport(ReportView& view, int milliseconds)
+{
+    HID_TRACE_SCOPE ("DeviceIO::readReport");
+    HID_COUNT_ALLOCATIONS ("DeviceIO::readReport");
+    hid_report* report = nullptr;
+    int r = hid_read_report_timeout (device, &report, milliseconds);
+    
+    view = ReportView (report);
+    return r == 0
+        ? Result::fail(TRANS("no bytes read"))
+        : r == HID_ERROR
+            ? Result::fail(TRANS(hid_error(device)))
+            : Result::ok();
+}
+
+Result hid::DeviceIO::sendFeatureReport(const unsigned char *data, size_t length, size_t* bytesWritten)
+{
+    HID_TRACE_SCOPE ("DeviceIO::sendFeatureReport");
+    HID_COUNT_ALLOCATIONS ("DeviceIO::sendFeatureReport");
+    int r = hid_send_feature_report(device, data, length);
+    if (bytesWritten != nullptr) {
+        *bytesWritten = (size_t) r;
+    }
+    return r == 0
+        ? Result::fail(TRANS("no bytes written"))
+        : r == HID_ERROR
+            ? Result::fail(TRANS(hid_error(device)))
+            : Result::ok();
+}
+
+Result hid::DeviceIO::getFeatureReport(unsigned char *data, size_t length, size_t* bytesRead)
+{
+    HID_TRACE_SCOPE ("DeviceIO::getFeatureReport");
+    HID_COUNT_ALLOCATIONS ("DeviceIO::getFeatureReport");
+    int r = hid_get_feature_report(device, data, length);
+
+    if (bytesRead != nullptr) {
+        *bytesRead = (size_t) r;
+    }
+    return r == 0 || r == 1
+        ? Result::fail(TRANS("no bytes read"))
+        : r == HID_ERROR
+            ? Result::fail(TRANS(hid_error(device)))
+            : Result::ok();
+}
+
+Result hid::DeviceIO::setFeatureReportCache (int timeToLiveMs)
+{
+    return hid_set_feature_report_cache (device, timeToLiveMs) == HID_ERROR
+        ? Result::fail(TRANS("could not set up the feature report cache"))
+        : Result::ok();
+}
+
+Result hid::DeviceIO::invalidateFeatureReportCache (int reportID)
+{
+    return hid_invalidate_feature_report_cache (device, reportID) == HID_ERROR
+        ? Result::fail(TRANS("invalid report ID"))
+        : Result::ok();
+}
+
+namespace
+{
+    hid::IOResult toIOResult (const Result& result, size_t numBytes)
+    {
+        hid::IOResult io;
+        io.result = result;
+        io.numBytes = result.wasOk() ? numBytes : 0;
+        return io;
+    }
+    
+    // How many reports the buffer versions of writeMany() hand to
+    // the backend at a time, gathered on the stack.
+    constexpr int writeManyChunk = 32;
+    
+    // Gathers the reports chunk by chunk and writes them, stopping at the first failure.
+    template <typename ReportArray, typename GetReport>
+    Result writeManyInChunks (hid::DeviceIO& io, const ReportArray& reports, size_t count,
+                              size_t* numWritten, GetReport getReport)
+    {
+        hid_output_report chunk[writeManyChunk];
+        size_t total = 0;
+        Result result = Result::ok();
+        
+        for (size_t first = 0; first < count && result.wasOk(); first += writeManyChunk) {
+            const size_t n = jmin ((size_t) writeManyChunk, count - first);
+            for (size_t i = 0; i < n; ++i) {
+                chunk[i] = getReport (reports, first + i);
+            }
+            size_t written = 0;
+            result = io.writeMany (chunk, n, &written);
+            total += written;
+        }
+        
+        if (numWritten != nullptr) {
+            *numWritten = total;
+        }
+        return result;
+    }
+    
+    // Grows a block to fit the largest report, never shrinks it.
+    unsigned char* prepareBlock (MemoryBlock& data, size_t maxReportLength)
+    {
+        const size_t size = maxReportLength > 0 ? maxReportLength : (size_t) DEFAULT_SIZE;
+        if (data.getSize() < size) {
+            data.setSize (size, false);
+        }
+        return static_cast<unsigned char*> (data.getData());
+    }
+}
+
+hid::IOResult hid::DeviceIO::write (const MemoryBlock& data)
+{
+    HID_COUNT_ALLOCATIONS ("DeviceIO::write (MemoryBlock)");
+    size_t n = 0;
+    Result r = write (static_cast<const unsigned char*> (data.getData()), data.getSize(), &n);
+    return toIOResult (r, n);
+}
+
+Result hid::DeviceIO::writeMany (const Array<MemoryBlock>& reports, size_t* numWritten)
+{
+    HID_COUNT_ALLOCATIONS ("DeviceIO::writeMany (MemoryBlock)");
+    return writeManyInChunks (*this, reports, (size_t) reports.size(), numWritten,
+                              [] (const Array<MemoryBlock>& blocks, size_t i)
+                              {
+                                  const MemoryBlock& block = blocks.getReference ((int) i);
+                                  return hid_output_report { static_cast<const unsigned char*> (block.getData()), block.getSize() };
+                              });
+}
+
+hid::IOResult hid::DeviceIO::read (MemoryBlock& data)
+{
+    HID_COUNT_ALLOCATIONS ("DeviceIO::read (MemoryBlock)");
+    size_t n = 0;
+    unsigned char* buffer = prepareBlock (data, reportLengths.input);
+    Result r = read (buffer, data.getSize(), &n);
+    return toIOResult (r, n);
+}
+
+hid::IOResult hid::DeviceIO::readTimeout (MemoryBlock& data, int milliseconds)
+{
+    HID_COUNT_ALLOCATIONS ("DeviceIO::readTimeout (MemoryBlock)");
+    size_t n = 0;
+    unsigned char* buffer = prepareBlock (data, reportLengths.input);
+    Result r = readTimeout (buffer, data.getSize(), milliseconds, &n);
+    return toIOResult (r, n);
+}
+
+hid::IOResult hid::DeviceIO::sendFeatureReport (const MemoryBlock& data)
+{
+    HID_COUNT_ALLOCATIONS ("DeviceIO::sendFeatureReport (MemoryBlock)");
+    size_t n = 0;
+    Result r = sendFeatureReport (static_cast<const unsigned char*> (data.getData()), data.getSize(), &n);
+    return toIOResult (r, n);
+}
+
+hid::IOResult hid::DeviceIO::getFeatureReport (MemoryBlock& data, unsigned char reportID)
+{
+    HID_COUNT_ALLOCATIONS ("DeviceIO::getFeatureReport (MemoryBlock)");
+    size_t n = 0;
+    unsigned char* buffer = prepareBlock (data, reportLengths.feature);
+    buffer[0] = reportID;
+    Result r = getFeatureReport (buffer, data.getSize(), &n);
+    return toIOResult (r, n);
+}
+
+#if JUCE_HID_SPAN
+hid::IOResult hid::DeviceIO::write (std::span<const unsigned char> data)
+{
+    size_t n = 0;
+    Result r = write (data.data(), data.size(), &n);
+    return toIOResult (r, n);
+}
+
+Result hid::DeviceIO::writeMany (std::span<const std::span<const unsigned char>> reports, size_t* numWritten)
+{
+    return writeManyInChunks (*this, reports, reports.size(), numWritten,
+                              [] (std::span<const std::span<const unsigned char>> spans, size_t i)
+                              {
+                                  return hid_output_report { spans[i].data(), spans[i].size() };
+                              });
+}
+
+hid::IOResult hid::DeviceIO::read (std::span<unsigned char> data)
+{
+    size_t n = 0;
+    Result r = read (data.data(), data.size(), &n);
+    return toIOResult (r, n);
+}
+
+hid::IOResult hid::DeviceIO::readTimeout (std::span<unsigned char> data, int milliseconds)
+{
+    size_t n = 0;
+    Result r = readTimeout (data.data(), data.size(), milliseconds, &n);
+    return toIOResult (r, n);
+}
+
+hid::IOResult hid::DeviceIO::sendFeatureReport (std::span<const unsigned char> data)
+{
+    size_t n = 0;
+    Result r = sendFeatureReport (data.data(), data.size(), &n);
+    return toIOResult (r, n);
+}
+
+hid::IOResult hid::DeviceIO::getFeatureReport (std::span<unsigned char> data)
+{
+    size_t n = 0;
+    Result r = getFeatureReport (data.data(), data.size(), &n);
+    return toIOResult (r, n);
+}
+#endif
+
+#if JUCE_HID_COROUTINES
+hid::AsyncOperation hid::DeviceIO::readAsync (int milliseconds, AsyncLoop* loop)
+{
+    return AsyncOperation (loop != nullptr ? *loop : AsyncLoop::getDefault(),
+                           AsyncOperation::readType, device, nullptr, 0, milliseconds);
+}
+
+hid::AsyncOperation hid::DeviceIO::writeAsync (const unsigned char* data, size_t length, AsyncLoop* loop)
+{
+    return AsyncOperation (loop != nullptr ? *loop : AsyncLoop::getDefault(),
+                           AsyncOperation::writeType, device, const_cast<unsigned char*> (data), length, -1);
+}
+
+hid::AsyncOperation hid::DeviceIO::getFeatureReportAsync (unsigned char* data, size_t length, AsyncLoop* loop)
+{
+    return AsyncOperation (loop != nullptr ? *loop : AsyncLoop::getDefault(),
+                           AsyncOperation::getFeatureReportType, device, data, length, -1);
+}
+#endif
+
+namespace
+{
+    // Like the backends, truncates and always terminates.
+    void copyWideString (const std::wstring& source, wchar_t* dest, size_t maxLength)
+    {
+        if (maxLength == 0) {
+            return;
+        }
+        const size_t n = jmin (source.size(), maxLength - 1);
+        memcpy (dest, source.c_str(), n * sizeof (wchar_t));
+        dest[n] = 0;
+    }
+}
+
+const String&       hid::DeviceIO::getManufacturerString()     const { return info.record->getManufacturerString(); }
+const String&       hid::DeviceIO::getProductString()          const { return info.record->getProductString(); }
+const String&       hid::DeviceIO::getSerialNumberString()     const { return info.record->getSerialNumber(); }
+const std::wstring& hid::DeviceIO::getManufacturerStringWide() const { return info.record->getManufacturerStringWide(); }
+const std::wstring& hid::DeviceIO::getProductStringWide()      const { return info.record->getProductStringWide(); }
+const std::wstring& hid::DeviceIO::getSerialNumberStringWide() const { return info.record->getSerialNumberWide(); }
+
+Result hid::DeviceIO::getManufacturerString(wchar_t* string, size_t maxLength)
+{
+    HID_COUNT_ALLOCATIONS ("DeviceIO::getManufacturerString");
+    if (info.record->readStrings(device)) {
+        copyWideString(info.record->getManufacturerStringWide(), string, maxLength);
+        return Result::ok();
+    }
+    int r = hid_get_manufacturer_string(device, string, maxLength);
+    return r == HID_ERROR
+        ? Result::fail(TRANS(hid_error(device)))
+        : Result::ok();
+}
+
+Result hid::DeviceIO::getProductString(wchar_t* string, size_t maxLength)
+{
+    HID_COUNT_ALLOCATIONS ("DeviceIO::getProductString");
+    if (info.record->readStrings(device)) {
+        copyWideString(info.record->getProductStringWide(), string, maxLength);
+        return Result::ok();
+    }
+    int r = hid_get_product_string(device, string, maxLength);
+    return r == HID_ERROR
+        ? Result::fail(TRANS(hid_error(device)))
+        : Result::ok();
+}
+
+Result hid::DeviceIO::getSerialNumberString(wchar_t* string, size_t maxLength)
+{
+    HID_COUNT_ALLOCATIONS ("DeviceIO::getSerialNumberString");
+    if (info.record->readStrings(device)) {
+        copyWideString(info.record->getSerialNumberWide(), string, maxLength);
+        return Result::ok();
+    }
+    int r = hid_get_serial_number_string(device, string, maxLength);
+    return r == HID_ERROR
+        ? Result::fail(TRANS(hid_error(device)))
+        : Result::ok();
+}
+
+Result hid::DeviceIO::getIndexedString(int index, wchar_t* string, size_t maxLength)
+{
+    HID_COUNT_ALLOCATIONS ("DeviceIO::getIndexedString");
+    
+    // The record shared by every unidentified device mustn't remember strings.
+    if (info.getPath().isEmpty()) {
+        int r = hid_get_indexed_string(device, index, string, maxLength);
+        return r == HID_ERROR
+            ? Result::fail(TRANS("hid_get_indexed_string not implemented on macOS"))
+            : Result::ok();
+    }
+    
+    const DeviceRecord::IndexedString* s = info.record->getIndexedString(device, index);
+    if (s == nullptr) {
+        return Result::fail(TRANS("hid_get_indexed_string not implemented on macOS"));
+    }
+    copyWideString(s->wide, string, maxLength);
+    return Result::ok();
+}
+
+Result hid::DeviceIO::getIndexedString(int index, String& result)
+{
+    if (info.getPath().isNotEmpty()) {
+        const DeviceRecord::IndexedString* s = info.record->getIndexedString(device, index);
+        result = s != nullptr ? s->text : String();
+        return s != nullptr
+            ? Result::ok()
+            : Result::fail(TRANS("hid_get_indexed_string not implemented on macOS"));
+    }
+    
+    wchar_t text[256] = { 0 };
+    Result r = getIndexedString(index, text, 256);
+    result = r.wasOk() ? String(text) : String();
+    return r;
+}
+
+const hid::ReportLengths& hid::DeviceIO::getReportLengths() const
+{
+    return reportLengths;
+}
+
+Result hid::DeviceIO::getMaxReportLengths (ReportLengths& lengths)
+{
+    int r = hid_get_max_report_lengths(device, &lengths.input, &lengths.output, &lengths.feature);
+    return r == HID_ERROR
+        ? Result::fail(TRANS("could not get the report lengths"))
+        : Result::ok();
+}
+
+Result hid::DeviceIO::setReaderThreadOptions (const ThreadOptions& options)
+{
+    hid_thread_options o = toBackendOptions (options);
+    int r = hid_set_thread_options(device, &o);
+    return r == HID_ERROR
+        ? Result::fail(TRANS("this backend has no reader thread"))
+        : Result::ok();
+}
+
+Result hid::DeviceIO::getReaderThreadStats (ThreadStats& stats)
+{
+    hid_thread_stats s;
+    int r = hid_get_thread_stats(device, &s);
+    if (r == HID_ERROR) {
+        return Result::fail(TRANS("this backend has no reader thread"));
+    }
+    stats = toThreadStats (s);
+    return Result::ok();
+}
+
+Result hid::DeviceIO::getMetrics (DeviceMetrics& metrics)
+{
+    HID_COUNT_ALLOCATIONS ("DeviceIO::getMetrics");
+    hid_device_metrics m;
+    int r = hid_get_device_metrics(device, &m);
+    if (r == HID_ERROR) {
+        return Result::fail(TRANS("could not get the device metrics"));
+    }
+    
+    metrics.reportsReceived = m.reports_received;
+    metrics.reportsRead     = m.reports_read;
+    metrics.bytesRead       = m.bytes_read;
+    metrics.reportsWritten  = m.reports_written;
+    metrics.bytesWritten    = m.bytes_written;
+    metrics.reportsDropped  = m.reports_dropped;
+    metrics.readErrors      = m.read_errors;
+    metrics.writeErrors     = m.write_errors;
+    metrics.queueHighWater  = m.queue_high_water;
+    metrics.writeLatency    = LatencyHistogram (m.write_latency);
+    metrics.consumeLatency  = LatencyHistogram (m.consume_latency);
+    return Result::ok();
+}
+
+void hid::DeviceIO::resetMetrics()
+{
+    hid_reset_device_metrics(device);
+}
+
+Result hid::DeviceIO::setInputQueue (int depth, OverflowPolicy policy, int maxDepth)
+{
+    int r = hid_set_input_queue(device, depth, (int) policy, maxDepth);
+    return r == HID_ERROR
+        ? Result::fail(TRANS("could not configure the input queue"))
+        : Result::ok();
+}
+
+Result hid::DeviceIO::setDropListener (DropListener* listener)
+{
+    int r = listener != nullptr
+        ? hid_set_drop_callback(device, callDropListener, listener)
+        : hid_set_drop_callback(device, nullptr, nullptr);
+    return r == HID_ERROR
+        ? Result::fail(TRANS("this backend can't report dropped reports"))
+        : Result::ok();
+}
+
+uint64 hid::DeviceIO::getNumDroppedReports()
+{
+    hid_device_metrics m;
+    return hid_get_device_metrics(device, &m) == HID_ERROR ? 0 : m.reports_dropped;
+}
+
+void hid::DeviceIO::disconnect()
+{
+    if (device == nullptr || ! hid::isConnected()) {
+        DBG("    Warning: disconnecting device when none are connected.");
+    }
+    hid_close(device);
+    device = nullptr;
+}
+
+Result hid::DeviceIO::connect()
+{
+    if (device != nullptr || hid::isConnected()) {
+        return Result::fail(TRANS("Already connected to device"));
+    }
+    
+    *this = info.connect();
+    
+    if (device == nullptr) {
+        return Result::fail(TRANS("failed to connect to device"));
+    }
+    
+    return Result::ok();
+}
+
+const hid::DeviceInfo& hid::DeviceIO::getInfo() const
+{
+    return info;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+hid::DeviceIndex::DeviceIndex() : lastUpdateTime(0), maxAge(1000) {}
+
+hid::DeviceIndex& hid::DeviceIndex::getShared()
+{
+    static DeviceIndex index;
+    return index;
+}
+
+int hid::DeviceIndex::idKey (unsigned short vid, unsigned short pid)
+{
+    return (int) (((unsigned int) vid << 16) | pid);
+}
+
+void hid::DeviceIndex::addToIndex (const DeviceInfo& device)
+{
+    byPath.set (device.getPath(), device);
+    byIds.getReference (idKey (device.getVendorId(), device.getProductId())).add (device);
+    byUsage.getReference (idKey (device.getUsagePage(), device.getUsage())).add (device);
+}
+
+void hid::DeviceIndex::removeFromIndex (const DeviceInfo& device)
+{
+    byPath.remove (device.getPath());
+    
+    const int ids = idKey (device.getVendorId(), device.getProductId());
+    byIds.getReference (ids).removeFirstMatchingValue (device);
+    if (byIds[ids].isEmpty()) {
+        byIds.remove (ids);
+    }
+    
+    const int usage = idKey (device.getUsagePage(), device.getUsage());
+    byUsage.getReference (usage).removeFirstMatchingValue (device);
+    if (byUsage[usage].isEmpty()) {
+        byUsage.remove (usage);
+    }
+}
+
+bool hid::DeviceIndex::update (const Array<DeviceInfo>& currentDevices)
+{
+    const ScopedLock sl (lock);
+    bool changed = false;
+    
+    HashMap<String, bool> currentPaths;
+    for (const DeviceInfo& device : currentDevices) {
+        currentPaths.set (device.getPath(), true);
+        
+        if (byPath.contains (device.getPath())) {
+            const DeviceInfo existing (byPath[device.getPath()]);
+            if (existing == device) {
+                continue;
+            }
+            // Same path, different device (e.g. a different unit plugged into the same port)
+            removeFromIndex (existing);
+        }
+        addToIndex (device);
+        changed = true;
+    }
+    
+    for (const DeviceInfo& device : devices) {
+        if (! currentPaths.contains (device.getPath())) {
+            removeFromIndex (device);
+            changed = true;
+        }
+    }
+    
+    devices = currentDevices;
+    lastUpdateTime = jmax ((uint32) 1, Time::getMillisecondCounter());
+    return changed;
+}
+
+void hid::DeviceIndex::refresh()
+{
+    update (hid::getAllDevicesAvailable());
+}
+
+void hid::DeviceIndex::refreshIfStale()
+{
+    bool stale;
+    {
+        const ScopedLock sl (lock);
+        stale = lastUpdateTime == 0
+             || Time::getMillisecondCounter() - lastUpdateTime > (uint32) maxAge;
+    }
+    if (stale) {
+        refresh();
+    }
+}
+
+bool hid::DeviceIndex::contains (unsigned short vid, unsigned short pid) const
+{
+    DeviceInfo unused;
+    return findFirst (vid, pid, unused);
+}
+
+bool hid::DeviceIndex::findFirst (unsigned short vid, unsigned short pid, DeviceInfo& result) const
+{
+    const ScopedLock sl (lock);
+    
+    // Wildcards can't be hashed — fall back to a scan, like hid_enumerate does.
+    if (vid == 0 || pid == 0) {
+        for (const DeviceInfo& device : devices) {
+            if ((vid == 0 || device.getVendorId() == vid) && (pid == 0 || device.getProductId() == pid)) {
+                result = device;
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    const int ids = idKey (vid, pid);
+    if (! byIds.contains (ids)) {
+        return false;
+    }
+    result = byIds[ids].getFirst();
+    return true;
+}
+
+bool hid::DeviceIndex::findByPath (const String& path, DeviceInfo& result) const
+{
+    const ScopedLock sl (lock);
+    if (! byPath.contains (path)) {
+        return false;
+    }
+    result = byPath[path];
+    return true;
+}
+
+Array<hid::DeviceInfo> hid::DeviceIndex::getDevicesWithIds (unsigned short vid, unsigned short pid) const
+{
+    const ScopedLock sl (lock);
+    
+    if (vid == 0 || pid == 0) {
+        Array<DeviceInfo> matches;
+        for (const DeviceInfo& device : devices) {
+            if ((vid == 0 || device.getVendorId() == vid) && (pid == 0 || device.getProductId() == pid)) {
+                matches.add (device);
+            }
+        }
+        return matches;
+    }
+    return byIds[idKey (vid, pid)];
+}
+
+Array<hid::DeviceInfo> hid::DeviceIndex::getDevicesWithSerialNumber (const String& serialNumber) const
+{
+    // Reading a serial number can mean asking the OS, so that's done on a
+    // copy rather than while holding up every other lookup.
+    Array<DeviceInfo> candidates;
+    {
+        const ScopedLock sl (lock);
+        candidates = devices;
+    }
+    
+    Array<DeviceInfo> matches;
+    for (const DeviceInfo& device : candidates) {
+        if (device.getSerialNumber() == serialNumber) {
+            matches.add (device);
+        }
+    }
+    return matches;
+}
+
+Array<hid::DeviceInfo> hid::DeviceIndex::getDevicesWithUsage (unsigned short usagePage, unsigned short usage) const
+{
+    const ScopedLock sl (lock);
+    return byUsage[idKey (usagePage, usage)];
+}
+
+Array<hid::DeviceInfo> hid::DeviceIndex::getAllDevices() const
+{
+    const ScopedLock sl (lock);
+    return devices;
+}
+
+uint32 hid::DeviceIndex::getLastUpdateTime() const
+{
+    const ScopedLock sl (lock);
+    return lastUpdateTime;
+}
+
+void hid::DeviceIndex::setMaxAge (int milliseconds)
+{
+    const ScopedLock sl (lock);
+    maxAge = milliseconds;
+}
+
+int hid::DeviceIndex::getMaxAge() const
+{
+    const ScopedLock sl (lock);
+    return maxAge;
+}
+
+
+
+
+
+
+
+
+
+
+
+namespace
+{
+    // Bump when the layout of the cache file changes; older files are ignored.
+    const int deviceCacheVersion = 1;
+    
+    // Scans that skip strings keep a record's strings, which may have come
+    // from another unit that was at the same path before. This checks the
+    // serial number through an open handle and, if it has changed, returns
+    // a DeviceInfo for the unit that's really there. Interning it replaces
+    // the stale record for later lookups too.
+    hid::DeviceInfo getInfoForOpenDevice (hid::Device device, const hid::DeviceInfo& info)
+    {
+        const size_t maxLength = 256;
+        wchar_t serial[maxLength]       = { 0 };
+        wchar_t manufacturer[maxLength] = { 0 };
+        wchar_t product[maxLength]      = { 0 };
+        
+        if (device == nullptr
+         || info.getPath().isEmpty()
+         || hid_get_serial_number_string (device, serial, maxLength) == HID_ERROR
+         || info.getSerialNumber() == serial) {
+            return info;
+        }
+        
+        hid_get_manufacturer_string (device, manufacturer, maxLength);
+        hid_get_product_string (device, product, maxLength);
+        
+        const String path (info.getPath());
+        hid_device_info current;
+        zerostruct (current);
+        current.path                = const_cast<char*> (path.toRawUTF8());
+        current.vendor_id           = info.getVendorId();
+        current.product_id          = info.getProductId();
+        current.release_number      = info.getReleaseNumber();
+        current.usage_page          = info.getUsagePage();
+        current.usage               = info.getUsage();
+        current.interface_number    = info.getInterfaceNumber();
+        current.serial_number       = serial;
+        current.manufacturer_string = manufacturer;
+        current.product_string      = product;
+        return hid::DeviceInfo (current);
+    }
+    
+    var entryToVar (const hid::DeviceCache::Entry& entry)
+    {
+        const hid::DeviceInfo& device = entry.device;
+        DynamicObject::Ptr object = new DynamicObject();
+        object->setProperty ("path",               device.getPath());
+        object->setProperty ("vendorId",           (int) device.getVendorId());
+        object->setProperty ("productId",          (int) device.getProductId());
+        object->setProperty ("releaseNumber",      (int) device.getReleaseNumber());
+        object->setProperty ("usagePage",          (int) device.getUsagePage());
+        object->setProperty ("usage",              (int) device.getUsage());
+        object->setProperty ("interfaceNumber",    device.getInterfaceNumber());
+        object->setProperty ("serialNumber",       device.getSerialNumber());
+        object->setProperty ("manufacturer",       device.getManufacturerString());
+        object->setProperty ("product",            device.getProductString());
+        object->setProperty ("maxInputReport",     (int) entry.reportLengths.input);
+        object->setProperty ("maxOutputReport",    (int) entry.reportLengths.output);
+        object->setProperty ("maxFeatureReport",   (int) entry.reportLengths.feature);
+        object->setProperty ("lastSeen",           entry.lastSeen.toMilliseconds());
+        return var (object.get());
+    }
+    
+    hid::DeviceCache::Entry entryFromVar (const var& v)
+    {
+        const String path         = v["path"].toString();
+        const String serialNumber = v["serialNumber"].toString();
+        const String manufacturer = v["manufacturer"].toString();
+        const String product      = v["product"].toString();
+        
+        // Strings are filled in, so the record won't have to fetch them.
+        hid_device_info info;
+        zerostruct (info);
+        info.path                = const_cast<char*> (path.toRawUTF8());
+        info.vendor_id           = (unsigned short) (int) v["vendorId"];
+        info.product_id          = (unsigned short) (int) v["productId"];
+        info.release_number      = (unsigned short) (int) v["releaseNumber"];
+        info.usage_page          = (unsigned short) (int) v["usagePage"];
+        info.usage               = (unsigned short) (int) v["usage"];
+        info.interface_number    = (int) v["interfaceNumber"];
+        info.serial_number       = const_cast<wchar_t*> (serialNumber.toWideCharPointer());
+        info.manufacturer_string = const_cast<wchar_t*> (manufacturer.toWideCharPointer());
+        info.product_string      = const_cast<wchar_t*> (product.toWideCharPointer());
+        
+        hid::DeviceCache::Entry entry;
+        entry.device = hid::DeviceInfo (info);
+        entry.reportLengths.input   = (size_t) (int) v["maxInputReport"];
+        entry.reportLengths.output  = (size_t) (int) v["maxOutputReport"];
+        entry.reportLengths.feature = (size_t) (int) v["maxFeatureReport"];
+        entry.lastSeen = Time ((int64) v["lastSeen"]);
+        return entry;
+    }
+}
+
+hid::DeviceCache::DeviceCache (const File& fileToUse)
+: Thread ("HID Device Cache Validation")
+, file (fileToUse)
+, validated (false) {}
+
+hid::DeviceCache::~DeviceCache()
+{
+    removeAllChangeListeners();
+    stopThread (2000);
+}
+
+File hid::DeviceCache::getDefaultFile (const String& applicationName)
+{
+    return File::getSpecialLocation (File::userApplicationDataDirectory)
+        .getChildFile (applicationName)
+        .getChildFile ("hid_devices.json");
+}
+
+Result hid::DeviceCache::load()
+{
+    if (! file.existsAsFile()) {
+        return Result::ok();
+    }
+    
+    var parsed;
+    Result r = JSON::parse (file.loadFileAsString(), parsed);
+    if (r.failed()) {
+        return Result::fail(TRANS("could not parse the device cache: ") + r.getErrorMessage());
+    }
+    
+    if ((int) parsed["version"] != deviceCacheVersion) {
+        return Result::fail(TRANS("the device cache was written by a different version"));
+    }
+    
+    Array<Entry> loaded;
+    if (const Array<var>* devices = parsed["devices"].getArray()) {
+        for (const var& v : *devices) {
+            loaded.add (entryFromVar (v));
+        }
+    }
+    
+    const ScopedLock sl (lock);
+    entries.swapWith (loaded);
+    missing.clear();
+    validated = false;
+    return Result::ok();
+}
+
+Result hid::DeviceCache::save() const
+{
+    Array<var> devices;
+    {
+        const ScopedLock sl (lock);
+        for (const Entry& entry : entries) {
+            devices.add (entryToVar (entry));
+        }
+    }
+    
+    DynamicObject::Ptr root = new DynamicObject();
+    root->setProperty ("version", deviceCacheVersion);
+    root->setProperty ("devices", devices);
+    
+    Result r = file.getParentDirectory().createDirectory();
+    if (r.failed()) {
+        return r;
+    }
+    
+    return file.replaceWithText (JSON::toString (var (root.get())))
+        ? Result::ok()
+        : Result::fail(TRANS("could not write the device cache to ") + file.getFullPathName());
+}
+
+int hid::DeviceCache::indexOf (const DeviceInfo& device) const
+{
+    for (int i = 0; i < entries.size(); ++i) {
+        if (entries.getReference (i).device.getPath() == device.getPath()) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void hid::DeviceCache::remember (DeviceIO& device)
+{
+    ReportLengths lengths;
+    device.getMaxReportLengths (lengths);
+    remember (getInfoForOpenDevice (device.device, device.getInfo()), lengths);
+}
+
+void hid::DeviceCache::remember (const DeviceInfo& device, const ReportLengths& reportLengths)
+{
+    // Read the strings now, outside the lock, so they can be saved.
+    device.getSerialNumber();
+    
+    Entry entry;
+    entry.device = device;
+    entry.reportLengths = reportLengths;
+    entry.lastSeen = Time::getCurrentTime();
+    
+    const ScopedLock sl (lock);
+    const int index = indexOf (device);
+    if (index >= 0) {
+        entries.set (index, entry);
+    }
+    else {
+        entries.add (entry);
+    }
+    missing.removeFirstMatchingValue (device);
+}
+
+void hid::DeviceCache::forget (const DeviceInfo& device)
+{
+    const ScopedLock sl (lock);
+    const int index = indexOf (device);
+    if (index >= 0) {
+        entries.remove (index);
+    }
+    missing.removeFirstMatchingValue (device);
+}
+
+void hid::DeviceCache::clear()
+{
+    const ScopedLock sl (lock);
+    entries.clear();
+    missing.clear();
+}
+
+Array<hid::DeviceCache::Entry> hid::DeviceCache::getEntries() const
+{
+    const ScopedLock sl (lock);
+    return entries;
+}
+
+Array<hid::DeviceInfo> hid::DeviceCache::getKnownDevices() const
+{
+    const ScopedLock sl (lock);
+    Array<DeviceInfo> devices;
+    for (const Entry& entry : entries) {
+        devices.add (entry.device);
+    }
+    return devices;
+}
+
+bool hid::DeviceCache::findKnownDevice (unsigned short vid, unsigned short pid,
+                                        DeviceInfo& result, const String& serialNumber) const
+{
+    // Compared outside the lock, as a serial number can need an OS call.
+    for (const DeviceInfo& device : getKnownDevices()) {
+        if ((vid == 0 || device.getVendorId() == vid)
+         && (pid == 0 || device.getProductId() == pid)
+         && (serialNumber.isEmpty() || device.getSerialNumber() == serialNumber)) {
+            result = device;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool hid::DeviceCache::getReportLengths (const DeviceInfo& device, ReportLengths& result) const
+{
+    const ScopedLock sl (lock);
+    const int index = indexOf (device);
+    if (index < 0) {
+        return false;
+    }
+    result = entries.getReference (index).reportLengths;
+    return true;
+}
+
+void hid::DeviceCache::startValidation()
+{
+    if (! isThreadRunning()) {
+        startThread();
+    }
+}
+
+bool hid::DeviceCache::isValidating() const
+{
+    return isThreadRunning();
+}
+
+bool hid::DeviceCache::hasBeenValidated() const
+{
+    const ScopedLock sl (lock);
+    return validated;
+}
+
+Array<hid::DeviceInfo> hid::DeviceCache::getMissingDevices() const
+{
+    const ScopedLock sl (lock);
+    return missing;
+}
+
+void hid::DeviceCache::removeMissingDevices()
+{
+    const ScopedLock sl (lock);
+    for (const DeviceInfo& device : missing) {
+        const int index = indexOf (device);
+        if (index >= 0) {
+            entries.remove (index);
+        }
+    }
+    missing.clear();
+}
+
+void hid::DeviceCache::run()
+{
+    HID_TRACE_SCOPE ("DeviceCache::validate");
+    DeviceIndex& index = DeviceIndex::getShared();
+    index.refresh();
+    
+    if (threadShouldExit()) {
+        return;
+    }
+    
+    const Time now = Time::getCurrentTime();
+    {
+        const ScopedLock sl (lock);
+        missing.clear();
+        for (Entry& entry : entries) {
+            // Present means the same device (ids, usage...) is still at the same path.
+            DeviceInfo found;
+            if (index.findByPath (entry.device.getPath(), found) && found == entry.device) {
+                entry.lastSeen = now;
+            }
+            else {
+                missing.add (entry.device);
+            }
+        }
+        validated = true;
+    }
+    
+    sendChangeMessage();
+}
+
+
+
+
+
+
+
+
+
+
+
+hid::ManagedConnection::ManagedConnection (const DeviceInfo& device, int pollIntervalInMilliseconds)
+: Thread ("HID Managed Connection")
+, io (nullptr, device)
+, state (disconnected)
+, lost (0)
+, lossTicks (0)
+, pollInterval (pollIntervalInMilliseconds)
+, reconnectTimeout (0)
+, numReconnects (0)
+, lastReconnectLatency (0)
+, maxReconnectLatency (0) {}
+
+hid::ManagedConnection::~ManagedConnection()
+{
+    removeAllChangeListeners();
+    close();
+}
+
+void hid::ManagedConnection::addInitFeatureReport (const unsigned char* data, size_t length)
+{
+    const ScopedLock sl (lock);
+    InitReport report = { true, MemoryBlock (data, length) };
+    initReports.add (report);
+}
+
+void hid::ManagedConnection::addInitOutputReport (const unsigned char* data, size_t length)
+{
+    const ScopedLock sl (lock);
+    InitReport report = { false, MemoryBlock (data, length) };
+    initReports.add (report);
+}
+
+void hid::ManagedConnection::clearInitReports()
+{
+    const ScopedLock sl (lock);
+    initReports.clear();
+}
+
+Result hid::ManagedConnection::open()
+{
+    close();
+    
+    DeviceInfo device (getDeviceInfo());
+    // Read the strings while the device is surely there; the serial number is
+    // what we'll look for if it goes away.
+    device.getSerialNumber();
+    
+    Result r = openDevice (device);
+    if (r.wasOk()) {
+        setState (connected);
+    }
+    else {
+        lossTicks = Time::getHighResolutionTicks();
+        setState (reconnecting);
+    }
+    
+    startThread();
+    return r;
+}
+
+void hid::ManagedConnection::close()
+{
+    stopThread (jmax (2000, pollInterval * 2));
+    
+    {
+        const ScopedWriteLock wl (deviceLock);
+        if (io.device != nullptr) {
+            hid_close (io.device);
+            io.device = nullptr;
+        }
+    }
+    
+    lost = 0;
+    if (getState() != disconnected) {
+        setState (disconnected);
+    }
+}
+
+Result hid::ManagedConnection::openDevice (const DeviceInfo& deviceToOpen)
+{
+    HID_TRACE_SCOPE ("ManagedConnection::openDevice");
+    Device device = hid_open_path (deviceToOpen.getPath().toRawUTF8());
+    if (device == nullptr) {
+        return Result::fail(TRANS("failed to connect to device"));
+    }
+    
+    // Somebody else may have been plugged in where the device was.
+    const DeviceInfo current (getInfoForOpenDevice (device, deviceToOpen));
+    if (current.getSerialNumber() != deviceToOpen.getSerialNumber()) {
+        hid_close (device);
+        return Result::fail(TRANS("a different device is connected at this path"));
+    }
+    
+    Array<InitReport> reports;
+    {
+        const ScopedLock sl (lock);
+        reports = initReports;
+    }
+    
+    for (const InitReport& report : reports) {
+        const unsigned char* data = static_cast<const unsigned char*> (report.data.getData());
+        int r = report.isFeatureReport
+            ? hid_send_feature_report (device, data, report.data.getSize())
+            : hid_write (device, data, report.data.getSize());
+        
+        if (r == HID_ERROR) {
+            Result failure = Result::fail(TRANS(hid_error(device)));
+            hid_close (device);
+            return failure;
+        }
+    }
+    
+    const ScopedWriteLock wl (deviceLock);
+    io = DeviceIO (device, current);
+    lost = 0;
+    return Result::ok();
+}
+
+hid::ManagedConnection::State hid::ManagedConnection::getState() const
+{
+    return (State) state.get();
+}
+
+bool hid::ManagedConnection::isConnected() const
+{
+    return getState() == connected;
+}
+
+void hid::ManagedConnection::setState (State newState)
+{
+    state = (int) newState;
+    sendChangeMessage();
+}
+
+hid::DeviceInfo hid::ManagedConnection::getDeviceInfo() const
+{
+    const ScopedReadLock rl (deviceLock);
+    return io.getInfo();
+}
+
+void hid::ManagedConnection::setReconnectTimeout (int milliseconds)
+{
+    const ScopedLock sl (lock);
+    reconnectTimeout = milliseconds;
+}
+
+int hid::ManagedConnection::getNumReconnects() const
+{
+    const ScopedLock sl (lock);
+    return numReconnects;
+}
+
+double hid::ManagedConnection::getLastReconnectLatency() const
+{
+    const ScopedLock sl (lock);
+    return lastReconnectLatency;
+}
+
+double hid::ManagedConnection::getMaxReconnectLatency() const
+{
+    const ScopedLock sl (lock);
+    return maxReconnectLatency;
+}
+
+// An I/O error means the handle is dead: flag it and let the thread reconnect.
+Result hid::ManagedConnection::checkResult (const Result& result, size_t count)
+{
+    if (count == (size_t) HID_ERROR) {
+        lost = 1;
+        notify();
+    }
+    return result;
+}
+
+Result hid::ManagedConnection::write (const unsigned char* data, size_t length, size_t* bytesWritten)
+{
+    const ScopedReadLock rl (deviceLock);
+    if (io.device == nullptr) {
+        return Result::fail(TRANS("device not connected"));
+    }
+    size_t count = 0;
+    Result r = io.write (data, length, &count);
+    if (bytesWritten != nullptr) {
+        *bytesWritten = count;
+    }
+    return checkResult (r, count);
+}
+
+Result hid::ManagedConnection::read (unsigned char* data, size_t length, size_t* bytesRead)
+{
+    const ScopedReadLock rl (deviceLock);
+    if (io.device == nullptr) {
+        return Result::fail(TRANS("device not connected"));
+    }
+    size_t count = 0;
+    Result r = io.read (data, length, &count);
+    if (bytesRead != nullptr) {
+        *bytesRead = count;
+    }
+    return checkResult (r, count);
+}
+
+Result hid::ManagedConnection::readTimeout (unsigned char* data, size_t length, int milliseconds, size_t* bytesRead)
+{
+    const ScopedReadLock rl (deviceLock);
+    if (io.device == nullptr) {
+        return Result::fail(TRANS("device not connected"));
+    }
+    size_t count = 0;
+    Result r = io.readTimeout (data, length, milliseconds, &count);
+    if (bytesRead != nullptr) {
+        *bytesRead = count;
+    }
+    return checkResult (r, count);
+}
+
+Result hid::ManagedConnection::sendFeatureReport (const unsigned char* data, size_t length, size_t* bytesWritten)
+{
+    const ScopedReadLock rl (deviceLock);
+    if (io.device == nullptr) {
+        return Result::fail(TRANS("device not connected"));
+    }
+    size_t count = 0;
+    Result r = io.sendFeatureReport (data, length, &count);
+    if (bytesWritten != nullptr) {
+        *bytesWritten = count;
+    }
+    return checkResult (r, count);
+}
+
+Result hid::ManagedConnection::getFeatureReport (unsigned char* data, size_t length, size_t* bytesRead)
+{
+    const ScopedReadLock rl (deviceLock);
+    if (io.device == nullptr) {
+        return Result::fail(TRANS("device not connected"));
+    }
+    size_t count = 0;
+    Result r = io.getFeatureReport (data, length, &count);
+    if (bytesRead != nullptr) {
+        *bytesRead = count;
+    }
+    return checkResult (r, count);
+}
+
+void hid::ManagedConnection::run()
+{
+    while (! threadShouldExit()) {
+        const State current = getState();
+        
+        if (current == connected) {
+            if (lost.get() != 0 || ! isStillPresent()) {
+                handleLoss();
+                continue;
+            }
+            // A failed I/O call wakes the thread straight away, so the scan
+            // only has to catch a device that's gone quiet.
+            wait (jmax (pollInterval, (int) presenceCheckInterval));
+            continue;
+        }
+        else if (current == reconnecting) {
+            tryToReconnect();
+        }
+        
+        wait (pollInterval);
+    }
+}
+
+void hid::ManagedConnection::handleLoss()
+{
+    HID_TRACE_INSTANT ("ManagedConnection: device lost");
+    {
+        const ScopedWriteLock wl (deviceLock);
+        if (io.device != nullptr) {
+            hid_close (io.device);
+            io.device = nullptr;
+        }
+    }
+    
+    lossTicks = Time::getHighResolutionTicks();
+    setState (reconnecting);
+}
+
+// Only devices with the same ids are looked at, and their strings aren't read.
+bool hid::ManagedConnection::isStillPresent() const
+{
+    const DeviceInfo target (getDeviceInfo());
+    const Array<DeviceInfo> candidates (getAllDevicesAvailable (DeviceFilter()
+                                                                    .setIds (target.getVendorId(), target.getProductId())
+                                                                    .setReadStrings (false)));
+    
+    for (const DeviceInfo& device : candidates) {
+        if (device.getPath() == target.getPath()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool hid::ManagedConnection::findReturnedDevice (DeviceInfo& result) const
+{
+    const DeviceInfo target (getDeviceInfo());
+    
+    // This is polled for as long as the device is gone, so the scan skips the
+    // strings; only devices with the right ids have theirs read, when asked.
+    const Array<DeviceInfo> candidates (getAllDevicesAvailable (DeviceFilter()
+                                                                    .setIds (target.getVendorId(), target.getProductId())
+                                                                    .setReadStrings (false)));
+    
+    // A serial number follows the device to another port; without one, the
+    // best we can do is wait for something with the same ids at the same path.
+    const String& serialNumber = target.getSerialNumber();
+    
+    for (const DeviceInfo& device : candidates) {
+        if (serialNumber.isEmpty()) {
+            if (device.getPath() == target.getPath()) {
+                result = device;
+                return true;
+            }
+            continue;
+        }
+        
+        if (device.getUsagePage() == target.getUsagePage()
+         && device.getUsage() == target.getUsage()
+         && device.getInterfaceNumber() == target.getInterfaceNumber()
+         && device.getSerialNumber() == serialNumber) {
+            result = device;
+            return true;
+        }
+    }
+    return false;
+}
+
+void hid::ManagedConnection::tryToReconnect()
+{
+    const int64 now = Time::getHighResolutionTicks();
+    const double elapsed = Time::highResolutionTicksToSeconds (now - lossTicks) * 1000.0;
+    
+    DeviceInfo device;
+    if (! findReturnedDevice (device) || openDevice (device).failed()) {
+        bool givingUp;
+        {
+            const ScopedLock sl (lock);
+            givingUp = reconnectTimeout > 0 && elapsed > reconnectTimeout;
+        }
+        
+        if (givingUp) {
+            // Nothing left to watch; open() starts the thread again.
+            setState (disconnected);
+            signalThreadShouldExit();
+        }
+        return;
+    }
+    
+    const double latency = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - lossTicks) * 1000.0;
+    {
+        const ScopedLock sl (lock);
+        ++numReconnects;
+        lastReconnectLatency = latency;
+        maxReconnectLatency = jmax (maxReconnectLatency, latency);
+    }
+    setState (connected);
+}
+
+
+
+
+
+
+
+
+
+
+
+hid::DeviceScanner::DeviceScanner() : DeviceScanner (nullptr) {}
+hid::DeviceScanner::DeviceScanner(ChangeListener* listener, int intervalInMilliseconds)
+{
+    if (listener != nullptr) {
+        addChangeListener(listener);
+    }
+    startTimer(intervalInMilliseconds);
+}
+
+hid::DeviceScanner::~DeviceScanner()
+{
+    removeAllChangeListeners();
+    stopTimer();
+}
+
+void hid::DeviceScanner::timerCallback()
+{
+    HID_TRACE_SCOPE ("DeviceScanner::timerCallback");
+    scanNow();
+}
+
+const Array<hid::DeviceInfo>& hid::DeviceScanner::getCurrentDevices() const
+{
+    return devices;
+}
+
+void hid::DeviceScanner::scanNow()
+{
+    HID_TRACE_SCOPE ("DeviceScanner::scanNow");
+    HID_COUNT_ALLOCATIONS ("DeviceScanner::scanNow");
+    Array<DeviceInfo> newDevices = hid::getAllDevicesAvailable();
+    DeviceIndex::getShared().update (newDevices);
+    
+    // Device removed or connected. DeviceInfo compares are pointer compares,
+    // so this catches a swap without caring about enumeration order.
+    bool changed = newDevices.size() != devices.size();
+    for (int i = 0; ! changed && i < newDevices.size(); ++i) {
+        changed = ! devices.contains (newDevices.getReference (i));
+    }
+    
+    if (changed) {
+        HID_TRACE_INSTANT ("DeviceScanner: devices changed");
+        devices.swapWith(newDevices);
+        sendChangeMessage();
+    }
+    
+    DeviceRecord::purgeUnused();
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+bool hid::isDeviceAvailable (unsigned short vid, unsigned short pid)
+{
+    HID_COUNT_ALLOCATIONS ("hid::isDeviceAvailable");
+    DeviceIndex& index = DeviceIndex::getShared();
+    index.refreshIfStale();
+    return index.contains (vid, pid);
+}
+
+hid::DeviceInfo hid::getDeviceInfo(unsigned short vid, unsigned short pid)
+{
+    HID_COUNT_ALLOCATIONS ("hid::getDeviceInfo");
+    DeviceIndex& index = DeviceIndex::getShared();
+    index.refreshIfStale();
+    
+    DeviceInfo device;
+    bool found = index.findFirst (vid, pid, device);
+    
+    // Can't get the device when there are none! Check if it's availiable with
+    // isDeviceAvailable (unsigned short vid, unsigned short pid).
+    jassert(found);
+    ignoreUnused(found);
+    return device;
+}
+
+Array<hid::DeviceInfo> hid::getAllDevicesAvailable()
+{
+    HID_COUNT_ALLOCATIONS ("hid::getAllDevicesAvailable");
+    Array<DeviceInfo> allDevices;
+    hid::DeviceIterator iterator;
+    while (iterator.hasNext()) {
+        allDevices.add(iterator.getNext());
+    }
+    return allDevices;
+}
+
+Array<hid::DeviceInfo> hid::getAllDevicesAvailable (const DeviceFilter& filter)
+{
+    HID_COUNT_ALLOCATIONS ("hid::getAllDevicesAvailable (DeviceFilter)");
+    Array<DeviceInfo> allDevices;
+    hid::DeviceIterator iterator (filter);
+    while (iterator.hasNext()) {
+        allDevices.add(iterator.getNext());
+    }
+    return allDevices;
+}
+
+void hid::printAllDevices()
+{
+    hid::DeviceIterator iterator;
+    
+    while (iterator.hasNext())
+    {
+        DeviceInfo currentDevice (iterator.getNext());
+        
+        String s;
+        String usage_str;
+        s += "0x" + String::toHexString (currentDevice.getVendorId()).paddedLeft('0', 4) + ":";
+        s += "0x" + String::toHexString (currentDevice.getProductId()).paddedLeft('0', 4);
+        s += String(" ") + currentDevice.getManufacturerString();
+        s += String(" ") + currentDevice.getProductString();
+        
+        usage_str += "0x" + String::toHexString (currentDevice.getUsagePage()).paddedLeft('0', 4);
+        usage_str += ":0x" + String::toHexString (currentDevice.getUsage()).paddedLeft('0', 4);
+        s += " " + usage_str;
+        
+        std::cout << s << "\n";
+        std::cout << currentDevice.getPath() << "\n\n";
+    }
+}
+
+hid::DeviceIO hid::getConnectedDevice()
+{
+    // Don't call this function if no device is connected!!!!!!!
+    jassert(isConnected());
+    
+    return changeConnection(false, DeviceInfo(hid_device_info()), true);
+}
+
+hid::DeviceInfo hid::getConnectedDeviceInfo()
+{
+    // Don't call this function if no device is connected!!!!!!!
+    jassert(isConnected());
+    
+    return getConnectedDevice().getInfo();
+}
+
+bool hid::isConnected()
+{
+    return connectionStatus(false);
+}
+
+hid::DeviceIO hid::connect (const DeviceInfo& device)
+{
+    return changeConnection(true, device);
+}
+
+void hid::disconnect()
+{
+    changeConnection(false);
+}
+
+const unsigned int hid::reportID()
+{
+    static unsigned int idCounter = 0;
+    return idCounter++;
+}
+
+uint64 hid::getMonotonicTime()
+{
+    return hid_get_monotonic_time();
+}
+
+void hid::setDefaultReaderThreadOptions (const ThreadOptions& options)
+{
+    getDefaultThreadOptionsStorage() = options;
+    hid_thread_options o = toBackendOptions (options);
+    hid_set_default_thread_options (&o);
+}
+
+hid::ThreadOptions hid::getDefaultReaderThreadOptions()
+{
+    return getDefaultThreadOptionsStorage();
+}
+
+Result hid::setCurrentThreadOptions (const ThreadOptions& options)
+{
+    hid_thread_options o = toBackendOptions (options);
+    int r = hid_set_current_thread_options (&o);
+    return r == HID_ERROR
+        ? Result::fail(TRANS("could not apply all the thread options"))
+        : Result::ok();
+}
+
+// Why use a class when you could use a function
+// Don't worry it's a rhetorical question — this approach worked for my
+// specific use case, but this could easily be replaced with something
+// a little more clear.
+//
+// These functions maintain an internal static device representation and 
+// are the single point of entry for all connection/disconnection related things.
+// Note that this only supports one connection at a time.
+bool hid::connectionStatus (bool shouldSet, bool shouldBeConnected)
+{
+    static bool isConnected = false;
+
+    if (shouldSet) {
+        isConnected = shouldBeConnected;
+    }
+    
+    return isConnected;
+}
+
+hid::DeviceIO hid::changeConnection(bool shouldConnect, const DeviceInfo& deviceInfo, bool get)
+{
+    static DeviceInfo connectedDeviceInfo;
+    static Device connectedDevice = nullptr;
+    
+    // Made once per connection; the DeviceIO constructor asks the backend
+    // for the report lengths, and handing out copies doesn't.
+    static DeviceIO connectedIO (nullptr, DeviceInfo());
+    
+    if (get) {
+        return connectedIO;
+    }
+    connectionStatus(true, false);
+    if (shouldConnect) {
+        HID_TRACE_SCOPE ("hid::connect");
+        HID_COUNT_ALLOCATIONS ("hid::connect");
+        if ((connectedDevice = hid_open_path(deviceInfo.getPath().toRawUTF8())) != nullptr) {
+            // Connection Success
+            connectedDeviceInfo = deviceInfo;
+            connectedIO = DeviceIO(connectedDevice, connectedDeviceInfo);
+            DBG("    HID Device Connected: " << deviceInfo.getName());
+            connectionStatus(true, true);
+        }
+        else {
+            DBG("    HID Device Failed To Connect: " << deviceInfo.getName());
+        }
+    }
+    else if (connectedDevice != nullptr) {
+        HID_TRACE_SCOPE ("hid::disconnect");
+        HID_COUNT_ALLOCATIONS ("hid::disconnect");
+        connectedIO = DeviceIO(nullptr, DeviceInfo());
+        hid_close(connectedDevice);
+        connectedDevice = nullptr;
+        DBG("    HID Device Disconnected: " << connectedDeviceInfo.getName());
+    }
+    else {
+        DBG("    Could not disconnect HID Device - none connected.");
+    }
+
+    return connectedIO;
+}
+
+
+
+
+
+
+
+
+
+
+#if JUCE_HID_TRACING
+struct hid::Trace::Event
+{
+    const char* name;
+    uint64 start;
+    uint64 duration;
+    char phase;
+};
+
+// Only the thread it belongs to writes to a buffer. Events go into chunks that
+// never move, and numEvents is only bumped once an event is complete, so a
+// dump can read up to it while the thread carries on recording. A prepared
+// buffer's chunks are allocated up front, under the state's lock, and it
+// never allocates more; other buffers allocate chunks as they need them.
+struct hid::Trace::ThreadBuffer
+{
+    enum
+    {
+        chunkSize = 1024,
+        maxChunks = maxEventsPerThread / chunkSize,
+        preparedChunks = preparedEventsPerThread / chunkSize
+    };
+    
+    ~ThreadBuffer()
+    {
+        for (auto& chunk : chunks) {
+            delete[] chunk.get();
+        }
+    }
+    
+    String threadName;
+    int threadIndex = 0;
+    Atomic<int> prepared;
+    Atomic<int> finished;       // set when its thread exits
+    Atomic<int> generation;
+    Atomic<int> numEvents;
+    Atomic<int64> numDropped;
+    Atomic<Event*> chunks[maxChunks];
+};
+
+struct hid::Trace::State
+{
+    Atomic<int> recording;
+    Atomic<int> generation;     // bumped by clear(); stale buffers empty themselves
+    Atomic<uint64> origin;      // trace timestamps are relative to this
+    CriticalSection lock;       // taken when a buffer is made or freed, and by dumps
+    Array<ThreadBuffer*> buffers;
+    int nextThreadIndex = 1;
+};
+
+hid::Trace::State& hid::Trace::getState()
+{
+    // Never deleted, as other threads may still be recording while statics
+    // are destroyed.
+    static State* state = new State();
+    return *state;
+}
+
+hid::Trace::ThreadBuffer* hid::Trace::getThreadBuffer()
+{
+    // Marks the buffer finished when its thread exits, so clear() can free it.
+    struct Owner
+    {
+        ~Owner()
+        {
+            if (buffer != nullptr) {
+                buffer->finished = 1;
+            }
+        }
+        
+        ThreadBuffer* buffer = nullptr;
+    };
+    
+    static thread_local Owner owner;
+    ThreadBuffer*& buffer = owner.buffer;
+    
+    if (buffer == nullptr) {
+        buffer = new ThreadBuffer();
+        
+        MessageManager* mm = MessageManager::getInstanceWithoutCreating();
+        if (mm != nullptr && mm->isThisTheMessageThread()) {
+            buffer->threadName = "JUCE Message Thread";
+        }
+        else if (Thread* thread = Thread::getCurrentThread()) {
+            buffer->threadName = thread->getThreadName();
+        }
+        else {
+            buffer->threadName = "Thread 0x" + String::toHexString ((pointer_sized_int) Thread::getCurrentThreadId());
+        }
+        
+        State& state = getState();
+        const ScopedLock sl (state.lock);
+        state.buffers.add (buffer);
+        buffer->threadIndex = state.nextThreadIndex++;
+    }
+    return buffer;
+}
+
+// Called with the state's lock held.
+void hid::Trace::allocatePreparedChunks (ThreadBuffer& buffer)
+{
+    for (int i = 0; i < ThreadBuffer::preparedChunks; ++i) {
+        if (buffer.chunks[i].get() == nullptr) {
+            buffer.chunks[i] = new Event[ThreadBuffer::chunkSize];
+        }
+    }
+}
+
+void hid::Trace::prepareThread()
+{
+    ThreadBuffer& buffer = *getThreadBuffer();
+    State& state = getState();
+    const ScopedLock sl (state.lock);
+    
+    buffer.prepared = 1;
+    if (isRecording()) {
+        allocatePreparedChunks (buffer);
+    }
+}
+
+void hid::Trace::record (const char* name, char phase, uint64 start, uint64 duration)
+{
+    ThreadBuffer& buffer = *getThreadBuffer();
+    
+    const int generation = getState().generation.get();
+    if (buffer.generation.get() != generation) {
+        buffer.numEvents = 0;
+        buffer.numDropped = 0;
+        buffer.generation = generation;
+    }
+    
+    const int index = buffer.numEvents.get();
+    if (index >= maxEventsPerThread) {
+        buffer.numDropped += 1;
+        return;
+    }
+    
+    Event* chunk = buffer.chunks[index / ThreadBuffer::chunkSize].get();
+    if (chunk == nullptr) {
+        if (buffer.prepared.get() != 0) {
+            buffer.numDropped += 1;
+            return;
+        }
+        chunk = new Event[ThreadBuffer::chunkSize];
+        buffer.chunks[index / ThreadBuffer::chunkSize] = chunk;
+    }
+    
+    Event& e = chunk[index % ThreadBuffer::chunkSize];
+    e.name = name;
+    e.start = start;
+    e.duration = duration;
+    e.phase = phase;
+    buffer.numEvents = index + 1;
+}
+
+void hid::Trace::start()
+{
+    State& state = getState();
+    if (state.origin.get() == 0) {
+        state.origin = hid_get_monotonic_time();
+    }
+    
+    {
+        const ScopedLock sl (state.lock);
+        for (auto* buffer : state.buffers) {
+            if (buffer->prepared.get() != 0) {
+                allocatePreparedChunks (*buffer);
+            }
+        }
+    }
+    state.recording = 1;
+}
+
+void hid::Trace::stop()
+{
+    getState().recording = 0;
+}
+
+bool hid::Trace::isRecording() noexcept
+{
+    return getState().recording.get() != 0;
+}
+
+void hid::Trace::clear()
+{
+    State& state = getState();
+    state.origin = hid_get_monotonic_time();
+    state.generation += 1;
+    
+    // Their events have just been thrown away, and nothing will record into
+    // them again.
+    const ScopedLock sl (state.lock);
+    for (int i = state.buffers.size(); --i >= 0;) {
+        ThreadBuffer* buffer = state.buffers.getUnchecked (i);
+        if (buffer->finished.get() != 0) {
+            state.buffers.remove (i);
+            delete buffer;
+        }
+    }
+}
+
+int64 hid::Trace::getNumDropped()
+{
+    State& state = getState();
+    const int generation = state.generation.get();
+    
+    // Held throughout, so clear() can't free a buffer under us.
+    const ScopedLock sl (state.lock);
+    
+    int64 numDropped = 0;
+    for (auto* buffer : state.buffers) {
+        if (buffer->generation.get() == generation) {
+            numDropped += buffer->numDropped.get();
+        }
+    }
+    return numDropped;
+}
+
+String hid::Trace::toChromeJSON()
+{
+    State& state = getState();
+    const int generation = state.generation.get();
+    const uint64 origin = state.origin.get();
+    
+    // Held throughout, so clear() can't free a buffer under us.
+    const ScopedLock sl (state.lock);
+    
+    MemoryOutputStream out;
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    
+    bool first = true;
+    for (auto* buffer : state.buffers) {
+        const int numEvents = buffer->generation.get() == generation ? buffer->numEvents.get() : 0;
+        if (numEvents == 0) {
+            continue;
+        }
+        
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->threadIndex
+            << ",\"args\":{\"name\":\"" << JSON::escapeString (buffer->threadName) << "\"}}";
+        
+        for (int i = 0; i < numEvents; ++i) {
+            const Event& e = buffer->chunks[i / ThreadBuffer::chunkSize].get()[i % ThreadBuffer::chunkSize];
+            const uint64 start = e.start > origin ? e.start - origin : 0;
+            
+            // Chrome traces count in microseconds.
+            out << ",\n{\"name\":\"" << JSON::escapeString (e.name) << "\",\"cat\":\"hid\",\"ph\":\"" << e.phase
+                << "\",\"pid\":1,\"tid\":" << buffer->threadIndex
+                << ",\"ts\":" << String ((double) start / 1000.0, 3);
+            if (e.phase == 'X') {
+                out << ",\"dur\":" << String ((double) e.duration / 1000.0, 3);
+            } else {
+                out << ",\"s\":\"t\"";
+            }
+            out << "}";
+        }
+    }
+    
+    out << "\n]}\n";
+    return out.toString();
+}
+
+Result hid::Trace::writeChromeTrace (const File& file)
+{
+    return file.replaceWithText (toChromeJSON())
+        ? Result::ok()
+        : Result::fail(TRANS("could not write the trace to ") + file.getFullPathName());
+}
+
+void hid::Trace::instant (const char* name)
+{
+    if (isRecording()) {
+        record (name, 'i', hid_get_monotonic_time(), 0);
+    }
+}
+
+hid::Trace::Scope::Scope (const char* nameToUse) noexcept
+: name (nameToUse)
+, start (isRecording() ? hid_get_monotonic_time() : 0) {}
+
+hid::Trace::Scope::~Scope()
+{
+    if (start != 0 && isRecording()) {
+        record (name, 'X', start, hid_get_monotonic_time() - start);
+    }
+}
+#endif
+
+
+
+
+
+
+
+
+
+
+#if JUCE_HID_ALLOCATION_TRACKING
+// These are touched from inside malloc(), so they must be usable before any
+// constructor has run and reaching them must never allocate: a thread local
+// that needs no construction, in the initial-exec model so it isn't set up
+// lazily, and std::atomics that are initialised at compile time.
+namespace
+{
+    struct AllocationCounters
+    {
+        int64 allocations;
+        int64 bytes;
+        int noAllocationDepth;
+        bool reportingViolation;
+    };
+    
+   #if defined (__GNUC__)
+    thread_local AllocationCounters allocationCounters __attribute__ ((tls_model ("initial-exec")));
+   #else
+    thread_local AllocationCounters allocationCounters;
+   #endif
+    
+    std::atomic<int64> numAllocationViolations { 0 };
+    std::atomic<hid::AllocationTracker::EntryPoint*> firstEntryPoint { nullptr };
+    
+    void countAllocation (size_t numBytes) noexcept
+    {
+        AllocationCounters& counters = allocationCounters;
+        ++counters.allocations;
+        counters.bytes += (int64) numBytes;
+        
+        if (counters.noAllocationDepth > 0 && ! counters.reportingViolation) {
+            // Logging the assertion may allocate too; don't report that.
+            counters.reportingViolation = true;
+            ++numAllocationViolations;
+            
+            // Something allocated on a path that mustn't: the culprit is on the call stack.
+            jassertfalse;
+            
+            counters.reportingViolation = false;
+        }
+    }
+    
+    double perCall (int64 total, int64 calls)
+    {
+        return calls > 0 ? (double) total / (double) calls : 0.0;
+    }
+    
+    struct AllocationsPerCallComparator
+    {
+        static int compareElements (const hid::AllocationTracker::Stats& a, const hid::AllocationTracker::Stats& b)
+        {
+            const double perCallA = perCall (a.allocations, a.calls);
+            const double perCallB = perCall (b.allocations, b.calls);
+            return perCallA > perCallB ? -1 : (perCallA < perCallB ? 1 : a.entryPoint.compare (b.entryPoint));
+        }
+    };
+}
+
+#if defined (__GLIBC__)
+// glibc lets a program replace malloc() and friends; these count and forward to
+// the real allocator, so free() can stay as it is.
+extern "C"
+{
+    void* __libc_malloc (size_t);
+    void* __libc_calloc (size_t, size_t);
+    void* __libc_realloc (void*, size_t);
+    
+    void* malloc (size_t size) noexcept                 { countAllocation (size); return __libc_malloc (size); }
+    void* calloc (size_t count, size_t size) noexcept   { countAllocation (count * size); return __libc_calloc (count, size); }
+    void* realloc (void* ptr, size_t size) noexcept     { countAllocation (size); return __libc_realloc (ptr, size); }
+}
+#else
+void* operator new (size_t size)
+{
+    countAllocation (size);
+    
+    if (void* ptr = std::malloc (size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new (size_t size, const std::nothrow_t&) noexcept
+{
+    countAllocation (size);
+    return std::malloc (size == 0 ? 1 : size);
+}
+
+void* operator new[] (size_t size)                                      { return operator new (size); }
+void* operator new[] (size_t size, const std::nothrow_t& tag) noexcept  { return operator new (size, tag); }
+void operator delete (void* ptr) noexcept                               { std::free (ptr); }
+void operator delete[] (void* ptr) noexcept                             { std::free (ptr); }
+void operator delete (void* ptr, size_t) noexcept                       { std::free (ptr); }
+void operator delete[] (void* ptr, size_t) noexcept                     { std::free (ptr); }
+void operator delete (void* ptr, const std::nothrow_t&) noexcept        { std::free (ptr); }
+void operator delete[] (void* ptr, const std::nothrow_t&) noexcept      { std::free (ptr); }
+#endif
+
+Array<hid::AllocationTracker::Stats> hid::AllocationTracker::getStats()
+{
+    Array<Stats> stats;
+    
+    for (EntryPoint* e = firstEntryPoint.load(); e != nullptr; e = e->next) {
+        Stats s;
+        s.entryPoint = e->name;
+        s.mustNotAllocate = e->mustNotAllocate;
+        s.calls = e->calls.get();
+        s.allocations = e->allocations.get();
+        s.bytes = e->bytes.get();
+        s.maxAllocationsPerCall = e->maxAllocationsPerCall.get();
+        s.violations = e->violations.get();
+        stats.add (s);
+    }
+    return stats;
+}
+
+String hid::AllocationTracker::getReport()
+{
+    Array<Stats> stats = getStats();
+    AllocationsPerCallComparator comparator;
+    stats.sort (comparator, true);
+    
+    String report;
+    report << String ("entry point").paddedRight (' ', 40)
+           << String ("calls").paddedLeft (' ', 12)
+           << String ("allocs/call").paddedLeft (' ', 14)
+           << String ("bytes/call").paddedLeft (' ', 14)
+           << String ("max allocs").paddedLeft (' ', 12)
+           << String ("violations").paddedLeft (' ', 12) << "\n";
+    
+    for (const Stats& s : stats) {
+        report << s.entryPoint.paddedRight (' ', 40)
+               << String (s.calls).paddedLeft (' ', 12)
+               << String (perCall (s.allocations, s.calls), 2).paddedLeft (' ', 14)
+               << String (perCall (s.bytes, s.calls), 1).paddedLeft (' ', 14)
+               << String (s.maxAllocationsPerCall).paddedLeft (' ', 12)
+               << (s.mustNotAllocate ? String (s.violations) : String ("-")).paddedLeft (' ', 12) << "\n";
+    }
+    report << "violations: " << String (getNumViolations()) << "\n";
+    return report;
+}
+
+void hid::AllocationTracker::reset()
+{
+    for (EntryPoint* e = firstEntryPoint.load(); e != nullptr; e = e->next) {
+        e->calls = 0;
+        e->allocations = 0;
+        e->bytes = 0;
+        e->maxAllocationsPerCall = 0;
+        e->violations = 0;
+    }
+    numAllocationViolations = 0;
+}
+
+int64 hid::AllocationTracker::getNumViolations() noexcept
+{
+    return numAllocationViolations.load();
+}
+
+int64 hid::AllocationTracker::getThreadAllocations() noexcept
+{
+    return allocationCounters.allocations;
+}
+
+int64 hid::AllocationTracker::getThreadBytes() noexcept
+{
+    return allocationCounters.bytes;
+}
+
+hid::AllocationTracker::ScopedNoAllocations::ScopedNoAllocations() noexcept
+{
+    ++allocationCounters.noAllocationDepth;
+}
+
+hid::AllocationTracker::ScopedNoAllocations::~ScopedNoAllocations()
+{
+    --allocationCounters.noAllocationDepth;
+}
+
+hid::AllocationTracker::EntryPoint::EntryPoint (const char* nameToUse, bool mustNotAllocateToUse) noexcept
+: name (nameToUse)
+, mustNotAllocate (mustNotAllocateToUse)
+, next (firstEntryPoint.load())
+{
+    while (! firstEntryPoint.compare_exchange_weak (next, this)) {}
+}
+
+hid::AllocationTracker::Scope::Scope (EntryPoint& entryPointToUse) noexcept
+: entryPoint (entryPointToUse)
+, allocationsAtStart (allocationCounters.allocations)
+, bytesAtStart (allocationCounters.bytes)
+{
+    if (entryPoint.mustNotAllocate) {
+        ++allocationCounters.noAllocationDepth;
+    }
+}
+
+hid::AllocationTracker::Scope::~Scope()
+{
+    const int64 numAllocations = allocationCounters.allocations - allocationsAtStart;
+    
+    if (entryPoint.mustNotAllocate) {
+        --allocationCounters.noAllocationDepth;
+    }
+    
+    entryPoint.calls += 1;
+    if (numAllocations > 0) {
+        entryPoint.allocations += numAllocations;
+        entryPoint.bytes += allocationCounters.bytes - bytesAtStart;
+        
+        for (int64 max = entryPoint.maxAllocationsPerCall.get(); numAllocations > max;
+             max = entryPoint.maxAllocationsPerCall.get()) {
+            if (entryPoint.maxAllocationsPerCall.compareAndSetBool (numAllocations, max)) {
+                break;
+            }
+        }
+        if (entryPoint.mustNotAllocate) {
+            entryPoint.violations += 1;
+        }
+    }
+}
+#endif
@@ -1,499 +1,2256 @@
-/*
-  ==============================================================================
- 
-    juce_hid.h
-    Created: 6 Dec 2017 8:18:00pm
-    Author:  Chris Penny
- 
-  ==============================================================================
-*/
-
-#pragma once
-
-// This is NOT thread-safe! It does not support multiple connections to different
-// HID devices! This library is only useful when you are connecting to a single 
-// HID device at a time.
-struct hid {
-    
-    /** @brief Initialize the HIDAPI library.
-     
-        This function initializes the HIDAPI library. Calling it is not
-        strictly necessary, as it will be called automatically by other
-        functions if it is needed.  This function should be called at the
-        beginning of execution however, if there is a chance of HIDAPI
-        handles being opened by different threads simultaneously.
-     
-        @ingroup API
-     
-        @returns
-        This function returns 0 on success and -1 on error.
-     */
-    static juce::Result init();
-    
-    /** @brief Finalize the HIDAPI library.
-     
-        This function frees all of the static data associated with
-        HIDAPI. It should be called at the end of execution to avoid
-        memory leaks.
-     
-        @ingroup API
-     
-        @returns
-        This function returns 0 on success and -1 on error.
-     */
-    static juce::Result exit();
-    
-    typedef hid_device* Device;
-    class DeviceInfo;
-    class MutableDeviceInfo;
-    class DeviceIO;
-    
-    /** Holds all the information associated with a device.
-     */
-    //=========================================================================
-    //=========================================================================
-    class DeviceInfo
-    {
-    public:
-        
-        DeviceInfo();
-        DeviceInfo (const hid_device_info& info);
-        DeviceInfo (const DeviceInfo& other);
-        DeviceInfo (const MutableDeviceInfo& other);
-        bool operator== (const DeviceInfo& other) const;
-        bool operator== (const MutableDeviceInfo& other) const;
-        bool operator== (const DeviceIO& other) const;
-
-        const juce::String&  getPath()               const;
-        const unsigned short getVendorId()           const;
-        const unsigned short getProductId()          const;
-        const juce::String&  getSerialNumber()       const;
-        const unsigned short getReleaseNumber()      const;
-        const juce::String&  getManufacturerString() const;
-        const juce::String&  getProductString()      const;
-        const unsigned short getUsagePage()          const;
-        const unsigned short getUsage()              const;
-        const int            getInterfaceNumber()    const;
-        const juce::String  getName()               const;
-        
-        const DeviceIO connect() const;
-        void disconnect() const;
-        
-    private:
-        
-        const juce::String   path;
-        const unsigned short vendorId;
-        const unsigned short productId;
-        const juce::String   serialNumber;
-        const unsigned short releaseNumber;
-        const juce::String   manufacturerString;
-        const juce::String   productString;
-        const unsigned short usagePage;
-        const unsigned short usage;
-        const int            interfaceNumber;
-        
-        friend class MutableDeviceInfo;
-        JUCE_LEAK_DETECTOR(DeviceInfo)
-    };
-    
-    
-    /** Exact same as DeviceInfo, but is mutable.
-     *  Example:
-     *
-     *      DeviceInfo info1;
-     *      DeviceInfo info2;
-     *      info1 = info2; // ERROR - not allowed
-     *
-     *      MutableDeviceInfo mutableInfo1;
-     *      MutableDeviceInfo mutableInfo2;
-     *      mutableInfo1 = mutableInfo2;   // Allowed, 1 is now a copy of 2
-     *
-     *  I really like immutable data structures, but I like it even better
-     *  when it is explicit when a data structure is mutable or immutable.
-     *  I know this seems redundant and unnecessary. Sue me. 
-     *  You really shouldn't ever use this class — it's used internally.
-     *  Immutable == better, except in cases where you're forced to do otherwise.
-     */
-    //=========================================================================
-    //=========================================================================
-    class MutableDeviceInfo
-    {
-    public:
-        
-        MutableDeviceInfo ();
-        MutableDeviceInfo (const hid_device_info& info);
-        MutableDeviceInfo (const DeviceInfo& other);
-        MutableDeviceInfo (const MutableDeviceInfo& other);
-        bool operator== (const DeviceInfo& other) const;
-        bool operator== (const MutableDeviceInfo& other) const;
-        bool operator== (const DeviceIO& other) const;
-        
-        const juce::String&  getPath()               const;
-        const unsigned short getVendorId()           const;
-        const unsigned short getProductId()          const;
-        const juce::String&  getSerialNumber()       const;
-        const unsigned short getReleaseNumber()      const;
-        const juce::String&  getManufacturerString() const;
-        const juce::String&  getProductString()      const;
-        const unsigned short getUsagePage()          const;
-        const unsigned short getUsage()              const;
-        const int            getInterfaceNumber()    const;
-        const juce::String   getName()               const;
-        
-        DeviceIO connect() const;
-        void disconnect() const;
-        
-    private:
-        
-        juce::String   path;
-        unsigned short vendorId;
-        unsigned short productId;
-        juce::String   serialNumber;
-        unsigned short releaseNumber;
-        juce::String   manufacturerString;
-        juce::String   productString;
-        unsigned short usagePage;
-        unsigned short usage;
-        int            interfaceNumber;
-        
-        friend class DeviceInfo;
-        JUCE_LEAK_DETECTOR(MutableDeviceInfo)
-    };
-    
-    
-    /** Handles all reading/writing
-     */
-    //=========================================================================
-    //=========================================================================
-    class DeviceIO
-    {
-    public:
-
-        /** Create from Device (opaque API pointer) & deviceInfo.
-         *
-         *  You'd usually never create one of these on your own.
-         *  Get one from calling DeviceInfo::connect() or hid::getConnectedDevice() 
-         *
-         *  Note that Device is an alias for hid_device (from hidapi.h)
-         */
-        DeviceIO (Device deviceToUse, const DeviceInfo& deviceInfo);
-        
-        /** Copy Constructor
-         */
-        DeviceIO (const DeviceIO& other);
-        
-        /** @brief Set the device handle to be non-blocking.
-         
-            In non-blocking mode calls to hid_read() will return
-            immediately with a value of 0 if there is no data to be
-            read. In blocking mode, hid_read() will wait (block) until
-            there is data to read before returning.
-        
-            Nonblocking can be turned on and off at any time.
-        
-            @ingroup API
-            @param device A device handle returned from hid_open().
-            @param nonblock enable or not the nonblocking reads
-            - 1 to enable nonblocking
-            - 0 to disable nonblocking.
-        
-         @returns
-         This function returns 0 on success and -1 on error.
-         */
-        juce::Result setNonblocking (bool shouldBeNonblocking);
-        
-        /** @brief Write an Output report to a HID device.
-         
-         write() will send the data on the first OUT endpoint, if
-         one exists. If it does not, it will send the data through
-         the Control Endpoint (Endpoint 0).
-         
-         @param data The data to send
-         @param length The length in bytes of the data to send.
-         @param bytesWritten Optional int reference that will store 
-         the actual number of bytes written or -1 on error.
-         
-         @returns
-         The Result of the write.
-         */
-        juce::Result write (const unsigned char *data, size_t length, size_t* bytesWritten = nullptr);
-        
-        /** @brief Read an Input report from a HID device.
-         
-         Input reports are returned
-         to the host through the INTERRUPT IN endpoint
-         
-         @param data A buffer to put the read data into.
-         @param length The number of bytes to read.
-         @param bytesRead Optional int reference that will store
-         the actual number of bytes read or -1 on error.
-         
-         @returns
-         The Result of the read.
-         */
-        juce::Result read (unsigned char *data, size_t length, size_t* bytesRead = nullptr);
-        
-        /** @brief Read an Input report from a HID device with timeout.
-         
-         Input reports are returned
-         to the host through the INTERRUPT IN endpoint.
-         
-         @param data A buffer to put the read data into.
-         @param length The number of bytes to read.
-         @param milliseconds timeout in milliseconds or -1 for blocking wait.
-         @param bytesRead Optional int reference that will store
-         the actual number of bytes read or -1 on error.
-         
-         @returns
-         The result of the read. If no packet was available to be read within
-         the timeout period, this function returns Result::fail.
-         */
-        juce::Result readTimeout (unsigned char *data, size_t length, int milliseconds, size_t* bytesRead = nullptr);
-        
-        /** @brief Send a Feature report to the device.
-         
-         Feature reports are sent over the Control endpoint as a
-         Set_Report transfer.
-         
-         @param data The data to send
-         @param length The length in bytes of the data to send
-         @param bytesWritten Optional int reference that will store
-         the actual number of bytes read or -1 on error.
-
-         @returns
-         The result of the write.
-         */
-        juce::Result sendFeatureReport (const unsigned char *data, size_t length, size_t* bytesWritten = nullptr);
-        
-        /** @brief Get a feature report from a HID device.
-
-         @param data A buffer to put the read data into
-         @param length The number of bytes to read. The buffer can be longer
-         than the actual report.
-         @param bytesRead Optional int reference that will store
-         the actual number of bytes read plus
-         one for the report ID, or -1 on error.
-
-         @returns
-         The result of the write.
-         */
-        juce::Result getFeatureReport (unsigned char *data, size_t length, size_t* bytesRead = nullptr);
-        
-        /** @brief Get The Manufacturer String from a HID device.
-         
-         @param string A wide string buffer to put the data into.
-         @param maxlen The length of the buffer in multiples of wchar_t.
-         
-         @returns
-         This function returns Result::ok on success and Result::fail on error.
-         */
-        juce::Result getManufacturerString (wchar_t* string, size_t maxLength);
-        
-        /** @brief Get The Product String from a HID device.
-         
-         @param string A wide string buffer to put the data into.
-         @param maxlen The length of the buffer in multiples of wchar_t.
-         
-         @returns
-         This function returns Result::ok on success and Result::fail on error.
-         */
-        juce::Result getProductString (wchar_t* string, size_t maxLength);
-        
-        /** @brief Get The Serial Number String from a HID device.
-         
-         @param string A wide string buffer to put the data into.
-         @param maxlen The length of the buffer in multiples of wchar_t.
-         
-         @returns
-         This function returns Result::ok on success and Result::fail on error.
-         */
-        juce::Result getSerialNumberString (wchar_t* string, size_t maxLength);
-        
-        /** @brief Get a string from a HID device, based on its string index.
-         
-         @param string_index The index of the string to get.
-         @param string A wide string buffer to put the data into.
-         @param maxlen The length of the buffer in multiples of wchar_t.
-         
-         @returns
-         This function returns Result::ok on success and Result::fail on error.
-         */
-        juce::Result getIndexedString (int index, wchar_t* string, size_t maxLength);
-        
-        /** Connect to this device. Returns Result::fail if already connected
-         */
-        juce::Result connect();
-        
-        /** Disconnect from the device. Returns Result::fail if not connected.
-         */
-        void disconnect();
-        
-        /** Returns the DeviceInfo associated with this DeviceIO.
-         *
-         *  DeviceInfo & DeviceIO always both refer to the same unique device
-         */
-        const DeviceInfo getInfo() const;
-        
-        bool operator== (const DeviceIO& other) const;
-        bool operator== (const DeviceInfo& other) const;
-        bool operator== (const MutableDeviceInfo& other) const;
-        
-    private:
-
-        Device device;
-        MutableDeviceInfo info;
-        JUCE_LEAK_DETECTOR(DeviceIO)
-    };
-    
-    
-    
-    
-    
-    
-    
-    
-    
-    
-    
-    
-    
-    /**  Iterates through all the availiable devices, optionally with a given
-     *  VendorID and ProductID.
-     *
-     *  Call DeviceIterator::hasNext() to see if there are any available,
-     *  and DeviceIterator::getNext() to get them. Do not call getNext() when
-     *  there are no devices available — this will crash the program.
-     */
-    //=========================================================================
-    //=========================================================================
-    class DeviceIterator
-    {
-    public:
-        
-        /** Create an iterator from a VendorID & ProductID */
-        DeviceIterator (unsigned short vendorID  = 0,
-                        unsigned short productID = 0);
-        
-        /**
-         */
-        ~DeviceIterator();
-        
-        /** Returns true if there is another device to get via getNext()
-         */
-        bool hasNext();
-        
-        /**  Returns the next DeviceInfo available.
-         *  You MUST call hasNext() first to see if there are any available.
-         *  Program will crash if you call getNext() when there are no more devices available.
-         */
-        DeviceInfo getNext();
-        
-    private:
-        
-        JUCE_LEAK_DETECTOR(DeviceIterator)
-        hid_device_info* current;
-        hid_device_info* DeleteThis;
-    };
-    
-    
-    
-    /** Frequently scans for HID Devices and sends a change message when one is added/removed.
-     *  Call DeviceScanner::addChangeListener (ChangeListener* listener) to be notified when devices
-     *  are connected or disconnected.
-     */
-    //=========================================================================
-    //=========================================================================
-    class DeviceScanner :   public juce::ChangeBroadcaster, private juce::Timer
-    {
-    public:
-        
-        DeviceScanner();
-        DeviceScanner (juce::ChangeListener* listener, int intervalInMilliseconds = 500);
-        ~DeviceScanner();
-        
-        /** Returns all devices that are available from the most recent scan.
-         */
-        const juce::Array<DeviceInfo>& getCurrentDevices() const;
-        
-        /** Scans for devices immediately
-         */
-        void scanNow();
-        
-    private:
-        
-        void timerCallback();
-        juce::Array<DeviceInfo> devices;
-        
-        JUCE_LEAK_DETECTOR(DeviceScanner)
-    };
-    
-    
-    
-    
-    
-    
-    //=========================================================================
-    //=========================================================================
-    //=========================================================================
-    //=========================================================================
-    
-    /**  Returns true if a device with the vid & pid exists.
-     */
-    static bool isDeviceAvailable (unsigned short vendorID, unsigned short productID);
-    
-    /**  Gets the device information for a given VendorID and ProductID.
-     *  If multiple devices with the same vid & pid are available, this returns
-     *  the first one.
-     *
-     *  Do not call this unless isDeviceAvailable  returns true for your vid & pid
-     */
-    static DeviceInfo getDeviceInfo(unsigned short vendorID, unsigned short productID);
-    
-    /**  Returns a list of all the devices available
-     */
-    static juce::Array<DeviceInfo> getAllDevicesAvailable();
-    
-    /**  Prints info about all the available devices.
-     */
-    static void printAllDevices();
-    
-    /** returns true if there currently is an active connection
-     */
-    static bool isConnected();
-    
-    /** Returns the DeviceIO that is currently connected.
-     *  If there is no connection, the DeviceIO returned is invalid and shouldn't
-     *  be used.
-     *
-     *  Check isConnected() first before trying getConnectedDevice()!
-     */
-    static DeviceIO getConnectedDevice();
-    
-    /** Returns the DeviceInfo for the connected device.
-     *  If no device is connected, the DeviceInfo is invalid and shouldn't be used.
-     *
-     *  Check isConnected() first before trying getConnectedDeviceInfo()
-     */
-    static const DeviceInfo getConnectedDeviceInfo();
-    
-    /** Connects to a device (only one connection allowed at a time, for now)
-     */
-    static DeviceIO connect (const DeviceInfo& device);
-    
-    /** Disconnects from the currently connected device (does nothing if not connected)
-     */
-    static void disconnect();
-    
-    /** Always returns a unique report ID.
-     */
-    static const unsigned int reportID();
-    
-private:
-    
-    /** INTERNAL */
-    static bool connectionStatus (bool shouldSet, bool shouldBeConnected = true);
-    static DeviceIO changeConnection(bool shouldConnect,
-                                     const DeviceInfo& device = DeviceInfo(hid_device_info()),
-                                     bool get = false);
-    
-}; 
+/*
+  ==============================================================================
+ 
+    juce_hid.h
+    Created: 6 Dec 2017 8:18:00pm
+    Author:  Chris Penny
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+// The co_await API (DeviceIO::readAsync() etc.) is only there when the compiler
+// supports C++20 coroutines.
+#ifndef JUCE_HID_COROUTINES
+ #if defined (__cpp_impl_coroutine) && defined (__has_include)
+  #if __has_include (<coroutine>)
+   #define JUCE_HID_COROUTINES 1
+  #endif
+ #endif
+#endif
+
+#ifndef JUCE_HID_COROUTINES
+ #define JUCE_HID_COROUTINES 0
+#endif
+
+#if JUCE_HID_COROUTINES
+ #include <coroutine>
+#endif
+
+// The std::span overloads of the DeviceIO calls need C++20.
+#ifndef JUCE_HID_SPAN
+ #if (__cplusplus >= 202002L || (defined (_MSVC_LANG) && _MSVC_LANG >= 202002L)) && defined (__has_include)
+  #if __has_include (<span>)
+   #define JUCE_HID_SPAN 1
+  #endif
+ #endif
+#endif
+
+#ifndef JUCE_HID_SPAN
+ #define JUCE_HID_SPAN 0
+#endif
+
+#if JUCE_HID_SPAN
+ #include <span>
+#endif
+
+// This is NOT thread-safe! It does not support multiple connections to different
+// HID devices! This library is only useful when you are connecting to a single 
+// HID device at a time.
+struct hid {
+    
+    /** @brief Initialize the HIDAPI library.
+     
+        This function initializes the HIDAPI library. Calling it is not
+        strictly necessary, as it will be called automatically by other
+        functions if it is needed.  This function should be called at the
+        beginning of execution however, if there is a chance of HIDAPI
+        handles being opened by different threads simultaneously.
+     
+        @ingroup API
+     
+        @returns
+        This function returns 0 on success and -1 on error.
+     */
+    static juce::Result init();
+    
+    /** @brief Finalize the HIDAPI library.
+     
+        This function frees all of the static data associated with
+        HIDAPI. It should be called at the end of execution to avoid
+        memory leaks.
+     
+        @ingroup API
+     
+        @returns
+        This function returns 0 on success and -1 on error.
+     */
+    static juce::Result exit();
+    
+    typedef hid_device* Device;
+    class DeviceRecord;
+    class DeviceInfo;
+    class ReportView;
+    class DeviceIO;
+    class DeviceFilter;
+    class DeviceCache;
+    class ManagedConnection;
+    class RealtimeReportQueue;
+    class ReportReader;
+    class DecodePool;
+    class FeatureReportBatch;
+   #if JUCE_HID_COROUTINES
+    class AsyncLoop;
+    class AsyncOperation;
+   #endif
+    class ControlEventBuffer;
+    class SampleAligner;
+    
+    /** The immutable, reference-counted data behind DeviceInfo.
+     *
+     *  Records are interned: every DeviceInfo that describes the same device
+     *  shares one record, so copying a DeviceInfo is a single reference count
+     *  bump and comparing two of them is a pointer (or 64-bit hash) compare.
+     *
+     *  The string properties are not part of a device's identity and are read
+     *  lazily: scans leave them out, and they're fetched from the OS and cached
+     *  in the record the first time one of them is asked for, or when a
+     *  DeviceIO first opens the device. Strings read by index are remembered
+     *  here too. A path can outlive the unit plugged in at it, and a scan
+     *  that skips strings can't notice that, so it keeps the strings of a
+     *  record that's in use; code that needs to be sure can check the serial
+     *  number through a handle once it has opened the device.
+     *
+     *  You shouldn't ever need to use this directly — it's used internally.
+     */
+    //=========================================================================
+    //=========================================================================
+    class DeviceRecord : public juce::ReferenceCountedObject
+    {
+    public:
+        
+        typedef juce::ReferenceCountedObjectPtr<DeviceRecord> Ptr;
+        
+        /** Returns the shared record describing info, creating it if needed. */
+        static Ptr intern (const hid_device_info& info);
+        
+        /** Forgets interned records that no DeviceInfo refers to any more.
+         *  Called by the DeviceScanner after each scan.
+         */
+        static void purgeUnused();
+        
+        /** Compares field by field. Only needed when two records share a hash.
+         *  Strings are only compared when both sides have them.
+         */
+        bool matches (const DeviceRecord& other) const;
+        bool matches (const hid_device_info& info) const;
+        
+        /** These fetch the strings on first use, which costs an OS call. */
+        const juce::String& getSerialNumber()       const;
+        const juce::String& getManufacturerString() const;
+        const juce::String& getProductString()      const;
+        
+        /** The same strings in the form the OS gives them, for the wchar_t
+         *  calls on DeviceIO.
+         */
+        const std::wstring& getSerialNumberWide()       const;
+        const std::wstring& getManufacturerStringWide() const;
+        const std::wstring& getProductStringWide()      const;
+        
+        /** Returns true if the strings have been read already. */
+        bool hasStrings() const;
+        
+        /** Reads the strings through an open handle to the device, unless
+         *  they've been read already. DeviceIO does this when it's opened.
+         *  Returns hasStrings().
+         */
+        bool readStrings (hid_device* device) const;
+        
+        struct IndexedString
+        {
+            int index;
+            juce::String text;
+            std::wstring wide;
+        };
+        
+        /** A string by its index, read through an open handle the first time
+         *  that index is asked for and remembered after that. Returns nullptr
+         *  if it couldn't be read. The pointer stays valid as long as the
+         *  record does.
+         */
+        const IndexedString* getIndexedString (hid_device* device, int index) const;
+        
+        const juce::String   path;
+        const unsigned short vendorId;
+        const unsigned short productId;
+        const unsigned short releaseNumber;
+        const unsigned short usagePage;
+        const unsigned short usage;
+        const int            interfaceNumber;
+        const juce::uint64   hash;
+        
+    private:
+        
+        DeviceRecord (const hid_device_info& info, juce::uint64 hashToUse);
+        static juce::uint64 hashOf (const hid_device_info& info);
+        void fetchStrings() const;
+        void adoptStrings (const hid_device_info& info) const;
+        void forgetStrings() const;
+        bool hasSameAddress (const hid_device_info& info) const;
+        void setStrings (const wchar_t* serial, const wchar_t* manufacturer, const wchar_t* product) const;
+        bool stringsMatch (const DeviceRecord& other) const;
+        
+        mutable juce::CriticalSection stringLock;
+        mutable juce::Atomic<int> stringsRead;
+        mutable juce::String serialNumber;
+        mutable juce::String manufacturerString;
+        mutable juce::String productString;
+        mutable std::wstring serialNumberWide;
+        mutable std::wstring manufacturerStringWide;
+        mutable std::wstring productStringWide;
+        mutable juce::OwnedArray<IndexedString> indexedStrings;    // guarded by stringLock
+        
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DeviceRecord)
+    };
+    
+    
+    /** Holds all the information associated with a device.
+     *
+     *  The information itself is immutable — it lives in a shared DeviceRecord —
+     *  but a DeviceInfo can be assigned and moved, which just repoints it at
+     *  another record. Copies are cheap, so pass these around by value freely.
+     *  A moved-from DeviceInfo is the same as a default-constructed one: an
+     *  empty device with no path, ids or strings.
+     */
+    //=========================================================================
+    //=========================================================================
+    class DeviceInfo
+    {
+    public:
+        
+        DeviceInfo();
+        DeviceInfo (const hid_device_info& info);
+        DeviceInfo (const DeviceInfo& other) noexcept;
+        DeviceInfo (DeviceInfo&& other) noexcept;
+        DeviceInfo& operator= (const DeviceInfo& other) noexcept;
+        DeviceInfo& operator= (DeviceInfo&& other) noexcept;
+        bool operator== (const DeviceInfo& other) const;
+        bool operator== (const DeviceIO& other) const;
+
+        const juce::String&  getPath()               const;
+        const unsigned short getVendorId()           const;
+        const unsigned short getProductId()          const;
+        const juce::String&  getSerialNumber()       const;
+        const unsigned short getReleaseNumber()      const;
+        const juce::String&  getManufacturerString() const;
+        const juce::String&  getProductString()      const;
+        const unsigned short getUsagePage()          const;
+        const unsigned short getUsage()              const;
+        const int            getInterfaceNumber()    const;
+        const juce::String  getName()               const;
+        
+        DeviceIO connect() const;
+        void disconnect() const;
+        
+    private:
+        
+        friend class DeviceIO;
+        
+        DeviceRecord::Ptr record;
+        
+        JUCE_LEAK_DETECTOR(DeviceInfo)
+    };
+    
+    /** DeviceInfo used to come in an immutable and a mutable flavour. Now that
+     *  DeviceInfo is backed by an immutable shared record it is assignable
+     *  itself, so this is only kept so that old code still compiles.
+     */
+    typedef DeviceInfo MutableDeviceInfo;
+    
+    
+    /** How a thread that reads input reports should be scheduled.
+     *
+     *  Real-time policies usually need extra privileges (root or
+     *  CAP_SYS_NICE on Linux); without them applying the options fails and the
+     *  thread keeps its normal scheduling.
+     */
+    struct ThreadOptions
+    {
+        enum Policy
+        {
+            defaultPolicy = HID_THREAD_POLICY_DEFAULT,
+            fifo          = HID_THREAD_POLICY_FIFO,
+            roundRobin    = HID_THREAD_POLICY_RR
+        };
+        
+        Policy policy = defaultPolicy;
+        int priority = 0;                   /**< 1 - 99, for the real-time policies. */
+        juce::uint64 affinityMask = 0;      /**< Bit n allows CPU n. 0 leaves it alone. */
+        juce::String name;                  /**< Empty leaves it alone. */
+        int latencyProbeInterval = 0;       /**< Milliseconds; see hid_get_thread_stats(). 0 is off. */
+    };
+    
+    /** Scheduling latency observed on a reader thread, in nanoseconds. */
+    struct ThreadStats
+    {
+        juce::uint64 numSamples  = 0;
+        juce::uint64 meanLatency = 0;
+        juce::uint64 maxLatency  = 0;
+        juce::uint64 lastLatency = 0;
+    };
+    
+    
+    /** A latency histogram in nanoseconds, copied from the backend or filled
+     *  in with addSample().
+     *
+     *  Buckets are a quarter of a power of two wide, so values read back from
+     *  it are within 25% of the real ones.
+     */
+    class LatencyHistogram
+    {
+    public:
+        
+        LatencyHistogram() noexcept;
+        explicit LatencyHistogram (const hid_latency_histogram& histogram) noexcept;
+        
+        juce::uint64 getCount() const noexcept;
+        juce::uint64 getMean() const noexcept;
+        juce::uint64 getMax() const noexcept;
+        
+        /** The latency that this proportion (0 to 1) of the samples were at or
+         *  below, e.g. 0.99 for the 99th percentile. 0 if there are no samples.
+         */
+        juce::uint64 getPercentile (double proportion) const noexcept;
+        
+        /** Adds a latency of your own, e.g. from a report arriving to it being
+         *  handled. Not thread-safe: keep one histogram per thread and merge them.
+         */
+        void addSample (juce::uint64 nanoseconds) noexcept;
+        
+        /** Adds all of other's samples to this one. */
+        void merge (const LatencyHistogram& other) noexcept;
+        
+    private:
+        
+        hid_latency_histogram histogram;
+    };
+    
+    
+    /** What a device's input queue does with reports that arrive while it's
+     *  full. See DeviceIO::setInputQueue().
+     */
+    enum OverflowPolicy
+    {
+        dropOldest = HID_OVERFLOW_DROP_OLDEST,  /**< Make room by dropping the oldest queued report. */
+        dropNewest = HID_OVERFLOW_DROP_NEWEST,  /**< Drop the report that just arrived. */
+        block      = HID_OVERFLOW_BLOCK,        /**< Stop taking reports from the OS until one is read. */
+        grow       = HID_OVERFLOW_GROW          /**< Grow up to a bound, then drop the oldest. */
+    };
+    
+    /** Gets told when a device's input queue drops reports. */
+    class DropListener
+    {
+    public:
+        
+        virtual ~DropListener() {}
+        
+        /** Called on the backend's reader thread with the number of reports
+         *  dropped since the device was opened. Keep it short, and don't read
+         *  from the device in it.
+         */
+        virtual void inputReportsDropped (juce::uint64 totalDropped) = 0;
+    };
+    
+    
+    /** A snapshot of a device's counters, from DeviceIO::getMetrics(). */
+    struct DeviceMetrics
+    {
+        juce::uint64 reportsReceived = 0;   /**< Input reports that arrived from the OS. */
+        juce::uint64 reportsRead     = 0;
+        juce::uint64 bytesRead       = 0;
+        juce::uint64 reportsWritten  = 0;   /**< Output reports. */
+        juce::uint64 bytesWritten    = 0;
+        juce::uint64 reportsDropped  = 0;   /**< Input reports lost to a full queue. */
+        juce::uint64 readErrors      = 0;
+        juce::uint64 writeErrors     = 0;
+        juce::uint64 queueHighWater  = 0;   /**< Most input reports ever queued at once. */
+        
+        LatencyHistogram writeLatency;      /**< How long each write() took. */
+        LatencyHistogram consumeLatency;    /**< From a report arriving to it being read. */
+    };
+    
+    
+    /** The largest reports a device can send or receive, in bytes.
+     *  A length of 0 means it's unknown or the device has no reports of that type.
+     */
+    struct ReportLengths
+    {
+        size_t input   = 0;
+        size_t output  = 0;
+        size_t feature = 0;
+    };
+    
+    
+    /** What the buffer-based DeviceIO calls return: whether the transfer
+     *  worked, and how many bytes it moved (0 if it didn't).
+     */
+    struct IOResult
+    {
+        juce::Result result = juce::Result::ok();
+        size_t numBytes = 0;
+        
+        bool wasOk() const noexcept                 { return result.wasOk(); }
+        explicit operator bool() const noexcept     { return result.wasOk(); }
+    };
+    
+    
+    /** A read-only view of one input report, as returned by DeviceIO::readReport().
+     *
+     *  The bytes aren't copied into the view — it references the pooled buffer
+     *  the backend received the report into. Copying a view just takes another
+     *  reference to that buffer, and the buffer goes back to the device's pool
+     *  once the last view referencing it is released or destroyed.
+     *
+     *  Views stay valid after the device they came from is disconnected.
+     */
+    //=========================================================================
+    //=========================================================================
+    class ReportView
+    {
+    public:
+        
+        /** Creates an empty view. isValid() returns false. */
+        ReportView() noexcept;
+        
+        /** Takes ownership of a report from hid_read_report_timeout(). */
+        explicit ReportView (hid_report* reportToUse) noexcept;
+        
+        ReportView (const ReportView& other) noexcept;
+        ReportView (ReportView&& other) noexcept;
+        ReportView& operator= (const ReportView& other) noexcept;
+        ReportView& operator= (ReportView&& other) noexcept;
+        ~ReportView();
+        
+        /** Returns true if this view references a report. */
+        bool isValid() const noexcept;
+        
+        /** The report bytes. The first byte is the report ID if the device
+         *  uses numbered reports.
+         */
+        const unsigned char* getData() const noexcept;
+        
+        /** The number of bytes in the report. */
+        size_t getSize() const noexcept;
+        
+        /** The report ID, or 0 for devices that don't use numbered reports. */
+        unsigned char getReportID() const noexcept;
+        
+        /** When the report arrived, in nanoseconds on the same monotonic clock
+         *  as hid::getMonotonicTime().
+         */
+        juce::uint64 getTimestamp() const noexcept;
+        
+        /** Gives the buffer back to the pool now, leaving this view empty. */
+        void release() noexcept;
+        
+    private:
+        
+        hid_report* report;
+    };
+    
+    
+    /** Handles all reading/writing
+     */
+    //=========================================================================
+    //=========================================================================
+    class DeviceIO
+    {
+    public:
+
+        /** Create from Device (opaque API pointer) & deviceInfo.
+         *
+         *  You'd usually never create one of these on your own.
+         *  Get one from calling DeviceInfo::connect() or hid::getConnectedDevice() 
+         *
+         *  Note that Device is an alias for hid_device (from hidapi.h)
+         */
+        DeviceIO (Device deviceToUse, const DeviceInfo& deviceInfo);
+        
+        /** Copy Constructor
+         */
+        DeviceIO (const DeviceIO& other);
+        
+        /** Move Constructor. other is left without a device handle, and with
+         *  an empty DeviceInfo.
+         */
+        DeviceIO (DeviceIO&& other) noexcept;
+        
+        DeviceIO& operator= (const DeviceIO& other);
+        DeviceIO& operator= (DeviceIO&& other) noexcept;
+        
+        /** @brief Set the device handle to be non-blocking.
+         
+            In non-blocking mode calls to hid_read() will return
+            immediately with a value of 0 if there is no data to be
+            read. In blocking mode, hid_read() will wait (block) until
+            there is data to read before returning.
+        
+            Nonblocking can be turned on and off at any time.
+        
+            @ingroup API
+            @param device A device handle returned from hid_open().
+            @param nonblock enable or not the nonblocking reads
+            - 1 to enable nonblocking
+            - 0 to disable nonblocking.
+        
+         @returns
+         This function returns 0 on success and -1 on error.
+         */
+        juce::Result setNonblocking (bool shouldBeNonblocking);
+        
+        /** @brief Write an Output report to a HID device.
+         
+         write() will send the data on the first OUT endpoint, if
+         one exists. If it does not, it will send the data through
+         the Control Endpoint (Endpoint 0).
+         
+         @param data The data to send
+         @param length The length in bytes of the data to send.
+         @param bytesWritten Optional int reference that will store 
+         the actual number of bytes written or -1 on error.
+         
+         @returns
+         The Result of the write.
+         */
+        juce::Result write (const unsigned char *data, size_t length, size_t* bytesWritten = nullptr);
+        
+        /** @brief Write several Output reports, in order.
+         
+         Much cheaper than calling write() for each one: the backend submits
+         them with as few system calls and waits as it can. On Windows up to
+         16 writes are queued in the driver at once and short reports are
+         padded without allocating; on macOS each report is still a separate
+         synchronous transfer.
+         
+         No more reports are sent once one fails.
+         
+         @param reports The reports, each starting with its report ID.
+         @param count The number of reports.
+         @param numWritten Optional; receives the number of reports written
+         before the first failure.
+         
+         @returns
+         Result::ok if every report was written, otherwise the error of the
+         first one that wasn't.
+         */
+        juce::Result writeMany (const hid_output_report* reports, size_t count, size_t* numWritten = nullptr);
+        
+        /** @brief Read an Input report from a HID device.
+         
+         Input reports are returned
+         to the host through the INTERRUPT IN endpoint
+         
+         @param data A buffer to put the read data into.
+         @param length The number of bytes to read.
+         @param bytesRead Optional int reference that will store
+         the actual number of bytes read or -1 on error.
+         
+         @returns
+         The Result of the read.
+         */
+        juce::Result read (unsigned char *data, size_t length, size_t* bytesRead = nullptr);
+        
+        /** @brief Read an Input report from a HID device with timeout.
+         
+         Input reports are returned
+         to the host through the INTERRUPT IN endpoint.
+         
+         @param data A buffer to put the read data into.
+         @param length The number of bytes to read.
+         @param milliseconds timeout in milliseconds or -1 for blocking wait.
+         @param bytesRead Optional int reference that will store
+         the actual number of bytes read or -1 on error.
+         
+         @returns
+         The result of the read. If no packet was available to be read within
+         the timeout period, this function returns Result::fail.
+         */
+        juce::Result readTimeout (unsigned char *data, size_t length, int milliseconds, size_t* bytesRead = nullptr);
+        
+        /** @brief Read an Input report without copying it into caller memory.
+         
+         The report is copied exactly once, from the OS into a pooled buffer,
+         and handed out as a ReportView referencing that buffer.
+         
+         @param view Receives the report. Left empty if nothing was read.
+         @param milliseconds timeout in milliseconds or -1 for blocking wait.
+         
+         @returns
+         The result of the read. If no packet was available to be read within
+         the timeout period, this function returns Result::fail.
+         */
+        juce::Result readReport (ReportView& view, int milliseconds = -1);
+        
+        /** @brief Send a Feature report to the device.
+         
+         Feature reports are sent over the Control endpoint as a
+         Set_Report transfer.
+         
+         @param data The data to send
+         @param length The length in bytes of the data to send
+         @param bytesWritten Optional int reference that will store
+         the actual number of bytes read or -1 on error.
+
+         @returns
+         The result of the write.
+         */
+        juce::Result sendFeatureReport (const unsigned char *data, size_t length, size_t* bytesWritten = nullptr);
+        
+        /** @brief Get a feature report from a HID device.
+
+         @param data A buffer to put the read data into
+         @param length The number of bytes to read. The buffer can be longer
+         than the actual report.
+         @param bytesRead Optional int reference that will store
+         the actual number of bytes read plus
+         one for the report ID, or -1 on error.
+
+         @returns
+         The result of the write.
+         */
+        juce::Result getFeatureReport (unsigned char *data, size_t length, size_t* bytesRead = nullptr);
+        
+        /** @brief Have getFeatureReport() answer from memory for a while after
+         it has read a report, for settings that are polled far more often
+         than they change.
+         
+         Reports are cached per report ID, in the device handle, so every
+         DeviceIO for this connection shares the cache. A cached report is
+         thrown away when its time to live runs out, when a report with the
+         same ID is sent through this connection, and by
+         invalidateFeatureReportCache(). Changes made by the device itself
+         or through other connections aren't seen until then.
+         
+         @param timeToLiveMs How long a report stays cached. 0 turns the
+         cache off, and a negative value keeps reports until they're
+         invalidated.
+         
+         @returns
+         This function returns Result::ok on success and Result::fail on error.
+         */
+        juce::Result setFeatureReportCache (int timeToLiveMs);
+        
+        /** Throws away the cached report with this ID, or -1 for all of them. */
+        juce::Result invalidateFeatureReportCache (int reportID = -1);
+        
+       #if JUCE_HID_COROUTINES
+        /** @brief co_await versions of readReport(), write() and getFeatureReport().
+         
+         The coroutine is suspended while the transfer is pending and resumed
+         on the loop's thread with an AsyncResult, so one AsyncLoop can run a
+         large number of device conversations without a thread for each.
+         
+         The buffers must stay valid until the coroutine is resumed. Passing no
+         loop uses AsyncLoop::getDefault().
+         */
+        AsyncOperation readAsync (int milliseconds = -1, AsyncLoop* loop = nullptr);
+        AsyncOperation writeAsync (const unsigned char *data, size_t length, AsyncLoop* loop = nullptr);
+        AsyncOperation getFeatureReportAsync (unsigned char *data, size_t length, AsyncLoop* loop = nullptr);
+       #endif
+        
+        /** @brief Buffer versions of the calls above.
+         
+         The MemoryBlock reads grow the block to the device's largest report of
+         that type (see getReportLengths()) if it's shorter, and never shrink
+         it, so reusing one block doesn't allocate. The report fills the first
+         IOResult::numBytes bytes.
+         
+         For getFeatureReport() the first byte of the buffer is the report ID
+         to ask for; the MemoryBlock version sets it from reportID.
+         */
+        IOResult write (const juce::MemoryBlock& data);
+        juce::Result writeMany (const juce::Array<juce::MemoryBlock>& reports, size_t* numWritten = nullptr);
+        IOResult read (juce::MemoryBlock& data);
+        IOResult readTimeout (juce::MemoryBlock& data, int milliseconds);
+        IOResult sendFeatureReport (const juce::MemoryBlock& data);
+        IOResult getFeatureReport (juce::MemoryBlock& data, unsigned char reportID);
+        
+       #if JUCE_HID_SPAN
+        IOResult write (std::span<const unsigned char> data);
+        juce::Result writeMany (std::span<const std::span<const unsigned char>> reports, size_t* numWritten = nullptr);
+        IOResult read (std::span<unsigned char> data);
+        IOResult readTimeout (std::span<unsigned char> data, int milliseconds);
+        IOResult sendFeatureReport (std::span<const unsigned char> data);
+        IOResult getFeatureReport (std::span<unsigned char> data);
+       #endif
+        
+        /** The device's strings. They're read once, when the device is opened
+         *  (or taken from a scan that already read them), and shared with its
+         *  DeviceInfo, so these don't call the OS.
+         */
+        const juce::String& getManufacturerString() const;
+        const juce::String& getProductString() const;
+        const juce::String& getSerialNumberString() const;
+        const std::wstring& getManufacturerStringWide() const;
+        const std::wstring& getProductStringWide() const;
+        const std::wstring& getSerialNumberStringWide() const;
+        
+        /** @brief Get The Manufacturer String from a HID device.
+         
+         Copied from the strings read when the device was opened.
+         
+         @param string A wide string buffer to put the data into.
+         @param maxlen The length of the buffer in multiples of wchar_t.
+         
+         @returns
+         This function returns Result::ok on success and Result::fail on error.
+         */
+        juce::Result getManufacturerString (wchar_t* string, size_t maxLength);
+        
+        /** @brief Get The Product String from a HID device.
+         
+         @param string A wide string buffer to put the data into.
+         @param maxlen The length of the buffer in multiples of wchar_t.
+         
+         @returns
+         This function returns Result::ok on success and Result::fail on error.
+         */
+        juce::Result getProductString (wchar_t* string, size_t maxLength);
+        
+        /** @brief Get The Serial Number String from a HID device.
+         
+         @param string A wide string buffer to put the data into.
+         @param maxlen The length of the buffer in multiples of wchar_t.
+         
+         @returns
+         This function returns Result::ok on success and Result::fail on error.
+         */
+        juce::Result getSerialNumberString (wchar_t* string, size_t maxLength);
+        
+        /** @brief Get a string from a HID device, based on its string index.
+         
+         Each index is only asked of the device once; after that the string
+         is copied from memory.
+         
+         @param string_index The index of the string to get.
+         @param string A wide string buffer to put the data into.
+         @param maxlen The length of the buffer in multiples of wchar_t.
+         
+         @returns
+         This function returns Result::ok on success and Result::fail on error.
+         */
+        juce::Result getIndexedString (int index, wchar_t* string, size_t maxLength);
+        juce::Result getIndexedString (int index, juce::String& result);
+        
+        /** @brief Get the largest reports the device can send or receive.
+         
+         @param lengths Receives the maximum input, output and feature report
+         lengths, as reported by the OS.
+         
+         @returns
+         This function returns Result::ok on success and Result::fail on error.
+         */
+        juce::Result getMaxReportLengths (ReportLengths& lengths);
+        
+        /** The largest reports the device can send or receive, as queried once
+         *  when it was opened. All 0 if the backend couldn't tell.
+         */
+        const ReportLengths& getReportLengths() const;
+        
+        /** @brief Reschedule the thread the backend receives this device's
+         input reports on.
+         
+         Only the macOS backend has one; on Windows reports are read on the
+         calling thread, so use hid::setCurrentThreadOptions() there instead.
+         
+         @returns
+         This function returns Result::ok on success and Result::fail on error.
+         */
+        juce::Result setReaderThreadOptions (const ThreadOptions& options);
+        
+        /** @brief Get the scheduling latency measured on the backend's reader
+         thread. Needs ThreadOptions::latencyProbeInterval to be set.
+         
+         @returns
+         This function returns Result::ok on success and Result::fail on error.
+         */
+        juce::Result getReaderThreadStats (ThreadStats& stats);
+        
+        /** @brief Get a snapshot of the counters the backend keeps for this
+         device. Reading them doesn't hold up reads or writes.
+         
+         The Windows backend has no input queue, so there queueHighWater
+         stays 0, consumeLatency only covers its own bookkeeping, and reports
+         the OS drops aren't counted.
+         
+         @returns
+         This function returns Result::ok on success and Result::fail on error.
+         */
+        juce::Result getMetrics (DeviceMetrics& metrics);
+        
+        /** Sets all of this device's counters back to zero. */
+        void resetMetrics();
+        
+        /** @brief Configure how many input reports are queued for reading,
+         and what happens to the ones that arrive while the queue is full.
+         
+         The default is 32 reports (64 on Windows) with dropOldest. On Windows
+         only dropOldest and grow are supported, and the depth is limited to
+         2 - 512.
+         
+         @param depth The number of reports to queue, at least 1.
+         @param policy What to do when the queue is full.
+         @param maxDepth For grow, the most reports the queue can grow to.
+         
+         @returns
+         This function returns Result::ok on success and Result::fail on error.
+         */
+        juce::Result setInputQueue (int depth, OverflowPolicy policy = dropOldest, int maxDepth = 0);
+        
+        /** @brief Have a listener told whenever input reports are dropped.
+         
+         The listener must outlive the device, or be removed by passing
+         nullptr. Fails on Windows, where drops can't be seen.
+         
+         @returns
+         This function returns Result::ok on success and Result::fail on error.
+         */
+        juce::Result setDropListener (DropListener* listener);
+        
+        /** The number of input reports dropped since the device was opened. */
+        juce::uint64 getNumDroppedReports();
+        
+        /** Connect to this device. Returns Result::fail if already connected
+         */
+        juce::Result connect();
+        
+        /** Disconnect from the device. Returns Result::fail if not connected.
+         */
+        void disconnect();
+        
+        /** Returns the DeviceInfo associated with this DeviceIO.
+         *
+         *  DeviceInfo & DeviceIO always both refer to the same unique device
+         */
+        const DeviceInfo& getInfo() const;
+        
+        bool operator== (const DeviceIO& other) const;
+        bool operator== (const DeviceInfo& other) const;
+        
+    private:
+
+        friend class ManagedConnection;
+        friend class DeviceCache;
+        friend class ReportReader;
+        friend class FeatureReportBatch;
+        
+        Device device;
+        DeviceInfo info;
+        ReportLengths reportLengths;
+        JUCE_LEAK_DETECTOR(DeviceIO)
+    };
+    
+    
+    
+    
+    
+    
+    
+    
+    
+    
+    
+    
+    
+    /** A single-producer, single-consumer ring of timestamped input reports,
+     *  for getting reports into an audio callback.
+     *
+     *  All the memory is allocated up front. On the consumer side pop(),
+     *  popAll() and getNumReady() never allocate, lock or make system calls,
+     *  and always finish in a bounded number of steps, so they're safe to call
+     *  from AudioProcessor::processBlock(). Fill it from one other thread,
+     *  usually a ReportReader.
+     */
+    //=========================================================================
+    //=========================================================================
+    class RealtimeReportQueue
+    {
+    public:
+        
+        /** Holds up to capacity reports of at most maxReportSize bytes each. */
+        RealtimeReportQueue (int capacity = 256, size_t maxReportSize = 64);
+        
+        /** Producer side. Returns false, and counts the report as dropped, if
+         *  the queue is full or the report is longer than getMaxReportSize().
+         */
+        bool push (const unsigned char* data, size_t length, juce::uint64 timestamp) noexcept;
+        
+        /** Consumer side. Copies the oldest report into data, which should be
+         *  getMaxReportSize() long. Returns false if there was none.
+         */
+        bool pop (unsigned char* data, size_t& length, juce::uint64& timestamp) noexcept;
+        
+        /** Consumer side. Calls callback (const unsigned char* data, size_t length,
+         *  juce::uint64 timestamp) for every queued report, in order, without
+         *  copying it, then frees their slots. Returns how many there were.
+         */
+        template <typename Callback>
+        int popAll (Callback&& callback) noexcept
+        {
+            int start1, size1, start2, size2;
+            fifo.prepareToRead (fifo.getNumReady(), start1, size1, start2, size2);
+            
+            for (int i = start1; i < start1 + size1; ++i) {
+                callback (getSlotData (i), slots[i].length, slots[i].timestamp);
+            }
+            for (int i = start2; i < start2 + size2; ++i) {
+                callback (getSlotData (i), slots[i].length, slots[i].timestamp);
+            }
+            
+            fifo.finishedRead (size1 + size2);
+            return size1 + size2;
+        }
+        
+        /** Like popAll(), but stops at the first report with a timestamp of
+         *  timestampLimit or later, leaving it and the ones after it queued.
+         */
+        template <typename Callback>
+        int popUntil (juce::uint64 timestampLimit, Callback&& callback) noexcept
+        {
+            int start1, size1, start2, size2;
+            fifo.prepareToRead (fifo.getNumReady(), start1, size1, start2, size2);
+            
+            int numRead = 0;
+            for (int i = start1; i < start1 + size1 && slots[i].timestamp < timestampLimit; ++i, ++numRead) {
+                callback (getSlotData (i), slots[i].length, slots[i].timestamp);
+            }
+            if (numRead == size1) {
+                for (int i = start2; i < start2 + size2 && slots[i].timestamp < timestampLimit; ++i, ++numRead) {
+                    callback (getSlotData (i), slots[i].length, slots[i].timestamp);
+                }
+            }
+            
+            fifo.finishedRead (numRead);
+            return numRead;
+        }
+        
+        int getNumReady() const noexcept;
+        int getCapacity() const noexcept;
+        size_t getMaxReportSize() const noexcept;
+        
+        /** Number of reports push() has rejected. */
+        int getNumDropped() const noexcept;
+        
+        /** Empties the queue. Only call this while neither side is using it. */
+        void reset() noexcept;
+        
+    private:
+        
+        struct Slot
+        {
+            juce::uint64 timestamp;
+            size_t length;
+        };
+        
+        unsigned char* getSlotData (int index) const noexcept;
+        
+        juce::AbstractFifo fifo;
+        juce::HeapBlock<Slot> slots;
+        juce::HeapBlock<unsigned char> storage;
+        const size_t maxReportSize;
+        juce::Atomic<int> numDropped;
+        
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RealtimeReportQueue)
+    };
+    
+    
+    /** A thread that reads input reports from a device and pushes them into a
+     *  RealtimeReportQueue, keeping the timestamps the backend gave them.
+     *
+     *  The reader stops by itself if the device returns an error (e.g. it was
+     *  unplugged); check hasFailed().
+     *
+     *  Instead of a queue it can feed one lane of a DecodePool, when handling
+     *  the reports is too much work for the thread that reads them.
+     *
+     *  It starts with hid::getDefaultReaderThreadOptions(). getStats() measures
+     *  how long reports waited between arriving and being picked up by this
+     *  thread, which is where its scheduling latency shows.
+     */
+    //=========================================================================
+    //=========================================================================
+    class ReportReader :   private juce::Thread
+    {
+    public:
+        
+        ReportReader (const DeviceIO& device, RealtimeReportQueue& queue);
+        ReportReader (const DeviceIO& device, DecodePool& pool, int lane);
+        ~ReportReader();
+        
+        void start();
+        void stop();
+        bool isRunning() const;
+        bool hasFailed() const;
+        
+        /** Applied when the thread starts, or right away if it's running. */
+        void setThreadOptions (const ThreadOptions& options);
+        ThreadStats getStats() const;
+        
+    private:
+        
+        void run();
+        
+        DeviceIO device;
+        RealtimeReportQueue* queue;
+        DecodePool* pool;
+        const int lane;
+        juce::Atomic<int> failed;
+        
+        juce::SpinLock statsLock;
+        ThreadOptions options;
+        juce::Atomic<int> optionsChanged;
+        hid_thread_stats stats;
+        
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ReportReader)
+    };
+    
+    
+    /** Sends a list of feature reports, e.g. a device's configuration, and
+     *  optionally reads each one back to check it took.
+     *
+     *  The backends' control transfers are synchronous, so the reports still
+     *  go one at a time, but back to back: they go straight to the backend
+     *  from one buffer that holds the whole batch, and failures are recorded
+     *  as a status per report, so sending one doesn't allocate or build a
+     *  Result. Only the first error's message is kept.
+     *
+     *  send() works on the calling thread; sendInBackground() starts a thread
+     *  and tells a Listener how it's getting on. Don't change the batch while
+     *  it's being sent.
+     *  @code
+     *  hid::FeatureReportBatch batch;
+     *  for (auto& setting : settings)
+     *      batch.add (setting.report, setting.report);   // expect it back unchanged
+     *  
+     *  Result r = batch.send (device);
+     *  DBG (batch.getNumSucceeded() << " reports in " << (batch.getTotalTime() / 1000000) << " ms");
+     *  @endcode
+     */
+    //=========================================================================
+    //=========================================================================
+    class FeatureReportBatch :   private juce::Thread
+    {
+    public:
+        
+        enum Status
+        {
+            notSent,            /**< Not attempted (yet), or skipped after an earlier failure. */
+            sent,               /**< Sent, with no readback asked for. */
+            verified,           /**< Sent, and read back as expected. */
+            sendFailed,
+            readbackFailed,     /**< Sent, but reading it back failed. */
+            mismatch            /**< Sent, but read back different. */
+        };
+        
+        struct ItemResult
+        {
+            Status status = notSent;
+            size_t numBytes = 0;            /**< Bytes sent. */
+            juce::uint64 nanoseconds = 0;   /**< For the send and the readback. */
+        };
+        
+        /** Told on the batch's thread how a sendInBackground() is going. Keep
+         *  the callbacks short; they hold up the next report.
+         */
+        class Listener
+        {
+        public:
+            
+            virtual ~Listener() {}
+            
+            /** Called after each report. */
+            virtual void featureReportsSent (int numDone, int numTotal) = 0;
+            
+            /** Called once at the end, with what send() would have returned. */
+            virtual void featureReportBatchFinished (const juce::Result& result) = 0;
+        };
+        
+        FeatureReportBatch();
+        ~FeatureReportBatch();
+        
+        /** Adds a report to send; the first byte is the report ID. With an
+         *  expected readback, the report with that ID (its first byte) is
+         *  read back after sending and compared with it.
+         */
+        void add (const unsigned char* data, size_t length);
+        void add (const unsigned char* data, size_t length,
+                  const unsigned char* expected, size_t expectedLength);
+        void add (const juce::MemoryBlock& report);
+        void add (const juce::MemoryBlock& report, const juce::MemoryBlock& expected);
+        
+        /** Removes all the reports and results. */
+        void clear();
+        int size() const;
+        
+        /** If true (the default) the rest of the batch is skipped after the
+         *  first failure.
+         */
+        void setStopOnError (bool shouldStop);
+        
+        /** Sends the batch on the calling thread. Fails if any report did. */
+        juce::Result send (DeviceIO& device);
+        
+        /** Sends the batch on a background thread. The device handle must stay
+         *  open until it has finished. Fails if a send is already running.
+         */
+        juce::Result sendInBackground (const DeviceIO& device, Listener* listener = nullptr);
+        bool isSending() const;
+        
+        /** Skips whatever is left of a background send and waits for it. */
+        void cancel();
+        
+        /** Returns false if it hasn't finished in time. */
+        bool waitUntilFinished (int timeoutMs) const;
+        
+        /** Valid for reports below getNumDone(), even while sending. */
+        ItemResult getItemResult (int index) const;
+        
+        int getNumDone() const;
+        int getNumSucceeded() const;
+        int getNumFailed() const;
+        
+        /** How long the last send took, in nanoseconds. */
+        juce::uint64 getTotalTime() const;
+        
+        /** What the last send returned. */
+        juce::Result getResult() const;
+        
+    private:
+        
+        struct Item
+        {
+            size_t offset, length;
+            size_t expectedOffset, expectedLength;    // expectedLength is 0 without a readback
+            ItemResult result;
+        };
+        
+        void run();
+        juce::Result sendAll (Device handle, Listener* listener);
+        
+        juce::MemoryBlock data;         // every report and expected readback, back to back
+        size_t dataSize;
+        juce::Array<Item> items;
+        juce::HeapBlock<unsigned char> readbackBuffer;
+        size_t readbackBufferSize;
+        bool stopOnError;
+        
+        DeviceIO device;
+        Listener* listener;
+        juce::Atomic<int> numDone, numFailed;
+        juce::Atomic<juce::uint64> totalTime;
+        juce::CriticalSection resultLock;
+        juce::Result result;
+        
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(FeatureReportBatch)
+    };
+    
+    
+   #if JUCE_HID_COROUTINES
+    /** What co_await on an AsyncOperation gives back. */
+    struct AsyncResult
+    {
+        juce::Result result = juce::Result::ok();
+        size_t numBytes = 0;
+        ReportView report;          /**< Only set by DeviceIO::readAsync(). */
+    };
+    
+    
+    /** A transfer a coroutine is waiting on. Returned by DeviceIO::readAsync(),
+     *  writeAsync() and getFeatureReportAsync(); just co_await it.
+     */
+    class AsyncOperation
+    {
+    public:
+        
+        enum Type
+        {
+            readType,
+            writeType,
+            getFeatureReportType
+        };
+        
+        AsyncOperation (AsyncLoop& loop, Type type, Device device,
+                        unsigned char* data, size_t length, int milliseconds) noexcept;
+        
+        bool await_ready() const noexcept { return false; }
+        void await_suspend (std::coroutine_handle<> handle);
+        AsyncResult await_resume() { return std::move (result); }
+        
+    private:
+        
+        friend class AsyncLoop;
+        
+        AsyncLoop& loop;
+        const Type type;
+        Device device;
+        unsigned char* data;
+        size_t length;
+        int milliseconds;
+        juce::uint64 deadline = 0;      // on the hid::getMonotonicTime() clock, 0 for none
+        bool polled = false;            // a read on a backend without input callbacks
+        std::coroutine_handle<> handle;
+        AsyncResult result;
+    };
+    
+    
+    /** The thread that drives AsyncOperations.
+     *
+     *  Every coroutine is resumed on this thread. Writes and feature reports
+     *  block in the OS, so they're handed to a few transfer threads and the
+     *  loop gets on with everything else until they're done.
+     *
+     *  Pending reads are checked, without blocking, whenever a backend says
+     *  input has arrived on one of their devices (see hid_set_input_callback())
+     *  or one of them times out. Backends that can't say (Windows) are polled
+     *  every millisecond instead, at the cost of a call per pending read each
+     *  time. A device should only have one read pending at once.
+     *
+     *  Split devices over two or more loops if the handling code is heavy, or
+     *  there are many polled reads.
+     */
+    //=========================================================================
+    //=========================================================================
+    class AsyncLoop :   private juce::Thread
+    {
+    public:
+        
+        AsyncLoop();
+        
+        /** Operations still pending are resumed with Result::fail. */
+        ~AsyncLoop();
+        
+        /** Started the first time it's used. */
+        static AsyncLoop& getDefault();
+        
+        /** Number of operations waiting to complete. */
+        int getNumPending() const;
+        
+    private:
+        
+        friend class AsyncOperation;
+        
+        enum { numTransferThreads = 4 };
+        
+        void submit (AsyncOperation* operation);
+        void wake();
+        static void HID_API_CALL inputArrived (hid_device* device, void* context);
+        bool poll (AsyncOperation& operation, juce::uint64 now);
+        void startTransfer (AsyncOperation* operation);
+        static void transfer (AsyncOperation& operation);
+        void run();
+        
+        juce::CriticalSection lock;
+        juce::Array<AsyncOperation*> incoming;      // guarded by lock
+        juce::Array<AsyncOperation*> transferred;   // guarded by lock: back from the transfer threads
+        juce::Array<AsyncOperation*> arrived;       // only touched by the loop thread
+        juce::Array<AsyncOperation*> pending;       // only touched by the loop thread
+        juce::Array<AsyncOperation*> completed;     // only touched by the loop thread
+        juce::Atomic<int> numPending;
+        juce::Atomic<int> numTransfers;             // handed to the transfer threads and not back yet
+        juce::Atomic<int> wakeRequested;
+        bool hasInputCallbacks = true;              // only touched by the loop thread
+        juce::WaitableEvent wakeUp;
+        juce::ThreadPool transfers;                 // last, so it's gone before what its jobs use
+        
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AsyncLoop)
+    };
+    
+    
+    /** A coroutine return type for fire-and-forget device conversations:
+     *  it starts running straight away and cleans up after itself.
+     *
+     *  @code
+     *  hid::AsyncTask ping (hid::DeviceIO& device)
+     *  {
+     *      auto sent = co_await device.writeAsync (command, sizeof (command));
+     *      auto reply = co_await device.readAsync (100);
+     *      ...
+     *  }
+     *  @endcode
+     */
+    struct AsyncTask
+    {
+        struct promise_type
+        {
+            AsyncTask get_return_object() noexcept               { return {}; }
+            std::suspend_never initial_suspend() const noexcept  { return {}; }
+            std::suspend_never final_suspend() const noexcept    { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept                  { std::terminate(); }
+        };
+    };
+   #endif
+    
+    
+    /** Hands input reports from many devices to a small pool of threads.
+     *
+     *  Each device gets a lane. The reports submitted to one lane are handled
+     *  one at a time and in the order they were submitted, while different
+     *  lanes are handled in parallel. A lane waits on the thread its index maps
+     *  to; a thread that runs out of lanes steals waiting ones from the others,
+     *  so a few busy devices don't leave the rest of the pool idle. Idle
+     *  threads sleep until a lane has to wait behind a busy thread, so a pool
+     *  with no traffic costs next to nothing.
+     *
+     *  Whatever a lane has collected by the time a thread picks it up is
+     *  handled as one batch, so a busy lane costs one hand-over per batch
+     *  rather than one per report.
+     */
+    //=========================================================================
+    //=========================================================================
+    class DecodePool
+    {
+    public:
+        
+        /** Called on one of the pool's threads with the lane the report was
+         *  submitted to.
+         */
+        typedef std::function<void (int lane, const ReportView& report)> Handler;
+        
+        /** numThreads of 0 uses one thread per CPU core. */
+        DecodePool (Handler handler, int numThreads = 0);
+        ~DecodePool();
+        
+        /** Adds a lane and returns its index. */
+        int addLane();
+        int getNumLanes() const;
+        int getNumThreads() const;
+        
+        /** Queues a report on a lane. Returns false if there's no such lane. */
+        bool submit (int lane, const ReportView& report);
+        
+        /** Waits until every submitted report has been handled. Returns false
+         *  if that didn't happen within timeoutMs (-1 waits forever).
+         */
+        bool waitUntilIdle (int timeoutMs = -1) const;
+        
+        /** Number of reports handled so far. */
+        juce::int64 getNumHandled() const;
+        
+        /** Number of times a thread took a lane that was waiting on another. */
+        juce::int64 getNumStolen() const;
+        
+    private:
+        
+        struct Lane;
+        class Worker;
+        
+        void schedule (Lane* lane, int workerIndex);
+        void wakeThief (int busyWorkerIndex);
+        Lane* steal (int thiefIndex);
+        void handleLane (Lane& lane, int workerIndex);
+        
+        const Handler handler;
+        juce::ReadWriteLock lanesLock;
+        juce::OwnedArray<Lane> lanes;
+        juce::OwnedArray<Worker> workers;
+        juce::Atomic<juce::int64> numSubmitted, numHandled, numStolen;
+        
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DecodePool)
+    };
+    
+    
+    
+    /** One control change, positioned within an audio block. */
+    struct ControlEvent
+    {
+        int samplePosition;         /**< Offset from the start of the block. */
+        int controller;
+        int value;
+        juce::uint64 timestamp;     /**< When the report it came from arrived. */
+    };
+    
+    
+    /** A fixed-capacity list of ControlEvents for one audio block, in the spirit
+     *  of juce::MidiBuffer (which lives in juce_audio_basics, so this module
+     *  can't use it). Adding events never allocates.
+     *
+     *  Events are kept in the order they were added, which SampleAligner makes
+     *  the order of their sample positions. Iterate with a range-based for.
+     */
+    //=========================================================================
+    //=========================================================================
+    class ControlEventBuffer
+    {
+    public:
+        
+        ControlEventBuffer (int capacity = 512);
+        
+        /** Returns false, and counts the event as dropped, if the buffer is full. */
+        bool addEvent (int samplePosition, int controller, int value, juce::uint64 timestamp) noexcept;
+        
+        void clear() noexcept;
+        bool isEmpty() const noexcept;
+        int getNumEvents() const noexcept;
+        int getNumDropped() const noexcept;
+        
+        const ControlEvent* begin() const noexcept;
+        const ControlEvent* end() const noexcept;
+        
+    private:
+        
+        juce::HeapBlock<ControlEvent> events;
+        int capacity;
+        int numEvents;
+        int numDropped;
+        
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ControlEventBuffer)
+    };
+    
+    
+    /** Places input reports at the right sample within an audio block, using
+     *  their arrival timestamps, instead of all at the start of the block.
+     *
+     *  Reports are delayed by a fixed latency (by default one block) so that a
+     *  report's position depends only on when it arrived, not on where the
+     *  block boundaries happen to fall — the jitter becomes a constant delay.
+     *
+     *  blockStartTime is when the block's first sample is played, in
+     *  nanoseconds on the hid::getMonotonicTime() clock. Hosts that provide a
+     *  host time use the same clock on macOS (mach_absolute_time) and Windows
+     *  (QueryPerformanceCounter); otherwise hid::getMonotonicTime() at the top
+     *  of processBlock() is a good approximation.
+     *
+     *  Everything here is real-time safe.
+     *  @code
+     *  void processBlock (AudioBuffer<float>& buffer, MidiBuffer&)
+     *  {
+     *      events.clear();
+     *      aligner.alignBlock (queue, hid::getMonotonicTime(), buffer.getNumSamples(), events,
+     *          [] (const unsigned char* data, size_t length, int position,
+     *              juce::uint64 timestamp, hid::ControlEventBuffer& out)
+     *          {
+     *              if (length >= 3)
+     *                  out.addEvent (position, data[1], data[2], timestamp);
+     *          });
+     *
+     *      for (const hid::ControlEvent& e : events)
+     *          ...
+     *  }
+     *  @endcode
+     */
+    //=========================================================================
+    //=========================================================================
+    class SampleAligner
+    {
+    public:
+        
+        SampleAligner();
+        
+        /** Call from prepareToPlay(). The latency defaults to one block of
+         *  samplesPerBlock samples.
+         */
+        void prepare (double sampleRate, int samplesPerBlock);
+        
+        /** Overrides the delay applied to every report. */
+        void setLatency (juce::uint64 nanoseconds) noexcept;
+        juce::uint64 getLatency() const noexcept;
+        
+        /** Where a report that arrived at timestamp falls in a block of numSamples
+         *  starting at blockStartTime, clamped to the block.
+         */
+        int getSamplePosition (juce::uint64 timestamp, juce::uint64 blockStartTime, int numSamples) const noexcept;
+        
+        /** Takes every report due within this block from the queue and calls
+         *  decoder (data, length, samplePosition, timestamp, events) for each,
+         *  which should add the control changes the report stands for. Reports
+         *  due in a later block stay queued. Returns the number of reports used.
+         */
+        template <typename Decoder>
+        int alignBlock (RealtimeReportQueue& queue, juce::uint64 blockStartTime, int numSamples,
+                        ControlEventBuffer& events, Decoder&& decoder) noexcept
+        {
+            const juce::uint64 blockEndTime = blockStartTime + samplesToNanoseconds (numSamples);
+            const juce::uint64 limit = blockEndTime > latency ? blockEndTime - latency : 0;
+            
+            return queue.popUntil (limit, [&] (const unsigned char* data, size_t length, juce::uint64 timestamp)
+            {
+                decoder (data, length, getSamplePosition (timestamp, blockStartTime, numSamples), timestamp, events);
+            });
+        }
+        
+    private:
+        
+        juce::uint64 samplesToNanoseconds (int numSamples) const noexcept;
+        
+        double sampleRate;
+        juce::uint64 latency;
+        
+        JUCE_LEAK_DETECTOR(SampleAligner)
+    };
+    
+    
+    
+    /** Describes which devices an enumeration should return.
+     *
+     *  The criteria are handed down to hid_enumerate_filtered(), which checks
+     *  each of them as soon as the OS reports the property it looks at, so
+     *  devices that don't match are skipped before their strings are read
+     *  (and on Windows, before they're even opened where possible).
+     *
+     *  Every criterion is optional; a default DeviceFilter matches everything.
+     *  @code
+     *  hid::DeviceFilter filter;
+     *  filter.setIds (0x1234, 0x5678).setUsage (0xFF00, 0x01);
+     *  hid::DeviceIterator iterator (filter);
+     *  @endcode
+     */
+    //=========================================================================
+    //=========================================================================
+    class DeviceFilter
+    {
+    public:
+        
+        /** Signature of a custom predicate. The serial number, manufacturer and
+         *  product strings are not filled in yet when it's called.
+         */
+        typedef std::function<bool (const hid_device_info&)> Predicate;
+        
+        /** Creates a filter that matches every device. */
+        DeviceFilter();
+        
+        /** Only match devices with this VendorID & ProductID (0 matches any). */
+        DeviceFilter& setIds (unsigned short vendorID, unsigned short productID = 0);
+        
+        /** Only match devices with this usage page & usage (0 matches any). */
+        DeviceFilter& setUsage (unsigned short usagePage, unsigned short usage = 0);
+        
+        /** Only match devices with this interface number (-1 if the OS doesn't report one). */
+        DeviceFilter& setInterfaceNumber (int interfaceNumber);
+        
+        /** Only match devices whose path starts with this prefix. */
+        DeviceFilter& setPathPrefix (const juce::String& prefix);
+        
+        /** Only match devices for which this returns true. It runs last, after
+         *  all the other criteria have passed.
+         */
+        DeviceFilter& setPredicate (Predicate predicate);
+        
+        /** By default the string properties aren't read during the scan
+         *  (DeviceInfo fetches them lazily). Pass true to read them up front.
+         */
+        DeviceFilter& setReadStrings (bool shouldReadStrings);
+        
+        /** Runs the enumeration. The list must be freed with hid_free_enumeration(). */
+        hid_device_info* enumerate() const;
+        
+    private:
+        
+        static int callPredicate (const hid_device_info* info, void* context);
+        
+        hid_enumerate_filter filter;
+        juce::String pathPrefix;
+        Predicate predicate;
+        
+        JUCE_LEAK_DETECTOR(DeviceFilter)
+    };
+    
+    
+    
+    /**  Iterates through all the availiable devices, optionally with a given
+     *  VendorID and ProductID.
+     *
+     *  Call DeviceIterator::hasNext() to see if there are any available,
+     *  and DeviceIterator::getNext() to get them. Do not call getNext() when
+     *  there are no devices available — this will crash the program.
+     */
+    //=========================================================================
+    //=========================================================================
+    class DeviceIterator
+    {
+    public:
+        
+        /** Create an iterator from a VendorID & ProductID */
+        DeviceIterator (unsigned short vendorID  = 0,
+                        unsigned short productID = 0);
+        
+        /** Create an iterator over the devices matching a DeviceFilter */
+        DeviceIterator (const DeviceFilter& filter);
+        
+        /**
+         */
+        ~DeviceIterator();
+        
+        /** Returns true if there is another device to get via getNext()
+         */
+        bool hasNext();
+        
+        /**  Returns the next DeviceInfo available.
+         *  You MUST call hasNext() first to see if there are any available.
+         *  Program will crash if you call getNext() when there are no more devices available.
+         */
+        DeviceInfo getNext();
+        
+    private:
+        
+        JUCE_LEAK_DETECTOR(DeviceIterator)
+        hid_device_info* current;
+        hid_device_info* DeleteThis;
+    };
+    
+    
+    
+    /** A cached, hash-indexed set of devices.
+     *
+     *  Looking a device up here costs a hash probe instead of a full OS
+     *  enumeration. The shared index is kept up to date incrementally by every
+     *  DeviceScanner, and hid::isDeviceAvailable() / hid::getDeviceInfo() use it
+     *  as long as it isn't older than getMaxAge().
+     */
+    //=========================================================================
+    //=========================================================================
+    class DeviceIndex
+    {
+    public:
+        
+        DeviceIndex();
+        
+        /** The index used by DeviceScanner, hid::isDeviceAvailable() and
+         *  hid::getDeviceInfo().
+         */
+        static DeviceIndex& getShared();
+        
+        /** Brings the index in line with a freshly enumerated device list,
+         *  only touching the entries of devices that were added or removed.
+         *  Returns true if anything changed.
+         */
+        bool update (const juce::Array<DeviceInfo>& currentDevices);
+        
+        /** Enumerates all devices and updates the index with them. */
+        void refresh();
+        
+        /** Refreshes the index if the last update is older than getMaxAge(). */
+        void refreshIfStale();
+        
+        /** Returns true if a device with this VendorID & ProductID is indexed.
+         *  Either id may be 0 to match any.
+         */
+        bool contains (unsigned short vendorID, unsigned short productID) const;
+        
+        /** Finds the first device with this VendorID & ProductID (0 matches any).
+         *  Returns false if there is none.
+         */
+        bool findFirst (unsigned short vendorID, unsigned short productID, DeviceInfo& result) const;
+        
+        /** Finds the device with this path. Returns false if there is none. */
+        bool findByPath (const juce::String& path, DeviceInfo& result) const;
+        
+        juce::Array<DeviceInfo> getDevicesWithIds (unsigned short vendorID, unsigned short productID) const;
+        
+        /** Unlike the other lookups this is a linear scan, since serial numbers
+         *  are read lazily. It reads the serial number of every indexed device
+         *  that hasn't had it read yet, on a copy of the list, so other lookups
+         *  aren't held up while it does.
+         */
+        juce::Array<DeviceInfo> getDevicesWithSerialNumber (const juce::String& serialNumber) const;
+        
+        juce::Array<DeviceInfo> getDevicesWithUsage (unsigned short usagePage, unsigned short usage) const;
+        juce::Array<DeviceInfo> getAllDevices() const;
+        
+        /** Millisecond counter value of the last update, or 0 if never updated. */
+        juce::uint32 getLastUpdateTime() const;
+        
+        /** How old the index may get before refreshIfStale() enumerates again.
+         *  Defaults to 1000ms.
+         */
+        void setMaxAge (int milliseconds);
+        int getMaxAge() const;
+        
+    private:
+        
+        static int idKey (unsigned short vendorID, unsigned short productID);
+        void addToIndex (const DeviceInfo& device);
+        void removeFromIndex (const DeviceInfo& device);
+        
+        juce::CriticalSection lock;
+        juce::Array<DeviceInfo> devices;
+        juce::HashMap<juce::String, DeviceInfo> byPath;
+        juce::HashMap<int, juce::Array<DeviceInfo>> byIds;
+        juce::HashMap<int, juce::Array<DeviceInfo>> byUsage;
+        juce::uint32 lastUpdateTime;
+        int maxAge;
+        
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DeviceIndex)
+    };
+    
+    
+    
+    /** Remembers known devices between runs of the application.
+     *
+     *  Call remember() for the devices your app connects to, save() when it
+     *  quits and load() when it starts. The cached DeviceInfos carry everything
+     *  needed to connect (path, ids, strings and report lengths), so the app can
+     *  open the last-known paths straight away instead of enumerating first,
+     *  and call startValidation() to check the cache against a real scan on a
+     *  background thread. A change message is sent when validation finishes.
+     */
+    //=========================================================================
+    //=========================================================================
+    class DeviceCache :   public juce::ChangeBroadcaster, private juce::Thread
+    {
+    public:
+        
+        struct Entry
+        {
+            DeviceInfo device;
+            ReportLengths reportLengths;
+            juce::Time lastSeen;
+        };
+        
+        /** Creates an empty cache backed by this file. Call load() to read it. */
+        DeviceCache (const juce::File& file);
+        ~DeviceCache();
+        
+        /** A sensible place for the cache file, in the user's application data folder. */
+        static juce::File getDefaultFile (const juce::String& applicationName);
+        
+        /** Replaces the cached devices with the ones stored in the file.
+         *  A missing file isn't an error — the cache is just left empty.
+         */
+        juce::Result load();
+        
+        /** Writes the cached devices to the file. */
+        juce::Result save() const;
+        
+        /** Adds or updates the entry for a connected device, reading its strings
+         *  and report lengths.
+         */
+        void remember (DeviceIO& device);
+        void remember (const DeviceInfo& device, const ReportLengths& reportLengths);
+        
+        void forget (const DeviceInfo& device);
+        void clear();
+        
+        juce::Array<Entry> getEntries() const;
+        juce::Array<DeviceInfo> getKnownDevices() const;
+        
+        /** Finds a cached device with this VendorID & ProductID (0 matches any),
+         *  and serial number if one is given. Doesn't touch the OS.
+         */
+        bool findKnownDevice (unsigned short vendorID, unsigned short productID,
+                              DeviceInfo& result,
+                              const juce::String& serialNumber = juce::String()) const;
+        
+        /** Returns false if the device isn't cached. */
+        bool getReportLengths (const DeviceInfo& device, ReportLengths& result) const;
+        
+        /** Enumerates on a background thread, updating DeviceIndex::getShared()
+         *  and working out which cached devices are no longer present at their
+         *  last-known path. Sends a change message when done.
+         */
+        void startValidation();
+        bool isValidating() const;
+        bool hasBeenValidated() const;
+        
+        /** Cached devices the last validation didn't find. */
+        juce::Array<DeviceInfo> getMissingDevices() const;
+        
+        /** Forgets the devices the last validation didn't find. */
+        void removeMissingDevices();
+        
+    private:
+        
+        void run();
+        int indexOf (const DeviceInfo& device) const;
+        
+        const juce::File file;
+        juce::CriticalSection lock;
+        juce::Array<Entry> entries;
+        juce::Array<DeviceInfo> missing;
+        bool validated;
+        
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DeviceCache)
+    };
+    
+    
+    
+    /** A connection that survives the device being unplugged and plugged back in.
+     *
+     *  A background thread watches the connection. Removal is detected either
+     *  by an I/O call through this object failing, which wakes the thread at
+     *  once, or by the device's path dropping out of a scan for its ids. That
+     *  scan skips the strings and runs at most once a second, so it's only a
+     *  backstop for a device nobody is talking to. The handle is then closed
+     *  (so nothing is left dangling) and the thread polls for the device to
+     *  come back — by serial number if it has one, by path otherwise, with a
+     *  scan for its ids that only reads the strings of the devices it finds —
+     *  re-opens it, checks its serial number through the new handle, and
+     *  replays the initialisation reports added with addInitFeatureReport()
+     *  and addInitOutputReport() before reporting it connected again. A change
+     *  message is sent whenever the state changes. If the reconnect timeout
+     *  runs out the state goes to disconnected and the thread stops.
+     *
+     *  Reconnect latency is bounded by the poll interval plus the time it takes
+     *  to open the device and replay its reports; it is measured and available
+     *  from getLastReconnectLatency().
+     *
+     *  ManagedConnections open their own handles rather than going through
+     *  hid::connect(), so they are independent of the single global connection.
+     *  Prefer readTimeout() over read() on them: a blocking read holds the
+     *  handle and delays the reconnect until it returns.
+     */
+    //=========================================================================
+    //=========================================================================
+    class ManagedConnection :   public juce::ChangeBroadcaster, private juce::Thread
+    {
+    public:
+        
+        enum State
+        {
+            disconnected,   /**< Not opened, closed, or gave up reconnecting. */
+            connected,
+            reconnecting    /**< Lost, waiting for the device to come back. */
+        };
+        
+        ManagedConnection (const DeviceInfo& device, int pollIntervalInMilliseconds = 250);
+        ~ManagedConnection();
+        
+        /** Reports sent, in the order added, every time the device is (re)opened. */
+        void addInitFeatureReport (const unsigned char* data, size_t length);
+        void addInitOutputReport (const unsigned char* data, size_t length);
+        void clearInitReports();
+        
+        /** Opens the device, sends the initialisation reports and starts watching
+         *  the connection. If the device can't be opened right now this returns
+         *  Result::fail, but keeps trying in the background.
+         */
+        juce::Result open();
+        
+        /** Closes the device and stops watching it. */
+        void close();
+        
+        State getState() const;
+        bool isConnected() const;
+        
+        /** The device currently connected, or last connected. Its path can change
+         *  after a reconnect.
+         */
+        DeviceInfo getDeviceInfo() const;
+        
+        /** How long to keep trying once the device is lost before giving up and
+         *  going to the disconnected state. 0 (the default) means forever.
+         */
+        void setReconnectTimeout (int milliseconds);
+        
+        /** Number of times the device was lost and successfully re-opened. */
+        int getNumReconnects() const;
+        
+        /** From detecting the loss to the init reports having been replayed, in
+         *  milliseconds. 0 until the first reconnect.
+         */
+        double getLastReconnectLatency() const;
+        double getMaxReconnectLatency() const;
+        
+        /** These behave like the DeviceIO calls with the same names, but fail
+         *  with "device not connected" while the device is away, and an error
+         *  from the OS starts a reconnect.
+         */
+        juce::Result write (const unsigned char* data, size_t length, size_t* bytesWritten = nullptr);
+        juce::Result read (unsigned char* data, size_t length, size_t* bytesRead = nullptr);
+        juce::Result readTimeout (unsigned char* data, size_t length, int milliseconds, size_t* bytesRead = nullptr);
+        juce::Result sendFeatureReport (const unsigned char* data, size_t length, size_t* bytesWritten = nullptr);
+        juce::Result getFeatureReport (unsigned char* data, size_t length, size_t* bytesRead = nullptr);
+        
+    private:
+        
+        struct InitReport
+        {
+            bool isFeatureReport;
+            juce::MemoryBlock data;
+        };
+        
+        void run();
+        juce::Result checkResult (const juce::Result& result, size_t count);
+        juce::Result openDevice (const DeviceInfo& deviceToOpen);
+        void handleLoss();
+        void tryToReconnect();
+        bool isStillPresent() const;
+        bool findReturnedDevice (DeviceInfo& result) const;
+        void setState (State newState);
+        
+        juce::ReadWriteLock deviceLock;     // Held for reading during I/O, for writing to swap the handle
+        DeviceIO io;
+        
+        juce::CriticalSection lock;         // Everything below
+        juce::Array<InitReport> initReports;
+        juce::Atomic<int> state;
+        juce::Atomic<int> lost;
+        juce::int64 lossTicks;
+        int pollInterval;
+        int reconnectTimeout;
+        int numReconnects;
+        double lastReconnectLatency;
+        double maxReconnectLatency;
+        
+        enum { presenceCheckInterval = 1000 };  // ms between scans while connected
+        
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ManagedConnection)
+    };
+    
+    
+    
+    /** Frequently scans for HID Devices and sends a change message when one is added/removed.
+     *  Call DeviceScanner::addChangeListener (ChangeListener* listener) to be notified when devices
+     *  are connected or disconnected.
+     */
+    //=========================================================================
+    //=========================================================================
+    class DeviceScanner :   public juce::ChangeBroadcaster, private juce::Timer
+    {
+    public:
+        
+        DeviceScanner();
+        DeviceScanner (juce::ChangeListener* listener, int intervalInMilliseconds = 500);
+        ~DeviceScanner();
+        
+        /** Returns all devices that are available from the most recent scan.
+         */
+        const juce::Array<DeviceInfo>& getCurrentDevices() const;
+        
+        /** Scans for devices immediately
+         */
+        void scanNow();
+        
+    private:
+        
+        void timerCallback();
+        juce::Array<DeviceInfo> devices;
+        
+        JUCE_LEAK_DETECTOR(DeviceScanner)
+    };
+    
+    
+   #if JUCE_HID_TRACING
+    /** Records a timeline of the library's I/O — connects, reads, writes,
+     *  feature reports, enumerations, scans and the reader and decode threads —
+     *  that chrome://tracing and Perfetto (ui.perfetto.dev) can show.
+     *
+     *  Only there when the module is built with JUCE_HID_TRACING=1; otherwise
+     *  the HID_TRACE_SCOPE and HID_TRACE_INSTANT macros are empty. Even when
+     *  it's compiled in, nothing is recorded until start() is called, and a
+     *  trace point costs one atomic load until then.
+     *
+     *  Each thread records into its own buffer without taking any locks. A
+     *  thread that has recorded maxEventsPerThread events drops the rest until
+     *  clear() is called. Use the macros in your own code to see it on the
+     *  same timeline; names must be string literals, as only the pointer is
+     *  kept.
+     *
+     *  A thread's buffer is made the first time it records, which allocates
+     *  and takes a lock, and grows as it fills. Realtime threads should call
+     *  prepareThread() (or HID_TRACE_PREPARE_THREAD) before their realtime
+     *  work instead, as the ReportReader and DecodePool threads do. The
+     *  buffers of threads that have finished are freed by clear().
+     *  @code
+     *  hid::Trace::start();
+     *  ...
+     *  hid::Trace::stop();
+     *  hid::Trace::writeChromeTrace (File::getSpecialLocation (File::userDesktopDirectory)
+     *                                    .getChildFile ("hid-trace.json"));
+     *  @endcode
+     */
+    //=========================================================================
+    //=========================================================================
+    class Trace
+    {
+    public:
+        
+        static void start();
+        static void stop();
+        static bool isRecording() noexcept;
+        
+        /** Throws away everything recorded so far. */
+        static void clear();
+        
+        /** Events lost to full buffers since the last clear(). */
+        static juce::int64 getNumDropped();
+        
+        /** Everything recorded since the last clear(), in the Chrome trace
+         *  event format. Can be called while recording.
+         */
+        static juce::String toChromeJSON();
+        static juce::Result writeChromeTrace (const juce::File& file);
+        
+        /** Records a point in time on the calling thread. */
+        static void instant (const char* name);
+        
+        /** Sets up the calling thread's buffer now, so that recording on this
+         *  thread never allocates or locks. Its memory, for
+         *  preparedEventsPerThread events, is allocated here if recording has
+         *  started, or otherwise by start(). The buffer doesn't grow after
+         *  that: events past the end are dropped.
+         */
+        static void prepareThread();
+        
+        /** Records the time from its creation to its destruction as one event
+         *  on the calling thread.
+         */
+        class Scope
+        {
+        public:
+            
+            Scope (const char* name) noexcept;
+            ~Scope();
+            
+        private:
+            
+            const char* const name;
+            const juce::uint64 start;
+            
+            JUCE_DECLARE_NON_COPYABLE(Scope)
+        };
+        
+        enum { maxEventsPerThread = 262144, preparedEventsPerThread = 16384 };
+        
+    private:
+        
+        struct Event;
+        struct ThreadBuffer;
+        struct State;
+        
+        static State& getState();
+        static ThreadBuffer* getThreadBuffer();
+        static void allocatePreparedChunks (ThreadBuffer& buffer);
+        static void record (const char* name, char phase, juce::uint64 start, juce::uint64 duration);
+    };
+   #endif
+    
+    
+   #if JUCE_HID_ALLOCATION_TRACKING
+    /** Counts the heap allocations made inside the library's entry points, per
+     *  entry point, and catches allocations on the ones that must not allocate:
+     *  copying or moving a DeviceInfo, copying a ReportView, and pushing to or
+     *  popping from a RealtimeReportQueue or ControlEventBuffer.
+     *
+     *  Only there when the module is built with JUCE_HID_ALLOCATION_TRACKING=1;
+     *  otherwise the HID_COUNT_ALLOCATIONS and HID_FORBID_ALLOCATIONS macros are
+     *  empty. To see allocations at all the module has to replace the program's
+     *  allocator: on glibc it replaces malloc(), calloc() and realloc(), so
+     *  HeapBlocks and the backend are counted too; elsewhere it replaces the
+     *  global operator new and delete, and only C++ allocations are counted.
+     *  Turn it on for debug and test builds only.
+     *
+     *  Counts are inclusive: an entry point that calls another one counts the
+     *  allocations of both. An allocation while a must-not-allocate entry point
+     *  or a ScopedNoAllocations is active hits a jassert, with the offending
+     *  call on the stack, and counts as a violation, so a test can check
+     *  getNumViolations() after driving the paths it cares about;
+     *  benchmarks/juce_hid_allocation_test.cpp does that for these.
+     *  @code
+     *  hid::AllocationTracker::reset();
+     *  {
+     *      const hid::AllocationTracker::ScopedNoAllocations noAllocations;
+     *      queue.pop (buffer, length, timestamp);
+     *  }
+     *  expectEquals (hid::AllocationTracker::getNumViolations(), (int64) 0);
+     *  DBG (hid::AllocationTracker::getReport());
+     *  @endcode
+     */
+    //=========================================================================
+    //=========================================================================
+    class AllocationTracker
+    {
+    public:
+        
+        struct Stats
+        {
+            juce::String entryPoint;
+            bool mustNotAllocate;
+            juce::int64 calls;
+            juce::int64 allocations;
+            juce::int64 bytes;
+            juce::int64 maxAllocationsPerCall;
+            /** Calls that allocated although they mustn't. */
+            juce::int64 violations;
+        };
+        
+        /** Every entry point that has been called since the program started. */
+        static juce::Array<Stats> getStats();
+        
+        /** getStats() as a table, the entry points that allocate most per call
+         *  first.
+         */
+        static juce::String getReport();
+        
+        /** Zeroes every entry point's counts and the number of violations. */
+        static void reset();
+        
+        /** Allocations made where none were allowed, since the last reset(). */
+        static juce::int64 getNumViolations() noexcept;
+        
+        /** Allocations and bytes allocated by the calling thread since it
+         *  started. Take the difference around the code you want to measure.
+         */
+        static juce::int64 getThreadAllocations() noexcept;
+        static juce::int64 getThreadBytes() noexcept;
+        
+        /** Forbids allocations on the calling thread for its lifetime. */
+        class ScopedNoAllocations
+        {
+        public:
+            
+            ScopedNoAllocations() noexcept;
+            ~ScopedNoAllocations();
+            
+        private:
+            
+            JUCE_DECLARE_NON_COPYABLE(ScopedNoAllocations)
+        };
+        
+        /** One instrumented entry point. The macros declare these as function
+         *  statics; they link themselves into a list when first used, without
+         *  allocating, and are never removed.
+         */
+        class EntryPoint
+        {
+        public:
+            
+            EntryPoint (const char* name, bool mustNotAllocate) noexcept;
+            
+        private:
+            
+            friend class AllocationTracker;
+            
+            const char* const name;
+            const bool mustNotAllocate;
+            EntryPoint* next;
+            juce::Atomic<juce::int64> calls, allocations, bytes, maxAllocationsPerCall, violations;
+            
+            JUCE_DECLARE_NON_COPYABLE(EntryPoint)
+        };
+        
+        /** Adds what the calling thread allocates during its lifetime to an
+         *  EntryPoint.
+         */
+        class Scope
+        {
+        public:
+            
+            Scope (EntryPoint& entryPoint) noexcept;
+            ~Scope();
+            
+        private:
+            
+            EntryPoint& entryPoint;
+            const juce::int64 allocationsAtStart;
+            const juce::int64 bytesAtStart;
+            
+            JUCE_DECLARE_NON_COPYABLE(Scope)
+        };
+    };
+   #endif
+    
+    
+    
+    
+    
+    
+    //=========================================================================
+    //=========================================================================
+    //=========================================================================
+    //=========================================================================
+    
+    /**  Returns true if a device with the vid & pid exists.
+     *
+     *  Answered from DeviceIndex::getShared(), which is only re-enumerated
+     *  if it has gone stale.
+     */
+    static bool isDeviceAvailable (unsigned short vendorID, unsigned short productID);
+    
+    /**  Gets the device information for a given VendorID and ProductID.
+     *  If multiple devices with the same vid & pid are available, this returns
+     *  the first one.
+     *
+     *  Do not call this unless isDeviceAvailable  returns true for your vid & pid
+     */
+    static DeviceInfo getDeviceInfo(unsigned short vendorID, unsigned short productID);
+    
+    /**  Returns a list of all the devices available
+     */
+    static juce::Array<DeviceInfo> getAllDevicesAvailable();
+    
+    /**  Returns a list of the available devices matching a DeviceFilter
+     */
+    static juce::Array<DeviceInfo> getAllDevicesAvailable (const DeviceFilter& filter);
+    
+    /**  Prints info about all the available devices.
+     */
+    static void printAllDevices();
+    
+    /** returns true if there currently is an active connection
+     */
+    static bool isConnected();
+    
+    /** Returns the DeviceIO that is currently connected.
+     *  If there is no connection, the DeviceIO returned is invalid and shouldn't
+     *  be used.
+     *
+     *  Check isConnected() first before trying getConnectedDevice()!
+     */
+    static DeviceIO getConnectedDevice();
+    
+    /** Returns the DeviceInfo for the connected device.
+     *  If no device is connected, the DeviceInfo is invalid and shouldn't be used.
+     *
+     *  Check isConnected() first before trying getConnectedDeviceInfo()
+     */
+    static DeviceInfo getConnectedDeviceInfo();
+    
+    /** Connects to a device (only one connection allowed at a time, for now)
+     */
+    static DeviceIO connect (const DeviceInfo& device);
+    
+    /** Disconnects from the currently connected device (does nothing if not connected)
+     */
+    static void disconnect();
+    
+    /** Always returns a unique report ID.
+     */
+    static const unsigned int reportID();
+    
+    /** Returns the current time in nanoseconds, on the monotonic clock used
+     *  to timestamp input reports.
+     */
+    static juce::uint64 getMonotonicTime();
+    
+    /** Sets how reader threads started from now on are scheduled: the backend's
+     *  (on macOS) and every ReportReader's.
+     */
+    static void setDefaultReaderThreadOptions (const ThreadOptions& options);
+    static ThreadOptions getDefaultReaderThreadOptions();
+    
+    /** Applies options to the calling thread, e.g. one you read reports on. */
+    static juce::Result setCurrentThreadOptions (const ThreadOptions& options);
+    
+private:
+    
+    /** INTERNAL */
+    static bool connectionStatus (bool shouldSet, bool shouldBeConnected = true);
+    static DeviceIO changeConnection(bool shouldConnect,
+                                     const DeviceInfo& device = DeviceInfo(hid_device_info()),
+                                     bool get = false);
+    
+}; 
+
+
+#if JUCE_HID_TRACING
+ #define HID_TRACE_SCOPE(name)      const hid::Trace::Scope JUCE_JOIN_MACRO (hidTraceScope_, __LINE__) (name)
+ #define HID_TRACE_INSTANT(name)    hid::Trace::instant (name)
+ #define HID_TRACE_PREPARE_THREAD() hid::Trace::prepareThread()
+#else
+ #define HID_TRACE_SCOPE(name)
+ #define HID_TRACE_INSTANT(name)
+ #define HID_TRACE_PREPARE_THREAD()
+#endif
+
+#if JUCE_HID_ALLOCATION_TRACKING
+ #define HID_ALLOCATION_SCOPE(name, mustNotAllocate) \
+    static hid::AllocationTracker::EntryPoint JUCE_JOIN_MACRO (hidEntryPoint_, __LINE__) (name, mustNotAllocate); \
+    const hid::AllocationTracker::Scope JUCE_JOIN_MACRO (hidAllocationScope_, __LINE__) (JUCE_JOIN_MACRO (hidEntryPoint_, __LINE__))
+ #define HID_COUNT_ALLOCATIONS(name)    HID_ALLOCATION_SCOPE (name, false)
+ #define HID_FORBID_ALLOCATIONS(name)   HID_ALLOCATION_SCOPE (name, true)
+#else
+ #define HID_COUNT_ALLOCATIONS(name)
+ #define HID_FORBID_ALLOCATIONS(name)
+#endif
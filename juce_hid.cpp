@@ -10,7 +10,9 @@
 
 #include "juce_hid.h"
 
-#if JUCE_MAC
+#if JUCE_HID_LOOPBACK
+#include "hid/hidapi_loopback.c"
+#elif JUCE_MAC
 #include "hid/hidapi_mac.c"
 #elif JUCE_WINDOWS
 #include "hid/hidapi_windows.c"
@@ -36,5 +36,39 @@
 #include <juce_core/juce_core.h>
 #include <juce_events/juce_events.h>
 
+//==============================================================================
+/** Config: JUCE_HID_LOOPBACK
+    Builds the module against the loopback backend (hid/hidapi_loopback.c)
+    instead of the OS's. It simulates devices in memory and builds on Linux,
+    so the benchmarks can run without hardware. Never enable this in an app
+    that should talk to real devices.
+*/
+#ifndef JUCE_HID_LOOPBACK
+ #define JUCE_HID_LOOPBACK 0
+#endif
+
+//==============================================================================
+/** Config: JUCE_HID_TRACING
+    Compiles in hid::Trace, which records the library's I/O as a Chrome trace
+    (chrome://tracing, ui.perfetto.dev). When it's 0 the HID_TRACE_SCOPE and
+    HID_TRACE_INSTANT macros the library is instrumented with are empty.
+*/
+#ifndef JUCE_HID_TRACING
+ #define JUCE_HID_TRACING 0
+#endif
+
+/** Config: JUCE_HID_ALLOCATION_TRACKING
+    Compiles in hid::AllocationTracker, which counts the heap allocations made
+    in each of the library's entry points and jasserts on the ones that mustn't
+    allocate. It replaces the program's malloc() (on glibc) or operator new, so
+    only enable it in debug and test builds.
+*/
+#ifndef JUCE_HID_ALLOCATION_TRACKING
+ #define JUCE_HID_ALLOCATION_TRACKING 0
+#endif
+
 #include "hid/hidapi.h"
+#if JUCE_HID_LOOPBACK
+ #include "hid/hidapi_loopback.h"
+#endif
 #include "hid/juce_hid.h"